@@ -1,21 +1,41 @@
 #pragma once
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <bit>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <coroutine>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <exception>
 #include <fstream>
+#include <functional>
 #include <ios>
+#include <istream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <ostream>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <string_view>
-#include <unordered_map>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+// based on https://qoiformat.org/qoi-specification.pdf  | accessed on 2026.02.2025
+
 // assumes little endian if not big endian
 #if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-#define BIG_ENDIAN
+#define QOID_BIG_ENDIAN
 #endif
 
 namespace QOID {
@@ -36,20 +56,134 @@ inline color max{255};
 enum class ImageType {
   // Will be saved according to QOI specification - 26.02.2025
   qoi = 0,
-  // TGA is a lot faster, but its raw data, so a lot more space taken up in
-  // storage
+  // TGA is a lot faster, but its raw data, so a lot more space taken up in storage (EncodeOptions::rle helps for
+  // flat images)
   tga,
 };
 
+// how GenerateFile gets the encoded bytes into the file
+enum class OutputBackend {
+  // buffered writes through a file descriptor
+  stream = 0,
+  // file is sized once, encoded straight into a memory mapping and truncated to the final size. Falls back to
+  // stream where mapping isn't available
+  mmap,
+};
+
+// Width and height of an image, e.g. read from a file header before decoding
+struct Dimensions {
+  ui width;
+  ui height;
+};
+
+// width x height pixels at (x, y), empty if either is 0
+struct Rect {
+  ui x;
+  ui y;
+  ui width;
+  ui height;
+
+  constexpr bool empty() const { return width == 0 || height == 0; }
+};
+
+// options for Image::GenerateFile, formats ignore the ones that don't apply to them
+struct EncodeOptions {
+  // qoi: number of threads encoding row bands in parallel. 1 encodes serially, 0 uses all hardware threads
+  unsigned threads{1};
+  // qoi: rows per band in parallel mode, 0 picks a size from the image height and thread count
+  ui bandRows{0};
+  // qoi, tga: output path used by GenerateFile
+  OutputBackend output{OutputBackend::stream};
+  // tga: run-length encode the pixels (image type 10). A lot smaller for flat images, slower to write than raw
+  bool rle{false};
+  // qoi: record a restart point every restartRows rows in a chunk after the end marker, 0 writes none. Decoders that
+  // know the chunk can split the work between threads, others ignore it. Overrides bandRows
+  ui restartRows{0};
+  // qoi: near-lossless when above 0, every channel of every pixel may come out up to maxError off. The output is a
+  // standard qoi file, smaller for noisy images (longer runs, DIFF / LUMA instead of RGB). Always encodes serially,
+  // without restart points. Small bounds on noisy images cost encode time: every pixel's chunk depends on the decoded
+  // value of the one before, and pixels DIFF can't reach are looked up in all 64 index slots. On camera-like noise
+  // maxError 1 and 2 take about 3-4x the lossless time, large bounds are faster than lossless (long runs)
+  uint8_t maxError{0};
+  // qoi, near-lossless only: trades size for speed. The index is only searched for pixels that neither DIFF nor LUMA
+  // reach (they would need RGB / RGBA otherwise) instead of for every pixel DIFF misses. On camera-like noise at
+  // maxError 1 about a quarter faster, at 2 barely, and about 30% larger at both
+  bool nearFast{false};
+};
+
+// options for qoi::SequenceWriter
+struct SequenceOptions {
+  // every keyframeInterval-th frame is stored whole, so seeking decodes at most that many frames. 0 only makes the
+  // first frame and frames that changed too much (maxChanged) keyframes
+  ui keyframeInterval{60};
+  // unchanged stretches shorter than this many pixels are stored with the changed pixels around them, every skip
+  // costs a few bytes and interrupts the qoi runs
+  ui minSkip{16};
+  // a frame where more than this share of the pixels changed is stored as a keyframe, a delta would only be larger
+  float maxChanged{0.75f};
+  // used for the keyframes
+  EncodeOptions keyframe{};
+};
+
+// Statistics of one qoi encode, filled by the qoi Encode / GenerateFile overloads taking it. Sizes and timings are
+// always filled. The chunk counts need QOID_ENCODER_STATS to be defined, otherwise counted stays false and they stay 0.
+// Encodes without an EncodeStats never pay for any of it
+struct EncodeStats {
+  bool counted{false};
+  // chunks per opcode
+  uint64_t run{0};
+  uint64_t diff{0};
+  uint64_t luma{0};
+  uint64_t index{0};
+  uint64_t rgb{0};
+  uint64_t rgba{0};
+  // runLengths[n - 1] is the amount of RUN chunks covering n pixels
+  std::array<uint64_t, 62> runLengths{};
+  uint64_t pixels{0};
+  // bytes written, header and end marker included
+  uint64_t bytes{0};
+  // wall time per phase: opaque scan + header, pixel data, end marker + restart points + flush
+  double headerSeconds{0};
+  double encodeSeconds{0};
+  double flushSeconds{0};
+
+  // Share of the pixels outside of runs that were found in the index
+  inline double IndexHitRate() const {
+    const uint64_t lookups{index + diff + luma + rgb + rgba};
+    return lookups ? static_cast<double>(index) / static_cast<double>(lookups) : 0.0;
+  }
+};
+
+// Result of writing an image file (GenerateFile), true on success. Files are written to a temporary file first, which
+// only replaces the target once it is complete and synced, so a failed write never leaves a truncated image behind
+struct WriteResult {
+  bool ok{false};
+  // size of the file, on failure the bytes encoded up to it
+  uint64_t bytes{0};
+  // errno value of the failure (e.g. ENOSPC, EACCES), EINVAL if the encoder refused the image (e.g. too large for tga)
+  // or a row source aborted
+  int error{0};
+
+  explicit operator bool() const { return ok; }
+};
+
+// options for Image::LoadFile
+struct DecodeOptions {
+  // qoi: threads decoding in parallel if the file has restart points (see EncodeOptions::restartRows). 0 uses all
+  // hardware threads
+  unsigned threads{1};
+};
+} // namespace QOID
+
+namespace QOID {
 struct Pixel {
   p_color packed;
 
   constexpr Pixel(p_color p) : packed(p) {}
 
-#if defined(BIG_ENDIAN)
-  constexpr Pixel(const color r = 0, const color g = 0, const color b = 0,
-                  const color a = 255)
-      : packed((r << 24) | (g << 16) | (b << 8) | a) {}
+#if defined(QOID_BIG_ENDIAN)
+  constexpr Pixel(const color r = 0, const color g = 0, const color b = 0, const color a = 255) :
+      packed((r << 24) | (g << 16) | (b << 8) | a) {}
 
   constexpr color R() const { return packed >> 24; }
   constexpr color G() const { return (packed >> 16) & 0xFF; }
@@ -61,9 +195,8 @@ struct Pixel {
   constexpr void setB(color b) { packed = (packed & 0xFFFF00FF) | (b << 8); }
   constexpr void setA(color a) { packed = (packed & 0xFFFFFF00) | a; }
 #else
-  constexpr Pixel(const color r = 0, const color g = 0, const color b = 0,
-                  const color a = 255)
-      : packed((a << 24) | (b << 16) | (g << 8) | r) {}
+  constexpr Pixel(const color r = 0, const color g = 0, const color b = 0, const color a = 255) :
+      packed((a << 24) | (b << 16) | (g << 8) | r) {}
 
   constexpr color A() const { return packed >> 24; }
   constexpr color B() const { return (packed >> 16) & 0xFF; }
@@ -89,20 +222,18 @@ struct Pixel {
 
   // Arithmetic Operators (Clamped to Avoid Overflow/Underflow)
   constexpr Pixel operator+(const Pixel &p) const {
-    return Pixel(std::min(255, R() + p.R()), std::min(255, G() + p.G()),
-                 std::min(255, B() + p.B()), std::min(255, A() + p.A()));
+    return Pixel(std::min(255, R() + p.R()), std::min(255, G() + p.G()), std::min(255, B() + p.B()),
+                 std::min(255, A() + p.A()));
   }
 
   constexpr Pixel operator-(const Pixel &p) const {
-    return Pixel(std::max(0, R() - p.R()), std::max(0, G() - p.G()),
-                 std::max(0, B() - p.B()), std::max(0, A() - p.A()));
+    return Pixel(std::max(0, R() - p.R()), std::max(0, G() - p.G()), std::max(0, B() - p.B()),
+                 std::max(0, A() - p.A()));
   }
 
   constexpr Pixel operator*(float scale) const {
-    return Pixel(std::min(255, static_cast<int>(R() * scale)),
-                 std::min(255, static_cast<int>(G() * scale)),
-                 std::min(255, static_cast<int>(B() * scale)),
-                 std::min(255, static_cast<int>(A() * scale)));
+    return Pixel(std::min(255, static_cast<int>(R() * scale)), std::min(255, static_cast<int>(G() * scale)),
+                 std::min(255, static_cast<int>(B() * scale)), std::min(255, static_cast<int>(A() * scale)));
   }
 
   // Compound Assignment Operators (Avoids Creating New Objects)
@@ -127,397 +258,3719 @@ struct Pixel {
   constexpr bool operator!=(const Pixel &p) const { return packed != p.packed; }
 };
 
-class Image {
-public:
-  Image() = delete;
-  Image(const ui width, const ui height)
-      : m_width{width}, m_height{height}, m_pixel_data(width * height) {}
-  Image(Image &I)
-      : m_width{I.m_width}, m_height{I.m_height}, m_pixel_data{I.m_pixel_data} {
-  }
+} // namespace QOID
 
-  // Set pixel at position
-  inline void SetPixel(const Pixel P, const ui width, const ui height);
+// x86 kernels are compiled with target attributes and picked at runtime, so no -mavx2 is needed
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define QOID_SIMD_X86
+#include <immintrin.h>
+#endif
 
-  // Set pixel at position (no bounds checking)
-  inline void fSetPixel(const Pixel P, const ui width, const ui height);
+namespace QOID {
+namespace simd {
 
-  // Returns reference to pixel at position
-  inline Pixel &GetPixel(const ui width, const ui height);
+enum class Level {
+  scalar = 0,
+  sse41,
+  avx2,
+};
 
-  // Returns reference to pixel at position (no bounds checking)
-  inline Pixel &fGetPixel(const ui width, const ui height);
+// Best level the cpu supports
+inline Level Detect() {
+#if defined(QOID_SIMD_X86)
+  static const Level level{__builtin_cpu_supports("avx2")     ? Level::avx2
+                           : __builtin_cpu_supports("sse4.1") ? Level::sse41
+                                                              : Level::scalar};
+  return level;
+#else
+  return Level::scalar;
+#endif
+}
 
-  // Fill Image with given Pixel
-  inline void Fill(const Pixel Pixel) {
-    std::fill(m_pixel_data.begin(), m_pixel_data.end(), Pixel);
+namespace detail {
+inline Level &ActiveLevel() {
+  static Level level{Detect()};
+  return level;
+}
+} // namespace detail
+
+// Level the kernels currently use
+inline Level Active() { return detail::ActiveLevel(); }
+
+// Restricts the kernels to at most Max (e.g. to benchmark against the scalar code). Never goes above Detect()
+inline void Limit(const Level Max) { detail::ActiveLevel() = std::min(Max, Detect()); }
+
+// Classification of 8 consecutive pixels against their predecessors, bit i belongs to p[i] and p[i - 1]
+struct BlockMasks {
+  // p[i] == p[i - 1]
+  uint32_t run;
+  // alpha unchanged and every channel difference in [-2, 1] (QOI_OP_DIFF)
+  uint32_t diff;
+  // alpha unchanged, green difference in [-32, 31], red and blue minus green difference in [-8, 7] (QOI_OP_LUMA)
+  uint32_t luma;
+};
+
+namespace detail {
+
+inline BlockMasks Classify8Scalar(const Pixel *p) {
+  BlockMasks masks{0, 0, 0};
+  for (unsigned i{0}; i < 8; ++i) {
+    const Pixel current{p[i]}, previous{p[static_cast<std::ptrdiff_t>(i) - 1]};
+    masks.run |= static_cast<uint32_t>(current == previous) << i;
+    if (current.A() != previous.A()) continue;
+    const int8_t dr{static_cast<int8_t>(current.R() - previous.R())};
+    const int8_t dg{static_cast<int8_t>(current.G() - previous.G())};
+    const int8_t db{static_cast<int8_t>(current.B() - previous.B())};
+    const int8_t dgr{static_cast<int8_t>(dr - dg)}, dgb{static_cast<int8_t>(db - dg)};
+    masks.diff |= static_cast<uint32_t>(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) << i;
+    masks.luma |= static_cast<uint32_t>(dg >= -32 && dg <= 31 && dgr >= -8 && dgr <= 7 && dgb >= -8 && dgb <= 7) << i;
   }
+  return masks;
+}
 
-  // Get reference to pixel data (mutable)
-  inline std::vector<Pixel> &GetData() { return m_pixel_data; }
+inline void SwapRedBlueScalar(const std::byte *in, std::byte *out, const size_t count) {
+  for (size_t i{0}; i < count; ++i, in += 4, out += 4) {
+    const std::byte r{in[0]}, b{in[2]};
+    out[0] = b;
+    out[1] = in[1];
+    out[2] = r;
+    out[3] = in[3];
+  }
+}
 
-  // Get reference to pixel data (read-only)
-  inline const std::vector<Pixel> &GetData() const { return m_pixel_data; }
+inline size_t RunLengthScalar(const Pixel *p, const Pixel *const end, const Pixel value) {
+  const Pixel *const begin{p};
+  while (p < end && *p == value) ++p;
+  return static_cast<size_t>(p - begin);
+}
 
-  constexpr ui getWidth() const { return m_width; }
-  constexpr ui getHeight() const { return m_height; }
+inline size_t LiteralLengthScalar(const Pixel *p, const Pixel *const end) {
+  const Pixel *const begin{p};
+  while (end - p >= 2 && p[0] != p[1]) ++p;
+  return static_cast<size_t>(p - begin) + (end - p == 1);
+}
 
-  // Filepath can be realtive to cwd or absolute
-  bool GenerateFile(const strv FilePath,
-                    const ImageType Type = QOID::ImageType::qoi);
+inline size_t EqualLengthScalar(const Pixel *a, const Pixel *b, const size_t count) {
+  size_t i{0};
+  while (i < count && a[i] == b[i]) ++i;
+  return i;
+}
 
-private:
-  ui m_width{};
-  ui m_height{};
-  std::vector<Pixel> m_pixel_data;
-};
+inline size_t DifferentLengthScalar(const Pixel *a, const Pixel *b, const size_t count) {
+  size_t i{0};
+  while (i < count && a[i] != b[i]) ++i;
+  return i;
+}
 
-inline void Image::SetPixel(const Pixel P, const ui width, const ui height) {
-  if (width >= m_width || height >= m_height)
-    throw std::out_of_range("Pixel coordinates out of bounds");
-  fSetPixel(P, width, height);
+inline size_t FindWithinScalar(const Pixel *p, const size_t count, const Pixel value, const uint8_t tolerance) {
+  for (size_t i{0}; i < count; ++i) {
+    const Pixel x{p[i]};
+    if (std::abs(x.R() - value.R()) <= tolerance && std::abs(x.G() - value.G()) <= tolerance &&
+        std::abs(x.B() - value.B()) <= tolerance && std::abs(x.A() - value.A()) <= tolerance)
+      return i;
+  }
+  return count;
 }
 
-inline void Image::fSetPixel(const Pixel P, const ui width, const ui height) {
-  std::memcpy(&m_pixel_data[width + height * m_width], &P, sizeof(P));
+inline bool AllOpaqueScalar(const Pixel *p, const size_t count) {
+  for (size_t i{0}; i < count; ++i)
+    if (p[i].A() != 255) return false;
+  return true;
 }
 
-inline Pixel &Image::GetPixel(const ui width, const ui height) {
-  if (m_pixel_data.empty())
-    throw std::runtime_error("Image has no pixel data.");
-  if (width >= m_width || height >= m_height)
-    throw std::out_of_range("Pixel coordinates out of bounds");
-  return fGetPixel(width, height);
+// the vector kernels AND pixels together and only check the alpha bytes once per chunk, so a translucent image stops
+// the scan early without a compare per load
+inline constexpr size_t OpaqueChunk{256};
+
+// Straight (not premultiplied) alpha source-over of one pixel. Opaque destinations (the common case when drawing onto
+// a frame) only need a weighted average, which is what the vector kernels compute
+inline Pixel BlendPixel(const Pixel src, const Pixel dst) {
+  const unsigned sa{src.A()}, da{dst.A()};
+  if (sa == 255) return src;
+  if (sa == 0) return dst;
+  if (da == 255) {
+    // rounded x / 255, exact for x <= 255 * 255
+    const auto channel{[&](const unsigned s, const unsigned d) {
+      const unsigned x{s * sa + d * (255 - sa) + 128};
+      return static_cast<color>((x + (x >> 8)) >> 8);
+    }};
+    return Pixel{channel(src.R(), dst.R()), channel(src.G(), dst.G()), channel(src.B(), dst.B()), 255};
+  }
+  // both weights scaled by 255: source sa * 255, destination da * (255 - sa)
+  const unsigned dw{da * (255 - sa)}, total{sa * 255 + dw};
+  const auto channel{[&](const unsigned s, const unsigned d) {
+    return static_cast<color>((s * sa * 255 + d * dw + total / 2) / total);
+  }};
+  return Pixel{channel(src.R(), dst.R()), channel(src.G(), dst.G()), channel(src.B(), dst.B()),
+               static_cast<color>((total + 127) / 255)};
 }
 
-inline Pixel &Image::fGetPixel(const ui width, const ui height) {
-  return m_pixel_data[width + height * m_width];
+inline void BlendOverScalar(const Pixel *src, Pixel *dst, const size_t count) {
+  for (size_t i{0}; i < count; ++i) dst[i] = BlendPixel(src[i], dst[i]);
 }
-// } // namespace QOID
 
-// #include "DataTypes/ImageFunctions/qoi.hpp"
-// #include "DataTypes/ImageFunctions/tiff.hpp"
-// namespace QOID {
-// namespace qoi {
-// bool GenerateFile(const Image &image, const strv FilePath); // Declare the
-// function
-// }
-// } // namespace QOID
+// rounded a * b / 255, exact for a, b <= 255. The vector kernels compute the same with pmulhuw: (x * 257) >> 16
+inline constexpr unsigned MulDiv255(const unsigned a, const unsigned b) {
+  const unsigned x{a * b + 128};
+  return (x + (x >> 8)) >> 8;
+}
 
-// namespace QOID {
+// Channel wise product, alpha included (multiply blend / modulation)
+inline constexpr Pixel MultiplyPixel(const Pixel a, const Pixel b) {
+  return Pixel{static_cast<color>(MulDiv255(a.R(), b.R())), static_cast<color>(MulDiv255(a.G(), b.G())),
+               static_cast<color>(MulDiv255(a.B(), b.B())), static_cast<color>(MulDiv255(a.A(), b.A()))};
+}
 
-namespace qoi { // forward declare the function
-bool GenerateFile(const Image &image, const strv FilePath);
+// Source-over of premultiplied pixels: src + dst * (255 - src alpha) / 255 per channel, saturated for inputs that
+// aren't actually premultiplied (a channel above alpha)
+inline constexpr Pixel PremultipliedOverPixel(const Pixel src, const Pixel dst) {
+  const unsigned inverse{255u - src.A()};
+  const auto channel{[inverse](const unsigned s, const unsigned d) {
+    return static_cast<color>(std::min(255u, s + MulDiv255(d, inverse)));
+  }};
+  return Pixel{channel(src.R(), dst.R()), channel(src.G(), dst.G()), channel(src.B(), dst.B()),
+               channel(src.A(), dst.A())};
 }
-namespace tga { // forward declare the function
-bool GenerateFile(const Image &image, const strv FilePath);
+
+inline void AddScalar(const Pixel *src, Pixel *dst, const size_t count) {
+  for (size_t i{0}; i < count; ++i) dst[i] += src[i];
 }
 
-inline bool Image::GenerateFile(const strv FilePath, const ImageType Type) {
-  if (FilePath.empty())
-    throw std::invalid_argument("Filename is empty");
+inline void SubtractScalar(const Pixel *src, Pixel *dst, const size_t count) {
+  for (size_t i{0}; i < count; ++i) dst[i] -= src[i];
+}
 
-  switch (Type) {
-  case ImageType::qoi:
-    return qoi::GenerateFile(*this, FilePath);
-  case ImageType::tga:
-    return tga::GenerateFile(*this, FilePath);
-  default:
-    return false;
-  }
+inline void MultiplyScalar(const Pixel *src, Pixel *dst, const size_t count) {
+  for (size_t i{0}; i < count; ++i) dst[i] = MultiplyPixel(dst[i], src[i]);
 }
 
-namespace qoi {
+inline void PremultipliedOverScalar(const Pixel *src, Pixel *dst, const size_t count) {
+  for (size_t i{0}; i < count; ++i) dst[i] = PremultipliedOverPixel(src[i], dst[i]);
+}
 
-static inline bool writeTrail(std::ostream &file) {
-#if defined(BIG_ENDIAN)
-  static constexpr uint64_t end_marker{0x0000000000000001};
-#else
-  static constexpr uint64_t end_marker{0x0100000000000000};
-#endif
-  return !!file.write(reinterpret_cast<const char *>(&end_marker),
-                      sizeof(end_marker));
+inline void ScaleScalar(Pixel *dst, const size_t count, const float scale) {
+  for (size_t i{0}; i < count; ++i) dst[i] *= scale;
 }
 
-static inline bool writeHeader(std::ostream &file, const Image &image) {
-  std::array<std::byte, 14> buffer{};
+#if defined(QOID_SIMD_X86)
+// Both kernels work on the little endian byte layout of Pixel (R, G, B, A). Channel differences are byte wise
+// subtractions, which wrap exactly like the int8_t casts of the scalar encoder. A range check [lo, hi] becomes
+// "(d - lo) has no bits above hi - lo" after adding -lo.
+
+// returns a 4 bit mask (bit per pixel) for each class
+__attribute__((target("sse4.1"))) inline void Classify4SSE41(const Pixel *p, uint32_t &run, uint32_t &diff,
+                                                              uint32_t &luma) {
+  const __m128i current{_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))};
+  const __m128i previous{_mm_loadu_si128(reinterpret_cast<const __m128i *>(p - 1))};
+  const __m128i zero{_mm_setzero_si128()};
+  const __m128i d{_mm_sub_epi8(current, previous)};
+
+  run = static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(current, previous))));
+
+  // DIFF: (d + 2) & 0xFC must be zero for R, G, B and the alpha difference must be zero
+  const __m128i diffBits{
+      _mm_and_si128(_mm_add_epi8(d, _mm_set1_epi32(0x00020202)), _mm_set1_epi32(-0x01000000 | 0xFCFCFC))};
+  diff = static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(diffBits, zero))));
+
+  // LUMA: subtract dg from dr and db (bytes 0 and 2), keep dg in byte 1, then range check all three
+  const __m128i dgSpread{_mm_shuffle_epi8(d, _mm_setr_epi8(1, -1, 1, -1, 5, -1, 5, -1, 9, -1, 9, -1, 13, -1, 13, -1))};
+  const __m128i lumaBits{_mm_and_si128(_mm_add_epi8(_mm_sub_epi8(d, dgSpread), _mm_set1_epi32(0x00082008)),
+                                       _mm_set1_epi32(-0x01000000 | 0xF0C0F0))};
+  luma = static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(lumaBits, zero))));
+}
 
-  static constexpr uint8_t channels{4}; // will be optimized out anyways
-  static constexpr uint8_t colorspace{1};
+__attribute__((target("sse4.1"))) inline BlockMasks Classify8SSE41(const Pixel *p) {
+  BlockMasks low, high;
+  Classify4SSE41(p, low.run, low.diff, low.luma);
+  Classify4SSE41(p + 4, high.run, high.diff, high.luma);
+  return {low.run | high.run << 4, low.diff | high.diff << 4, low.luma | high.luma << 4};
+}
 
-  // Write the "qoif" magic number
-  std::memcpy(buffer.data(), "qoif", 4);
+__attribute__((target("avx2"))) inline BlockMasks Classify8AVX2(const Pixel *p) {
+  const __m256i current{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p))};
+  const __m256i previous{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p - 1))};
+  const __m256i zero{_mm256_setzero_si256()};
+  const __m256i d{_mm256_sub_epi8(current, previous)};
+
+  const __m256i diffBits{_mm256_and_si256(_mm256_add_epi8(d, _mm256_set1_epi32(0x00020202)),
+                                          _mm256_set1_epi32(-0x01000000 | 0xFCFCFC))};
+  const __m256i dgSpread{_mm256_shuffle_epi8(d, _mm256_setr_epi8(1, -1, 1, -1, 5, -1, 5, -1, 9, -1, 9, -1, 13, -1,
+                                                                  13, -1, 1, -1, 1, -1, 5, -1, 5, -1, 9, -1, 9, -1,
+                                                                  13, -1, 13, -1))};
+  const __m256i lumaBits{
+      _mm256_and_si256(_mm256_add_epi8(_mm256_sub_epi8(d, dgSpread), _mm256_set1_epi32(0x00082008)),
+                       _mm256_set1_epi32(-0x01000000 | 0xF0C0F0))};
+  return {static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(current, previous)))),
+          static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(diffBits, zero)))),
+          static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(lumaBits, zero))))};
+}
 
-  // write Width and height according to endian
-#if defined(BIG_ENDIAN)
-  const uint32_t swappedWidth = (image.getWidth());
-  const uint32_t swappedHeight = (image.getHeight());
-  static constexpr uint16_t combined{channels << 8 | colorspace};
-#else
-  static constexpr uint16_t combined{colorspace << 8 | channels};
-  const uint32_t swappedWidth = std::byteswap(image.getWidth());
-  const uint32_t swappedHeight = std::byteswap(image.getHeight());
-#endif
-  std::memcpy(buffer.data() + 4, &swappedWidth, sizeof(swappedWidth));
-  std::memcpy(buffer.data() + 8, &swappedHeight, sizeof(swappedHeight));
+__attribute__((target("sse4.1"))) inline size_t RunLengthSSE41(const Pixel *p, const Pixel *const end,
+                                                                const Pixel value) {
+  const Pixel *const begin{p};
+  const __m128i broadcast{_mm_set1_epi32(static_cast<int>(value.packed))};
+  for (; end - p >= 4; p += 4) {
+    const __m128i block{_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))};
+    const unsigned equal{
+        static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(block, broadcast))))};
+    if (equal != 0xF) return static_cast<size_t>(p - begin) + std::countr_one(equal);
+  }
+  return static_cast<size_t>(p - begin) + RunLengthScalar(p, end, value);
+}
 
-  // Write the combined channels/colorspace value
-  std::memcpy(buffer.data() + 12, &combined, sizeof(combined));
+__attribute__((target("avx2"))) inline size_t RunLengthAVX2(const Pixel *p, const Pixel *const end,
+                                                              const Pixel value) {
+  const Pixel *const begin{p};
+  const __m256i broadcast{_mm256_set1_epi32(static_cast<int>(value.packed))};
+  for (; end - p >= 8; p += 8) {
+    const __m256i block{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p))};
+    const unsigned equal{
+        static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(block, broadcast))))};
+    if (equal != 0xFF) return static_cast<size_t>(p - begin) + std::countr_one(equal);
+  }
+  return static_cast<size_t>(p - begin) + RunLengthScalar(p, end, value);
+}
 
-  return !!file.write(reinterpret_cast<const char *>(buffer.data()),
-                      buffer.size());
+// Equal = true counts leading pixels with a[i] == b[i], false leading pixels with a[i] != b[i]
+template <bool Equal>
+__attribute__((target("sse4.1"))) inline size_t CompareLengthSSE41(const Pixel *a, const Pixel *b, const size_t count) {
+  size_t i{0};
+  for (; count - i >= 4; i += 4) {
+    const __m128i x{_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i))};
+    const __m128i y{_mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i))};
+    unsigned same{static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(x, y))))};
+    if (!Equal) same ^= 0xF;
+    if (same != 0xF) return i + std::countr_one(same);
+  }
+  return i + (Equal ? EqualLengthScalar(a + i, b + i, count - i) : DifferentLengthScalar(a + i, b + i, count - i));
 }
 
-namespace {
+template <bool Equal>
+__attribute__((target("avx2"))) inline size_t CompareLengthAVX2(const Pixel *a, const Pixel *b, const size_t count) {
+  size_t i{0};
+  for (; count - i >= 8; i += 8) {
+    const __m256i x{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i))};
+    const __m256i y{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i))};
+    unsigned same{static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(x, y))))};
+    if (!Equal) same ^= 0xFF;
+    if (same != 0xFF) return i + std::countr_one(same);
+  }
+  return i + CompareLengthSSE41<Equal>(a + i, b + i, count - i);
+}
 
-static inline bool writeDataNonCompressedNonOptimized(std::ostream &file,
-                                                      const Image &image) {
-  static uint8_t tmp{0xFF};
-  for (auto i : image.GetData()) {
-    file.write(reinterpret_cast<const char *>(&tmp), sizeof(tmp));
-    file.write(reinterpret_cast<const char *>(&i), sizeof(Pixel));
+// every pixel is compared with its successor, so a block of n pixels needs n + 1 left
+__attribute__((target("sse4.1"))) inline size_t LiteralLengthSSE41(const Pixel *p, const Pixel *const end) {
+  const Pixel *const begin{p};
+  for (; end - p > 4; p += 4) {
+    const __m128i current{_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))};
+    const __m128i next{_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 1))};
+    const unsigned equal{static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(current, next))))};
+    if (equal) return static_cast<size_t>(p - begin) + std::countr_zero(equal);
   }
-  return true;
+  return static_cast<size_t>(p - begin) + LiteralLengthScalar(p, end);
 }
 
-static inline void updateIndex(std::unordered_map<p_color, uint8_t> &SeenPixels,
-                               const Pixel &px, unsigned int &SwapNum) {
-  if (SeenPixels.size() >= 64) {
-    auto it = SeenPixels.begin();
-    std::advance(it, SwapNum); // Move iterator to SwapNum-th element
-    SeenPixels.erase(it);      // Erase it in O(1) (on average)
+__attribute__((target("avx2"))) inline size_t LiteralLengthAVX2(const Pixel *p, const Pixel *const end) {
+  const Pixel *const begin{p};
+  for (; end - p > 8; p += 8) {
+    const __m256i current{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p))};
+    const __m256i next{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 1))};
+    const unsigned equal{
+        static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(current, next))))};
+    if (equal) return static_cast<size_t>(p - begin) + std::countr_zero(equal);
   }
+  return static_cast<size_t>(p - begin) + LiteralLengthSSE41(p, end);
+}
 
-  SeenPixels[px.Pack()] =
-      (px.R() * 3 + px.G() * 5 + px.B() * 7 + px.A() * 11) % 64;
-  SwapNum = (SwapNum + 1) % 64; // Proper circular increment
+// byte 0 <-> byte 2 of every 4 byte pixel, RGBA <-> BGRA
+__attribute__((target("sse4.1"))) inline void SwapRedBlueSSE41(const std::byte *in, std::byte *out, size_t count) {
+  const __m128i shuffle{_mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15)};
+  for (; count >= 4; count -= 4, in += 16, out += 16) {
+    const __m128i block{_mm_loadu_si128(reinterpret_cast<const __m128i *>(in))};
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_shuffle_epi8(block, shuffle));
+  }
+  SwapRedBlueScalar(in, out, count);
 }
-static inline void
-WriteFirstCol(std::vector<std::byte> &buffer,
-              std::vector<Pixel>::const_iterator &DataIterator,
-              std::unordered_map<p_color, uint8_t> &SeenPixels,
-              size_t &bufferIndex, unsigned int &SwapNum) {
-  static constexpr uint8_t Uint8Tmp{0xFF};
-  std::memcpy(buffer.data() + bufferIndex, &Uint8Tmp, sizeof(Uint8Tmp));
-  std::memcpy(buffer.data() + bufferIndex + 1, &(*DataIterator), sizeof(Pixel));
-  updateIndex(SeenPixels, *DataIterator, SwapNum);
-  ++DataIterator;
-  bufferIndex += sizeof(Pixel) + sizeof(Uint8Tmp);
-  return;
+
+__attribute__((target("avx2"))) inline void SwapRedBlueAVX2(const std::byte *in, std::byte *out, size_t count) {
+  const __m256i shuffle{_mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15, 2, 1, 0, 3, 6, 5, 4, 7,
+                                         10, 9, 8, 11, 14, 13, 12, 15)};
+  // unrolled twice, 16 pixels per iteration
+  for (; count >= 16; count -= 16, in += 64, out += 64) {
+    const __m256i low{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(in))};
+    const __m256i high{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + 32))};
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), _mm256_shuffle_epi8(low, shuffle));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 32), _mm256_shuffle_epi8(high, shuffle));
+  }
+  SwapRedBlueSSE41(in, out, count);
 }
 
-static inline void
-WriteToBuffer(std::vector<std::byte> &buffer,
-              std::vector<Pixel>::const_iterator &DataIterator,
-              std::unordered_map<p_color, uint8_t> &SeenPixels,
-              size_t &bufferIndex, const auto &DataEndIt,
-              unsigned int &SwapNum) {
-  if (DataIterator->packed == (DataIterator - 1)->packed) // RUN
-  {
-    constexpr size_t maxRunLength = 62;
-    size_t runCount = 1;
-    while (runCount < maxRunLength && (DataIterator + runCount) != DataEndIt &&
-           (DataIterator + runCount)->packed == DataIterator->packed) {
-      ++runCount;
-    }
-    uint8_t runMarker = static_cast<uint8_t>((runCount - 1) | 0xC0);
-    std::memcpy(buffer.data() + bufferIndex, &runMarker, sizeof(runMarker));
-    bufferIndex += 1;
-    DataIterator += runCount;
-    return;
+// |x - value| per byte is the saturated difference in one direction or the other, a pixel is within when no byte of it
+// is still above 0 after subtracting tolerance
+__attribute__((target("sse4.1"))) inline size_t FindWithinSSE41(const Pixel *p, const size_t count, const Pixel value,
+                                                                const uint8_t tolerance) {
+  const __m128i v{_mm_set1_epi32(static_cast<int>(value.packed))};
+  const __m128i t{_mm_set1_epi8(static_cast<char>(tolerance))};
+  size_t i{0};
+  for (; count - i >= 4; i += 4) {
+    const __m128i x{_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i))};
+    const __m128i over{_mm_subs_epu8(_mm_or_si128(_mm_subs_epu8(x, v), _mm_subs_epu8(v, x)), t)};
+    const int within{_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(over, _mm_setzero_si128())))};
+    if (within) return i + std::countr_zero(static_cast<unsigned>(within));
   }
+  return i + FindWithinScalar(p + i, count - i, value, tolerance);
+}
 
-  const Pixel &current{*DataIterator};
-  const Pixel &previous{*(DataIterator - 1)};
-  if (DataIterator->A() == (DataIterator - 1)->A()) {
-    int diffG = static_cast<int>(current.G()) - static_cast<int>(previous.G());
-    int diffR = static_cast<int>(current.R()) - static_cast<int>(previous.R());
-    int diffB = static_cast<int>(current.B()) - static_cast<int>(previous.B());
-    if ((diffR >= -2 && diffR <= 1) && (diffG >= -2 && diffG <= 1) &&
-        (diffB >= -2 && diffB <= 1)) { // Diff
-      // Compute current minus previous.
-      uint8_t diffR = static_cast<uint8_t>(current.R() - previous.R() + 2);
-      uint8_t diffG = static_cast<uint8_t>(current.G() - previous.G() + 2);
-      uint8_t diffB = static_cast<uint8_t>(current.B() - previous.B() + 2);
-      const uint8_t comb{
-          static_cast<uint8_t>(0x40 | (diffR << 4 | diffG << 2 | diffB))};
-      std::memcpy(buffer.data() + bufferIndex, &comb, sizeof(comb));
-      bufferIndex += 1;
-      updateIndex(SeenPixels, current, SwapNum);
-      ++DataIterator;
-      return;
+__attribute__((target("avx2"))) inline size_t FindWithinAVX2(const Pixel *p, const size_t count, const Pixel value,
+                                                             const uint8_t tolerance) {
+  const __m256i v{_mm256_set1_epi32(static_cast<int>(value.packed))};
+  const __m256i t{_mm256_set1_epi8(static_cast<char>(tolerance))};
+  size_t i{0};
+  for (; count - i >= 8; i += 8) {
+    const __m256i x{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i))};
+    const __m256i over{_mm256_subs_epu8(_mm256_or_si256(_mm256_subs_epu8(x, v), _mm256_subs_epu8(v, x)), t)};
+    const int within{_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(over, _mm256_setzero_si256())))};
+    if (within) return i + std::countr_zero(static_cast<unsigned>(within));
+  }
+  return i + FindWithinSSE41(p + i, count - i, value, tolerance);
+}
+
+__attribute__((target("sse4.1"))) inline bool AllOpaqueSSE41(const Pixel *p, size_t count) {
+  const __m128i alphaMask{_mm_set1_epi32(static_cast<int>(0xFF000000u))};
+  while (count >= 4) {
+    const size_t chunk{std::min(count, OpaqueChunk) & ~size_t{3}};
+    __m128i all{_mm_set1_epi32(-1)};
+    for (size_t i{0}; i < chunk; i += 4)
+      all = _mm_and_si128(all, _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i)));
+    if (!_mm_testc_si128(all, alphaMask)) return false;
+    p += chunk;
+    count -= chunk;
+  }
+  return AllOpaqueScalar(p, count);
+}
+
+__attribute__((target("avx2"))) inline bool AllOpaqueAVX2(const Pixel *p, size_t count) {
+  const __m256i alphaMask{_mm256_set1_epi32(static_cast<int>(0xFF000000u))};
+  while (count >= 8) {
+    const size_t chunk{std::min(count, OpaqueChunk) & ~size_t{7}};
+    __m256i all{_mm256_set1_epi32(-1)};
+    for (size_t i{0}; i < chunk; i += 8)
+      all = _mm256_and_si256(all, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i)));
+    if (!_mm256_testc_si256(all, alphaMask)) return false;
+    p += chunk;
+    count -= chunk;
+  }
+  return AllOpaqueSSE41(p, count);
+}
+
+// BlendPixel for opaque destinations on 16 bit lanes (2 pixels per 128 bit lane), the alpha word of each pixel is
+// broadcast to its 4 words. The alpha channel itself comes out as garbage and is set to 255 afterwards
+__attribute__((target("sse4.1"))) inline __m128i BlendOpaque2SSE41(const __m128i src, const __m128i dst) {
+  const __m128i alpha{_mm_shufflehi_epi16(_mm_shufflelo_epi16(src, 0xFF), 0xFF)};
+  const __m128i inverse{_mm_sub_epi16(_mm_set1_epi16(255), alpha)};
+  __m128i x{_mm_add_epi16(_mm_mullo_epi16(src, alpha), _mm_mullo_epi16(dst, inverse))};
+  x = _mm_add_epi16(x, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// blocks with a translucent destination pixel go through BlendPixel
+__attribute__((target("sse4.1"))) inline void BlendOverSSE41(const Pixel *src, Pixel *dst, size_t count) {
+  const __m128i alphaMask{_mm_set1_epi32(static_cast<int>(0xFF000000u))};
+  const __m128i zero{_mm_setzero_si128()};
+  for (; count >= 4; count -= 4, src += 4, dst += 4) {
+    const __m128i s{_mm_loadu_si128(reinterpret_cast<const __m128i *>(src))};
+    const __m128i d{_mm_loadu_si128(reinterpret_cast<const __m128i *>(dst))};
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(d, alphaMask), alphaMask)) != 0xFFFF) {
+      BlendOverScalar(src, dst, 4);
+      continue;
     }
-    diffR -= diffG;
-    diffB -= diffG;
-    if ((diffG >= -32 && diffG <= 31) && (diffR >= -8 && diffR <= 7) &&
-        (diffB >= -8 && diffB <= 7)) { // LUMA
-      int8_t dg = static_cast<int8_t>(current.G() - previous.G());
-      int8_t dr = static_cast<int8_t>(current.R() - previous.R()) - dg;
-      int8_t db = static_cast<int8_t>(current.B() - previous.B()) - dg;
-      uint8_t encodedDG = static_cast<uint8_t>(dg + 32); // Range: 0 to 63.
-      uint8_t encodedDR = static_cast<uint8_t>(dr + 8);  // Range: 0 to 15.
-      uint8_t encodedDB = static_cast<uint8_t>(db + 8);  // Range: 0 to 15.
-#if defined(BIG_ENDIAN)
-      const uint16_t comb{static_cast<uint16_t>(0x8000 | (encodedDG << 8) |
-                                                (encodedDR << 4) | encodedDB)};
-#else
-      const uint16_t comb{std::byteswap(static_cast<uint16_t>(
-          0x8000 | (encodedDG << 8) | (encodedDR << 4) | encodedDB))};
-#endif
-      std::memcpy(buffer.data() + bufferIndex, &comb, sizeof(comb));
-      bufferIndex += 2;
-      updateIndex(SeenPixels, current, SwapNum);
-      ++DataIterator;
-      return;
+    const __m128i low{BlendOpaque2SSE41(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero))};
+    const __m128i high{BlendOpaque2SSE41(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero))};
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_or_si128(_mm_packus_epi16(low, high), alphaMask));
+  }
+  BlendOverScalar(src, dst, count);
+}
+
+__attribute__((target("avx2"))) inline __m256i BlendOpaque4AVX2(const __m256i src, const __m256i dst) {
+  const __m256i alpha{_mm256_shufflehi_epi16(_mm256_shufflelo_epi16(src, 0xFF), 0xFF)};
+  const __m256i inverse{_mm256_sub_epi16(_mm256_set1_epi16(255), alpha)};
+  __m256i x{_mm256_add_epi16(_mm256_mullo_epi16(src, alpha), _mm256_mullo_epi16(dst, inverse))};
+  x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+// unpack and pack both work within 128 bit lanes, so the pixel order survives the round trip
+__attribute__((target("avx2"))) inline void BlendOverAVX2(const Pixel *src, Pixel *dst, size_t count) {
+  const __m256i alphaMask{_mm256_set1_epi32(static_cast<int>(0xFF000000u))};
+  const __m256i zero{_mm256_setzero_si256()};
+  for (; count >= 8; count -= 8, src += 8, dst += 8) {
+    const __m256i s{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src))};
+    const __m256i d{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst))};
+    if (static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_cmpeq_epi32(_mm256_and_si256(d, alphaMask), alphaMask))) != 0xFFFFFFFFu) {
+      BlendOverScalar(src, dst, 8);
+      continue;
     }
+    const __m256i low{BlendOpaque4AVX2(_mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi8(d, zero))};
+    const __m256i high{BlendOpaque4AVX2(_mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi8(d, zero))};
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_or_si256(_mm256_packus_epi16(low, high), alphaMask));
   }
-  if (SeenPixels.count(DataIterator->packed)) { // index
-    const uint8_t comb{SeenPixels[DataIterator->packed]};
-    std::memcpy(buffer.data() + bufferIndex, &comb, sizeof(comb));
-    ++bufferIndex;
-    ++DataIterator;
-    return;
-  } else { // NEW
-    static constexpr uint8_t Uint8Tmp{0xFF};
-    std::memcpy(buffer.data() + bufferIndex, &Uint8Tmp, sizeof(Uint8Tmp));
-    std::memcpy(buffer.data() + bufferIndex + 1, &(*DataIterator),
-                sizeof(Pixel));
-    updateIndex(SeenPixels, *DataIterator, SwapNum);
-    ++DataIterator;
-    bufferIndex += sizeof(Pixel) + sizeof(Uint8Tmp);
-    return;
+  BlendOverSSE41(src, dst, count);
+}
+
+// Pixel::operator+ and operator- saturate every byte, which is exactly paddusb / psubusb
+__attribute__((target("sse4.1"))) inline void AddSSE41(const Pixel *src, Pixel *dst, size_t count) {
+  for (; count >= 4; count -= 4, src += 4, dst += 4) {
+    const __m128i s{_mm_loadu_si128(reinterpret_cast<const __m128i *>(src))};
+    const __m128i d{_mm_loadu_si128(reinterpret_cast<const __m128i *>(dst))};
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_adds_epu8(d, s));
   }
+  AddScalar(src, dst, count);
 }
 
-static inline bool writeData(std::ostream &file, const Image &image) {
-  const size_t ImageSize{image.getHeight() * image.getWidth()};
-  const auto &RawDataVec{image.GetData()};
-  std::vector<std::byte> buffer(
-      ImageSize * 5); // max possible size  this has to because of memcpy
-  std::unordered_map<p_color, uint8_t> SeenPixels;
-  auto DataIterator{RawDataVec.begin()};
-  size_t bufferIndex = 0;
-  unsigned int SwapNum{0};
-
-  // The first pixel is always new.
-  WriteFirstCol(buffer, DataIterator, SeenPixels, bufferIndex, SwapNum);
-  for (; DataIterator != image.GetData().end();) {
-    WriteToBuffer(buffer, DataIterator, SeenPixels, bufferIndex,
-                  RawDataVec.end(), SwapNum);
-  }
-
-  // Write out the buffer in chunks.
-  constexpr size_t chunkSize = 4096; // 4KB
-  size_t chunkCount = bufferIndex / chunkSize;
-  for (size_t pos = 0; pos < chunkCount; ++pos) {
-    file.write(reinterpret_cast<const char *>(buffer.data() + pos * chunkSize),
-               chunkSize);
-  }
-  // Write the remaining bytes.
-  size_t remainder = bufferIndex % chunkSize;
-  if (remainder)
-    file.write(
-        reinterpret_cast<const char *>(buffer.data() + chunkCount * chunkSize),
-        remainder);
-  return true;
+__attribute__((target("avx2"))) inline void AddAVX2(const Pixel *src, Pixel *dst, size_t count) {
+  for (; count >= 8; count -= 8, src += 8, dst += 8) {
+    const __m256i s{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src))};
+    const __m256i d{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst))};
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_adds_epu8(d, s));
+  }
+  AddSSE41(src, dst, count);
 }
 
-} // namespace
+__attribute__((target("sse4.1"))) inline void SubtractSSE41(const Pixel *src, Pixel *dst, size_t count) {
+  for (; count >= 4; count -= 4, src += 4, dst += 4) {
+    const __m128i s{_mm_loadu_si128(reinterpret_cast<const __m128i *>(src))};
+    const __m128i d{_mm_loadu_si128(reinterpret_cast<const __m128i *>(dst))};
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_subs_epu8(d, s));
+  }
+  SubtractScalar(src, dst, count);
+}
 
-inline bool GenerateFile(const Image &image, const strv FilePath) {
-  std::ofstream file{FilePath.ends_with(".qoi")
-                         ? FilePath.data()
-                         : std::string(FilePath) + ".qoi",
-                     std::ios::binary | std::ios::out};
-  return writeHeader(file, image) && writeData(file, image) && writeTrail(file);
+__attribute__((target("avx2"))) inline void SubtractAVX2(const Pixel *src, Pixel *dst, size_t count) {
+  for (; count >= 8; count -= 8, src += 8, dst += 8) {
+    const __m256i s{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src))};
+    const __m256i d{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst))};
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_subs_epu8(d, s));
+  }
+  SubtractSSE41(src, dst, count);
 }
 
-static inline bool GenerateFileNonCompressed(const Image &image,
-                                             const strv FilePath) {
-  std::ofstream file{FilePath.ends_with(".qoi")
-                         ? FilePath.data()
-                         : std::string(FilePath) + ".qoi",
-                     std::ios::binary | std::ios::out};
-  return writeHeader(file, image) &&
-         writeDataNonCompressedNonOptimized(file, image) && writeTrail(file);
+// MulDiv255 on 16 bit lanes: x = a * b + 128 fits 16 bits, (x + (x >> 8)) >> 8 == (x * 257) >> 16
+__attribute__((target("sse4.1"))) inline __m128i MulDiv255SSE41(const __m128i a, const __m128i b) {
+  return _mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128)), _mm_set1_epi16(257));
 }
 
-} // namespace qoi
+__attribute__((target("avx2"))) inline __m256i MulDiv255AVX2(const __m256i a, const __m256i b) {
+  return _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(a, b), _mm256_set1_epi16(128)),
+                            _mm256_set1_epi16(257));
+}
 
-namespace tga {
+__attribute__((target("sse4.1"))) inline void MultiplySSE41(const Pixel *src, Pixel *dst, size_t count) {
+  const __m128i zero{_mm_setzero_si128()};
+  for (; count >= 4; count -= 4, src += 4, dst += 4) {
+    const __m128i s{_mm_loadu_si128(reinterpret_cast<const __m128i *>(src))};
+    const __m128i d{_mm_loadu_si128(reinterpret_cast<const __m128i *>(dst))};
+    const __m128i low{MulDiv255SSE41(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero))};
+    const __m128i high{MulDiv255SSE41(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero))};
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_packus_epi16(low, high));
+  }
+  MultiplyScalar(src, dst, count);
+}
 
-// Writes the 18-byte TGA header for a 32-bit (8-bit per channel RGBA) image.
-static inline bool writeHeader(std::ostream &file, const Image &image) {
-  // TGA header (18 bytes):
-  // Byte 0: ID length = 0
-  // Byte 1: Color map type = 0 (no color map)
-  // Byte 2: Image type = 2 (uncompressed true-color image)
-  // Bytes 3-7: Color map specification (unused, set to 0)
-  // Bytes 8-9: X-origin (0)
-  // Bytes 10-11: Y-origin (0)
-  // Bytes 12-13: Width (little-endian)
-  // Bytes 14-15: Height (little-endian)
-  // Byte 16: Pixel depth = 32 (bits per pixel)
-  // Byte 17: Image descriptor = 0x28
-  //          (bits 0-3: 8 bits of alpha, bit 5: top-left origin)
-  std::array<std::uint8_t, 18> header{};
-  header[0] = 0; // ID length
-  header[1] = 0; // Color map type
-  header[2] = 2; // Image type (uncompressed true-color)
+__attribute__((target("avx2"))) inline void MultiplyAVX2(const Pixel *src, Pixel *dst, size_t count) {
+  const __m256i zero{_mm256_setzero_si256()};
+  for (; count >= 8; count -= 8, src += 8, dst += 8) {
+    const __m256i s{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src))};
+    const __m256i d{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst))};
+    const __m256i low{MulDiv255AVX2(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(s, zero))};
+    const __m256i high{MulDiv255AVX2(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(s, zero))};
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_packus_epi16(low, high));
+  }
+  MultiplySSE41(src, dst, count);
+}
 
-  // Color map specification: bytes 3-7 already zeroed.
-  // X-origin (bytes 8-9)
-  header[8] = 0;
-  header[9] = 0;
-  // Y-origin (bytes 10-11)
-  header[10] = 0;
-  header[11] = 0;
+// dst * (255 - src alpha) on 16 bit lanes, the inverse alpha word of each pixel is broadcast to its 4 words like in
+// BlendOpaque2SSE41, then src is added with saturation
+__attribute__((target("sse4.1"))) inline void PremultipliedOverSSE41(const Pixel *src, Pixel *dst, size_t count) {
+  const __m128i zero{_mm_setzero_si128()};
+  const __m128i ones{_mm_set1_epi16(255)};
+  for (; count >= 4; count -= 4, src += 4, dst += 4) {
+    const __m128i s{_mm_loadu_si128(reinterpret_cast<const __m128i *>(src))};
+    const __m128i d{_mm_loadu_si128(reinterpret_cast<const __m128i *>(dst))};
+    const __m128i sLow{_mm_unpacklo_epi8(s, zero)}, sHigh{_mm_unpackhi_epi8(s, zero)};
+    const __m128i inverseLow{_mm_sub_epi16(ones, _mm_shufflehi_epi16(_mm_shufflelo_epi16(sLow, 0xFF), 0xFF))};
+    const __m128i inverseHigh{_mm_sub_epi16(ones, _mm_shufflehi_epi16(_mm_shufflelo_epi16(sHigh, 0xFF), 0xFF))};
+    const __m128i low{MulDiv255SSE41(_mm_unpacklo_epi8(d, zero), inverseLow)};
+    const __m128i high{MulDiv255SSE41(_mm_unpackhi_epi8(d, zero), inverseHigh)};
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_adds_epu8(s, _mm_packus_epi16(low, high)));
+  }
+  PremultipliedOverScalar(src, dst, count);
+}
 
-  // Image width (little-endian)
-  uint16_t width = static_cast<uint16_t>(image.getWidth());
-  header[12] = static_cast<std::uint8_t>(width & 0xFF);
-  header[13] = static_cast<std::uint8_t>((width >> 8) & 0xFF);
+__attribute__((target("avx2"))) inline void PremultipliedOverAVX2(const Pixel *src, Pixel *dst, size_t count) {
+  const __m256i zero{_mm256_setzero_si256()};
+  const __m256i ones{_mm256_set1_epi16(255)};
+  for (; count >= 8; count -= 8, src += 8, dst += 8) {
+    const __m256i s{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src))};
+    const __m256i d{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst))};
+    const __m256i sLow{_mm256_unpacklo_epi8(s, zero)}, sHigh{_mm256_unpackhi_epi8(s, zero)};
+    const __m256i inverseLow{
+        _mm256_sub_epi16(ones, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(sLow, 0xFF), 0xFF))};
+    const __m256i inverseHigh{
+        _mm256_sub_epi16(ones, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(sHigh, 0xFF), 0xFF))};
+    const __m256i low{MulDiv255AVX2(_mm256_unpacklo_epi8(d, zero), inverseLow)};
+    const __m256i high{MulDiv255AVX2(_mm256_unpackhi_epi8(d, zero), inverseHigh)};
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_adds_epu8(s, _mm256_packus_epi16(low, high)));
+  }
+  PremultipliedOverSSE41(src, dst, count);
+}
 
-  // Image height (little-endian)
-  uint16_t height = static_cast<uint16_t>(image.getHeight());
-  header[14] = static_cast<std::uint8_t>(height & 0xFF);
-  header[15] = static_cast<std::uint8_t>((height >> 8) & 0xFF);
+// Pixel::operator*(float) multiplies int channels by a float and truncates, so the kernels do the same in single
+// precision: every product and the truncation match bit for bit. A 16 bit fixed point multiply (pmulhuw) would round
+// differently for most scales. Results below 0 keep their low byte like the color conversion of the operator
+__attribute__((target("sse4.1"))) inline __m128i Scale4SSE41(const __m128i channels, const __m128 scale) {
+  const __m128i scaled{_mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(channels), scale))};
+  return _mm_and_si128(_mm_min_epi32(scaled, _mm_set1_epi32(255)), _mm_set1_epi32(0xFF));
+}
 
-  header[16] = 32; // Pixel depth: 32 bits per pixel (8 bits per channel)
-  header[17] =
-      0x28; // Image descriptor: 8-bit alpha, top-left origin (bit 5 set)
+__attribute__((target("sse4.1"))) inline void ScaleSSE41(Pixel *dst, size_t count, const float scale) {
+  const __m128 factor{_mm_set1_ps(scale)};
+  for (; count >= 4; count -= 4, dst += 4) {
+    const __m128i d{_mm_loadu_si128(reinterpret_cast<const __m128i *>(dst))};
+    const __m128i p0{Scale4SSE41(_mm_cvtepu8_epi32(d), factor)};
+    const __m128i p1{Scale4SSE41(_mm_cvtepu8_epi32(_mm_srli_si128(d, 4)), factor)};
+    const __m128i p2{Scale4SSE41(_mm_cvtepu8_epi32(_mm_srli_si128(d, 8)), factor)};
+    const __m128i p3{Scale4SSE41(_mm_cvtepu8_epi32(_mm_srli_si128(d, 12)), factor)};
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+                     _mm_packus_epi16(_mm_packus_epi32(p0, p1), _mm_packus_epi32(p2, p3)));
+  }
+  ScaleScalar(dst, count, scale);
+}
 
-  return !!file.write(reinterpret_cast<const char *>(header.data()),
-                      header.size());
+__attribute__((target("avx2"))) inline __m256i Scale8AVX2(const __m128i channels, const __m256 scale) {
+  const __m256i scaled{_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(channels)), scale))};
+  return _mm256_and_si256(_mm256_min_epi32(scaled, _mm256_set1_epi32(255)), _mm256_set1_epi32(0xFF));
 }
 
-// Writes the image data in BGRA order (TGA expects pixels stored as Blue,
-// Green, Red, Alpha). Assumes that image.GetData() returns a container of
-// Pixels in RGBA order.
-static inline bool writeData(std::ostream &file, const Image &image) {
-  const auto &pixels = image.GetData();
-  // Each pixel is written as 4 bytes: BGRA
-  for (const auto &px : pixels) {
-    // Convert from RGBA (your internal format) to BGRA.
-    uint8_t bgra[4] = {px.B(), px.G(), px.R(), px.A()};
-    file.write(reinterpret_cast<const char *>(bgra), sizeof(bgra));
+// the 128 bit lane wise packs leave the pixels in the order 0 2 4 6 1 3 5 7, one dword permute restores it
+__attribute__((target("avx2"))) inline void ScaleAVX2(Pixel *dst, size_t count, const float scale) {
+  const __m256 factor{_mm256_set1_ps(scale)};
+  const __m256i order{_mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)};
+  for (; count >= 8; count -= 8, dst += 8) {
+    const __m128i low{_mm_loadu_si128(reinterpret_cast<const __m128i *>(dst))};
+    const __m128i high{_mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + 4))};
+    const __m256i p0{Scale8AVX2(low, factor)}, p1{Scale8AVX2(_mm_srli_si128(low, 8), factor)};
+    const __m256i p2{Scale8AVX2(high, factor)}, p3{Scale8AVX2(_mm_srli_si128(high, 8), factor)};
+    const __m256i packed{_mm256_packus_epi16(_mm256_packus_epi32(p0, p1), _mm256_packus_epi32(p2, p3))};
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_permutevar8x32_epi32(packed, order));
   }
-  return true;
+  ScaleSSE41(dst, count, scale);
 }
+#endif
 
-// Generates a TGA file from the provided image. If FilePath does not end with
-// ".tga", it will be appended.
-inline bool GenerateFile(const Image &image, const strv FilePath) {
-  std::string filePath;
-  if (std::string(FilePath).ends_with(".tga"))
-    filePath = FilePath;
-  else
-    filePath = std::string(FilePath) + ".tga";
-  std::ofstream file{filePath, std::ios::binary | std::ios::out};
-  if (!file)
-    return false;
-  return writeHeader(file, image) && writeData(file, image);
+} // namespace detail
+
+// Classifies p[0..7] against p[-1..6]. p[-1] and p[7] have to be readable
+inline BlockMasks Classify8(const Pixel *p) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::Classify8AVX2(p);
+  case Level::sse41: return detail::Classify8SSE41(p);
+  default: break;
+  }
+#endif
+  return detail::Classify8Scalar(p);
 }
 
-} // namespace tga
+// Number of pixels equal to value at the start of [p, end)
+inline size_t RunLength(const Pixel *p, const Pixel *const end, const Pixel value) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::RunLengthAVX2(p, end, value);
+  case Level::sse41: return detail::RunLengthSSE41(p, end, value);
+  default: break;
+  }
+#endif
+  return detail::RunLengthScalar(p, end, value);
+}
+
+// Amount of pixels from p on until the first one that equals its successor (where a run starts), end - p if there
+// is none
+inline size_t LiteralLength(const Pixel *p, const Pixel *const end) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::LiteralLengthAVX2(p, end);
+  case Level::sse41: return detail::LiteralLengthSSE41(p, end);
+  default: break;
+  }
+#endif
+  return detail::LiteralLengthScalar(p, end);
+}
+
+// Amount of pixels from the start on that are the same in a and b, at most count
+inline size_t EqualLength(const Pixel *a, const Pixel *b, const size_t count) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::CompareLengthAVX2<true>(a, b, count);
+  case Level::sse41: return detail::CompareLengthSSE41<true>(a, b, count);
+  default: break;
+  }
+#endif
+  return detail::EqualLengthScalar(a, b, count);
+}
+
+// Amount of pixels from the start on that differ between a and b, at most count
+inline size_t DifferentLength(const Pixel *a, const Pixel *b, const size_t count) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::CompareLengthAVX2<false>(a, b, count);
+  case Level::sse41: return detail::CompareLengthSSE41<false>(a, b, count);
+  default: break;
+  }
+#endif
+  return detail::DifferentLengthScalar(a, b, count);
+}
+
+// Position of the first of the count pixels at p where no channel differs from value by more than tolerance, count if
+// there is none
+inline size_t FindWithin(const Pixel *p, const size_t count, const Pixel value, const uint8_t tolerance) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::FindWithinAVX2(p, count, value, tolerance);
+  case Level::sse41: return detail::FindWithinSSE41(p, count, value, tolerance);
+  default: break;
+  }
+#endif
+  return detail::FindWithinScalar(p, count, value, tolerance);
+}
+
+// true if every one of the count pixels at p has alpha 255
+inline bool AllOpaque(const Pixel *p, const size_t count) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::AllOpaqueAVX2(p, count);
+  case Level::sse41: return detail::AllOpaqueSSE41(p, count);
+  default: break;
+  }
+#endif
+  return detail::AllOpaqueScalar(p, count);
+}
+
+// Copies count 4 byte pixels from in to out, swapping the first and third byte (RGBA <-> BGRA). in and out may be
+// the same buffer
+inline void SwapRedBlue(const std::byte *in, std::byte *out, const size_t count) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::SwapRedBlueAVX2(in, out, count);
+  case Level::sse41: return detail::SwapRedBlueSSE41(in, out, count);
+  default: break;
+  }
+#endif
+  detail::SwapRedBlueScalar(in, out, count);
+}
+
+// Blends count src pixels over dst (straight alpha source-over, see detail::BlendPixel)
+inline void BlendOver(const Pixel *src, Pixel *dst, const size_t count) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::BlendOverAVX2(src, dst, count);
+  case Level::sse41: return detail::BlendOverSSE41(src, dst, count);
+  default: break;
+  }
+#endif
+  detail::BlendOverScalar(src, dst, count);
+}
+
+// dst[i] = dst[i] + src[i] (Pixel::operator+, saturating). src may be dst
+inline void Add(const Pixel *src, Pixel *dst, const size_t count) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::AddAVX2(src, dst, count);
+  case Level::sse41: return detail::AddSSE41(src, dst, count);
+  default: break;
+  }
+#endif
+  detail::AddScalar(src, dst, count);
+}
+
+// dst[i] = dst[i] - src[i] (Pixel::operator-, saturating). src may be dst
+inline void Subtract(const Pixel *src, Pixel *dst, const size_t count) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::SubtractAVX2(src, dst, count);
+  case Level::sse41: return detail::SubtractSSE41(src, dst, count);
+  default: break;
+  }
+#endif
+  detail::SubtractScalar(src, dst, count);
+}
+
+// dst[i] = dst[i] * src[i] / 255 per channel, rounded (see detail::MultiplyPixel). src may be dst
+inline void Multiply(const Pixel *src, Pixel *dst, const size_t count) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::MultiplyAVX2(src, dst, count);
+  case Level::sse41: return detail::MultiplySSE41(src, dst, count);
+  default: break;
+  }
+#endif
+  detail::MultiplyScalar(src, dst, count);
+}
+
+// Blends count premultiplied src pixels over dst (see detail::PremultipliedOverPixel)
+inline void BlendOverPremultiplied(const Pixel *src, Pixel *dst, const size_t count) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::PremultipliedOverAVX2(src, dst, count);
+  case Level::sse41: return detail::PremultipliedOverSSE41(src, dst, count);
+  default: break;
+  }
+#endif
+  detail::PremultipliedOverScalar(src, dst, count);
+}
+
+// dst[i] = dst[i] * scale (Pixel::operator*(float))
+inline void Scale(Pixel *dst, const size_t count, const float scale) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::ScaleAVX2(dst, count, scale);
+  case Level::sse41: return detail::ScaleSSE41(dst, count, scale);
+  default: break;
+  }
+#endif
+  detail::ScaleScalar(dst, count, scale);
+}
+
+} // namespace simd
+} // namespace QOID
+
+namespace QOID {
+
+// Non owning view of a rectangle of pixels, rows are Stride pixels apart. Views of an Image come from Image::SubRect
+// and stay valid as long as the image isn't resized or destroyed
+template <typename PixelType> class BasicView {
+public:
+  BasicView(PixelType *Data, const ui Width, const ui Height, const size_t Stride) :
+      m_data{Data}, m_width{Width}, m_height{Height}, m_stride{Stride} {}
+
+  // View -> ConstView
+  template <typename Other>
+    requires std::is_convertible_v<Other *, PixelType *>
+  BasicView(const BasicView<Other> &view) :
+      m_data{view.Data()}, m_width{view.getWidth()}, m_height{view.getHeight()}, m_stride{view.getStride()} {}
+
+  constexpr ui getWidth() const { return m_width; }
+  constexpr ui getHeight() const { return m_height; }
+  constexpr size_t getStride() const { return m_stride; }
+  constexpr PixelType *Data() const { return m_data; }
+
+  // Row y of the view. Throws std::out_of_range
+  inline std::span<PixelType> Row(const ui y) const {
+    if (y >= m_height) throw std::out_of_range("Row out of bounds");
+    return fRow(y);
+  }
+
+  // Row y of the view (no bounds checking)
+  inline std::span<PixelType> fRow(const ui y) const { return {m_data + y * m_stride, m_width}; }
+
+  // View of the Width x Height rectangle at (x, y), relative to this view. Throws std::out_of_range if it doesn't fit
+  inline BasicView SubRect(const ui x, const ui y, const ui Width, const ui Height) const {
+    if (x > m_width || y > m_height || Width > m_width - x || Height > m_height - y)
+      throw std::out_of_range("Rectangle out of bounds");
+    return {m_data + y * m_stride + x, Width, Height, m_stride};
+  }
+
+private:
+  PixelType *m_data;
+  ui m_width;
+  ui m_height;
+  size_t m_stride;
+};
+
+using View = BasicView<Pixel>;
+using ConstView = BasicView<const Pixel>;
+
+// Bulk operations, sizes are checked once per call and the rows are handled by std::fill / memmove / the simd kernels
+
+// Sets every pixel of Target to P
+inline void Fill(const View Target, const Pixel P) {
+  for (ui y{0}; y < Target.getHeight(); ++y) std::ranges::fill(Target.fRow(y), P);
+}
+
+// Copies Source into Target, which must have the same size (throws std::invalid_argument otherwise). Both may overlap
+// (e.g. two rectangles of the same image)
+inline void Copy(const ConstView Source, const View Target) {
+  if (Source.getWidth() != Target.getWidth() || Source.getHeight() != Target.getHeight())
+    throw std::invalid_argument("Source and target sizes differ");
+  const size_t rowBytes{Source.getWidth() * sizeof(Pixel)};
+  // copying a rectangle down over itself has to start at the bottom
+  if (std::greater<const Pixel *>{}(Target.Data(), Source.Data())) {
+    for (ui y{Source.getHeight()}; y-- > 0;) std::memmove(Target.fRow(y).data(), Source.fRow(y).data(), rowBytes);
+  } else {
+    for (ui y{0}; y < Source.getHeight(); ++y) std::memmove(Target.fRow(y).data(), Source.fRow(y).data(), rowBytes);
+  }
+}
+
+namespace detail {
+// Runs Kernel(source row, target row, width) over every row, sizes must match (throws std::invalid_argument otherwise)
+template <typename Kernel> inline void ForEachRow(const ConstView Source, const View Target, const Kernel &kernel) {
+  if (Source.getWidth() != Target.getWidth() || Source.getHeight() != Target.getHeight())
+    throw std::invalid_argument("Source and target sizes differ");
+  for (ui y{0}; y < Source.getHeight(); ++y) kernel(Source.fRow(y).data(), Target.fRow(y).data(), Source.getWidth());
+}
+
+// Span version of ForEachRow, the whole span is one row
+template <typename Kernel>
+inline void ForEachRow(const std::span<const Pixel> Source, const std::span<Pixel> Target, const Kernel &kernel) {
+  if (Source.size() != Target.size()) throw std::invalid_argument("Source and target sizes differ");
+  kernel(Source.data(), Target.data(), Source.size());
+}
+} // namespace detail
+
+// Blends Source over Target (straight alpha source-over), sizes must match (throws std::invalid_argument otherwise).
+// Source and Target must not overlap
+inline void BlendOver(const ConstView Source, const View Target) {
+  detail::ForEachRow(Source, Target, simd::BlendOver);
+}
+
+// Per pixel arithmetic on the simd kernels, every pixel comes out exactly like the scalar Pixel operator (or
+// simd::detail function) named. Views or spans (e.g. Image::GetData() for whole images), sizes must match (throws
+// std::invalid_argument otherwise). Source may be Target itself but must not overlap it otherwise
+
+// Target = Target + Source (Pixel::operator+, saturating)
+inline void Add(const ConstView Source, const View Target) { detail::ForEachRow(Source, Target, simd::Add); }
+inline void Add(const std::span<const Pixel> Source, const std::span<Pixel> Target) {
+  detail::ForEachRow(Source, Target, simd::Add);
+}
+
+// Target = Target - Source (Pixel::operator-, saturating)
+inline void Subtract(const ConstView Source, const View Target) { detail::ForEachRow(Source, Target, simd::Subtract); }
+inline void Subtract(const std::span<const Pixel> Source, const std::span<Pixel> Target) {
+  detail::ForEachRow(Source, Target, simd::Subtract);
+}
+
+// Target = Target * Source / 255 per channel, alpha included (multiply blend, simd::detail::MultiplyPixel)
+inline void Multiply(const ConstView Source, const View Target) { detail::ForEachRow(Source, Target, simd::Multiply); }
+inline void Multiply(const std::span<const Pixel> Source, const std::span<Pixel> Target) {
+  detail::ForEachRow(Source, Target, simd::Multiply);
+}
+
+// Blends premultiplied Source over premultiplied Target (simd::detail::PremultipliedOverPixel)
+inline void BlendOverPremultiplied(const ConstView Source, const View Target) {
+  detail::ForEachRow(Source, Target, simd::BlendOverPremultiplied);
+}
+inline void BlendOverPremultiplied(const std::span<const Pixel> Source, const std::span<Pixel> Target) {
+  detail::ForEachRow(Source, Target, simd::BlendOverPremultiplied);
+}
+
+// Target = Target * Factor (Pixel::operator*(float)), e.g. to brighten or darken a frame
+inline void Scale(const View Target, const float Factor) {
+  for (ui y{0}; y < Target.getHeight(); ++y) simd::Scale(Target.fRow(y).data(), Target.getWidth(), Factor);
+}
+inline void Scale(const std::span<Pixel> Target, const float Factor) {
+  simd::Scale(Target.data(), Target.size(), Factor);
+}
+
+} // namespace QOID
+
+namespace QOID {
+
+class Image {
+public:
+  // Tag for the constructor that leaves the pixels uninitialized
+  struct Uninitialized {};
+
+  Image() = delete;
+  // Every pixel starts out as (0, 0, 0, 255)
+  Image(const ui width, const ui height) : Image{width, height, Uninitialized{}} { Fill(Pixel{}); }
+  // Pixels hold whatever the allocator returned, for images that get overwritten completely anyway (decoders, frames)
+  Image(const ui width, const ui height, Uninitialized) :
+      m_width{width}, m_height{height}, m_owned{Allocate(static_cast<size_t>(width) * height)},
+      m_pixel_data{m_owned.get()} {}
+  // Deep copy, the copy always owns its pixels
+  Image(const Image &I) : Image{I.m_width, I.m_height, Uninitialized{}} {
+    std::copy_n(I.m_pixel_data, I.PixelCount(), m_pixel_data);
+  }
+  Image(Image &&I) noexcept :
+      m_width{std::exchange(I.m_width, 0)}, m_height{std::exchange(I.m_height, 0)}, m_owned{std::move(I.m_owned)},
+      m_pixel_data{std::exchange(I.m_pixel_data, nullptr)}, m_dirty{std::move(I.m_dirty)},
+      m_trackingId{std::exchange(I.m_trackingId, 0)}, m_generation{std::exchange(I.m_generation, 0)} {
+    I.m_dirty.clear();
+  }
+
+  // A tracking image keeps tracking with every pixel marked
+  Image &operator=(const Image &I) {
+    if (this == &I) return *this;
+    const bool tracking{Tracking()};
+    *this = Image{I};
+    if (tracking) TrackChanges();
+    return *this;
+  }
+  Image &operator=(Image &&I) noexcept {
+    m_width = std::exchange(I.m_width, 0);
+    m_height = std::exchange(I.m_height, 0);
+    m_owned = std::move(I.m_owned);
+    m_pixel_data = std::exchange(I.m_pixel_data, nullptr);
+    m_dirty = std::move(I.m_dirty);
+    I.m_dirty.clear();
+    m_trackingId = std::exchange(I.m_trackingId, 0);
+    m_generation = std::exchange(I.m_generation, 0);
+    return *this;
+  }
+
+  // Uses width * height pixels at Data (e.g. a camera or decoder buffer) without copying. The memory stays owned by
+  // the caller and has to outlive the image and every move of it
+  static Image Wrap(Pixel *const Data, const ui width, const ui height) { return Image{Data, width, height}; }
+
+  // false for images made with Wrap
+  inline bool OwnsData() const { return m_owned != nullptr; }
+
+  // Same size and pixels
+  inline bool operator==(const Image &I) const {
+    return m_width == I.m_width && m_height == I.m_height && std::ranges::equal(GetData(), I.GetData());
+  }
+
+  // Loads an image from disk. Throws std::runtime_error if the file can't be read or is malformed
+  static Image LoadFile(const strv FilePath, const ImageType Type = QOID::ImageType::qoi,
+                        const DecodeOptions &Options = {});
+
+  // Set pixel at position
+  inline void SetPixel(const Pixel P, const ui width, const ui height);
+
+  // Set pixel at position (no bounds checking)
+  inline void fSetPixel(const Pixel P, const ui width, const ui height);
+
+  // Returns reference to pixel at position
+  inline Pixel &GetPixel(const ui width, const ui height);
+
+  // Returns reference to pixel at position (no bounds checking)
+  inline Pixel &fGetPixel(const ui width, const ui height);
+
+  // Fill Image with given Pixel
+  inline void Fill(const Pixel Pixel) {
+    MarkAllDirty();
+    std::fill_n(m_pixel_data, PixelCount(), Pixel);
+  }
+
+  // Row y. Throws std::out_of_range
+  inline std::span<Pixel> Row(const ui y) {
+    const std::span<Pixel> row{View{m_pixel_data, m_width, m_height, m_width}.Row(y)};
+    MarkDirty(0, y, m_width, 1);
+    return row;
+  }
+  inline std::span<const Pixel> Row(const ui y) const { return GetView().Row(y); }
+
+  // Whole image as a view
+  inline View GetView() {
+    MarkAllDirty();
+    return {m_pixel_data, m_width, m_height, m_width};
+  }
+  inline ConstView GetView() const { return {m_pixel_data, m_width, m_height, m_width}; }
+
+  // View of the width x height rectangle at (x, y). Throws std::out_of_range if it doesn't fit
+  inline View SubRect(const ui x, const ui y, const ui width, const ui height) {
+    const View view{View{m_pixel_data, m_width, m_height, m_width}.SubRect(x, y, width, height)};
+    MarkDirty(x, y, width, height);
+    return view;
+  }
+  inline ConstView SubRect(const ui x, const ui y, const ui width, const ui height) const {
+    return GetView().SubRect(x, y, width, height);
+  }
+
+  // Bulk writes, bounds are checked once per call (std::out_of_range)
+
+  // Fills the width x height rectangle at (x, y) with P
+  inline void FillRect(const ui x, const ui y, const ui width, const ui height, const Pixel P) {
+    QOID::Fill(SubRect(x, y, width, height), P);
+  }
+
+  // Copies Source (e.g. other.SubRect(...), may be part of this image) to (x, y)
+  inline void CopyRect(const ConstView Source, const ui x, const ui y) {
+    Copy(Source, SubRect(x, y, Source.getWidth(), Source.getHeight()));
+  }
+
+  // Blends Source over the pixels at (x, y), straight alpha source-over. Source must not overlap the target rectangle
+  inline void Blit(const ConstView Source, const ui x, const ui y) {
+    BlendOver(Source, SubRect(x, y, Source.getWidth(), Source.getHeight()));
+  }
+
+  // Get pixel data, row by row (mutable)
+  inline std::span<Pixel> GetData() {
+    MarkAllDirty();
+    return {m_pixel_data, PixelCount()};
+  }
+
+  // Get pixel data, row by row (read-only)
+  inline std::span<const Pixel> GetData() const { return {m_pixel_data, PixelCount()}; }
+
+  constexpr ui getWidth() const { return m_width; }
+  constexpr ui getHeight() const { return m_height; }
+
+  // Change tracking, for consumers that only want to look at what changed (e.g. qoi::IncrementalEncoder). Once
+  // started, every mutable access marks the pixels it can reach: SetPixel and GetPixel one pixel, Row, SubRect and the
+  // rectangle functions their rectangle, Fill, GetView and GetData the whole image. Writes the image can't see (through
+  // pointers kept from earlier calls or through memory passed to Wrap) have to be marked with MarkDirty. Copies of an
+  // image don't track.
+  // There are two ways to read the marks. Dirty / DirtyBounds see everything marked since the last ClearDirty, for a
+  // single owner of the image. Consumers that share an image keep the Generation of their last look instead and ask
+  // ChangedSince, nobody has to clear anything then
+
+  // Starts tracking with the whole image marked. Costs 16 bytes per row. Every start gets a new TrackingId
+  inline void TrackChanges() {
+    static std::atomic<uint64_t> nextId{1};
+    m_trackingId = nextId++;
+    m_dirty.assign(m_height, DirtySpan{0, m_width, ++m_generation});
+  }
+
+  inline bool Tracking() const { return !m_dirty.empty(); }
+
+  // Identifies the tracked pixels for consumers that keep state about them: unique in the process for every
+  // TrackChanges, moves take it along. 0 without tracking
+  inline uint64_t TrackingId() const { return m_trackingId; }
+
+  // Counts the marks, a consumer keeps the value of its last look for ChangedSince
+  inline uint64_t Generation() const { return m_generation; }
+
+  // true if one of the Count rows from y on was marked after Generation returned Since. Always true without tracking
+  inline bool ChangedSince(const uint64_t Since, const ui y, const ui Count = 1) const {
+    if (m_dirty.empty()) return true;
+    for (ui row{y}; row < m_height && row - y < Count; ++row)
+      if (m_dirty[row].generation > Since) return true;
+    return false;
+  }
+
+  // Marks the width x height rectangle at (x, y), clipped to the image
+  inline void MarkDirty(const ui x, const ui y, const ui width, const ui height) {
+    if (m_dirty.empty() || x >= m_width || y >= m_height) return;
+    const ui end{x + std::min(width, m_width - x)};
+    ++m_generation;
+    for (ui row{y}; row < y + std::min(height, m_height - y); ++row) {
+      m_dirty[row].begin = std::min(m_dirty[row].begin, x);
+      m_dirty[row].end = std::max(m_dirty[row].end, end);
+      m_dirty[row].generation = m_generation;
+    }
+  }
+
+  inline void MarkAllDirty() { MarkDirty(0, 0, m_width, m_height); }
+
+  // Forgets what has been marked for Dirty / DirtyBounds, the current pixels become the state later changes are
+  // relative to. ChangedSince isn't affected
+  inline void ClearDirty() {
+    for (DirtySpan &row : m_dirty) {
+      row.begin = DirtySpan{}.begin;
+      row.end = 0;
+    }
+  }
+
+  // true if one of the Count rows from y on has marked pixels. Always true without tracking
+  inline bool Dirty(const ui y, const ui Count = 1) const {
+    if (m_dirty.empty()) return true;
+    for (ui row{y}; row < m_height && row - y < Count; ++row)
+      if (m_dirty[row].begin < m_dirty[row].end) return true;
+    return false;
+  }
+
+  // Smallest rectangle holding every marked pixel. The whole image without tracking
+  inline Rect DirtyBounds() const {
+    if (m_dirty.empty()) return {0, 0, m_width, m_height};
+    ui left{m_width}, right{0}, top{m_height}, bottom{0};
+    for (ui row{0}; row < m_height; ++row) {
+      if (m_dirty[row].begin >= m_dirty[row].end) continue;
+      left = std::min(left, m_dirty[row].begin);
+      right = std::max(right, m_dirty[row].end);
+      top = std::min(top, row);
+      bottom = row + 1;
+    }
+    return top < bottom ? Rect{left, top, right - left, bottom - top} : Rect{};
+  }
+
+  // Filepath can be realtive to cwd or absolute. The file is replaced only once it is written completely (see
+  // WriteResult)
+  WriteResult GenerateFile(const strv FilePath, const ImageType Type = QOID::ImageType::qoi,
+                           const EncodeOptions &Options = {});
+
+  // Writes a qoi file and fills Stats (see EncodeStats)
+  WriteResult GenerateFile(const strv FilePath, EncodeStats &Stats, const EncodeOptions &Options = {});
+
+private:
+  // raw storage: operator new creates the (implicit lifetime) pixels without running a constructor
+  struct FreePixels {
+    void operator()(Pixel *const Data) const { ::operator delete(Data); }
+  };
+  static std::unique_ptr<Pixel, FreePixels> Allocate(const size_t Count) {
+    if (Count > std::numeric_limits<size_t>::max() / sizeof(Pixel)) throw std::length_error("Image is too large");
+    void *const memory{::operator new(std::max<size_t>(Count, 1) * sizeof(Pixel))};
+    return std::unique_ptr<Pixel, FreePixels>{static_cast<Pixel *>(memory)};
+  }
+
+  Image(Pixel *const Data, const ui width, const ui height) : m_width{width}, m_height{height}, m_pixel_data{Data} {}
+
+  inline size_t PixelCount() const { return static_cast<size_t>(m_width) * m_height; }
+
+  inline void MarkPixel(const ui x, const ui y) {
+    if (m_dirty.empty()) return;
+    m_dirty[y].begin = std::min(m_dirty[y].begin, x);
+    m_dirty[y].end = std::max(m_dirty[y].end, x + 1);
+    m_dirty[y].generation = ++m_generation;
+  }
+
+  // Marked columns [begin, end) of a row since ClearDirty, begin >= end if the row is clean. generation is the value
+  // of m_generation at the row's last mark
+  struct DirtySpan {
+    ui begin{std::numeric_limits<ui>::max()};
+    ui end{0};
+    uint64_t generation{0};
+  };
+
+  ui m_width{};
+  ui m_height{};
+  std::unique_ptr<Pixel, FreePixels> m_owned; // null for wrapped memory
+  Pixel *m_pixel_data{nullptr};
+  std::vector<DirtySpan> m_dirty; // one per row while tracking, empty otherwise
+  uint64_t m_trackingId{0};
+  uint64_t m_generation{0};
+};
+
+inline void Image::SetPixel(const Pixel P, const ui width, const ui height) {
+  if (width >= m_width || height >= m_height) throw std::out_of_range("Pixel coordinates out of bounds");
+  fSetPixel(P, width, height);
+}
+
+inline void Image::fSetPixel(const Pixel P, const ui width, const ui height) {
+  MarkPixel(width, height);
+  std::memcpy(&m_pixel_data[width + static_cast<size_t>(height) * m_width], &P, sizeof(P));
+}
+
+inline Pixel &Image::GetPixel(const ui width, const ui height) {
+  if (!m_pixel_data) throw std::runtime_error("Image has no pixel data.");
+  if (width >= m_width || height >= m_height) throw std::out_of_range("Pixel coordinates out of bounds");
+  return fGetPixel(width, height);
+}
+
+inline Pixel &Image::fGetPixel(const ui width, const ui height) {
+  MarkPixel(width, height);
+  return m_pixel_data[width + static_cast<size_t>(height) * m_width];
+}
+// } // namespace QOID
+
+// #include "DataTypes/ImageFunctions/qoi.hpp"
+// #include "DataTypes/ImageFunctions/tiff.hpp"
+// namespace QOID {
+// namespace qoi {
+// bool GenerateFile(const Image &image, const strv FilePath); // Declare the function
+// }
+// } // namespace QOID
+
+// namespace QOID {
+
+namespace qoi { // forward declare the functions
+WriteResult GenerateFile(const Image &image, const strv FilePath, const EncodeOptions &Options);
+WriteResult GenerateFile(const Image &image, const strv FilePath, const EncodeOptions &Options, EncodeStats &Stats);
+Image LoadFile(const strv FilePath, const DecodeOptions &Options);
+}
+namespace tga { // forward declare the functions
+WriteResult GenerateFile(const Image &image, const strv FilePath, const EncodeOptions &Options);
+Image LoadFile(const strv FilePath);
+}
+
+inline WriteResult Image::GenerateFile(const strv FilePath, const ImageType Type, const EncodeOptions &Options) {
+  if (FilePath.empty()) throw std::invalid_argument("Filename is empty");
+
+  switch (Type) {
+  case ImageType::qoi: return qoi::GenerateFile(*this, FilePath, Options);
+  case ImageType::tga: return tga::GenerateFile(*this, FilePath, Options);
+  default: return {false, 0, EINVAL};
+  }
+}
+
+inline WriteResult Image::GenerateFile(const strv FilePath, EncodeStats &Stats, const EncodeOptions &Options) {
+  if (FilePath.empty()) throw std::invalid_argument("Filename is empty");
+  return qoi::GenerateFile(*this, FilePath, Options, Stats);
+}
+
+inline Image Image::LoadFile(const strv FilePath, const ImageType Type, const DecodeOptions &Options) {
+  if (FilePath.empty()) throw std::invalid_argument("Filename is empty");
+
+  switch (Type) {
+  case ImageType::qoi: return qoi::LoadFile(FilePath, Options);
+  case ImageType::tga: return tga::LoadFile(FilePath);
+  default: throw std::invalid_argument("Loading is not supported for this image type");
+  }
+}
+} // namespace QOID
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <filesystem>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace QOID {
+
+// Output target of the encoders. Encoders write straight into [Pos(), Pos() + Available()) and hand the new
+// position back with Advance. What happens once the space runs out is up to the derived sink (flush, grow or fail).
+class Sink {
+public:
+  virtual ~Sink() = default;
+
+  // Makes sure at least Size bytes can be written at Pos(). Returns false if the sink can't take them
+  inline bool Reserve(const size_t Size) { return Available() >= Size || Overflow(Size); }
+
+  inline std::byte *Pos() const { return m_pos; }
+  inline size_t Available() const { return static_cast<size_t>(m_end - m_pos); }
+
+  // Marks everything up to Pos as written
+  inline void Advance(std::byte *const Pos) { m_pos = Pos; }
+
+  // Copies Size bytes into the sink
+  inline bool Write(const void *Data, size_t Size) {
+    const auto *bytes{static_cast<const std::byte *>(Data)};
+    while (Size) {
+      if (!Reserve(1)) return false;
+      const size_t chunk{std::min(Size, Available())};
+      std::memcpy(m_pos, bytes, chunk);
+      m_pos += chunk;
+      bytes += chunk;
+      Size -= chunk;
+    }
+    return true;
+  }
+
+  // Pushes out everything that is still buffered
+  virtual bool Flush() { return true; }
+
+  // Bytes written to the sink so far
+  inline size_t Written() const { return m_flushed + static_cast<size_t>(m_pos - m_begin); }
+
+  // errno value of the failure that made the sink return false (e.g. ENOSPC), 0 if it didn't fail
+  inline int Error() const { return m_error; }
+
+protected:
+  // Called when fewer than Size bytes are available
+  virtual bool Overflow(const size_t Size) = 0;
+
+  inline bool Fail(const int Error) {
+    m_error = Error;
+    return false;
+  }
+
+  std::byte *m_begin{nullptr};
+  std::byte *m_pos{nullptr};
+  std::byte *m_end{nullptr};
+  size_t m_flushed{0}; // bytes that already left [m_begin, m_pos)
+  int m_error{0};
+};
+
+// Fixed size buffer that is handed to Drain whenever it fills up, so memory use doesn't depend on the image size
+class BufferedSink : public Sink {
+public:
+  static constexpr size_t BufferSize{64 * 1024};
+
+  BufferedSink() : BufferedSink{std::span<std::byte>{}} {}
+  // Buffers in caller owned memory (at least MaxChunkSize of the encoders, usually BufferSize) that has to outlive the
+  // sink, which saves the allocation when sinks are created over and over (see qoi::Encoder). An empty Buffer
+  // allocates BufferSize bytes like the default constructor, not value initialized since every byte gets written
+  // before it is read
+  explicit BufferedSink(const std::span<std::byte> Buffer) :
+      m_buffer{Buffer.empty() ? std::make_unique_for_overwrite<std::byte[]>(BufferSize) : nullptr} {
+    m_begin = m_pos = m_buffer ? m_buffer.get() : Buffer.data();
+    m_end = m_begin + (m_buffer ? BufferSize : Buffer.size());
+  }
+
+  bool Flush() override {
+    const size_t size{static_cast<size_t>(m_pos - m_begin)};
+    if (size && !Drain(m_begin, size)) return false;
+    m_flushed += size;
+    m_pos = m_begin;
+    return true;
+  }
+
+protected:
+  virtual bool Drain(const std::byte *Data, const size_t Size) = 0;
+
+  bool Overflow(const size_t Size) override {
+    return Size <= static_cast<size_t>(m_end - m_begin) ? Flush() : Fail(ENOBUFS);
+  }
+
+private:
+  std::unique_ptr<std::byte[]> m_buffer; // null for caller owned buffers
+};
+
+// Buffers output for a std::ostream
+class StreamSink : public BufferedSink {
+public:
+  explicit StreamSink(std::ostream &Stream) : m_stream{Stream} {}
+
+  bool Flush() override {
+    if (!BufferedSink::Flush()) return false;
+    errno = 0;
+    return m_stream.flush() ? true : Fail(errno ? errno : EIO);
+  }
+
+protected:
+  // streams don't report why they failed, errno is the best guess (the file buffers set it)
+  bool Drain(const std::byte *Data, const size_t Size) override {
+    errno = 0;
+    if (m_stream.write(reinterpret_cast<const char *>(Data), static_cast<std::streamsize>(Size))) return true;
+    return Fail(errno ? errno : EIO);
+  }
+
+private:
+  std::ostream &m_stream;
+};
+
+// Buffers output for a file descriptor (which stays owned by the caller)
+class FdSink : public BufferedSink {
+public:
+  explicit FdSink(const int Fd) : m_fd{Fd} {}
+  // Buffers in Buffer instead of an own allocation, see BufferedSink. An empty Buffer allocates like FdSink(Fd)
+  FdSink(const int Fd, const std::span<std::byte> Buffer) : BufferedSink{Buffer}, m_fd{Fd} {}
+
+protected:
+  bool Drain(const std::byte *Data, size_t Size) override {
+    while (Size) {
+#if defined(_WIN32)
+      const auto written{::_write(m_fd, Data, static_cast<unsigned>(std::min<size_t>(Size, 1u << 30)))};
+#else
+      const auto written{::write(m_fd, Data, Size)};
+#endif
+      if (written < 0 && errno == EINTR) continue;
+      if (written <= 0) return Fail(written < 0 ? errno : ENOSPC);
+      Data += written;
+      Size -= static_cast<size_t>(written);
+    }
+    return true;
+  }
+
+private:
+  int m_fd;
+};
+
+// Writes into caller owned memory, fails once it is full
+class SpanSink : public Sink {
+public:
+  explicit SpanSink(const std::span<std::byte> Buffer) {
+    m_begin = m_pos = Buffer.data();
+    m_end = m_begin + Buffer.size();
+  }
+
+protected:
+  bool Overflow(const size_t) override { return Fail(ENOBUFS); }
+};
+
+// Appends to a vector, growing it as needed. The vector has its final size after Flush
+class VectorSink : public Sink {
+public:
+  explicit VectorSink(std::vector<std::byte> &Buffer, const size_t SizeHint = 0) :
+      m_buffer{Buffer}, m_start{Buffer.size()} {
+    m_buffer.resize(m_start + std::max<size_t>(SizeHint, 256));
+    m_begin = m_buffer.data() + m_start;
+    m_pos = m_begin;
+    m_end = m_buffer.data() + m_buffer.size();
+  }
+
+  bool Flush() override {
+    m_buffer.resize(m_start + Written());
+    m_begin = m_buffer.data() + m_start;
+    m_pos = m_end = m_buffer.data() + m_buffer.size();
+    return true;
+  }
+
+protected:
+  bool Overflow(const size_t Size) override {
+    const size_t written{Written()};
+    m_buffer.resize(m_start + written + std::max(Size, written));
+    m_begin = m_buffer.data() + m_start;
+    m_pos = m_begin + written;
+    m_end = m_buffer.data() + m_buffer.size();
+    return true;
+  }
+
+private:
+  std::vector<std::byte> &m_buffer;
+  size_t m_start; // size of the vector before anything was written
+};
+
+// Grows the empty file behind Fd (opened read / write, stays owned by the caller) to Capacity bytes and writes into a
+// shared mapping of it, so encoded bytes never go through a stream buffer. Flush truncates the file to the bytes
+// actually written. On Linux the blocks are allocated up front, so a full disk fails here instead of raising SIGBUS on
+// a write into the mapping. File systems that can't allocate blocks natively (EOPNOTSUPP) fail too rather than having
+// every block written, WriteFile uses the buffered backend then. If mapping fails the file is empty again. Only
+// available on POSIX systems, check IsOpen before use
+class MappedSink : public Sink {
+public:
+  MappedSink(const int Fd, const size_t Capacity) : m_fd{Fd} {
+#if !defined(_WIN32)
+    if (Capacity == 0) return;
+#if defined(__linux__)
+    // not posix_fallocate: glibc emulates that by writing every block where the file system has no fallocate
+    int grown;
+    do grown = ::fallocate(m_fd, 0, 0, static_cast<off_t>(Capacity)) == 0 ? 0 : errno;
+    while (grown == EINTR);
+#else
+    const int grown{::ftruncate(m_fd, static_cast<off_t>(Capacity)) == 0 ? 0 : errno};
+#endif
+    void *mapping{grown == 0 ? ::mmap(nullptr, Capacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0) : MAP_FAILED};
+    if (mapping == MAP_FAILED) {
+      Fail(grown ? grown : errno);
+      static_cast<void>(::ftruncate(m_fd, 0));
+      return;
+    }
+    m_begin = m_pos = static_cast<std::byte *>(mapping);
+    m_end = m_begin + Capacity;
+#else
+    (void)Capacity;
+#endif
+  }
+  MappedSink(const MappedSink &) = delete;
+  MappedSink &operator=(const MappedSink &) = delete;
+
+  ~MappedSink() override {
+#if !defined(_WIN32)
+    if (m_begin) ::munmap(m_begin, static_cast<size_t>(m_end - m_begin));
+#endif
+  }
+
+  inline bool IsOpen() const { return m_begin != nullptr; }
+
+  bool Flush() override {
+#if !defined(_WIN32)
+    if (!IsOpen()) return false;
+    return ::ftruncate(m_fd, static_cast<off_t>(Written())) == 0 ? true : Fail(errno);
+#else
+    return false;
+#endif
+  }
+
+protected:
+  bool Overflow(const size_t) override { return Fail(ENOSPC); }
+
+private:
+  int m_fd;
+};
+
+// Path strings of an AtomicFile. Handing the same one to every AtomicFile (e.g. through WriteFile) reuses their memory,
+// so writing a file makes no heap allocations once the strings have grown to the longest path
+struct AtomicFilePaths {
+  std::string path;
+  std::string tempPath;
+  std::string directory;
+};
+
+// Temporary file next to FilePath that replaces FilePath on Commit, so readers only ever see the old file or the
+// complete new one. Without Commit the temporary file is removed again. Error holds the errno value of a failure.
+// Paths (if given) has to outlive the file and must not be shared with another open AtomicFile
+class AtomicFile {
+public:
+  explicit AtomicFile(const strv FilePath, AtomicFilePaths *Paths = nullptr)
+      : m_paths{Paths ? *Paths : m_ownPaths}, m_path{m_paths.path}, m_tempPath{m_paths.tempPath} {
+    static std::atomic<unsigned> counter{0};
+    m_path.assign(FilePath);
+    // O_EXCL makes the name unique, a clash with another writer just takes the next one
+    for (int attempt{0}; attempt < 16 && m_fd < 0; ++attempt) {
+      m_tempPath.assign(m_path).append(".tmp");
+      appendNumber(m_tempPath, static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()));
+      m_tempPath += '-';
+      appendNumber(m_tempPath, counter++);
+#if defined(_WIN32)
+      m_fd = ::_open(m_tempPath.c_str(), _O_RDWR | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+      m_fd = ::open(m_tempPath.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+#endif
+      m_error = m_fd < 0 ? errno : 0;
+      if (m_error != EEXIST) break;
+    }
+#if !defined(_WIN32)
+    // a replaced file keeps its permissions, only new files get 0644 (less the umask)
+    struct stat existing;
+    if (m_fd >= 0 && ::stat(m_path.c_str(), &existing) == 0 && ::fchmod(m_fd, existing.st_mode & 07777) != 0) {
+      const int error{errno};
+      Close();
+      std::remove(m_tempPath.c_str());
+      m_created = false;
+      m_error = error;
+    }
+#endif
+  }
+  AtomicFile(const AtomicFile &) = delete;
+  AtomicFile &operator=(const AtomicFile &) = delete;
+
+  ~AtomicFile() {
+    if (m_committed) return;
+    Close();
+    if (m_created) std::remove(m_tempPath.c_str());
+  }
+
+  inline bool IsOpen() const { return m_fd >= 0; }
+  inline int Fd() const { return m_fd; }
+  inline int Error() const { return m_error; }
+
+  // Syncs the temporary file to disk, closes it and renames it to FilePath (the directory is synced as well on POSIX
+  // systems, where possible). Returns false if any of that fails, FilePath is untouched then
+  inline bool Commit() {
+    if (m_fd < 0) return false;
+#if defined(_WIN32)
+    if (::_commit(m_fd) != 0) return Failed(errno);
+    if (!Close()) return false;
+    std::error_code error;
+    std::filesystem::rename(m_tempPath, m_path, error);
+    if (error) return Failed(error.value());
+#else
+    if (::fsync(m_fd) != 0) return Failed(errno);
+    if (!Close()) return false;
+    if (::rename(m_tempPath.c_str(), m_path.c_str()) != 0) return Failed(errno);
+    SyncDirectory();
+#endif
+    m_committed = true;
+    return true;
+  }
+
+private:
+  inline bool Failed(const int Error) {
+    m_error = Error;
+    return false;
+  }
+
+  // appends Value in decimal, without the temporary string of std::to_string
+  static inline void appendNumber(std::string &Text, const uint64_t Value) {
+    std::array<char, 20> digits;
+    const auto [end, error]{std::to_chars(digits.data(), digits.data() + digits.size(), Value)};
+    Text.append(digits.data(), end);
+  }
+
+  inline bool Close() {
+    if (m_fd < 0) return true;
+    m_created = true;
+#if defined(_WIN32)
+    const bool closed{::_close(m_fd) == 0};
+#else
+    const bool closed{::close(m_fd) == 0};
+#endif
+    m_fd = -1;
+    return closed ? true : Failed(errno);
+  }
+
+#if !defined(_WIN32)
+  // makes the rename itself durable. Best effort, not every file system can sync a directory
+  inline void SyncDirectory() {
+    const size_t slash{m_path.find_last_of('/')};
+    std::string &directory{m_paths.directory};
+    if (slash == std::string::npos) directory.assign(".");
+    else directory.assign(m_path, 0, slash == 0 ? 1 : slash);
+    const int fd{::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+    if (fd < 0) return;
+    static_cast<void>(::fsync(fd));
+    ::close(fd);
+  }
+#endif
+
+  AtomicFilePaths m_ownPaths;
+  AtomicFilePaths &m_paths;
+  std::string &m_path;
+  std::string &m_tempPath;
+  int m_fd{-1};
+  int m_error{0};
+  bool m_created{false};
+  bool m_committed{false};
+};
+
+// Writes FilePath through an AtomicFile: EncodeTo(Sink &) writes everything (and flushes), then the file is committed.
+// OutputBackend::mmap maps MaxSize bytes (an upper bound of the output) and falls back to buffered writes if that
+// fails. Buffered writes go through Buffer if it isn't empty (see FdSink), the path strings go into Paths if given
+template <typename Function>
+inline WriteResult WriteFile(const strv FilePath, const OutputBackend Output, const size_t MaxSize,
+                             const Function &EncodeTo, const std::span<std::byte> Buffer = {},
+                             AtomicFilePaths *Paths = nullptr) {
+  AtomicFile file{FilePath, Paths};
+  if (!file.IsOpen()) return {false, 0, file.Error()};
+  const auto finish{[&file](const Sink &sink, const bool Encoded) -> WriteResult {
+    // a failure without an error of the sink means the encoder refused the input
+    if (!Encoded) return {false, sink.Written(), sink.Error() ? sink.Error() : EINVAL};
+    if (!file.Commit()) return {false, sink.Written(), file.Error()};
+    return {true, sink.Written(), 0};
+  }};
+  if (Output == OutputBackend::mmap) {
+    MappedSink sink{file.Fd(), MaxSize};
+    if (sink.IsOpen()) return finish(sink, EncodeTo(sink));
+  }
+  FdSink sink{file.Fd(), Buffer};
+  return finish(sink, EncodeTo(sink));
+}
+
+} // namespace QOID
+
+namespace QOID {
+
+// Minimal synchronous generator (std::generator is C++23 and missing from older standard libraries). The coroutine
+// runs until its next co_yield whenever the consumer advances, so producing and consuming interleave:
+//   Generator<int> Count() { for (int i{0};; ++i) co_yield i; }
+// A yielded value stays valid until the consumer advances again. Exceptions thrown by the coroutine come out of
+// begin() / operator++
+template <typename T> class Generator {
+public:
+  struct promise_type {
+    const T *current{nullptr};
+    std::exception_ptr exception;
+
+    Generator get_return_object() { return Generator{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    // temporaries of the co_yield expression live until the coroutine resumes, so pointing at them is fine
+    std::suspend_always yield_value(const T &Value) noexcept {
+      current = std::addressof(Value);
+      return {};
+    }
+    void return_void() noexcept {}
+    void unhandled_exception() { exception = std::current_exception(); }
+    // only co_yield makes sense in a generator
+    template <typename U> std::suspend_never await_transform(U &&) = delete;
+  };
+
+  class Iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+
+    Iterator() = default;
+    explicit Iterator(const std::coroutine_handle<promise_type> Handle) : m_handle{Handle} {}
+
+    inline const T &operator*() const { return *m_handle.promise().current; }
+    inline Iterator &operator++() {
+      Resume(m_handle);
+      return *this;
+    }
+    inline void operator++(int) { ++*this; }
+    inline bool operator==(std::default_sentinel_t) const { return !m_handle || m_handle.done(); }
+
+  private:
+    std::coroutine_handle<promise_type> m_handle{};
+  };
+
+  Generator(Generator &&Other) noexcept : m_handle{std::exchange(Other.m_handle, {})} {}
+  Generator &operator=(Generator &&Other) noexcept {
+    if (this != &Other) {
+      if (m_handle) m_handle.destroy();
+      m_handle = std::exchange(Other.m_handle, {});
+    }
+    return *this;
+  }
+  Generator(const Generator &) = delete;
+  Generator &operator=(const Generator &) = delete;
+  ~Generator() {
+    if (m_handle) m_handle.destroy();
+  }
+
+  // Runs the coroutine up to its first co_yield, call once
+  inline Iterator begin() {
+    Resume(m_handle);
+    return Iterator{m_handle};
+  }
+  inline std::default_sentinel_t end() const { return {}; }
+
+private:
+  explicit Generator(const std::coroutine_handle<promise_type> Handle) : m_handle{Handle} {}
+
+  static inline void Resume(const std::coroutine_handle<promise_type> Handle) {
+    if (!Handle || Handle.done()) return;
+    Handle.resume();
+    if (Handle.promise().exception) std::rethrow_exception(std::exchange(Handle.promise().exception, nullptr));
+  }
+
+  std::coroutine_handle<promise_type> m_handle;
+};
+
+} // namespace QOID
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace QOID {
+
+// Input of the row streaming encoders (qoi::EncodeRows), for images that don't fit into memory as a whole. Called once
+// per row from top to bottom, returns row y (width pixels) which has to stay valid until the next call. An empty span
+// aborts the encode
+using RowProvider = std::function<std::span<const Pixel>(ui y)>;
+
+// Coroutine producing the pixels for the streaming encoders (qoi::EncodeRows, qoi::StreamEncoder) in row order, e.g. a
+// renderer that co_yields every scanline as soon as it is done. A yielded span may hold any amount of pixels
+using RowGenerator = Generator<std::span<const Pixel>>;
+
+// Read only mapping of a raw RGBA file (width * height pixels, row by row, no header), so the encoders can walk an
+// image larger than RAM and the kernel pages it in and out. Passed as a RowProvider with std::ref. Only available on
+// POSIX systems, check IsOpen before use
+class MappedRaw {
+public:
+  MappedRaw(const std::string &FilePath, const ui width, const ui height) : m_width{width}, m_height{height} {
+#if !defined(_WIN32)
+    const size_t size{static_cast<size_t>(width) * height * sizeof(Pixel)};
+    const int fd{::open(FilePath.c_str(), O_RDONLY)};
+    if (fd < 0) return;
+    struct stat info{};
+    if (size != 0 && ::fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= size) {
+      void *mapping{::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)};
+      if (mapping != MAP_FAILED) {
+        // rows are read once from top to bottom
+        ::madvise(mapping, size, MADV_SEQUENTIAL);
+        m_data = static_cast<const Pixel *>(mapping);
+      }
+    }
+    ::close(fd); // the mapping keeps the file referenced
+#else
+    (void)FilePath;
+#endif
+  }
+  MappedRaw(const MappedRaw &) = delete;
+  MappedRaw &operator=(const MappedRaw &) = delete;
+
+  ~MappedRaw() {
+#if !defined(_WIN32)
+    if (m_data) ::munmap(const_cast<Pixel *>(m_data), static_cast<size_t>(m_width) * m_height * sizeof(Pixel));
+#endif
+  }
+
+  inline bool IsOpen() const { return m_data != nullptr; }
+
+  constexpr ui getWidth() const { return m_width; }
+  constexpr ui getHeight() const { return m_height; }
+
+  // Row y, empty if the file isn't mapped or y is out of bounds
+  inline std::span<const Pixel> operator()(const ui y) const {
+    if (!m_data || y >= m_height) return {};
+    return {m_data + static_cast<size_t>(y) * m_width, m_width};
+  }
+
+private:
+  ui m_width;
+  ui m_height;
+  const Pixel *m_data{nullptr};
+};
+
+} // namespace QOID
+
+namespace QOID {
+class Image;
+namespace qoi {
+
+// Position of a pixel inside the 64 entry color index (see specification)
+static inline constexpr uint8_t IndexPos(const Pixel px) {
+  return (px.R() * 3 + px.G() * 5 + px.B() * 7 + px.A() * 11) % 64;
+}
+
+static inline bool writeTrail(Sink &file) {
+#if defined(QOID_BIG_ENDIAN)
+  static constexpr uint64_t end_marker{0x0000000000000001};
+#else
+  static constexpr uint64_t end_marker{0x0100000000000000};
+#endif
+  return file.Write(&end_marker, sizeof(end_marker));
+}
+
+// channels is 4 (RGBA) or 3 (RGB, every pixel is opaque). It is informative only, decoders output the same pixels
+static inline bool writeHeader(Sink &file, const ui width, const ui height, const uint8_t channels = 4) {
+  std::array<std::byte, 14> buffer{};
+
+  static constexpr uint8_t colorspace{1};
+
+  // Write the "qoif" magic number
+  std::memcpy(buffer.data(), "qoif", 4);
+
+  // write Width and height according to endian
+#if defined(QOID_BIG_ENDIAN)
+  const uint32_t swappedWidth = (width);
+  const uint32_t swappedHeight = (height);
+  const uint16_t combined{static_cast<uint16_t>(channels << 8 | colorspace)};
+#else
+  const uint16_t combined{static_cast<uint16_t>(colorspace << 8 | channels)};
+  const uint32_t swappedWidth = std::byteswap(width);
+  const uint32_t swappedHeight = std::byteswap(height);
+#endif
+  std::memcpy(buffer.data() + 4, &swappedWidth, sizeof(swappedWidth));
+  std::memcpy(buffer.data() + 8, &swappedHeight, sizeof(swappedHeight));
+
+  // Write the combined channels/colorspace value
+  std::memcpy(buffer.data() + 12, &combined, sizeof(combined));
+
+  return file.Write(buffer.data(), buffer.size());
+}
+
+static inline bool writeHeader(Sink &file, const Image &image) {
+  return writeHeader(file, image.getWidth(), image.getHeight());
+}
+
+// Color index as described by the specification. All entries start out as (0, 0, 0, 0)
+using ColorIndex = std::array<Pixel, 64>;
+
+static inline ColorIndex EmptyIndex() {
+  ColorIndex index;
+  index.fill(Pixel{p_color{0}});
+  return index;
+}
+
+// Encoder state the streaming encoders carry from one row (or any other piece of the image) to the next. A run reaching
+// the end of a piece stays open in run, so runs cross pieces like in writeData and the output is the same
+struct RowState {
+  ColorIndex index{EmptyIndex()};
+  Pixel previous{0, 0, 0, 255};
+  size_t run{0}; // pixels equal to previous that aren't written yet
+};
+
+// Where a decoder can start decoding on its own: the chunk at byteOffset (counted from the start of the file) encodes
+// the pixel at pixelOffset, previous is the decoder's previous pixel at that point and the index is empty. Every band
+// written by writeBand is one
+struct RestartPoint {
+  uint64_t byteOffset;
+  uint64_t pixelOffset;
+  Pixel previous;
+};
+
+namespace {
+
+static inline bool writeDataNonCompressedNonOptimized(Sink &file, const Image &image) {
+  static uint8_t tmp{0xFF};
+  for (auto i : image.GetData()) {
+    if (!file.Write(&tmp, sizeof(tmp)) || !file.Write(&i, sizeof(Pixel))) return false;
+  }
+  return true;
+}
+
+// Largest amount of bytes a single WriteToBuffer call writes (OP_RGBA)
+static inline constexpr size_t MaxChunkSize{5};
+
+// Writes the run starting at DataIterator (DataIterator[0] == previous) and advances past it
+static inline void WriteRun(std::byte *&buffer, const Pixel *&DataIterator, const Pixel *const DataEndIt,
+                            const Pixel previous) {
+  constexpr ptrdiff_t maxRunLength = 62;
+  const size_t runCount{
+      simd::RunLength(DataIterator, DataIterator + std::min(maxRunLength, DataEndIt - DataIterator), previous)};
+  uint8_t runMarker = static_cast<uint8_t>((runCount - 1) | 0xC0);
+  std::memcpy(buffer, &runMarker, sizeof(runMarker));
+  buffer += 1;
+  DataIterator += runCount;
+}
+
+static inline void WriteDiff(std::byte *&buffer, const Pixel current, const Pixel previous) {
+  // differences wrap around, like the decoder's uint8 arithmetic
+  const uint8_t diffR = static_cast<uint8_t>(current.R() - previous.R() + 2);
+  const uint8_t diffG = static_cast<uint8_t>(current.G() - previous.G() + 2);
+  const uint8_t diffB = static_cast<uint8_t>(current.B() - previous.B() + 2);
+  const uint8_t comb{static_cast<uint8_t>(0x40 | ((diffR & 0x03) << 4 | (diffG & 0x03) << 2 | (diffB & 0x03)))};
+  std::memcpy(buffer, &comb, sizeof(comb));
+  buffer += 1;
+}
+
+static inline void WriteLuma(std::byte *&buffer, const Pixel current, const Pixel previous) {
+  const int8_t dg = static_cast<int8_t>(current.G() - previous.G());
+  const int8_t dr = static_cast<int8_t>(static_cast<int8_t>(current.R() - previous.R()) - dg);
+  const int8_t db = static_cast<int8_t>(static_cast<int8_t>(current.B() - previous.B()) - dg);
+  uint8_t encodedDG = static_cast<uint8_t>(dg + 32); // Range: 0 to 63.
+  uint8_t encodedDR = static_cast<uint8_t>(dr + 8);  // Range: 0 to 15.
+  uint8_t encodedDB = static_cast<uint8_t>(db + 8);  // Range: 0 to 15.
+#if defined(QOID_BIG_ENDIAN)
+  const uint16_t comb{static_cast<uint16_t>(0x8000 | (encodedDG << 8) | (encodedDR << 4) | encodedDB)};
+#else
+  const uint16_t comb{std::byteswap(static_cast<uint16_t>(0x8000 | (encodedDG << 8) | (encodedDR << 4) | encodedDB))};
+#endif
+  std::memcpy(buffer, &comb, sizeof(comb));
+  buffer += 2;
+}
+
+static inline void WriteRGB(std::byte *&buffer, const Pixel current) {
+  const std::array<uint8_t, 4> rgb{0xFE, current.R(), current.G(), current.B()};
+  std::memcpy(buffer, rgb.data(), rgb.size());
+  buffer += rgb.size();
+}
+
+// the packed pixel is laid out as R, G, B, A in memory
+static inline void WriteRGBA(std::byte *&buffer, const Pixel current) {
+  static constexpr uint8_t Uint8Tmp{0xFF};
+  std::memcpy(buffer, &Uint8Tmp, sizeof(Uint8Tmp));
+  std::memcpy(buffer + 1, &current, sizeof(Pixel));
+  buffer += sizeof(Pixel) + sizeof(Uint8Tmp);
+}
+
+// Encodes the pixel at DataIterator (or the run starting there) to buffer and advances both. Opaque encoders know every
+// pixel (and the initial previous pixel) has alpha 255, so the alpha checks and OP_RGBA drop out of the loop
+template <bool Opaque = false>
+static inline void WriteToBuffer(std::byte *&buffer, const Pixel *&DataIterator, ColorIndex &SeenPixels,
+                                 const Pixel *const DataEndIt, Pixel &previous) {
+  const Pixel current{*DataIterator};
+  if (current == previous) { // RUN
+    WriteRun(buffer, DataIterator, DataEndIt, previous);
+    return;
+  }
+  ++DataIterator;
+
+  const uint8_t indexPos{IndexPos(current)};
+  if (SeenPixels[indexPos] == current) { // INDEX
+    std::memcpy(buffer, &indexPos, sizeof(indexPos));
+    ++buffer;
+    previous = current;
+    return;
+  }
+  SeenPixels[indexPos] = current;
+
+  if (Opaque || current.A() == previous.A()) {
+    const int8_t diffR = static_cast<int8_t>(current.R() - previous.R());
+    const int8_t diffG = static_cast<int8_t>(current.G() - previous.G());
+    const int8_t diffB = static_cast<int8_t>(current.B() - previous.B());
+    const int8_t dr = static_cast<int8_t>(diffR - diffG);
+    const int8_t db = static_cast<int8_t>(diffB - diffG);
+    if ((diffR >= -2 && diffR <= 1) && (diffG >= -2 && diffG <= 1) && (diffB >= -2 && diffB <= 1)) { // DIFF
+      WriteDiff(buffer, current, previous);
+    } else if ((diffG >= -32 && diffG <= 31) && (dr >= -8 && dr <= 7) && (db >= -8 && db <= 7)) { // LUMA
+      WriteLuma(buffer, current, previous);
+    } else {
+      WriteRGB(buffer, current);
+    }
+  } else {
+    WriteRGBA(buffer, current);
+  }
+  previous = current;
+}
+
+// Same as calling WriteToBuffer for the next 8 pixels, but the RUN/DIFF/LUMA checks of all 8 come from one
+// simd::Classify8. Needs previous == DataIterator[-1] and 8 readable pixels. Runs can continue past the block.
+template <bool Opaque = false>
+static inline void WriteBlock(std::byte *&buffer, const Pixel *&DataIterator, ColorIndex &SeenPixels,
+                              const Pixel *const DataEndIt, Pixel &previous) {
+  const Pixel *const blockBegin{DataIterator};
+  const simd::BlockMasks masks{simd::Classify8(blockBegin)};
+  while (DataIterator < blockBegin + 8) {
+    const uint32_t bit{1u << (DataIterator - blockBegin)};
+    if (masks.run & bit) {
+      WriteRun(buffer, DataIterator, DataEndIt, previous);
+      continue;
+    }
+    const Pixel current{*DataIterator++};
+    const uint8_t indexPos{IndexPos(current)};
+    if (SeenPixels[indexPos] == current) { // INDEX
+      std::memcpy(buffer, &indexPos, sizeof(indexPos));
+      ++buffer;
+    } else {
+      SeenPixels[indexPos] = current;
+      if (masks.diff & bit) WriteDiff(buffer, current, previous);
+      else if (masks.luma & bit) WriteLuma(buffer, current, previous);
+      else if (Opaque || current.A() == previous.A()) WriteRGB(buffer, current);
+      else WriteRGBA(buffer, current);
+    }
+    previous = current;
+  }
+}
+
+// Encodes [DataIterator, BatchEnd) without checking for space: every step consumes at least one pixel and
+// writes at most MaxChunkSize bytes, so (BatchEnd - DataIterator) * MaxChunkSize bytes are always enough. Runs may
+// continue up to DataEndIt. previous has to equal DataIterator[-1]
+template <bool Opaque = false>
+static inline void WritePixels(std::byte *&buffer, const Pixel *&DataIterator, const Pixel *const BatchEnd,
+                               const Pixel *const DataEndIt, ColorIndex &SeenPixels, Pixel &previous) {
+  if (simd::Active() != simd::Level::scalar) {
+    while (BatchEnd - DataIterator >= 8) WriteBlock<Opaque>(buffer, DataIterator, SeenPixels, DataEndIt, previous);
+  }
+  while (DataIterator < BatchEnd) WriteToBuffer<Opaque>(buffer, DataIterator, SeenPixels, DataEndIt, previous);
+}
+
+// Encodes [DataIterator, DataEndIt) into file, checking for space once per batch. previous has to equal
+// DataIterator[-1]
+template <bool Opaque = false>
+static inline bool writeRange(Sink &file, const Pixel *DataIterator, const Pixel *const DataEndIt,
+                              ColorIndex &SeenPixels, Pixel &previous) {
+  while (DataIterator < DataEndIt) {
+    if (!file.Reserve(MaxChunkSize)) return false;
+    std::byte *buffer{file.Pos()};
+    const size_t batch{std::min<size_t>(file.Available() / MaxChunkSize, DataEndIt - DataIterator)};
+    WritePixels<Opaque>(buffer, DataIterator, DataIterator + batch, DataEndIt, SeenPixels, previous);
+    file.Advance(buffer);
+  }
+  return true;
+}
+
+template <bool Opaque = false> static inline bool writeData(Sink &file, const Image &image) {
+  const auto &RawDataVec{image.GetData()};
+  const Pixel *DataIterator{RawDataVec.data()};
+  const Pixel *const DataEndIt{DataIterator + RawDataVec.size()};
+  ColorIndex SeenPixels{EmptyIndex()};
+  Pixel previous{0, 0, 0, 255};
+  if (DataIterator == DataEndIt) return true;
+
+  // the first pixel is compared against the initial previous pixel, everything after it against its predecessor
+  if (!file.Reserve(MaxChunkSize)) return false;
+  std::byte *buffer{file.Pos()};
+  WriteToBuffer<Opaque>(buffer, DataIterator, SeenPixels, DataEndIt, previous);
+  file.Advance(buffer);
+  return writeRange<Opaque>(file, DataIterator, DataEndIt, SeenPixels, previous);
+}
+
+// Near-lossless encoding (EncodeOptions::maxError). Every pixel is replaced by the cheapest pixel within Tolerance of
+// it in every channel that the decoder reaches from its previous pixel: the previous pixel itself (RUN), an index
+// entry (INDEX) or one DIFF / LUMA step. previous and the index hold what the decoder reconstructs, not the input, so
+// no pixel is ever off by more than Tolerance and the errors don't add up along the image
+
+// The 4 channels of a packed pixel in 16 bit lanes
+static inline uint64_t SpreadChannels(const p_color Packed) {
+  uint64_t lanes{Packed};
+  lanes = (lanes | lanes << 16) & 0x0000FFFF0000FFFFull;
+  return (lanes | lanes << 8) & 0x00FF00FF00FF00FFull;
+}
+
+// Every channel of a within Tolerance of b. All 4 channels at once without a branch, on noisy images the outcome is
+// random and a branch per channel costs more than the arithmetic
+static inline bool Within(const Pixel a, const Pixel b, const int Tolerance) {
+  constexpr uint64_t ones{0x0001000100010001ull}, signs{0x8000800080008000ull};
+  const auto t{static_cast<uint64_t>(Tolerance)};
+  // each lane is a - b + 0x100 + Tolerance, which lies in [0x100, 0x100 + 2 * Tolerance] exactly if a is within
+  const uint64_t lanes{SpreadChannels(a.packed) + (0x100 + t) * ones - SpreadChannels(b.packed)};
+  const uint64_t atLeast{lanes + (0x8000 - 0x100) * ones}, atMost{lanes + (0x8000 - 0x101 - 2 * t) * ones};
+  return (atLeast & ~atMost & signs) == signs;
+}
+
+// Difference like the decoder sees it, channels wrap around
+static inline int WrappedDelta(const color current, const color previous) {
+  return static_cast<int8_t>(static_cast<uint8_t>(current - previous));
+}
+
+// Pixel within Tolerance of current a DIFF chunk reaches from previous, false if there is none. Alpha has to be
+// within Tolerance of previous (DIFF keeps it)
+static inline bool SnapDiff(const Pixel current, const Pixel previous, const int Tolerance, Pixel &snapped) {
+  const int dR{WrappedDelta(current.R(), previous.R())}, dG{WrappedDelta(current.G(), previous.G())},
+      dB{WrappedDelta(current.B(), previous.B())};
+  snapped = Pixel{static_cast<color>(previous.R() + std::clamp(dR, -2, 1)),
+                  static_cast<color>(previous.G() + std::clamp(dG, -2, 1)),
+                  static_cast<color>(previous.B() + std::clamp(dB, -2, 1)), previous.A()};
+  // a clamped step near 0 or 255 can wrap to the other end, so the error is measured on the result
+  return Within(snapped, current, Tolerance);
+}
+
+// Pixel within Tolerance of current a LUMA chunk reaches from previous, false if there is none. Picks the green step
+// closest to the real one that keeps red and blue within reach (dr and db are relative to the green step)
+static inline bool SnapLuma(const Pixel current, const Pixel previous, const int Tolerance, Pixel &snapped) {
+  const int dR{WrappedDelta(current.R(), previous.R())}, dG{WrappedDelta(current.G(), previous.G())},
+      dB{WrappedDelta(current.B(), previous.B())};
+  const int low{std::max({dG - Tolerance, -32, dR - Tolerance - 7, dB - Tolerance - 7})};
+  const int high{std::min({dG + Tolerance, 31, dR + Tolerance + 8, dB + Tolerance + 8})};
+  if (low > high) return false;
+  const int dg{std::clamp(dG, low, high)};
+  snapped = Pixel{static_cast<color>(previous.R() + dg + std::clamp(dR - dg, -8, 7)),
+                  static_cast<color>(previous.G() + dg),
+                  static_cast<color>(previous.B() + dg + std::clamp(dB - dg, -8, 7)), previous.A()};
+  return Within(snapped, current, Tolerance);
+}
+
+// Index slot holding a pixel within Tolerance of current, -1 if there is none. Slots still holding the initial
+// (0, 0, 0, 0) outside their own hash position are skipped, decoders differ in when they overwrite those
+static inline int FindIndexEntry(const ColorIndex &SeenPixels, const Pixel current, const int Tolerance) {
+  const size_t size{SeenPixels.size()};
+  for (size_t slot{0}; slot < size; ++slot) {
+    slot += simd::FindWithin(SeenPixels.data() + slot, size - slot, current, static_cast<uint8_t>(Tolerance));
+    if (slot < size && IndexPos(SeenPixels[slot]) == slot) return static_cast<int>(slot);
+  }
+  return -1;
+}
+
+// Near-lossless counterpart of WriteToBuffer, previous and SeenPixels are the decoder's state. Fast only searches the
+// index for pixels DIFF and LUMA can't reach (see EncodeOptions::nearFast)
+template <bool Fast>
+static inline void WriteToBufferNear(std::byte *&buffer, const Pixel *&DataIterator, ColorIndex &SeenPixels,
+                                     const Pixel *const DataEndIt, Pixel &previous, const int Tolerance) {
+  if (Within(*DataIterator, previous, Tolerance)) { // RUN
+    const Pixel *const runEnd{DataIterator + std::min<ptrdiff_t>(62, DataEndIt - DataIterator)};
+    const Pixel *const runBegin{DataIterator};
+    while (DataIterator < runEnd && Within(*DataIterator, previous, Tolerance)) ++DataIterator;
+    const uint8_t runMarker{static_cast<uint8_t>((DataIterator - runBegin - 1) | 0xC0)};
+    std::memcpy(buffer, &runMarker, sizeof(runMarker));
+    ++buffer;
+    return;
+  }
+  const Pixel current{*DataIterator++};
+
+  uint8_t indexPos{IndexPos(current)};
+  if (SeenPixels[indexPos] == current) { // INDEX, exact
+    std::memcpy(buffer, &indexPos, sizeof(indexPos));
+    ++buffer;
+    previous = current;
+    return;
+  }
+
+  // smallest chunk first. DIFF goes before the index search because it is cheaper to check. The search scans all 64
+  // slots, Fast saves it for the pixels that would need RGB / RGBA otherwise
+  Pixel snapped{current};
+  const bool sameAlpha{std::abs(current.A() - previous.A()) <= Tolerance};
+  if (sameAlpha && SnapDiff(current, previous, Tolerance, snapped)) {
+    WriteDiff(buffer, snapped, previous);
+  } else if (Fast && sameAlpha && SnapLuma(current, previous, Tolerance, snapped)) {
+    WriteLuma(buffer, snapped, previous);
+  } else if (const int slot{FindIndexEntry(SeenPixels, current, Tolerance)}; slot >= 0) {
+    indexPos = static_cast<uint8_t>(slot);
+    std::memcpy(buffer, &indexPos, sizeof(indexPos));
+    ++buffer;
+    previous = SeenPixels[indexPos];
+    return;
+  } else if (!Fast && sameAlpha && SnapLuma(current, previous, Tolerance, snapped)) {
+    WriteLuma(buffer, snapped, previous);
+  } else if (sameAlpha) {
+    snapped = Pixel{current.R(), current.G(), current.B(), previous.A()};
+    WriteRGB(buffer, snapped);
+  } else WriteRGBA(buffer, current);
+  SeenPixels[IndexPos(snapped)] = snapped;
+  previous = snapped;
+}
+
+// Near-lossless counterpart of writeData, always serial
+template <bool Fast> static inline bool writeDataNear(Sink &file, const Image &image, const int Tolerance) {
+  const Pixel *DataIterator{image.GetData().data()};
+  const Pixel *const DataEndIt{DataIterator + image.GetData().size()};
+  ColorIndex SeenPixels{EmptyIndex()};
+  Pixel previous{0, 0, 0, 255};
+  while (DataIterator < DataEndIt) {
+    if (!file.Reserve(MaxChunkSize)) return false;
+    std::byte *buffer{file.Pos()};
+    const size_t batch{std::min<size_t>(file.Available() / MaxChunkSize, DataEndIt - DataIterator)};
+    const Pixel *const BatchEnd{DataIterator + batch};
+    while (DataIterator < BatchEnd)
+      WriteToBufferNear<Fast>(buffer, DataIterator, SeenPixels, DataEndIt, previous, Tolerance);
+    file.Advance(buffer);
+  }
+  return true;
+}
+
+// Writes the open run as RUN chunks of at most 62 pixels
+static inline bool writeOpenRun(Sink &file, RowState &State) {
+  while (State.run) {
+    const size_t length{std::min<size_t>(State.run, 62)};
+    const uint8_t runMarker{static_cast<uint8_t>((length - 1) | 0xC0)};
+    if (!file.Write(&runMarker, sizeof(runMarker))) return false;
+    State.run -= length;
+  }
+  return true;
+}
+
+// Encodes the next pixels of the image [DataIterator, DataEndIt), usually a row. Pixels of earlier pieces are never
+// read, only State
+static inline bool writeRow(Sink &file, RowState &State, const Pixel *DataIterator, const Pixel *const DataEndIt) {
+  // the open run continues as long as the row starts with the previous pixel
+  const size_t leading{simd::RunLength(DataIterator, DataEndIt, State.previous)};
+  State.run += leading;
+  DataIterator += leading;
+  if (DataIterator == DataEndIt) return true;
+  if (!writeOpenRun(file, State)) return false;
+
+  // the pixels equal to the last one at the end of the piece start a run that may go on in the next one, so everything
+  // after the first of them is left open. The first one differs from its predecessor and is encoded here
+  const Pixel *stop{DataEndIt - 1};
+  while (stop > DataIterator && stop[-1] == *stop) --stop;
+  ++stop;
+
+  // DataIterator differs from previous, so WriteToBuffer doesn't start a run that would read the previous row
+  if (!file.Reserve(MaxChunkSize)) return false;
+  std::byte *buffer{file.Pos()};
+  WriteToBuffer(buffer, DataIterator, State.index, stop, State.previous);
+  file.Advance(buffer);
+  if (!writeRange(file, DataIterator, stop, State.index, State.previous)) return false;
+  State.run = static_cast<size_t>(DataEndIt - stop);
+  return true;
+}
+
+// Index for a band that doesn't know what the decoder's index holds. A lookup only hits when the slot holds the
+// pixel itself, so zeroed slots can only produce false hits for (0, 0, 0, 0) in slot 0. Slot 0 therefore gets a
+// pixel hashing elsewhere, and no slot can hit before the band wrote it.
+static inline ColorIndex BandIndex() {
+  ColorIndex index{EmptyIndex()};
+  index[0] = Pixel{1, 0, 0, 0};
+  return index;
+}
+
+// Writes the first pixel of a band as OP_RGBA (OP_RGB is enough when the decoder's previous alpha is 255 anyway)
+template <bool Opaque> static inline void WriteBandStart(std::byte *&buffer, const Pixel first) {
+  if constexpr (Opaque) WriteRGB(buffer, first);
+  else WriteRGBA(buffer, first);
+}
+
+// Encodes [begin, end) independently from the pixels before it. The first pixel is written in full to resync the
+// previous pixel, so the bands can be encoded in any order and concatenated into a standard qoi stream.
+template <bool Opaque = false>
+static inline void writeBand(std::vector<std::byte> &buffer, const Pixel *begin, const Pixel *const end) {
+  buffer.resize(static_cast<size_t>(end - begin) * MaxChunkSize);
+  ColorIndex SeenPixels{BandIndex()};
+  Pixel previous{*begin};
+  SeenPixels[IndexPos(previous)] = previous;
+  std::byte *out{buffer.data()};
+  WriteBandStart<Opaque>(out, previous);
+
+  ++begin;
+  WritePixels<Opaque>(out, begin, end, end, SeenPixels, previous);
+  buffer.resize(static_cast<size_t>(out - buffer.data()));
+}
+
+// Restart points are stored after the end marker, so standard decoders never see them:
+//   per point: byte offset (8), pixel offset (8), previous pixel (4, R G B A)
+//   point count (4), "qoiR"
+// all integers are big endian like the header
+static inline constexpr size_t RestartEntrySize{20};
+static inline constexpr size_t RestartFooterSize{8};
+static inline constexpr std::array<char, 4> RestartMagic{'q', 'o', 'i', 'R'};
+
+static inline RestartPoint MakeRestartPoint(const Image &image, const size_t PixelOffset, const size_t ByteOffset) {
+  return {ByteOffset, PixelOffset, PixelOffset ? image.GetData()[PixelOffset - 1] : Pixel{0, 0, 0, 255}};
+}
+
+// Serial counterpart of writeDataParallel for files with restart points, each band starts like in writeBand but is
+// encoded straight into the sink
+template <bool Opaque = false>
+static inline bool writeDataBands(Sink &file, const Image &image, const size_t bandPixels,
+                                  std::vector<RestartPoint> &Restarts) {
+  const Pixel *const begin{image.GetData().data()};
+  const size_t ImageSize{image.GetData().size()};
+  for (size_t start{0}; start < ImageSize; start += bandPixels) {
+    Restarts.push_back(MakeRestartPoint(image, start, file.Written()));
+    if (!file.Reserve(MaxChunkSize)) return false;
+    ColorIndex SeenPixels{BandIndex()};
+    Pixel previous{begin[start]};
+    SeenPixels[IndexPos(previous)] = previous;
+    std::byte *buffer{file.Pos()};
+    WriteBandStart<Opaque>(buffer, previous);
+    file.Advance(buffer);
+    const Pixel *const bandEnd{begin + std::min(ImageSize, start + bandPixels)};
+    if (!writeRange<Opaque>(file, begin + start + 1, bandEnd, SeenPixels, previous)) return false;
+  }
+  return true;
+}
+
+// Splits the image into bands of rows which worker threads encode into their own buffers, then writes the buffers
+// in order. Every band start is added to Restarts if it isn't null. Bands holds the band buffers if it isn't null, so
+// they can be reused by the next call
+template <bool Opaque = false>
+static inline bool writeDataParallel(Sink &file, const Image &image, const EncodeOptions &Options,
+                                     std::vector<RestartPoint> *Restarts = nullptr,
+                                     std::vector<std::vector<std::byte>> *Bands = nullptr) {
+  const unsigned threads{Options.threads ? Options.threads : std::max(1u, std::thread::hardware_concurrency())};
+  // a few bands per thread so uneven bands still keep every thread busy
+  const size_t targetBands{size_t{threads} * 4};
+  const ui autoRows{static_cast<ui>(std::max<size_t>(16, (image.getHeight() + targetBands - 1) / targetBands))};
+  const ui bandRows{Options.restartRows ? Options.restartRows : Options.bandRows ? Options.bandRows : autoRows};
+  const size_t bandPixels{static_cast<size_t>(bandRows) * image.getWidth()};
+  const size_t ImageSize{image.GetData().size()};
+  if (ImageSize == 0) return true;
+  const size_t bandCount{(ImageSize + bandPixels - 1) / bandPixels};
+
+  std::vector<std::vector<std::byte>> ownBands;
+  std::vector<std::vector<std::byte>> &bands{Bands ? *Bands : ownBands};
+  if (bands.size() < bandCount) bands.resize(bandCount);
+  std::atomic<size_t> nextBand{0};
+  auto worker = [&]() {
+    for (size_t band{nextBand++}; band < bandCount; band = nextBand++) {
+      const Pixel *const begin{image.GetData().data()};
+      writeBand<Opaque>(bands[band], begin + band * bandPixels, begin + std::min(ImageSize, (band + 1) * bandPixels));
+    }
+  };
+  {
+    std::vector<std::jthread> workers;
+    for (unsigned i{1}; i < std::min<size_t>(threads, bandCount); ++i) workers.emplace_back(worker);
+    worker();
+  }
+
+  for (size_t band{0}; band < bandCount; ++band) {
+    if (Restarts) Restarts->push_back(MakeRestartPoint(image, band * bandPixels, file.Written()));
+    if (!file.Write(bands[band].data(), bands[band].size())) return false;
+  }
+  return true;
+}
+
+static inline bool writeRestarts(Sink &file, const std::vector<RestartPoint> &Restarts) {
+  for (const RestartPoint &point : Restarts) {
+    std::array<uint8_t, RestartEntrySize> entry;
+    for (size_t i{0}; i < 8; ++i) {
+      entry[i] = static_cast<uint8_t>(point.byteOffset >> (56 - i * 8));
+      entry[8 + i] = static_cast<uint8_t>(point.pixelOffset >> (56 - i * 8));
+    }
+    entry[16] = point.previous.R();
+    entry[17] = point.previous.G();
+    entry[18] = point.previous.B();
+    entry[19] = point.previous.A();
+    if (!file.Write(entry.data(), entry.size())) return false;
+  }
+  const uint32_t count{static_cast<uint32_t>(Restarts.size())};
+  const std::array<uint8_t, 4> countBytes{static_cast<uint8_t>(count >> 24), static_cast<uint8_t>(count >> 16),
+                                          static_cast<uint8_t>(count >> 8), static_cast<uint8_t>(count)};
+  return file.Write(countBytes.data(), countBytes.size()) && file.Write(RestartMagic.data(), RestartMagic.size());
+}
+
+static inline constexpr size_t HeaderSize{14};
+static inline constexpr size_t TrailSize{8};
+
+static inline constexpr uint32_t readBE32(const uint8_t *bytes) {
+  return static_cast<uint32_t>(bytes[0]) << 24 | static_cast<uint32_t>(bytes[1]) << 16 |
+         static_cast<uint32_t>(bytes[2]) << 8 | static_cast<uint32_t>(bytes[3]);
+}
+
+// Decodes the chunk stream [in, end) into out. end points at the end marker (or at a later chunk), so reading up to 4
+// bytes past it (the payload of OP_RGB/OP_RGBA) is always inside the data. Returns false if the stream ends too early.
+// previous is the decoder state to start from, the index always starts out empty
+static inline bool readData(const uint8_t *in, const uint8_t *const end, Pixel *out, const size_t pixelCount,
+                            const Pixel previous = Pixel{0, 0, 0, 255}) {
+  ColorIndex index{EmptyIndex()};
+  uint8_t r{previous.R()}, g{previous.G()}, b{previous.B()}, a{previous.A()};
+  Pixel px{previous};
+  const Pixel *const outEnd{out + pixelCount};
+
+  while (out < outEnd) {
+    if (in >= end) return false;
+    const uint8_t op{*in++};
+    if (op < 0x40) { // INDEX
+      px = index[op];
+      r = px.R();
+      g = px.G();
+      b = px.B();
+      a = px.A();
+      *out++ = px;
+      continue;
+    }
+    if (op < 0x80) { // DIFF
+      r += ((op >> 4) & 0x03) - 2;
+      g += ((op >> 2) & 0x03) - 2;
+      b += (op & 0x03) - 2;
+    } else if (op < 0xC0) { // LUMA
+      const int dg{(op & 0x3F) - 32};
+      const uint8_t drdb{*in++};
+      r += dg - 8 + (drdb >> 4);
+      g += dg;
+      b += dg - 8 + (drdb & 0x0F);
+    } else if (op < 0xFE) { // RUN, the pixel is already in the index
+      const size_t run{std::min<size_t>((op & 0x3F) + 1, static_cast<size_t>(outEnd - out))};
+      out = std::fill_n(out, run, px);
+      continue;
+    } else if (op == 0xFE) { // RGB
+      r = in[0];
+      g = in[1];
+      b = in[2];
+      in += 3;
+    } else { // RGBA
+      r = in[0];
+      g = in[1];
+      b = in[2];
+      a = in[3];
+      in += 4;
+    }
+    px = Pixel{r, g, b, a};
+    index[IndexPos(px)] = px;
+    *out++ = px;
+  }
+  return true;
+}
+
+static inline constexpr uint64_t readBE64(const uint8_t *bytes) {
+  return static_cast<uint64_t>(readBE32(bytes)) << 32 | readBE32(bytes + 4);
+}
+
+// Reads the restart points at the end of data. Returns an empty vector if there are none or they don't describe a
+// usable split of the pixelCount pixels, the file then simply gets decoded serially
+static inline std::vector<RestartPoint> readRestarts(const std::span<const std::byte> data, const size_t pixelCount) {
+  const auto *bytes{reinterpret_cast<const uint8_t *>(data.data())};
+  if (data.size() < HeaderSize + TrailSize + RestartFooterSize) return {};
+  const uint8_t *const footer{bytes + data.size() - RestartFooterSize};
+  if (std::memcmp(footer + 4, RestartMagic.data(), RestartMagic.size()) != 0) return {};
+
+  const size_t count{readBE32(footer)};
+  if (count == 0 || count > (data.size() - HeaderSize - TrailSize - RestartFooterSize) / RestartEntrySize) return {};
+  const uint8_t *const entries{footer - count * RestartEntrySize};
+  // the chunk has to directly follow the end marker
+  static constexpr std::array<uint8_t, TrailSize> endMarker{0, 0, 0, 0, 0, 0, 0, 1};
+  if (std::memcmp(entries - TrailSize, endMarker.data(), TrailSize) != 0) return {};
+
+  std::vector<RestartPoint> restarts(count);
+  const uint64_t streamEnd{static_cast<uint64_t>(entries - TrailSize - bytes)};
+  for (size_t i{0}; i < count; ++i) {
+    const uint8_t *const entry{entries + i * RestartEntrySize};
+    restarts[i] = {readBE64(entry), readBE64(entry + 8), Pixel{entry[16], entry[17], entry[18], entry[19]}};
+    const bool first{i == 0};
+    if (restarts[i].byteOffset < HeaderSize || restarts[i].byteOffset >= streamEnd ||
+        restarts[i].pixelOffset >= pixelCount || (first && restarts[i].pixelOffset != 0) ||
+        (!first && (restarts[i].byteOffset <= restarts[i - 1].byteOffset ||
+                    restarts[i].pixelOffset <= restarts[i - 1].pixelOffset)))
+      return {};
+  }
+  return restarts;
+}
+
+// Decodes the pieces between restart points on up to Threads threads
+static inline bool readDataParallel(const uint8_t *bytes, const uint8_t *const end, Pixel *out,
+                                    const size_t pixelCount, const std::vector<RestartPoint> &Restarts,
+                                    const unsigned Threads) {
+  std::atomic<size_t> nextPiece{0};
+  std::atomic<bool> failed{false};
+  auto worker = [&]() {
+    for (size_t piece{nextPiece++}; piece < Restarts.size(); piece = nextPiece++) {
+      const RestartPoint &point{Restarts[piece]};
+      const bool last{piece + 1 == Restarts.size()};
+      const uint8_t *const pieceEnd{last ? end : bytes + Restarts[piece + 1].byteOffset};
+      const size_t pieceEndPixel{last ? pixelCount : Restarts[piece + 1].pixelOffset};
+      if (!readData(bytes + point.byteOffset, pieceEnd, out + point.pixelOffset, pieceEndPixel - point.pixelOffset,
+                    point.previous))
+        failed = true;
+    }
+  };
+  {
+    std::vector<std::jthread> workers;
+    for (unsigned i{1}; i < std::min<size_t>(Threads, Restarts.size()); ++i) workers.emplace_back(worker);
+    worker();
+  }
+  return !failed;
+}
+
+} // namespace
+
+// Reads and checks the header of a qoi file held in memory. Throws std::runtime_error like Decode
+inline Dimensions PeekSize(const std::span<const std::byte> data) {
+  if (data.size() < HeaderSize + TrailSize) throw std::runtime_error("QOI data is too small");
+  const auto *bytes{reinterpret_cast<const uint8_t *>(data.data())};
+  if (std::memcmp(bytes, "qoif", 4) != 0) throw std::runtime_error("QOI magic number missing");
+
+  const ui width{readBE32(bytes + 4)};
+  const ui height{readBE32(bytes + 8)};
+  const uint8_t channels{bytes[12]};
+  const uint8_t colorspace{bytes[13]};
+  if (width == 0 || height == 0 || channels < 3 || channels > 4 || colorspace > 1)
+    throw std::runtime_error("Invalid QOI header");
+
+  // a single byte encodes at most 62 pixels (RUN), anything above can't be valid
+  if (static_cast<size_t>(width) * height > (data.size() - HeaderSize - TrailSize) * 62)
+    throw std::runtime_error("QOI data is truncated");
+  return {width, height};
+}
+
+// Decodes a complete qoi file held in memory into image, which needs the size from PeekSize (std::invalid_argument
+// otherwise). With an Image::Wrap over a reused buffer no pixel memory gets allocated. Throws std::runtime_error on
+// malformed data, image may be partly overwritten then
+inline void DecodeInto(const std::span<const std::byte> data, Image &image, const DecodeOptions &Options = {}) {
+  const Dimensions size{PeekSize(data)};
+  if (image.getWidth() != size.width || image.getHeight() != size.height)
+    throw std::invalid_argument("Image size differs from the QOI header");
+  const auto *bytes{reinterpret_cast<const uint8_t *>(data.data())};
+  const size_t pixelCount{image.GetData().size()};
+  const unsigned threads{Options.threads ? Options.threads : std::max(1u, std::thread::hardware_concurrency())};
+  const std::vector<RestartPoint> restarts{threads > 1 ? readRestarts(data, pixelCount)
+                                                       : std::vector<RestartPoint>{}};
+  if (restarts.size() > 1) {
+    const uint8_t *const end{bytes + data.size() - RestartFooterSize - restarts.size() * RestartEntrySize - TrailSize};
+    if (!readDataParallel(bytes, end, image.GetData().data(), pixelCount, restarts, threads))
+      throw std::runtime_error("QOI data is truncated");
+    return;
+  }
+  if (!readData(bytes + HeaderSize, bytes + data.size() - TrailSize, image.GetData().data(), pixelCount))
+    throw std::runtime_error("QOI data is truncated");
+}
+
+// Decodes a complete qoi file held in memory. Throws std::runtime_error on malformed data. Files with restart points
+// (EncodeOptions::restartRows) are decoded on Options.threads threads
+inline Image Decode(const std::span<const std::byte> data, const DecodeOptions &Options = {}) {
+  const Dimensions size{PeekSize(data)};
+  Image image{size.width, size.height, Image::Uninitialized{}};
+  DecodeInto(data, image, Options);
+  return image;
+}
+
+// Decodes a qoi file from a stream (reads until end of stream)
+inline Image Decode(std::istream &stream, const DecodeOptions &Options = {}) {
+  const std::vector<char> data{std::istreambuf_iterator<char>{stream}, std::istreambuf_iterator<char>{}};
+  return Decode(std::as_bytes(std::span{data}), Options);
+}
+
+// Loads a qoi file. ".qoi" is appended if FilePath does not end with it (same as GenerateFile)
+inline Image LoadFile(const strv FilePath, const DecodeOptions &Options = {}) {
+  std::ifstream file{FilePath.ends_with(".qoi") ? std::string(FilePath) : std::string(FilePath) + ".qoi",
+                     std::ios::binary | std::ios::in};
+  if (!file) throw std::runtime_error("Could not open QOI file");
+  return Decode(file, Options);
+}
+
+// Pixel data of Encode, collects the restart points into Restarts if Options asks for them. Bands are the band buffers
+// of the parallel encoder, see writeDataParallel
+template <bool Opaque>
+static inline bool writeImageData(Sink &sink, const Image &image, const EncodeOptions &Options,
+                                  std::vector<RestartPoint> &Restarts,
+                                  std::vector<std::vector<std::byte>> *Bands = nullptr) {
+  if (Options.maxError)
+    return Options.nearFast ? writeDataNear<true>(sink, image, Options.maxError)
+                            : writeDataNear<false>(sink, image, Options.maxError);
+  if (!Options.restartRows)
+    return Options.threads == 1 ? writeData<Opaque>(sink, image)
+                                : writeDataParallel<Opaque>(sink, image, Options, nullptr, Bands);
+
+  const size_t bandPixels{static_cast<size_t>(Options.restartRows) * image.getWidth()};
+  return Options.threads == 1 ? writeDataBands<Opaque>(sink, image, bandPixels, Restarts)
+                              : writeDataParallel<Opaque>(sink, image, Options, &Restarts, Bands);
+}
+
+// Everything of Encode after the pixel data
+static inline bool writeImageEnd(Sink &sink, const EncodeOptions &Options, const std::vector<RestartPoint> &Restarts) {
+  return writeTrail(sink) && (!Options.restartRows || Options.maxError || writeRestarts(sink, Restarts)) &&
+         sink.Flush();
+}
+
+#if defined(QOID_ENCODER_STATS)
+// Buffer in front of the sink of an Encode with EncodeStats, counts the chunks of everything passing through before
+// handing it on. A chunk may be split over two drains, its remaining bytes are skipped at the start of the next one
+class StatsSink : public BufferedSink {
+public:
+  StatsSink(Sink &Target, EncodeStats &Stats) : m_target{Target}, m_stats{Stats}, m_pixels{Stats.pixels} {}
+
+  bool Flush() override { return BufferedSink::Flush() && m_target.Flush(); }
+
+protected:
+  // a full buffer only drains into the target, which is flushed once at the end (writeImageEnd). Flushing it on every
+  // drain would e.g. shrink a VectorSink each time, which then grows and zero fills again (quadratic)
+  bool Overflow(const size_t Size) override { return Size <= BufferSize ? BufferedSink::Flush() : Fail(ENOBUFS); }
+
+  bool Drain(const std::byte *Data, const size_t Size) override {
+    Count(reinterpret_cast<const uint8_t *>(Data), Size);
+    return m_target.Write(Data, Size);
+  }
+
+private:
+  inline void Count(const uint8_t *bytes, const size_t Size) {
+    size_t i{m_skip};
+    // the end marker and restart points follow the last pixel
+    while (i < Size && m_pixels) {
+      const uint8_t op{bytes[i]};
+      size_t chunk{1}, pixels{1};
+      if (op < 0x40) { // INDEX
+        ++m_stats.index;
+      } else if (op < 0x80) { // DIFF
+        ++m_stats.diff;
+      } else if (op < 0xC0) { // LUMA
+        ++m_stats.luma;
+        chunk = 2;
+      } else if (op < 0xFE) { // RUN
+        pixels = (op & 0x3F) + 1;
+        ++m_stats.run;
+        ++m_stats.runLengths[pixels - 1];
+      } else if (op == 0xFE) { // RGB
+        ++m_stats.rgb;
+        chunk = 4;
+      } else { // RGBA
+        ++m_stats.rgba;
+        chunk = 5;
+      }
+      m_pixels -= std::min(pixels, m_pixels);
+      i += chunk;
+    }
+    m_skip = i > Size ? i - Size : 0;
+  }
+
+  Sink &m_target;
+  EncodeStats &m_stats;
+  size_t m_skip{HeaderSize};
+  uint64_t m_pixels;
+};
+#endif
+
+// Encode with the scratch memory of the caller: Restarts (emptied first) and Bands, see writeImageData
+static inline bool encodeImage(const Image &image, Sink &sink, const EncodeOptions &Options,
+                               std::vector<RestartPoint> &Restarts,
+                               std::vector<std::vector<std::byte>> *Bands = nullptr) {
+  const bool opaque{simd::AllOpaque(image.GetData().data(), image.GetData().size())};
+  if (!writeHeader(sink, image.getWidth(), image.getHeight(), opaque ? 3 : 4)) return false;
+  Restarts.clear();
+  if (!(opaque ? writeImageData<true>(sink, image, Options, Restarts, Bands)
+               : writeImageData<false>(sink, image, Options, Restarts, Bands)))
+    return false;
+  return writeImageEnd(sink, Options, Restarts);
+}
+
+// Encodes image into sink (e.g. a StreamSink or FdSink) and flushes it. The serial encoder only ever holds the
+// sink's buffer, the parallel one additionally holds the encoded bands. Fully opaque images (one simd::AllOpaque scan)
+// get a 3 channel header and an encoder without alpha checks
+inline bool Encode(const Image &image, Sink &sink, const EncodeOptions &Options = {}) {
+  std::vector<RestartPoint> restarts;
+  return encodeImage(image, sink, Options, restarts);
+}
+
+// Encode that also fills Stats (see EncodeStats). With QOID_ENCODER_STATS the output takes a detour through one more
+// buffer where the chunks get counted, plain Encode calls are never affected
+inline bool Encode(const Image &image, Sink &sink, const EncodeOptions &Options, EncodeStats &Stats) {
+  using Clock = std::chrono::steady_clock;
+  Stats = {};
+  Stats.pixels = image.GetData().size();
+  const size_t start{sink.Written()};
+#if defined(QOID_ENCODER_STATS)
+  StatsSink counter{sink, Stats};
+  Sink &out{counter};
+  Stats.counted = true;
+#else
+  Sink &out{sink};
+#endif
+  Clock::time_point begin{Clock::now()};
+  const auto lap{[&begin](double &Seconds) {
+    const Clock::time_point now{Clock::now()};
+    Seconds = std::chrono::duration<double>(now - begin).count();
+    begin = now;
+  }};
+
+  const bool opaque{simd::AllOpaque(image.GetData().data(), image.GetData().size())};
+  if (!writeHeader(out, image.getWidth(), image.getHeight(), opaque ? 3 : 4)) return false;
+  lap(Stats.headerSeconds);
+  std::vector<RestartPoint> restarts;
+  if (!(opaque ? writeImageData<true>(out, image, Options, restarts)
+               : writeImageData<false>(out, image, Options, restarts)))
+    return false;
+  lap(Stats.encodeSeconds);
+  if (!writeImageEnd(out, Options, restarts)) return false;
+  lap(Stats.flushSeconds);
+  Stats.bytes = sink.Written() - start;
+  return true;
+}
+
+// Encodes an image that is handed over piece by piece while it is produced (e.g. scanlines of a renderer), so only the
+// sink's buffer and the current piece have to be in memory. Index, previous pixel and an open run are kept between
+// calls and the output is the same as Encode with one thread, given the channels Encode picks (3 if every pixel is
+// opaque, otherwise 4):
+//   StreamEncoder encoder{sink};
+//   encoder.BeginImage(w, h, channels);
+//   for (...) encoder.PushRows(row);
+//   encoder.Finish();
+// After a failed call (sink error or misuse) every following call fails until the next BeginImage
+class StreamEncoder {
+public:
+  // sink has to outlive the encoder
+  explicit StreamEncoder(Sink &sink) : m_sink{sink} {}
+
+  // Starts a width x height image and writes its header. The pixels aren't known yet, so the caller tells the channels
+  // of the header (see writeHeader, 3 only if every pixel will be opaque). An unfinished image is dropped
+  inline bool BeginImage(const ui width, const ui height, const uint8_t channels = 4) {
+    m_state = {};
+    m_remaining = static_cast<size_t>(width) * height;
+    m_open = writeHeader(m_sink, width, height, channels);
+    return m_open;
+  }
+
+  // Encodes the next pixels in row order. Any amount works (a row, several rows, part of a row), but pushing more
+  // than width * height pixels in total fails
+  inline bool PushRows(const std::span<const Pixel> Pixels) {
+    if (!m_open || Pixels.size() > m_remaining) return m_open = false;
+    m_remaining -= Pixels.size();
+    return m_open = writeRow(m_sink, m_state, Pixels.data(), Pixels.data() + Pixels.size());
+  }
+
+  // Writes the open run and the end marker and flushes the sink. Fails if pixels are missing
+  inline bool Finish() {
+    const bool done{m_open && m_remaining == 0 && writeOpenRun(m_sink, m_state) && writeTrail(m_sink) &&
+                    m_sink.Flush()};
+    m_open = false;
+    return done;
+  }
+
+  // Pixels still expected by the current image
+  inline size_t Remaining() const { return m_remaining; }
+
+private:
+  Sink &m_sink;
+  RowState m_state;
+  size_t m_remaining{0};
+  bool m_open{false};
+};
+
+// Encodes a width x height image row by row into sink and flushes it. Rows supplies one row at a time (see
+// RowProvider), so the image never has to be in memory as a whole. The output is the same as Encode with one thread
+// if channels is the one Encode writes (see StreamEncoder). Returns false if Rows aborts
+inline bool EncodeRows(const ui width, const ui height, const RowProvider &Rows, Sink &sink,
+                       const uint8_t channels = 4) {
+  StreamEncoder encoder{sink};
+  if (!encoder.BeginImage(width, height, channels)) return false;
+  for (ui y{0}; y < height; ++y) {
+    const std::span<const Pixel> row{Rows(y)};
+    if (row.size() != width || !encoder.PushRows(row)) return false;
+  }
+  return encoder.Finish();
+}
+
+// Encodes the pixels a coroutine co_yields (see RowGenerator) into sink and flushes it. The coroutine runs up to its
+// next co_yield whenever the encoder is done with the previous piece, so producing and encoding interleave. Fails if
+// it yields more or fewer than width * height pixels. channels like in the other EncodeRows
+inline bool EncodeRows(const ui width, const ui height, RowGenerator Rows, Sink &sink, const uint8_t channels = 4) {
+  StreamEncoder encoder{sink};
+  if (!encoder.BeginImage(width, height, channels)) return false;
+  for (const std::span<const Pixel> pixels : Rows)
+    if (!encoder.PushRows(pixels)) return false;
+  return encoder.Finish();
+}
+
+// Upper bound of the encoded size, a span of this size always fits the encoded image
+inline size_t MaxEncodedSize(const Image &image, const EncodeOptions &Options = {}) {
+  const size_t restarts{
+      Options.restartRows ? (size_t{image.getHeight()} + Options.restartRows - 1) / Options.restartRows : 0};
+  const size_t restartSize{restarts ? restarts * RestartEntrySize + RestartFooterSize : 0};
+  return HeaderSize + image.GetData().size() * MaxChunkSize + TrailSize + restartSize;
+}
+
+// Encodes image directly into Buffer. Returns the encoded size, or 0 if Buffer is too small (see MaxEncodedSize)
+inline size_t EncodeToBuffer(const Image &image, const std::span<std::byte> Buffer, const EncodeOptions &Options = {}) {
+  SpanSink sink{Buffer};
+  return Encode(image, sink, Options) ? sink.Written() : 0;
+}
+
+// Appends the encoded image to Buffer. Returns the amount of bytes appended
+inline size_t EncodeToBuffer(const Image &image, std::vector<std::byte> &Buffer, const EncodeOptions &Options = {}) {
+  VectorSink sink{Buffer, image.GetData().size()};
+  return Encode(image, sink, Options) ? sink.Written() : 0;
+}
+
+// Encodes Pixels independently of every pixel before them into Buffer (replacing its contents, the capacity is kept),
+// like the parallel encoder encodes its bands. A header (writeHeader), the bands of an image in order and the end
+// marker (writeTrail) make up a standard qoi file, so callers can spread one image over threads of their own
+inline void EncodeBand(const std::span<const Pixel> Pixels, std::vector<std::byte> &Buffer) {
+  if (Pixels.empty()) return Buffer.clear();
+  writeBand(Buffer, Pixels.data(), Pixels.data() + Pixels.size());
+}
+
+// Encodes an image that stays around and changes a little between encodes (a window, a canvas). The image is split
+// into bands of BandRows rows, encoded like the bands of the parallel encoder (writeBand: no state carried over from
+// the band before, so any band can be replaced on its own). The bytes of every band are kept and an encode only
+// re-encodes the bands with rows changed since its last encode (Image::ChangedSince) before writing header, bands and
+// end marker. Every encoder keeps its own view of the changes, any number of them can share an image:
+//   qoi::IncrementalEncoder encoder;
+//   for (...) { window.FillRect(...); encoder.Encode(window, sink); }
+// The output is a standard qoi file, slightly larger than from Encode because every band starts cold
+class IncrementalEncoder {
+public:
+  explicit IncrementalEncoder(const ui BandRows = 16) : m_bandRows{std::max<ui>(BandRows, 1)} {}
+
+  // Encodes image into sink and flushes it, the marks for Image::Dirty are left alone. The first encode, and encodes
+  // of an image with another TrackingId (another image, or one assigned to since), encode everything and start
+  // tracking if image doesn't track yet
+  inline bool Encode(Image &image, Sink &sink) {
+    const Image &pixels{image};
+    const ui width{image.getWidth()}, height{image.getHeight()};
+    const bool reset{!image.Tracking() || image.TrackingId() != m_trackingId};
+    if (reset) {
+      if (!image.Tracking()) image.TrackChanges();
+      m_trackingId = image.TrackingId();
+      m_bands.assign((size_t{height} + m_bandRows - 1) / m_bandRows, {});
+    }
+
+    m_reencoded = 0;
+    const Pixel *const data{pixels.GetData().data()};
+    for (size_t band{0}; band < m_bands.size(); ++band) {
+      const ui y{static_cast<ui>(band * m_bandRows)};
+      if (!reset && !image.ChangedSince(m_generation, y, m_bandRows)) continue;
+      const size_t begin{size_t{y} * width};
+      const size_t end{std::min<size_t>(height, size_t{y} + m_bandRows) * width};
+      EncodeBand({data + begin, end - begin}, m_scratch);
+      m_bands[band].assign(m_scratch.begin(), m_scratch.end());
+      ++m_reencoded;
+    }
+    m_generation = image.Generation();
+
+    if (!writeHeader(sink, width, height)) return false;
+    for (const std::vector<std::byte> &band : m_bands)
+      if (!sink.Write(band.data(), band.size())) return false;
+    return writeTrail(sink) && sink.Flush();
+  }
+
+  // Bands the last Encode encoded, the others came from the cache
+  inline size_t Reencoded() const { return m_reencoded; }
+  inline size_t Bands() const { return m_bands.size(); }
+
+  // Encoded size of the last Encode
+  inline size_t Size() const {
+    size_t size{HeaderSize + TrailSize};
+    for (const std::vector<std::byte> &band : m_bands) size += band.size();
+    return size;
+  }
+
+private:
+  ui m_bandRows;
+  uint64_t m_trackingId{0}; // Image::TrackingId the bands belong to
+  uint64_t m_generation{0}; // Image::Generation at the last encode
+  std::vector<std::vector<std::byte>> m_bands;
+  std::vector<std::byte> m_scratch; // writeBand needs room for the worst case, the bands only keep what they use
+  size_t m_reencoded{0};
+};
+
+// FilePath with ".qoi" appended if it does not end with it
+static inline std::string QoiPath(const strv FilePath) {
+  return FilePath.ends_with(".qoi") ? std::string(FilePath) : std::string(FilePath) + ".qoi";
+}
+
+// Writes a qoi file (see WriteFile: written to a temporary file that replaces FilePath once complete). ".qoi" is
+// appended if FilePath does not end with it
+inline WriteResult GenerateFile(const Image &image, const strv FilePath, const EncodeOptions &Options = {}) {
+  return WriteFile(QoiPath(FilePath), Options.output, MaxEncodedSize(image, Options),
+                   [&](Sink &sink) { return Encode(image, sink, Options); });
+}
+
+// GenerateFile that also fills Stats (see EncodeStats)
+inline WriteResult GenerateFile(const Image &image, const strv FilePath, const EncodeOptions &Options,
+                                EncodeStats &Stats) {
+  return WriteFile(QoiPath(FilePath), Options.output, MaxEncodedSize(image, Options),
+                   [&](Sink &sink) { return Encode(image, sink, Options, Stats); });
+}
+
+// Writes a qoi file from rows supplied one at a time, see EncodeRows. ".qoi" is appended like in GenerateFile
+inline WriteResult GenerateFile(const ui width, const ui height, const RowProvider &Rows, const strv FilePath,
+                                const uint8_t channels = 4) {
+  return WriteFile(QoiPath(FilePath), OutputBackend::stream, 0,
+                   [&](Sink &sink) { return EncodeRows(width, height, Rows, sink, channels); });
+}
+
+static inline WriteResult GenerateFileNonCompressed(const Image &image, const strv FilePath) {
+  return WriteFile(QoiPath(FilePath), OutputBackend::stream, 0, [&](Sink &sink) {
+    return writeHeader(sink, image) && writeDataNonCompressedNonOptimized(sink, image) && writeTrail(sink) &&
+           sink.Flush();
+  });
+}
+
+// Encoder context for many small encodes per second (icons, tiles, thumbnails). Keeps what the free Encode /
+// GenerateFile set up on every call: the output buffer, the restart points and band buffers of the band encoders and
+// the write buffer and path strings of the file writes. Once the buffers have grown to the largest image (and longest
+// path), Encode and GenerateFile make no heap allocations (threads other than 1 still start their threads on every
+// call). Not thread safe, one per thread:
+//   qoi::Encoder encoder;
+//   for (...) send(encoder.Encode(icon));
+class Encoder {
+public:
+  explicit Encoder(const EncodeOptions &Options = {}) : m_options{Options} {}
+
+  // Encodes image into the buffer of the encoder. The bytes stay valid until the next call, empty if the image was
+  // refused
+  inline std::span<const std::byte> Encode(const Image &image) {
+    // the buffer only ever grows, so the bytes are written into memory that is already there
+    const size_t maxSize{MaxEncodedSize(image, m_options)};
+    if (m_output.size() < maxSize) m_output.resize(maxSize);
+    SpanSink sink{m_output};
+    if (!Encode(image, sink)) return {};
+    return {m_output.data(), sink.Written()};
+  }
+
+  // Encodes image into sink and flushes it, like qoi::Encode
+  inline bool Encode(const Image &image, Sink &sink) {
+    return encodeImage(image, sink, m_options, m_restarts, &m_bands);
+  }
+
+  // Writes a qoi file like qoi::GenerateFile, buffered writes go through the buffer of the encoder and the paths
+  // (FilePath with ".qoi", the temporary file and its directory) are built in strings of the encoder
+  inline WriteResult GenerateFile(const Image &image, const strv FilePath) {
+    if (!m_fileBuffer) m_fileBuffer = std::make_unique_for_overwrite<std::byte[]>(BufferedSink::BufferSize);
+    m_qoiPath.assign(FilePath);
+    if (!FilePath.ends_with(".qoi")) m_qoiPath += ".qoi";
+    return WriteFile(
+        m_qoiPath, m_options.output, MaxEncodedSize(image, m_options), [&](Sink &sink) { return Encode(image, sink); },
+        std::span{m_fileBuffer.get(), BufferedSink::BufferSize}, &m_paths);
+  }
+
+  inline const EncodeOptions &Options() const { return m_options; }
+  inline void SetOptions(const EncodeOptions &Options) { m_options = Options; }
+
+private:
+  EncodeOptions m_options;
+  std::vector<std::byte> m_output;
+  std::vector<RestartPoint> m_restarts;
+  std::vector<std::vector<std::byte>> m_bands;
+  std::unique_ptr<std::byte[]> m_fileBuffer;
+  std::string m_qoiPath;
+  AtomicFilePaths m_paths;
+};
+
+} // namespace qoi
+
+} // namespace QOID
+
+// Sequence of equally sized frames (animation, screen recording) in one file. Frames are stored whole (keyframes) or
+// as the pixels that changed since the previous frame (delta frames). All numbers are big endian like in qoi:
+//   header    "qoiS", width (4), height (4)
+//   frame     type (1, 'K' or 'D'), payload size (8), payload
+//             K: a complete qoi file of the frame
+//             D: segment count, then per segment the unchanged pixels to skip and the changed pixels that follow (all
+//                LEB128 varints), then the qoi chunks of every changed pixel one after another (one index and previous
+//                pixel for the whole frame, no header) and the qoi end marker
+//   end       type 'E'
+//   index     per frame: offset of its type byte from the start of the header (8), type (1)
+//   footer    frame count (4), offset of the index (8), "qoiX"
+// Readers without seeking stop at 'E', the footer at the very end leads seeking readers to the index
+
+namespace QOID {
+namespace qoi {
+
+namespace {
+
+static inline constexpr size_t SequenceHeaderSize{12};
+static inline constexpr size_t RecordHeaderSize{9};
+static inline constexpr size_t IndexEntrySize{9};
+static inline constexpr size_t SequenceFooterSize{16};
+static inline constexpr uint8_t KeyFrame{'K'};
+static inline constexpr uint8_t DeltaFrame{'D'};
+static inline constexpr uint8_t SequenceEnd{'E'};
+
+// Writes the Size lowest bytes of Value big endian
+static inline void putBE(uint8_t *bytes, const uint64_t Value, const size_t Size) {
+  for (size_t i{0}; i < Size; ++i) bytes[i] = static_cast<uint8_t>(Value >> ((Size - 1 - i) * 8));
+}
+
+static inline uint64_t getBE(const uint8_t *bytes, const size_t Size) {
+  uint64_t value{0};
+  for (size_t i{0}; i < Size; ++i) value = value << 8 | bytes[i];
+  return value;
+}
+
+static inline bool writeVarint(Sink &file, uint64_t Value) {
+  if (!file.Reserve(10)) return false;
+  std::byte *buffer{file.Pos()};
+  for (; Value >= 0x80; Value >>= 7) *buffer++ = static_cast<std::byte>(Value | 0x80);
+  *buffer++ = static_cast<std::byte>(Value);
+  file.Advance(buffer);
+  return true;
+}
+
+// Throws std::runtime_error if the varint runs past end or doesn't fit 64 bits
+static inline uint64_t readVarint(const uint8_t *&in, const uint8_t *const end) {
+  uint64_t value{0};
+  for (unsigned shift{0}; shift < 64 && in < end; shift += 7) {
+    const uint8_t byte{*in++};
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) return value;
+  }
+  throw std::runtime_error("Invalid sequence delta frame");
+}
+
+} // namespace
+
+// Unchanged pixels to skip followed by changed pixels to store, see the format description above
+struct Segment {
+  uint64_t skip;
+  uint64_t copy;
+};
+
+// Writes frames into a sequence (format above). Every frame is compared with the previous one, pixels that stayed the
+// same turn into skips and only the changed ones go through the qoi encoder, so a screen recording where a cursor or
+// a line of text changes costs a few bytes per frame:
+//   SequenceWriter writer{sink, w, h};
+//   for (...) writer.AddFrame(frame);
+//   writer.Finish();
+// After a failed call every following call fails. Keeps a copy of the previous frame and reuses its buffers
+class SequenceWriter {
+public:
+  // sink has to outlive the writer. The header is written right away
+  SequenceWriter(Sink &sink, const ui width, const ui height, const SequenceOptions &Options = {}) :
+      m_sink{sink}, m_options{Options}, m_previous{width, height, Image::Uninitialized{}}, m_start{sink.Written()} {
+    std::array<uint8_t, SequenceHeaderSize> header;
+    std::memcpy(header.data(), "qoiS", 4);
+    putBE(header.data() + 4, width, 4);
+    putBE(header.data() + 8, height, 4);
+    m_ok = width && height && m_sink.Write(header.data(), header.size());
+  }
+
+  // Appends frame, which has to have the size given to the constructor
+  inline bool AddFrame(const Image &frame) {
+    if (!m_ok || frame.getWidth() != m_previous.getWidth() || frame.getHeight() != m_previous.getHeight())
+      return m_ok = false;
+    const size_t number{m_index.size()};
+    const size_t count{frame.GetData().size()};
+    bool key{number == 0 || (m_options.keyframeInterval && number % m_options.keyframeInterval == 0)};
+    if (!key) key = static_cast<double>(FindSegments(frame)) > m_options.maxChanged * static_cast<double>(count);
+
+    m_payload.clear();
+    VectorSink payload{m_payload};
+    m_ok = key ? Encode(frame, payload, m_options.keyframe) : writeDelta(payload, frame);
+    if (!m_ok) return false;
+
+    std::array<uint8_t, RecordHeaderSize> record;
+    record[0] = key ? KeyFrame : DeltaFrame;
+    putBE(record.data() + 1, m_payload.size(), 8);
+    m_index.push_back({m_sink.Written() - m_start, record[0]});
+    m_ok = m_sink.Write(record.data(), record.size()) && m_sink.Write(m_payload.data(), m_payload.size());
+
+    // only the stored pixels differ from the previous frame (short unchanged gaps are stored too, copying is harmless)
+    Pixel *const previous{m_previous.GetData().data()};
+    if (key) std::ranges::copy(frame.GetData(), previous);
+    else {
+      uint64_t pos{0};
+      for (const Segment &segment : m_segments) {
+        pos += segment.skip;
+        std::copy_n(frame.GetData().data() + pos, segment.copy, previous + pos);
+        pos += segment.copy;
+      }
+    }
+    return m_ok;
+  }
+
+  // Writes the end record, the index and the footer and flushes the sink
+  inline bool Finish() {
+    if (!m_ok) return false;
+    const uint64_t indexOffset{m_sink.Written() - m_start + 1};
+    m_ok = m_sink.Write(&SequenceEnd, 1);
+    for (const IndexEntry &entry : m_index) {
+      std::array<uint8_t, IndexEntrySize> bytes;
+      putBE(bytes.data(), entry.offset, 8);
+      bytes[8] = entry.type;
+      m_ok = m_ok && m_sink.Write(bytes.data(), bytes.size());
+    }
+    std::array<uint8_t, SequenceFooterSize> footer;
+    putBE(footer.data(), m_index.size(), 4);
+    putBE(footer.data() + 4, indexOffset, 8);
+    std::memcpy(footer.data() + 12, "qoiX", 4);
+    const bool done{m_ok && m_sink.Write(footer.data(), footer.size()) && m_sink.Flush()};
+    m_ok = false;
+    return done;
+  }
+
+  // Frames written so far
+  inline size_t Frames() const { return m_index.size(); }
+
+private:
+  struct IndexEntry {
+    uint64_t offset;
+    uint8_t type;
+  };
+
+  // Splits frame into segments against the previous frame, returns the amount of changed (stored) pixels
+  inline uint64_t FindSegments(const Image &frame) {
+    m_segments.clear();
+    const Pixel *const current{frame.GetData().data()};
+    const Pixel *const previous{m_previous.GetData().data()};
+    const size_t count{frame.GetData().size()};
+    size_t pos{simd::EqualLength(current, previous, count)};
+    uint64_t skip{pos}, stored{0};
+    while (pos < count) {
+      const size_t start{pos};
+      size_t equal{0};
+      // unchanged gaps shorter than minSkip stay part of the segment
+      while (pos < count) {
+        pos += simd::DifferentLength(current + pos, previous + pos, count - pos);
+        equal = simd::EqualLength(current + pos, previous + pos, count - pos);
+        if (equal >= m_options.minSkip || pos + equal == count) break;
+        pos += equal;
+      }
+      m_segments.push_back({skip, pos - start});
+      stored += pos - start;
+      skip = equal;
+      pos += equal;
+    }
+    return stored;
+  }
+
+  // Delta payload of frame from the segments FindSegments found
+  inline bool writeDelta(Sink &payload, const Image &frame) {
+    if (!writeVarint(payload, m_segments.size())) return false;
+    for (const Segment &segment : m_segments)
+      if (!writeVarint(payload, segment.skip) || !writeVarint(payload, segment.copy)) return false;
+    RowState state;
+    const Pixel *pixels{frame.GetData().data()};
+    for (const Segment &segment : m_segments) {
+      pixels += segment.skip;
+      if (!writeRow(payload, state, pixels, pixels + segment.copy)) return false;
+      pixels += segment.copy;
+    }
+    return writeOpenRun(payload, state) && writeTrail(payload) && payload.Flush();
+  }
+
+  Sink &m_sink;
+  SequenceOptions m_options;
+  Image m_previous;
+  size_t m_start;
+  std::vector<IndexEntry> m_index;
+  std::vector<Segment> m_segments;
+  std::vector<std::byte> m_payload;
+  bool m_ok{false};
+};
+
+// Reads a sequence frame by frame (Next), from any stream. On a seekable stream (e.g. std::ifstream) Seek jumps to a
+// frame through the index, decoding from the closest keyframe before it. Corrupt data throws std::runtime_error
+class SequenceReader {
+public:
+  // Reads the header. Stream has to outlive the reader and may hold other data before the sequence, but not after it.
+  // The frame is only allocated with the first keyframe, once its payload shows the size is real
+  explicit SequenceReader(std::istream &Stream) : m_stream{Stream}, m_start{Stream.tellg()} {
+    std::array<uint8_t, SequenceHeaderSize> header;
+    if (!m_stream.read(reinterpret_cast<char *>(header.data()), header.size()))
+      throw std::runtime_error("Sequence data is truncated");
+    if (std::memcmp(header.data(), "qoiS", 4) != 0) throw std::runtime_error("Sequence magic number missing");
+    m_width = static_cast<ui>(getBE(header.data() + 4, 4));
+    m_height = static_cast<ui>(getBE(header.data() + 8, 4));
+    if (m_width == 0 || m_height == 0) throw std::runtime_error("Invalid sequence header");
+    if (m_start >= 0) {
+      const std::streampos frames{m_stream.tellg()};
+      m_stream.seekg(0, std::ios::end);
+      m_end = m_stream.tellg();
+      m_stream.clear();
+      m_stream.seekg(frames);
+    }
+  }
+
+  constexpr ui getWidth() const { return m_width; }
+  constexpr ui getHeight() const { return m_height; }
+
+  // Decodes the next frame, nullptr after the last one. The image is reused by the following calls
+  inline const Image *Next() {
+    if (m_ended) return nullptr;
+    std::array<uint8_t, RecordHeaderSize> record;
+    if (!m_stream.read(reinterpret_cast<char *>(record.data()), 1)) throw std::runtime_error("Sequence is truncated");
+    if (record[0] == SequenceEnd) {
+      m_ended = true;
+      return nullptr;
+    }
+    if (!m_stream.read(reinterpret_cast<char *>(record.data() + 1), 8))
+      throw std::runtime_error("Sequence is truncated");
+    // no valid frame comes close to 16 bytes per pixel, so corrupt sizes don't end up as huge allocations
+    const uint64_t size{getBE(record.data() + 1, 8)};
+    if (size > static_cast<uint64_t>(m_width) * m_height * 16 + 64)
+      throw std::runtime_error("Invalid sequence frame size");
+    readPayload(size);
+
+    if (record[0] == KeyFrame) {
+      // PeekSize bounds the pixels by the payload that was actually read (at most 62 per byte)
+      const Dimensions frameSize{PeekSize(m_payload)};
+      if (frameSize.width != m_width || frameSize.height != m_height)
+        throw std::runtime_error("Sequence frame size differs from the header");
+      if (m_frame.getWidth() != m_width || m_frame.getHeight() != m_height)
+        m_frame = Image{m_width, m_height, Image::Uninitialized{}};
+      DecodeInto(m_payload, m_frame);
+    }
+    else if (record[0] == DeltaFrame && m_valid) applyDelta();
+    else throw std::runtime_error(record[0] == DeltaFrame ? "Delta frame without keyframe" : "Invalid sequence frame");
+    m_valid = true;
+    ++m_next;
+    return &m_frame;
+  }
+
+  // Number of the frame the next call of Next decodes
+  inline size_t Position() const { return m_next; }
+
+  // Frames in the sequence, 0 if the stream can't seek (see LoadIndex)
+  inline size_t FrameCount() { return LoadIndex() ? m_index.size() : 0; }
+
+  // Makes Next return frame Frame. Decodes forward from the closest keyframe, or from the current frame if that is
+  // closer. Returns false if Frame is out of range or the index can't be read
+  inline bool Seek(const size_t Frame) {
+    if (!LoadIndex() || Frame >= m_index.size()) return false;
+    size_t key{Frame};
+    while (key > 0 && m_index[key].type != KeyFrame) --key;
+    if (!(m_valid && !m_ended && m_next > key && m_next <= Frame)) {
+      m_stream.clear();
+      m_stream.seekg(m_start + static_cast<std::streamoff>(m_index[key].offset));
+      m_next = key;
+      m_valid = false;
+      m_ended = false;
+    }
+    while (m_next < Frame) Next();
+    return true;
+  }
+
+  // Reads the index through the footer at the end of the stream, once. Returns false if the stream can't seek
+  inline bool LoadIndex() {
+    if (m_indexLoaded) return true;
+    if (m_start < 0) return false;
+    m_stream.clear();
+    const std::streampos resume{m_stream.tellg()};
+    std::array<uint8_t, SequenceFooterSize> footer;
+    if (!m_stream.seekg(-static_cast<std::streamoff>(SequenceFooterSize), std::ios::end)) return false;
+    const std::streampos footerPos{m_stream.tellg()};
+    if (footerPos < m_start || !m_stream.read(reinterpret_cast<char *>(footer.data()), footer.size())) return false;
+    if (std::memcmp(footer.data() + 12, "qoiX", 4) != 0) throw std::runtime_error("Sequence index missing");
+    // the footer is untrusted: the index has to fit between its offset and the footer before anything is allocated
+    const uint64_t count{getBE(footer.data(), 4)}, offset{getBE(footer.data() + 4, 8)};
+    const auto indexEnd{static_cast<uint64_t>(footerPos - m_start)};
+    if (offset > indexEnd || count > (indexEnd - offset) / IndexEntrySize)
+      throw std::runtime_error("Invalid sequence index");
+    std::vector<uint8_t> entries(count * IndexEntrySize);
+    m_stream.seekg(m_start + static_cast<std::streamoff>(offset));
+    if (!m_stream.read(reinterpret_cast<char *>(entries.data()), static_cast<std::streamsize>(entries.size())))
+      throw std::runtime_error("Sequence index is truncated");
+    m_index.resize(count);
+    for (size_t i{0}; i < count; ++i)
+      m_index[i] = {getBE(entries.data() + i * IndexEntrySize, 8), entries[i * IndexEntrySize + 8]};
+    if (count && m_index[0].type != KeyFrame) throw std::runtime_error("Sequence starts without keyframe");
+    m_stream.clear();
+    m_stream.seekg(resume);
+    m_indexLoaded = true;
+    return true;
+  }
+
+private:
+  struct IndexEntry {
+    uint64_t offset;
+    uint8_t type;
+  };
+
+  // Reads Size payload bytes into m_payload. The buffer grows with the data that actually arrives (and the size is
+  // checked against the end of a seekable stream first), so a corrupt size fails as truncated instead of allocating
+  inline void readPayload(const uint64_t Size) {
+    if (m_end >= 0 && Size > static_cast<uint64_t>(m_end - m_stream.tellg()))
+      throw std::runtime_error("Sequence is truncated");
+    m_payload.clear();
+    for (size_t read{0}; read < Size;) {
+      const size_t chunk{static_cast<size_t>(std::min<uint64_t>(Size - read, std::max<size_t>(read, 1 << 20)))};
+      m_payload.resize(read + chunk);
+      if (!m_stream.read(reinterpret_cast<char *>(m_payload.data() + read), static_cast<std::streamsize>(chunk)))
+        throw std::runtime_error("Sequence is truncated");
+      read += chunk;
+    }
+  }
+
+  // Decodes the changed pixels of a delta payload and puts them over the previous frame
+  inline void applyDelta() {
+    const auto *in{reinterpret_cast<const uint8_t *>(m_payload.data())};
+    if (m_payload.size() < TrailSize) throw std::runtime_error("Invalid sequence delta frame");
+    const uint8_t *const end{in + m_payload.size() - TrailSize};
+    const size_t count{m_frame.GetData().size()};
+    const uint64_t segments{readVarint(in, end)};
+    if (segments > count) throw std::runtime_error("Invalid sequence delta frame");
+    m_segments.resize(segments);
+    uint64_t covered{0}, stored{0};
+    for (Segment &segment : m_segments) {
+      segment.skip = readVarint(in, end);
+      segment.copy = readVarint(in, end);
+      if (segment.skip > count - covered || segment.copy > count - covered - segment.skip)
+        throw std::runtime_error("Invalid sequence delta frame");
+      covered += segment.skip + segment.copy;
+      stored += segment.copy;
+    }
+    m_changed.resize(stored);
+    if (!readData(in, end, m_changed.data(), stored)) throw std::runtime_error("Sequence delta frame is truncated");
+
+    Pixel *const frame{m_frame.GetData().data()};
+    uint64_t pos{0};
+    const Pixel *changed{m_changed.data()};
+    for (const Segment &segment : m_segments) {
+      pos += segment.skip;
+      std::copy_n(changed, segment.copy, frame + pos);
+      changed += segment.copy;
+      pos += segment.copy;
+    }
+  }
+
+  std::istream &m_stream;
+  std::streampos m_start;
+  std::streampos m_end{-1};
+  ui m_width{0};
+  ui m_height{0};
+  Image m_frame{1, 1, Image::Uninitialized{}}; // placeholder until the first keyframe
+  std::vector<std::byte> m_payload;
+  std::vector<Segment> m_segments;
+  std::vector<Pixel> m_changed;
+  std::vector<IndexEntry> m_index;
+  size_t m_next{0};
+  bool m_valid{false};
+  bool m_ended{false};
+  bool m_indexLoaded{false};
+};
+
+} // namespace qoi
+} // namespace QOID
+
+namespace QOID {
+namespace tga {
+
+static inline constexpr size_t HeaderSize{18};
+// an RLE packet covers at most 128 pixels (7 bit count + 1)
+static inline constexpr size_t MaxPacketPixels{128};
+
+// Writes the 18-byte TGA header for a 32-bit (8-bit per channel RGBA) image. RLE selects image type 10 over 2
+static inline bool writeHeader(Sink &file, const Image &image, const bool RLE = false) {
+  // TGA header (18 bytes):
+  // Byte 0: ID length = 0
+  // Byte 1: Color map type = 0 (no color map)
+  // Byte 2: Image type = 2 (uncompressed true-color image) or 10 (run-length encoded true-color image)
+  // Bytes 3-7: Color map specification (unused, set to 0)
+  // Bytes 8-9: X-origin (0)
+  // Bytes 10-11: Y-origin (0)
+  // Bytes 12-13: Width (little-endian)
+  // Bytes 14-15: Height (little-endian)
+  // Byte 16: Pixel depth = 32 (bits per pixel)
+  // Byte 17: Image descriptor = 0x28
+  //          (bits 0-3: 8 bits of alpha, bit 5: top-left origin)
+  std::array<std::uint8_t, 18> header{};
+  header[0] = 0; // ID length
+  header[1] = 0; // Color map type
+  header[2] = RLE ? 10 : 2; // Image type (uncompressed / run-length encoded true-color)
+
+  // Color map specification: bytes 3-7 already zeroed.
+  // X-origin (bytes 8-9)
+  header[8] = 0;
+  header[9] = 0;
+  // Y-origin (bytes 10-11)
+  header[10] = 0;
+  header[11] = 0;
+
+  // Image width (little-endian)
+  uint16_t width = static_cast<uint16_t>(image.getWidth());
+  header[12] = static_cast<std::uint8_t>(width & 0xFF);
+  header[13] = static_cast<std::uint8_t>((width >> 8) & 0xFF);
+
+  // Image height (little-endian)
+  uint16_t height = static_cast<uint16_t>(image.getHeight());
+  header[14] = static_cast<std::uint8_t>(height & 0xFF);
+  header[15] = static_cast<std::uint8_t>((height >> 8) & 0xFF);
+
+  header[16] = 32;   // Pixel depth: 32 bits per pixel (8 bits per channel)
+  header[17] = 0x28; // Image descriptor: 8-bit alpha, top-left origin (bit 5 set)
+
+  return file.Write(header.data(), header.size());
+}
+
+// Writes the image data in BGRA order (TGA expects pixels stored as Blue, Green, Red, Alpha).
+// Pixels are swizzled in bulk straight into the sink's buffer (or the file mapping for MappedSink)
+static inline bool writeData(Sink &file, const Image &image) {
+  const auto *in{reinterpret_cast<const std::byte *>(image.GetData().data())};
+  size_t remaining{image.GetData().size()};
+  while (remaining) {
+    if (!file.Reserve(sizeof(Pixel))) return false;
+    const size_t count{std::min(remaining, file.Available() / sizeof(Pixel))};
+    simd::SwapRedBlue(in, file.Pos(), count);
+    file.Advance(file.Pos() + count * sizeof(Pixel));
+    in += count * sizeof(Pixel);
+    remaining -= count;
+  }
+  return true;
+}
+
+// Writes the image data as RLE packets, each starting with a byte whose high bit selects a run (one pixel repeated)
+// or a raw packet (pixels follow) and whose low 7 bits hold the pixel count - 1. Packets don't cross rows, as the spec
+// asks. Run and raw lengths are found with the simd scanners, raw pixels are swizzled in bulk like in writeData
+static inline bool writeDataRLE(Sink &file, const Image &image) {
+  const size_t width{image.getWidth()};
+  const Pixel *row{image.GetData().data()};
+  for (ui y{0}; y < image.getHeight(); ++y, row += width) {
+    const Pixel *it{row};
+    const Pixel *const rowEnd{row + width};
+    while (it < rowEnd) {
+      const Pixel *const packetEnd{it + std::min(MaxPacketPixels, static_cast<size_t>(rowEnd - it))};
+      const size_t run{simd::RunLength(it + 1, packetEnd, *it) + 1};
+      if (run > 1) {
+        if (!file.Reserve(1 + sizeof(Pixel))) return false;
+        std::byte *buffer{file.Pos()};
+        *buffer++ = static_cast<std::byte>(0x80 | (run - 1));
+        simd::SwapRedBlue(reinterpret_cast<const std::byte *>(it), buffer, 1);
+        file.Advance(buffer + sizeof(Pixel));
+        it += run;
+        continue;
+      }
+      // a raw packet ends where the next run starts, one pixel past the packet is looked at so a run starting on its
+      // last pixel isn't cut short
+      const Pixel *const scanEnd{it + std::min(MaxPacketPixels + 1, static_cast<size_t>(rowEnd - it))};
+      const size_t count{std::min(simd::LiteralLength(it, scanEnd), MaxPacketPixels)};
+      if (!file.Reserve(1 + count * sizeof(Pixel))) return false;
+      std::byte *buffer{file.Pos()};
+      *buffer++ = static_cast<std::byte>(count - 1);
+      simd::SwapRedBlue(reinterpret_cast<const std::byte *>(it), buffer, count);
+      file.Advance(buffer + count * sizeof(Pixel));
+      it += count;
+    }
+  }
+  return true;
+}
+
+// Per pixel version of writeData, kept to benchmark against
+static inline bool writeDataNonOptimized(Sink &file, const Image &image) {
+  const auto &pixels = image.GetData();
+  // Each pixel is written as 4 bytes: BGRA
+  for (const auto &px : pixels) {
+    // Convert from RGBA (your internal format) to BGRA.
+    uint8_t bgra[4] = {px.B(), px.G(), px.R(), px.A()};
+    if (!file.Write(bgra, sizeof(bgra))) return false;
+  }
+  return true;
+}
+
+// Largest width and height the 16 bit header fields can hold
+static inline constexpr ui MaxDimension{0xFFFF};
+
+// Encodes image into sink and flushes it. Only Options.rle applies. Fails for images larger than MaxDimension
+inline bool Encode(const Image &image, Sink &sink, const EncodeOptions &Options = {}) {
+  if (image.getWidth() > MaxDimension || image.getHeight() > MaxDimension) return false;
+  return writeHeader(sink, image, Options.rle) && (Options.rle ? writeDataRLE(sink, image) : writeData(sink, image)) &&
+         sink.Flush();
+}
+
+// Upper bound of the encoded size, exact for uncompressed images. RLE output is at worst one raw packet header per
+// 128 pixels of a row larger
+inline size_t MaxEncodedSize(const Image &image, const EncodeOptions &Options = {}) {
+  const size_t packetsPerRow{(image.getWidth() + MaxPacketPixels - 1) / MaxPacketPixels};
+  return HeaderSize + (Options.rle ? packetsPerRow * image.getHeight() : 0) + image.GetData().size() * sizeof(Pixel);
+}
+
+// Encodes image directly into Buffer. Returns the encoded size, or 0 if Buffer is too small (see MaxEncodedSize)
+inline size_t EncodeToBuffer(const Image &image, const std::span<std::byte> Buffer, const EncodeOptions &Options = {}) {
+  SpanSink sink{Buffer};
+  return Encode(image, sink, Options) ? sink.Written() : 0;
+}
+
+// Appends the encoded image to Buffer. Returns the amount of bytes appended
+inline size_t EncodeToBuffer(const Image &image, std::vector<std::byte> &Buffer, const EncodeOptions &Options = {}) {
+  // RLE output is usually far below the bound, so let the vector grow instead
+  VectorSink sink{Buffer, Options.rle ? 0 : MaxEncodedSize(image)};
+  return Encode(image, sink, Options) ? sink.Written() : 0;
+}
+
+// Reads Count pixels of RLE packets from [in, end) into out, in file order. Packets may cross rows here, other
+// writers don't all split them. Throws std::runtime_error if the data ends early
+static inline void readDataRLE(const uint8_t *in, const uint8_t *const end, const size_t depth, Pixel *out,
+                               size_t Count) {
+  while (Count) {
+    if (in == end) throw std::runtime_error("TGA data is truncated");
+    const uint8_t packet{*in++};
+    const size_t length{std::min<size_t>((packet & 0x7F) + 1u, Count)};
+    const size_t bytes{packet & 0x80 ? depth : length * depth};
+    if (static_cast<size_t>(end - in) < bytes) throw std::runtime_error("TGA data is truncated");
+    if (packet & 0x80) {
+      std::fill_n(out, length, Pixel{in[2], in[1], in[0], depth == 4 ? in[3] : color{255}});
+    } else if (depth == 4) {
+      simd::SwapRedBlue(reinterpret_cast<const std::byte *>(in), reinterpret_cast<std::byte *>(out), length);
+    } else {
+      for (size_t i{0}; i < length; ++i) out[i] = Pixel{in[i * 3 + 2], in[i * 3 + 1], in[i * 3], color{255}};
+    }
+    in += bytes;
+    out += length;
+    Count -= length;
+  }
+}
+
+// Reads and checks the header of a TGA file held in memory. Throws std::runtime_error like Decode
+inline Dimensions PeekSize(const std::span<const std::byte> data) {
+  if (data.size() < HeaderSize) throw std::runtime_error("TGA data is too small");
+  const auto *bytes{reinterpret_cast<const uint8_t *>(data.data())};
+  if (bytes[1] != 0 || (bytes[2] != 2 && bytes[2] != 10))
+    throw std::runtime_error("Only uncompressed or run-length encoded true-color TGA is supported");
+
+  const ui width{static_cast<ui>(bytes[12] | bytes[13] << 8)};
+  const ui height{static_cast<ui>(bytes[14] | bytes[15] << 8)};
+  const size_t depth{bytes[16] / 8u};
+  if (width == 0 || height == 0 || (depth != 3 && depth != 4)) throw std::runtime_error("Invalid TGA header");
+  const size_t offset{HeaderSize + bytes[0]}; // skips the image ID
+  if (data.size() < offset) throw std::runtime_error("TGA data is truncated");
+  // checked before anyone allocates the image, so a header can't ask for more pixels than the data holds. An RLE
+  // packet covers at most 128 pixels and takes at least a byte
+  const size_t pixels{static_cast<size_t>(width) * height};
+  if (bytes[2] == 2 ? data.size() - offset < pixels * depth : (data.size() - offset) * 128 < pixels)
+    throw std::runtime_error("TGA data is truncated");
+  return {width, height};
+}
+
+// Decodes a TGA file held in memory into image, which needs the size from PeekSize (std::invalid_argument otherwise).
+// With an Image::Wrap over a reused buffer no pixel memory gets allocated. Throws std::runtime_error on malformed
+// data, image may be partly overwritten then
+inline void DecodeInto(const std::span<const std::byte> data, Image &image) {
+  const Dimensions size{PeekSize(data)};
+  if (image.getWidth() != size.width || image.getHeight() != size.height)
+    throw std::invalid_argument("Image size differs from the TGA header");
+  const auto *bytes{reinterpret_cast<const uint8_t *>(data.data())};
+  const ui width{size.width};
+  const ui height{size.height};
+  const size_t depth{bytes[16] / 8u};
+  const bool topDown{(bytes[17] & 0x20) != 0};
+  const bool rightToLeft{(bytes[17] & 0x10) != 0};
+  const size_t offset{HeaderSize + bytes[0]}; // skips the image ID
+
+  if (bytes[2] == 10) {
+    Pixel *const pixels{image.GetData().data()};
+    readDataRLE(bytes + offset, bytes + data.size(), depth, pixels, image.GetData().size());
+    // pixels are in file order, flip into top-left origin
+    if (!topDown)
+      for (ui y{0}; y < height / 2; ++y)
+        std::swap_ranges(pixels + static_cast<size_t>(y) * width, pixels + static_cast<size_t>(y + 1) * width,
+                         pixels + static_cast<size_t>(height - 1 - y) * width);
+    if (rightToLeft)
+      for (ui y{0}; y < height; ++y)
+        std::reverse(pixels + static_cast<size_t>(y) * width, pixels + static_cast<size_t>(y + 1) * width);
+    return;
+  }
+
+  // PeekSize made sure the data holds every pixel
+  const uint8_t *in{bytes + offset};
+  for (ui y{0}; y < height; ++y) {
+    Pixel *row{image.GetData().data() + static_cast<size_t>(topDown ? y : height - 1 - y) * width};
+    if (depth == 4 && !rightToLeft) {
+      simd::SwapRedBlue(reinterpret_cast<const std::byte *>(in), reinterpret_cast<std::byte *>(row), width);
+      in += static_cast<size_t>(width) * depth;
+      continue;
+    }
+    for (ui x{0}; x < width; ++x, in += depth) {
+      row[rightToLeft ? width - 1 - x : x] = Pixel{in[2], in[1], in[0], depth == 4 ? in[3] : color{255}};
+    }
+  }
+}
+
+// Decodes an uncompressed (type 2) or run-length encoded (type 10) 24 or 32 bit TGA file held in memory. Throws
+// std::runtime_error on malformed or unsupported data
+inline Image Decode(const std::span<const std::byte> data) {
+  const Dimensions size{PeekSize(data)};
+  Image image{size.width, size.height, Image::Uninitialized{}};
+  DecodeInto(data, image);
+  return image;
+}
+
+// Loads a TGA file. ".tga" is appended if FilePath does not end with it (same as GenerateFile)
+inline Image LoadFile(const strv FilePath) {
+  std::ifstream file{FilePath.ends_with(".tga") ? std::string(FilePath) : std::string(FilePath) + ".tga",
+                     std::ios::binary | std::ios::in};
+  if (!file) throw std::runtime_error("Could not open TGA file");
+  const std::vector<char> data{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+  return Decode(std::as_bytes(std::span{data}));
+}
+
+// Same as GenerateFile (stream backend) but writes pixel by pixel
+static inline WriteResult GenerateFileNonOptimized(const Image &image, const strv FilePath) {
+  return WriteFile(FilePath.ends_with(".tga") ? std::string(FilePath) : std::string(FilePath) + ".tga",
+                   OutputBackend::stream, 0, [&](Sink &sink) {
+                     return writeHeader(sink, image) && writeDataNonOptimized(sink, image) && sink.Flush();
+                   });
+}
+
+// Generates a TGA file from the provided image. If FilePath does not end with ".tga",
+// it will be appended. Written like qoi::GenerateFile, through a temporary file (see WriteFile)
+inline WriteResult GenerateFile(const Image &image, const strv FilePath, const EncodeOptions &Options = {}) {
+  std::string filePath;
+  if (std::string(FilePath).ends_with(".tga")) filePath = FilePath;
+  else filePath = std::string(FilePath) + ".tga";
+  return WriteFile(filePath, Options.output, MaxEncodedSize(image, Options),
+                   [&](Sink &sink) { return Encode(image, sink, Options); });
+}
+
+} // namespace tga
+} // namespace QOID
+
+namespace QOID {
+
+// Image stored as 64x64 pixel tiles (each one contiguous, tiles in row-major order), so vertical and block shaped
+// access stays inside a few KB of memory instead of touching a new row for every pixel. Edge tiles are padded to the
+// full tile size. Encoding goes through ToImage, which converts back to the linear layout
+class TiledImage {
+public:
+  static constexpr ui TileShift{6};
+  static constexpr ui TileSize{1u << TileShift};
+  static constexpr ui TileMask{TileSize - 1};
+  static constexpr size_t TilePixels{static_cast<size_t>(TileSize) * TileSize};
+
+  // One tile, rows are TileSize pixels apart. width and height are smaller than TileSize at the right and bottom edge
+  struct Tile {
+    ui x;      // position of the top left pixel in the image
+    ui y;
+    ui width;  // valid pixels
+    ui height;
+    Pixel *data;
+
+    // valid pixels of row Row (relative to the tile)
+    inline std::span<Pixel> Row(const ui Row) const { return {data + static_cast<size_t>(Row) * TileSize, width}; }
+  };
+
+  class TileIterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Tile;
+    using difference_type = std::ptrdiff_t;
+
+    TileIterator(TiledImage *Image, const size_t Index) : m_image{Image}, m_index{Index} {}
+
+    inline Tile operator*() const { return m_image->GetTile(m_index); }
+    inline TileIterator &operator++() {
+      ++m_index;
+      return *this;
+    }
+    inline TileIterator operator++(int) { return {m_image, m_index++}; }
+    inline bool operator==(const TileIterator &Other) const { return m_index == Other.m_index; }
+
+  private:
+    TiledImage *m_image;
+    size_t m_index;
+  };
+
+  TiledImage() = delete;
+  TiledImage(const ui width, const ui height) :
+      m_width{width}, m_height{height}, m_tilesX{TilesFor(width)}, m_tilesY{TilesFor(height)},
+      m_pixel_data(static_cast<size_t>(m_tilesX) * m_tilesY * TilePixels) {}
+
+  // Converts a linear image
+  explicit TiledImage(const Image &image) : TiledImage{image.getWidth(), image.getHeight()} {
+    for (size_t i{0}; i < TileCount(); ++i) {
+      const Tile tile{GetTile(i)};
+      for (ui row{0}; row < tile.height; ++row)
+        std::memcpy(tile.Row(row).data(), &image.GetData()[tile.x + static_cast<size_t>(tile.y + row) * m_width],
+                    tile.width * sizeof(Pixel));
+    }
+  }
+
+  // Set pixel at position
+  inline void SetPixel(const Pixel P, const ui width, const ui height) {
+    if (width >= m_width || height >= m_height) throw std::out_of_range("Pixel coordinates out of bounds");
+    fSetPixel(P, width, height);
+  }
+
+  // Set pixel at position (no bounds checking)
+  inline void fSetPixel(const Pixel P, const ui width, const ui height) { m_pixel_data[Offset(width, height)] = P; }
+
+  // Returns reference to pixel at position
+  inline Pixel &GetPixel(const ui width, const ui height) {
+    if (width >= m_width || height >= m_height) throw std::out_of_range("Pixel coordinates out of bounds");
+    return fGetPixel(width, height);
+  }
+
+  // Returns reference to pixel at position (no bounds checking)
+  inline Pixel &fGetPixel(const ui width, const ui height) { return m_pixel_data[Offset(width, height)]; }
+
+  // Fill Image with given Pixel (padding included, it is never read)
+  inline void Fill(const Pixel Pixel) { std::fill(m_pixel_data.begin(), m_pixel_data.end(), Pixel); }
+
+  constexpr ui getWidth() const { return m_width; }
+  constexpr ui getHeight() const { return m_height; }
+
+  inline size_t TileCount() const { return static_cast<size_t>(m_tilesX) * m_tilesY; }
+
+  // Tile Index, counted row by row
+  inline Tile GetTile(const size_t Index) { return MakeTile(Index, m_pixel_data.data()); }
+
+  // Tiles in memory order: for (const TiledImage::Tile tile : image) ...
+  inline TileIterator begin() { return {this, 0}; }
+  inline TileIterator end() { return {this, TileCount()}; }
+
+  // Converts to the linear layout the encoders work on
+  inline Image ToImage() const {
+    Image image{m_width, m_height, Image::Uninitialized{}};
+    for (size_t i{0}; i < TileCount(); ++i) {
+      const Tile tile{MakeTile(i, nullptr)};
+      const Pixel *in{m_pixel_data.data() + i * TilePixels};
+      for (ui row{0}; row < tile.height; ++row, in += TileSize)
+        std::memcpy(&image.GetData()[tile.x + static_cast<size_t>(tile.y + row) * m_width], in,
+                    tile.width * sizeof(Pixel));
+    }
+    return image;
+  }
+
+  // Converts to the linear layout and writes the file, see Image::GenerateFile
+  inline WriteResult GenerateFile(const strv FilePath, const ImageType Type = QOID::ImageType::qoi,
+                                  const EncodeOptions &Options = {}) const {
+    return ToImage().GenerateFile(FilePath, Type, Options);
+  }
+
+private:
+  // computed in 64 bit, Size + TileMask can overflow ui
+  static constexpr ui TilesFor(const ui Size) {
+    return static_cast<ui>((static_cast<size_t>(Size) + TileMask) >> TileShift);
+  }
+
+  inline Tile MakeTile(const size_t Index, Pixel *const Data) const {
+    const ui x{static_cast<ui>(Index % m_tilesX) << TileShift}, y{static_cast<ui>(Index / m_tilesX) << TileShift};
+    return {x, y, std::min(TileSize, m_width - x), std::min(TileSize, m_height - y),
+            Data ? Data + Index * TilePixels : nullptr};
+  }
+
+  // tile base + position inside the tile, only shifts and masks
+  inline size_t Offset(const ui x, const ui y) const {
+    const size_t tile{static_cast<size_t>(y >> TileShift) * m_tilesX + (x >> TileShift)};
+    return tile * TilePixels + ((y & TileMask) << TileShift) + (x & TileMask);
+  }
+
+  ui m_width{};
+  ui m_height{};
+  ui m_tilesX{};
+  ui m_tilesY{};
+  std::vector<Pixel> m_pixel_data;
+};
+
 } // namespace QOID
@@ -24,7 +24,7 @@ union Pixel {
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wpedantic"
   struct {
-#if defined(BIG_ENDIAN)
+#if defined(QOID_BIG_ENDIAN)
     color R;
     color G;
     color B;
@@ -59,9 +59,9 @@ union Pixel {
 
   // Construct from four channels.
   // Note that the initializer order for the anonymous struct must follow the
-  // layout declared above (dependent on BIG_ENDIAN).
+  // layout declared above (dependent on QOID_BIG_ENDIAN).
   constexpr Pixel(color r = 0, color g = 0, color b = 0, color a = 255)
-#if defined(BIG_ENDIAN)
+#if defined(QOID_BIG_ENDIAN)
       : R(r), G(g), B(b), A(a)
 #else
       : A(a), B(b), G(g), R(r)
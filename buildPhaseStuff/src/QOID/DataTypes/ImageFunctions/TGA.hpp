@@ -2,21 +2,33 @@
 #include "../../QOID_General.hpp"
 #include "../pixel.hpp"
 #include "../../image.hpp"
+#include "../simd.hpp"
+#include "../sink.hpp"
+#include <algorithm>
 #include <array>
+#include <cstddef>
 #include <cstdint>
 #include <fstream>
+#include <iterator>
+#include <span>
+#include <stdexcept>
 #include <string>
 #include <cstring>
+#include <vector>
 
 namespace QOID {
 namespace tga {
 
-// Writes the 18-byte TGA header for a 32-bit (8-bit per channel RGBA) image.
-static inline bool writeHeader(std::ostream &file, const Image &image) {
+static inline constexpr size_t HeaderSize{18};
+// an RLE packet covers at most 128 pixels (7 bit count + 1)
+static inline constexpr size_t MaxPacketPixels{128};
+
+// Writes the 18-byte TGA header for a 32-bit (8-bit per channel RGBA) image. RLE selects image type 10 over 2
+static inline bool writeHeader(Sink &file, const Image &image, const bool RLE = false) {
   // TGA header (18 bytes):
   // Byte 0: ID length = 0
   // Byte 1: Color map type = 0 (no color map)
-  // Byte 2: Image type = 2 (uncompressed true-color image)
+  // Byte 2: Image type = 2 (uncompressed true-color image) or 10 (run-length encoded true-color image)
   // Bytes 3-7: Color map specification (unused, set to 0)
   // Bytes 8-9: X-origin (0)
   // Bytes 10-11: Y-origin (0)
@@ -28,7 +40,7 @@ static inline bool writeHeader(std::ostream &file, const Image &image) {
   std::array<std::uint8_t, 18> header{};
   header[0] = 0; // ID length
   header[1] = 0; // Color map type
-  header[2] = 2; // Image type (uncompressed true-color)
+  header[2] = RLE ? 10 : 2; // Image type (uncompressed / run-length encoded true-color)
 
   // Color map specification: bytes 3-7 already zeroed.
   // X-origin (bytes 8-9)
@@ -51,31 +63,225 @@ static inline bool writeHeader(std::ostream &file, const Image &image) {
   header[16] = 32;   // Pixel depth: 32 bits per pixel (8 bits per channel)
   header[17] = 0x28; // Image descriptor: 8-bit alpha, top-left origin (bit 5 set)
 
-  return !!file.write(reinterpret_cast<const char *>(header.data()), header.size());
+  return file.Write(header.data(), header.size());
 }
 
 // Writes the image data in BGRA order (TGA expects pixels stored as Blue, Green, Red, Alpha).
-// Assumes that image.GetData() returns a container of Pixels in RGBA order.
-static inline bool writeData(std::ostream &file, const Image &image) {
+// Pixels are swizzled in bulk straight into the sink's buffer (or the file mapping for MappedSink)
+static inline bool writeData(Sink &file, const Image &image) {
+  const auto *in{reinterpret_cast<const std::byte *>(image.GetData().data())};
+  size_t remaining{image.GetData().size()};
+  while (remaining) {
+    if (!file.Reserve(sizeof(Pixel))) return false;
+    const size_t count{std::min(remaining, file.Available() / sizeof(Pixel))};
+    simd::SwapRedBlue(in, file.Pos(), count);
+    file.Advance(file.Pos() + count * sizeof(Pixel));
+    in += count * sizeof(Pixel);
+    remaining -= count;
+  }
+  return true;
+}
+
+// Writes the image data as RLE packets, each starting with a byte whose high bit selects a run (one pixel repeated)
+// or a raw packet (pixels follow) and whose low 7 bits hold the pixel count - 1. Packets don't cross rows, as the spec
+// asks. Run and raw lengths are found with the simd scanners, raw pixels are swizzled in bulk like in writeData
+static inline bool writeDataRLE(Sink &file, const Image &image) {
+  const size_t width{image.getWidth()};
+  const Pixel *row{image.GetData().data()};
+  for (ui y{0}; y < image.getHeight(); ++y, row += width) {
+    const Pixel *it{row};
+    const Pixel *const rowEnd{row + width};
+    while (it < rowEnd) {
+      const Pixel *const packetEnd{it + std::min(MaxPacketPixels, static_cast<size_t>(rowEnd - it))};
+      const size_t run{simd::RunLength(it + 1, packetEnd, *it) + 1};
+      if (run > 1) {
+        if (!file.Reserve(1 + sizeof(Pixel))) return false;
+        std::byte *buffer{file.Pos()};
+        *buffer++ = static_cast<std::byte>(0x80 | (run - 1));
+        simd::SwapRedBlue(reinterpret_cast<const std::byte *>(it), buffer, 1);
+        file.Advance(buffer + sizeof(Pixel));
+        it += run;
+        continue;
+      }
+      // a raw packet ends where the next run starts, one pixel past the packet is looked at so a run starting on its
+      // last pixel isn't cut short
+      const Pixel *const scanEnd{it + std::min(MaxPacketPixels + 1, static_cast<size_t>(rowEnd - it))};
+      const size_t count{std::min(simd::LiteralLength(it, scanEnd), MaxPacketPixels)};
+      if (!file.Reserve(1 + count * sizeof(Pixel))) return false;
+      std::byte *buffer{file.Pos()};
+      *buffer++ = static_cast<std::byte>(count - 1);
+      simd::SwapRedBlue(reinterpret_cast<const std::byte *>(it), buffer, count);
+      file.Advance(buffer + count * sizeof(Pixel));
+      it += count;
+    }
+  }
+  return true;
+}
+
+// Per pixel version of writeData, kept to benchmark against
+static inline bool writeDataNonOptimized(Sink &file, const Image &image) {
   const auto &pixels = image.GetData();
   // Each pixel is written as 4 bytes: BGRA
   for (const auto &px : pixels) {
     // Convert from RGBA (your internal format) to BGRA.
     uint8_t bgra[4] = {px.B(), px.G(), px.R(), px.A()};
-    file.write(reinterpret_cast<const char *>(bgra), sizeof(bgra));
+    if (!file.Write(bgra, sizeof(bgra))) return false;
   }
   return true;
 }
 
+// Largest width and height the 16 bit header fields can hold
+static inline constexpr ui MaxDimension{0xFFFF};
+
+// Encodes image into sink and flushes it. Only Options.rle applies. Fails for images larger than MaxDimension
+inline bool Encode(const Image &image, Sink &sink, const EncodeOptions &Options = {}) {
+  if (image.getWidth() > MaxDimension || image.getHeight() > MaxDimension) return false;
+  return writeHeader(sink, image, Options.rle) && (Options.rle ? writeDataRLE(sink, image) : writeData(sink, image)) &&
+         sink.Flush();
+}
+
+// Upper bound of the encoded size, exact for uncompressed images. RLE output is at worst one raw packet header per
+// 128 pixels of a row larger
+inline size_t MaxEncodedSize(const Image &image, const EncodeOptions &Options = {}) {
+  const size_t packetsPerRow{(image.getWidth() + MaxPacketPixels - 1) / MaxPacketPixels};
+  return HeaderSize + (Options.rle ? packetsPerRow * image.getHeight() : 0) + image.GetData().size() * sizeof(Pixel);
+}
+
+// Encodes image directly into Buffer. Returns the encoded size, or 0 if Buffer is too small (see MaxEncodedSize)
+inline size_t EncodeToBuffer(const Image &image, const std::span<std::byte> Buffer, const EncodeOptions &Options = {}) {
+  SpanSink sink{Buffer};
+  return Encode(image, sink, Options) ? sink.Written() : 0;
+}
+
+// Appends the encoded image to Buffer. Returns the amount of bytes appended
+inline size_t EncodeToBuffer(const Image &image, std::vector<std::byte> &Buffer, const EncodeOptions &Options = {}) {
+  // RLE output is usually far below the bound, so let the vector grow instead
+  VectorSink sink{Buffer, Options.rle ? 0 : MaxEncodedSize(image)};
+  return Encode(image, sink, Options) ? sink.Written() : 0;
+}
+
+// Reads Count pixels of RLE packets from [in, end) into out, in file order. Packets may cross rows here, other
+// writers don't all split them. Throws std::runtime_error if the data ends early
+static inline void readDataRLE(const uint8_t *in, const uint8_t *const end, const size_t depth, Pixel *out,
+                               size_t Count) {
+  while (Count) {
+    if (in == end) throw std::runtime_error("TGA data is truncated");
+    const uint8_t packet{*in++};
+    const size_t length{std::min<size_t>((packet & 0x7F) + 1u, Count)};
+    const size_t bytes{packet & 0x80 ? depth : length * depth};
+    if (static_cast<size_t>(end - in) < bytes) throw std::runtime_error("TGA data is truncated");
+    if (packet & 0x80) {
+      std::fill_n(out, length, Pixel{in[2], in[1], in[0], depth == 4 ? in[3] : color{255}});
+    } else if (depth == 4) {
+      simd::SwapRedBlue(reinterpret_cast<const std::byte *>(in), reinterpret_cast<std::byte *>(out), length);
+    } else {
+      for (size_t i{0}; i < length; ++i) out[i] = Pixel{in[i * 3 + 2], in[i * 3 + 1], in[i * 3], color{255}};
+    }
+    in += bytes;
+    out += length;
+    Count -= length;
+  }
+}
+
+// Reads and checks the header of a TGA file held in memory. Throws std::runtime_error like Decode
+inline Dimensions PeekSize(const std::span<const std::byte> data) {
+  if (data.size() < HeaderSize) throw std::runtime_error("TGA data is too small");
+  const auto *bytes{reinterpret_cast<const uint8_t *>(data.data())};
+  if (bytes[1] != 0 || (bytes[2] != 2 && bytes[2] != 10))
+    throw std::runtime_error("Only uncompressed or run-length encoded true-color TGA is supported");
+
+  const ui width{static_cast<ui>(bytes[12] | bytes[13] << 8)};
+  const ui height{static_cast<ui>(bytes[14] | bytes[15] << 8)};
+  const size_t depth{bytes[16] / 8u};
+  if (width == 0 || height == 0 || (depth != 3 && depth != 4)) throw std::runtime_error("Invalid TGA header");
+  const size_t offset{HeaderSize + bytes[0]}; // skips the image ID
+  if (data.size() < offset) throw std::runtime_error("TGA data is truncated");
+  // checked before anyone allocates the image, so a header can't ask for more pixels than the data holds. An RLE
+  // packet covers at most 128 pixels and takes at least a byte
+  const size_t pixels{static_cast<size_t>(width) * height};
+  if (bytes[2] == 2 ? data.size() - offset < pixels * depth : (data.size() - offset) * 128 < pixels)
+    throw std::runtime_error("TGA data is truncated");
+  return {width, height};
+}
+
+// Decodes a TGA file held in memory into image, which needs the size from PeekSize (std::invalid_argument otherwise).
+// With an Image::Wrap over a reused buffer no pixel memory gets allocated. Throws std::runtime_error on malformed
+// data, image may be partly overwritten then
+inline void DecodeInto(const std::span<const std::byte> data, Image &image) {
+  const Dimensions size{PeekSize(data)};
+  if (image.getWidth() != size.width || image.getHeight() != size.height)
+    throw std::invalid_argument("Image size differs from the TGA header");
+  const auto *bytes{reinterpret_cast<const uint8_t *>(data.data())};
+  const ui width{size.width};
+  const ui height{size.height};
+  const size_t depth{bytes[16] / 8u};
+  const bool topDown{(bytes[17] & 0x20) != 0};
+  const bool rightToLeft{(bytes[17] & 0x10) != 0};
+  const size_t offset{HeaderSize + bytes[0]}; // skips the image ID
+
+  if (bytes[2] == 10) {
+    Pixel *const pixels{image.GetData().data()};
+    readDataRLE(bytes + offset, bytes + data.size(), depth, pixels, image.GetData().size());
+    // pixels are in file order, flip into top-left origin
+    if (!topDown)
+      for (ui y{0}; y < height / 2; ++y)
+        std::swap_ranges(pixels + static_cast<size_t>(y) * width, pixels + static_cast<size_t>(y + 1) * width,
+                         pixels + static_cast<size_t>(height - 1 - y) * width);
+    if (rightToLeft)
+      for (ui y{0}; y < height; ++y)
+        std::reverse(pixels + static_cast<size_t>(y) * width, pixels + static_cast<size_t>(y + 1) * width);
+    return;
+  }
+
+  // PeekSize made sure the data holds every pixel
+  const uint8_t *in{bytes + offset};
+  for (ui y{0}; y < height; ++y) {
+    Pixel *row{image.GetData().data() + static_cast<size_t>(topDown ? y : height - 1 - y) * width};
+    if (depth == 4 && !rightToLeft) {
+      simd::SwapRedBlue(reinterpret_cast<const std::byte *>(in), reinterpret_cast<std::byte *>(row), width);
+      in += static_cast<size_t>(width) * depth;
+      continue;
+    }
+    for (ui x{0}; x < width; ++x, in += depth) {
+      row[rightToLeft ? width - 1 - x : x] = Pixel{in[2], in[1], in[0], depth == 4 ? in[3] : color{255}};
+    }
+  }
+}
+
+// Decodes an uncompressed (type 2) or run-length encoded (type 10) 24 or 32 bit TGA file held in memory. Throws
+// std::runtime_error on malformed or unsupported data
+inline Image Decode(const std::span<const std::byte> data) {
+  const Dimensions size{PeekSize(data)};
+  Image image{size.width, size.height, Image::Uninitialized{}};
+  DecodeInto(data, image);
+  return image;
+}
+
+// Loads a TGA file. ".tga" is appended if FilePath does not end with it (same as GenerateFile)
+inline Image LoadFile(const strv FilePath) {
+  std::ifstream file{FilePath.ends_with(".tga") ? std::string(FilePath) : std::string(FilePath) + ".tga",
+                     std::ios::binary | std::ios::in};
+  if (!file) throw std::runtime_error("Could not open TGA file");
+  const std::vector<char> data{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+  return Decode(std::as_bytes(std::span{data}));
+}
+
+// Same as GenerateFile (stream backend) but writes pixel by pixel
+static inline WriteResult GenerateFileNonOptimized(const Image &image, const strv FilePath) {
+  return WriteFile(FilePath.ends_with(".tga") ? std::string(FilePath) : std::string(FilePath) + ".tga",
+                   OutputBackend::stream, 0, [&](Sink &sink) {
+                     return writeHeader(sink, image) && writeDataNonOptimized(sink, image) && sink.Flush();
+                   });
+}
+
 // Generates a TGA file from the provided image. If FilePath does not end with ".tga",
-// it will be appended.
-inline bool GenerateFile(const Image &image, const strv FilePath) {
+// it will be appended. Written like qoi::GenerateFile, through a temporary file (see WriteFile)
+inline WriteResult GenerateFile(const Image &image, const strv FilePath, const EncodeOptions &Options = {}) {
   std::string filePath;
   if (std::string(FilePath).ends_with(".tga")) filePath = FilePath;
   else filePath = std::string(FilePath) + ".tga";
-  std::ofstream file{filePath, std::ios::binary | std::ios::out};
-  if (!file) return false;
-  return writeHeader(file, image) && writeData(file, image);
+  return WriteFile(filePath, Options.output, MaxEncodedSize(image, Options),
+                   [&](Sink &sink) { return Encode(image, sink, Options); });
 }
 
 } // namespace tga
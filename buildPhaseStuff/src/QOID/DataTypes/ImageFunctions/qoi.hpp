@@ -1,49 +1,64 @@
 #pragma once
 #include "../../QOID_General.hpp"
 #include "../pixel.hpp"
+#include "../simd.hpp"
+#include "../sink.hpp"
+#include "../source.hpp"
 #include "../../image.hpp"
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <bit>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <ios>
-#include <unordered_map>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <thread>
 #include <vector>
 
 namespace QOID {
 class Image;
 namespace qoi {
 
-static inline bool writeTrail(std::ostream &file) {
-#if defined(BIG_ENDIAN)
+// Position of a pixel inside the 64 entry color index (see specification)
+static inline constexpr uint8_t IndexPos(const Pixel px) {
+  return (px.R() * 3 + px.G() * 5 + px.B() * 7 + px.A() * 11) % 64;
+}
+
+static inline bool writeTrail(Sink &file) {
+#if defined(QOID_BIG_ENDIAN)
   static constexpr uint64_t end_marker{0x0000000000000001};
 #else
   static constexpr uint64_t end_marker{0x0100000000000000};
 #endif
-  return !!file.write(reinterpret_cast<const char *>(&end_marker), sizeof(end_marker));
+  return file.Write(&end_marker, sizeof(end_marker));
 }
 
-static inline bool writeHeader(std::ostream &file, const Image &image) {
+// channels is 4 (RGBA) or 3 (RGB, every pixel is opaque). It is informative only, decoders output the same pixels
+static inline bool writeHeader(Sink &file, const ui width, const ui height, const uint8_t channels = 4) {
   std::array<std::byte, 14> buffer{};
 
-  static constexpr uint8_t channels{4}; // will be optimized out anyways
   static constexpr uint8_t colorspace{1};
 
   // Write the "qoif" magic number
   std::memcpy(buffer.data(), "qoif", 4);
 
   // write Width and height according to endian
-#if defined(BIG_ENDIAN)
-  const uint32_t swappedWidth = (image.getWidth());
-  const uint32_t swappedHeight = (image.getHeight());
-  static constexpr uint16_t combined{channels << 8 | colorspace};
+#if defined(QOID_BIG_ENDIAN)
+  const uint32_t swappedWidth = (width);
+  const uint32_t swappedHeight = (height);
+  const uint16_t combined{static_cast<uint16_t>(channels << 8 | colorspace)};
 #else
-  static constexpr uint16_t combined{colorspace << 8 | channels};
-  const uint32_t swappedWidth = std::byteswap(image.getWidth());
-  const uint32_t swappedHeight = std::byteswap(image.getHeight());
+  const uint16_t combined{static_cast<uint16_t>(colorspace << 8 | channels)};
+  const uint32_t swappedWidth = std::byteswap(width);
+  const uint32_t swappedHeight = std::byteswap(height);
 #endif
   std::memcpy(buffer.data() + 4, &swappedWidth, sizeof(swappedWidth));
   std::memcpy(buffer.data() + 8, &swappedHeight, sizeof(swappedHeight));
@@ -51,159 +66,1084 @@ static inline bool writeHeader(std::ostream &file, const Image &image) {
   // Write the combined channels/colorspace value
   std::memcpy(buffer.data() + 12, &combined, sizeof(combined));
 
-  return !!file.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+  return file.Write(buffer.data(), buffer.size());
+}
+
+static inline bool writeHeader(Sink &file, const Image &image) {
+  return writeHeader(file, image.getWidth(), image.getHeight());
+}
+
+// Color index as described by the specification. All entries start out as (0, 0, 0, 0)
+using ColorIndex = std::array<Pixel, 64>;
+
+static inline ColorIndex EmptyIndex() {
+  ColorIndex index;
+  index.fill(Pixel{p_color{0}});
+  return index;
 }
 
+// Encoder state the streaming encoders carry from one row (or any other piece of the image) to the next. A run reaching
+// the end of a piece stays open in run, so runs cross pieces like in writeData and the output is the same
+struct RowState {
+  ColorIndex index{EmptyIndex()};
+  Pixel previous{0, 0, 0, 255};
+  size_t run{0}; // pixels equal to previous that aren't written yet
+};
+
+// Where a decoder can start decoding on its own: the chunk at byteOffset (counted from the start of the file) encodes
+// the pixel at pixelOffset, previous is the decoder's previous pixel at that point and the index is empty. Every band
+// written by writeBand is one
+struct RestartPoint {
+  uint64_t byteOffset;
+  uint64_t pixelOffset;
+  Pixel previous;
+};
+
 namespace {
 
-static inline bool writeDataNonCompressedNonOptimized(std::ostream &file, const Image &image) {
+static inline bool writeDataNonCompressedNonOptimized(Sink &file, const Image &image) {
   static uint8_t tmp{0xFF};
   for (auto i : image.GetData()) {
-    file.write(reinterpret_cast<const char *>(&tmp), sizeof(tmp));
-    file.write(reinterpret_cast<const char *>(&i), sizeof(Pixel));
+    if (!file.Write(&tmp, sizeof(tmp)) || !file.Write(&i, sizeof(Pixel))) return false;
   }
   return true;
 }
 
-static inline void updateIndex(std::unordered_map<p_color, uint8_t> &SeenPixels, const Pixel &px,
-                               unsigned int &SwapNum) {
-  if (SeenPixels.size() >= 64) {
-    auto it = SeenPixels.begin();
-    std::advance(it, SwapNum); // Move iterator to SwapNum-th element
-    SeenPixels.erase(it);      // Erase it in O(1) (on average)
-  }
+// Largest amount of bytes a single WriteToBuffer call writes (OP_RGBA)
+static inline constexpr size_t MaxChunkSize{5};
+
+// Writes the run starting at DataIterator (DataIterator[0] == previous) and advances past it
+static inline void WriteRun(std::byte *&buffer, const Pixel *&DataIterator, const Pixel *const DataEndIt,
+                            const Pixel previous) {
+  constexpr ptrdiff_t maxRunLength = 62;
+  const size_t runCount{
+      simd::RunLength(DataIterator, DataIterator + std::min(maxRunLength, DataEndIt - DataIterator), previous)};
+  uint8_t runMarker = static_cast<uint8_t>((runCount - 1) | 0xC0);
+  std::memcpy(buffer, &runMarker, sizeof(runMarker));
+  buffer += 1;
+  DataIterator += runCount;
+}
+
+static inline void WriteDiff(std::byte *&buffer, const Pixel current, const Pixel previous) {
+  // differences wrap around, like the decoder's uint8 arithmetic
+  const uint8_t diffR = static_cast<uint8_t>(current.R() - previous.R() + 2);
+  const uint8_t diffG = static_cast<uint8_t>(current.G() - previous.G() + 2);
+  const uint8_t diffB = static_cast<uint8_t>(current.B() - previous.B() + 2);
+  const uint8_t comb{static_cast<uint8_t>(0x40 | ((diffR & 0x03) << 4 | (diffG & 0x03) << 2 | (diffB & 0x03)))};
+  std::memcpy(buffer, &comb, sizeof(comb));
+  buffer += 1;
+}
 
-  SeenPixels[px.Pack()] = (px.R() * 3 + px.G() * 5 + px.B() * 7 + px.A() * 11) % 64;
-  SwapNum = (SwapNum + 1) % 64; // Proper circular increment
+static inline void WriteLuma(std::byte *&buffer, const Pixel current, const Pixel previous) {
+  const int8_t dg = static_cast<int8_t>(current.G() - previous.G());
+  const int8_t dr = static_cast<int8_t>(static_cast<int8_t>(current.R() - previous.R()) - dg);
+  const int8_t db = static_cast<int8_t>(static_cast<int8_t>(current.B() - previous.B()) - dg);
+  uint8_t encodedDG = static_cast<uint8_t>(dg + 32); // Range: 0 to 63.
+  uint8_t encodedDR = static_cast<uint8_t>(dr + 8);  // Range: 0 to 15.
+  uint8_t encodedDB = static_cast<uint8_t>(db + 8);  // Range: 0 to 15.
+#if defined(QOID_BIG_ENDIAN)
+  const uint16_t comb{static_cast<uint16_t>(0x8000 | (encodedDG << 8) | (encodedDR << 4) | encodedDB)};
+#else
+  const uint16_t comb{std::byteswap(static_cast<uint16_t>(0x8000 | (encodedDG << 8) | (encodedDR << 4) | encodedDB))};
+#endif
+  std::memcpy(buffer, &comb, sizeof(comb));
+  buffer += 2;
 }
-static inline void WriteFirstCol(std::vector<std::byte> &buffer, std::vector<Pixel>::const_iterator &DataIterator,
-                                 std::unordered_map<p_color, uint8_t> &SeenPixels, size_t &bufferIndex,
-                                 unsigned int &SwapNum) {
+
+static inline void WriteRGB(std::byte *&buffer, const Pixel current) {
+  const std::array<uint8_t, 4> rgb{0xFE, current.R(), current.G(), current.B()};
+  std::memcpy(buffer, rgb.data(), rgb.size());
+  buffer += rgb.size();
+}
+
+// the packed pixel is laid out as R, G, B, A in memory
+static inline void WriteRGBA(std::byte *&buffer, const Pixel current) {
   static constexpr uint8_t Uint8Tmp{0xFF};
-  std::memcpy(buffer.data() + bufferIndex, &Uint8Tmp, sizeof(Uint8Tmp));
-  std::memcpy(buffer.data() + bufferIndex + 1, &(*DataIterator), sizeof(Pixel));
-  updateIndex(SeenPixels, *DataIterator, SwapNum);
+  std::memcpy(buffer, &Uint8Tmp, sizeof(Uint8Tmp));
+  std::memcpy(buffer + 1, &current, sizeof(Pixel));
+  buffer += sizeof(Pixel) + sizeof(Uint8Tmp);
+}
+
+// Encodes the pixel at DataIterator (or the run starting there) to buffer and advances both. Opaque encoders know every
+// pixel (and the initial previous pixel) has alpha 255, so the alpha checks and OP_RGBA drop out of the loop
+template <bool Opaque = false>
+static inline void WriteToBuffer(std::byte *&buffer, const Pixel *&DataIterator, ColorIndex &SeenPixels,
+                                 const Pixel *const DataEndIt, Pixel &previous) {
+  const Pixel current{*DataIterator};
+  if (current == previous) { // RUN
+    WriteRun(buffer, DataIterator, DataEndIt, previous);
+    return;
+  }
   ++DataIterator;
-  bufferIndex += sizeof(Pixel) + sizeof(Uint8Tmp);
-  return;
+
+  const uint8_t indexPos{IndexPos(current)};
+  if (SeenPixels[indexPos] == current) { // INDEX
+    std::memcpy(buffer, &indexPos, sizeof(indexPos));
+    ++buffer;
+    previous = current;
+    return;
+  }
+  SeenPixels[indexPos] = current;
+
+  if (Opaque || current.A() == previous.A()) {
+    const int8_t diffR = static_cast<int8_t>(current.R() - previous.R());
+    const int8_t diffG = static_cast<int8_t>(current.G() - previous.G());
+    const int8_t diffB = static_cast<int8_t>(current.B() - previous.B());
+    const int8_t dr = static_cast<int8_t>(diffR - diffG);
+    const int8_t db = static_cast<int8_t>(diffB - diffG);
+    if ((diffR >= -2 && diffR <= 1) && (diffG >= -2 && diffG <= 1) && (diffB >= -2 && diffB <= 1)) { // DIFF
+      WriteDiff(buffer, current, previous);
+    } else if ((diffG >= -32 && diffG <= 31) && (dr >= -8 && dr <= 7) && (db >= -8 && db <= 7)) { // LUMA
+      WriteLuma(buffer, current, previous);
+    } else {
+      WriteRGB(buffer, current);
+    }
+  } else {
+    WriteRGBA(buffer, current);
+  }
+  previous = current;
+}
+
+// Same as calling WriteToBuffer for the next 8 pixels, but the RUN/DIFF/LUMA checks of all 8 come from one
+// simd::Classify8. Needs previous == DataIterator[-1] and 8 readable pixels. Runs can continue past the block.
+template <bool Opaque = false>
+static inline void WriteBlock(std::byte *&buffer, const Pixel *&DataIterator, ColorIndex &SeenPixels,
+                              const Pixel *const DataEndIt, Pixel &previous) {
+  const Pixel *const blockBegin{DataIterator};
+  const simd::BlockMasks masks{simd::Classify8(blockBegin)};
+  while (DataIterator < blockBegin + 8) {
+    const uint32_t bit{1u << (DataIterator - blockBegin)};
+    if (masks.run & bit) {
+      WriteRun(buffer, DataIterator, DataEndIt, previous);
+      continue;
+    }
+    const Pixel current{*DataIterator++};
+    const uint8_t indexPos{IndexPos(current)};
+    if (SeenPixels[indexPos] == current) { // INDEX
+      std::memcpy(buffer, &indexPos, sizeof(indexPos));
+      ++buffer;
+    } else {
+      SeenPixels[indexPos] = current;
+      if (masks.diff & bit) WriteDiff(buffer, current, previous);
+      else if (masks.luma & bit) WriteLuma(buffer, current, previous);
+      else if (Opaque || current.A() == previous.A()) WriteRGB(buffer, current);
+      else WriteRGBA(buffer, current);
+    }
+    previous = current;
+  }
+}
+
+// Encodes [DataIterator, BatchEnd) without checking for space: every step consumes at least one pixel and
+// writes at most MaxChunkSize bytes, so (BatchEnd - DataIterator) * MaxChunkSize bytes are always enough. Runs may
+// continue up to DataEndIt. previous has to equal DataIterator[-1]
+template <bool Opaque = false>
+static inline void WritePixels(std::byte *&buffer, const Pixel *&DataIterator, const Pixel *const BatchEnd,
+                               const Pixel *const DataEndIt, ColorIndex &SeenPixels, Pixel &previous) {
+  if (simd::Active() != simd::Level::scalar) {
+    while (BatchEnd - DataIterator >= 8) WriteBlock<Opaque>(buffer, DataIterator, SeenPixels, DataEndIt, previous);
+  }
+  while (DataIterator < BatchEnd) WriteToBuffer<Opaque>(buffer, DataIterator, SeenPixels, DataEndIt, previous);
+}
+
+// Encodes [DataIterator, DataEndIt) into file, checking for space once per batch. previous has to equal
+// DataIterator[-1]
+template <bool Opaque = false>
+static inline bool writeRange(Sink &file, const Pixel *DataIterator, const Pixel *const DataEndIt,
+                              ColorIndex &SeenPixels, Pixel &previous) {
+  while (DataIterator < DataEndIt) {
+    if (!file.Reserve(MaxChunkSize)) return false;
+    std::byte *buffer{file.Pos()};
+    const size_t batch{std::min<size_t>(file.Available() / MaxChunkSize, DataEndIt - DataIterator)};
+    WritePixels<Opaque>(buffer, DataIterator, DataIterator + batch, DataEndIt, SeenPixels, previous);
+    file.Advance(buffer);
+  }
+  return true;
+}
+
+template <bool Opaque = false> static inline bool writeData(Sink &file, const Image &image) {
+  const auto &RawDataVec{image.GetData()};
+  const Pixel *DataIterator{RawDataVec.data()};
+  const Pixel *const DataEndIt{DataIterator + RawDataVec.size()};
+  ColorIndex SeenPixels{EmptyIndex()};
+  Pixel previous{0, 0, 0, 255};
+  if (DataIterator == DataEndIt) return true;
+
+  // the first pixel is compared against the initial previous pixel, everything after it against its predecessor
+  if (!file.Reserve(MaxChunkSize)) return false;
+  std::byte *buffer{file.Pos()};
+  WriteToBuffer<Opaque>(buffer, DataIterator, SeenPixels, DataEndIt, previous);
+  file.Advance(buffer);
+  return writeRange<Opaque>(file, DataIterator, DataEndIt, SeenPixels, previous);
+}
+
+// Near-lossless encoding (EncodeOptions::maxError). Every pixel is replaced by the cheapest pixel within Tolerance of
+// it in every channel that the decoder reaches from its previous pixel: the previous pixel itself (RUN), an index
+// entry (INDEX) or one DIFF / LUMA step. previous and the index hold what the decoder reconstructs, not the input, so
+// no pixel is ever off by more than Tolerance and the errors don't add up along the image
+
+// The 4 channels of a packed pixel in 16 bit lanes
+static inline uint64_t SpreadChannels(const p_color Packed) {
+  uint64_t lanes{Packed};
+  lanes = (lanes | lanes << 16) & 0x0000FFFF0000FFFFull;
+  return (lanes | lanes << 8) & 0x00FF00FF00FF00FFull;
+}
+
+// Every channel of a within Tolerance of b. All 4 channels at once without a branch, on noisy images the outcome is
+// random and a branch per channel costs more than the arithmetic
+static inline bool Within(const Pixel a, const Pixel b, const int Tolerance) {
+  constexpr uint64_t ones{0x0001000100010001ull}, signs{0x8000800080008000ull};
+  const auto t{static_cast<uint64_t>(Tolerance)};
+  // each lane is a - b + 0x100 + Tolerance, which lies in [0x100, 0x100 + 2 * Tolerance] exactly if a is within
+  const uint64_t lanes{SpreadChannels(a.packed) + (0x100 + t) * ones - SpreadChannels(b.packed)};
+  const uint64_t atLeast{lanes + (0x8000 - 0x100) * ones}, atMost{lanes + (0x8000 - 0x101 - 2 * t) * ones};
+  return (atLeast & ~atMost & signs) == signs;
+}
+
+// Difference like the decoder sees it, channels wrap around
+static inline int WrappedDelta(const color current, const color previous) {
+  return static_cast<int8_t>(static_cast<uint8_t>(current - previous));
 }
 
-static inline void WriteToBuffer(std::vector<std::byte> &buffer, std::vector<Pixel>::const_iterator &DataIterator,
-                                 std::unordered_map<p_color, uint8_t> &SeenPixels, size_t &bufferIndex,
-                                 const auto &DataEndIt, unsigned int &SwapNum) {
-  if (DataIterator->packed == (DataIterator - 1)->packed) // RUN
+// Pixel within Tolerance of current a DIFF chunk reaches from previous, false if there is none. Alpha has to be
+// within Tolerance of previous (DIFF keeps it)
+static inline bool SnapDiff(const Pixel current, const Pixel previous, const int Tolerance, Pixel &snapped) {
+  const int dR{WrappedDelta(current.R(), previous.R())}, dG{WrappedDelta(current.G(), previous.G())},
+      dB{WrappedDelta(current.B(), previous.B())};
+  snapped = Pixel{static_cast<color>(previous.R() + std::clamp(dR, -2, 1)),
+                  static_cast<color>(previous.G() + std::clamp(dG, -2, 1)),
+                  static_cast<color>(previous.B() + std::clamp(dB, -2, 1)), previous.A()};
+  // a clamped step near 0 or 255 can wrap to the other end, so the error is measured on the result
+  return Within(snapped, current, Tolerance);
+}
+
+// Pixel within Tolerance of current a LUMA chunk reaches from previous, false if there is none. Picks the green step
+// closest to the real one that keeps red and blue within reach (dr and db are relative to the green step)
+static inline bool SnapLuma(const Pixel current, const Pixel previous, const int Tolerance, Pixel &snapped) {
+  const int dR{WrappedDelta(current.R(), previous.R())}, dG{WrappedDelta(current.G(), previous.G())},
+      dB{WrappedDelta(current.B(), previous.B())};
+  const int low{std::max({dG - Tolerance, -32, dR - Tolerance - 7, dB - Tolerance - 7})};
+  const int high{std::min({dG + Tolerance, 31, dR + Tolerance + 8, dB + Tolerance + 8})};
+  if (low > high) return false;
+  const int dg{std::clamp(dG, low, high)};
+  snapped = Pixel{static_cast<color>(previous.R() + dg + std::clamp(dR - dg, -8, 7)),
+                  static_cast<color>(previous.G() + dg),
+                  static_cast<color>(previous.B() + dg + std::clamp(dB - dg, -8, 7)), previous.A()};
+  return Within(snapped, current, Tolerance);
+}
+
+// Index slot holding a pixel within Tolerance of current, -1 if there is none. Slots still holding the initial
+// (0, 0, 0, 0) outside their own hash position are skipped, decoders differ in when they overwrite those
+static inline int FindIndexEntry(const ColorIndex &SeenPixels, const Pixel current, const int Tolerance) {
+  const size_t size{SeenPixels.size()};
+  for (size_t slot{0}; slot < size; ++slot) {
+    slot += simd::FindWithin(SeenPixels.data() + slot, size - slot, current, static_cast<uint8_t>(Tolerance));
+    if (slot < size && IndexPos(SeenPixels[slot]) == slot) return static_cast<int>(slot);
+  }
+  return -1;
+}
+
+// Near-lossless counterpart of WriteToBuffer, previous and SeenPixels are the decoder's state. Fast only searches the
+// index for pixels DIFF and LUMA can't reach (see EncodeOptions::nearFast)
+template <bool Fast>
+static inline void WriteToBufferNear(std::byte *&buffer, const Pixel *&DataIterator, ColorIndex &SeenPixels,
+                                     const Pixel *const DataEndIt, Pixel &previous, const int Tolerance) {
+  if (Within(*DataIterator, previous, Tolerance)) { // RUN
+    const Pixel *const runEnd{DataIterator + std::min<ptrdiff_t>(62, DataEndIt - DataIterator)};
+    const Pixel *const runBegin{DataIterator};
+    while (DataIterator < runEnd && Within(*DataIterator, previous, Tolerance)) ++DataIterator;
+    const uint8_t runMarker{static_cast<uint8_t>((DataIterator - runBegin - 1) | 0xC0)};
+    std::memcpy(buffer, &runMarker, sizeof(runMarker));
+    ++buffer;
+    return;
+  }
+  const Pixel current{*DataIterator++};
+
+  uint8_t indexPos{IndexPos(current)};
+  if (SeenPixels[indexPos] == current) { // INDEX, exact
+    std::memcpy(buffer, &indexPos, sizeof(indexPos));
+    ++buffer;
+    previous = current;
+    return;
+  }
+
+  // smallest chunk first. DIFF goes before the index search because it is cheaper to check. The search scans all 64
+  // slots, Fast saves it for the pixels that would need RGB / RGBA otherwise
+  Pixel snapped{current};
+  const bool sameAlpha{std::abs(current.A() - previous.A()) <= Tolerance};
+  if (sameAlpha && SnapDiff(current, previous, Tolerance, snapped)) {
+    WriteDiff(buffer, snapped, previous);
+  } else if (Fast && sameAlpha && SnapLuma(current, previous, Tolerance, snapped)) {
+    WriteLuma(buffer, snapped, previous);
+  } else if (const int slot{FindIndexEntry(SeenPixels, current, Tolerance)}; slot >= 0) {
+    indexPos = static_cast<uint8_t>(slot);
+    std::memcpy(buffer, &indexPos, sizeof(indexPos));
+    ++buffer;
+    previous = SeenPixels[indexPos];
+    return;
+  } else if (!Fast && sameAlpha && SnapLuma(current, previous, Tolerance, snapped)) {
+    WriteLuma(buffer, snapped, previous);
+  } else if (sameAlpha) {
+    snapped = Pixel{current.R(), current.G(), current.B(), previous.A()};
+    WriteRGB(buffer, snapped);
+  } else WriteRGBA(buffer, current);
+  SeenPixels[IndexPos(snapped)] = snapped;
+  previous = snapped;
+}
+
+// Near-lossless counterpart of writeData, always serial
+template <bool Fast> static inline bool writeDataNear(Sink &file, const Image &image, const int Tolerance) {
+  const Pixel *DataIterator{image.GetData().data()};
+  const Pixel *const DataEndIt{DataIterator + image.GetData().size()};
+  ColorIndex SeenPixels{EmptyIndex()};
+  Pixel previous{0, 0, 0, 255};
+  while (DataIterator < DataEndIt) {
+    if (!file.Reserve(MaxChunkSize)) return false;
+    std::byte *buffer{file.Pos()};
+    const size_t batch{std::min<size_t>(file.Available() / MaxChunkSize, DataEndIt - DataIterator)};
+    const Pixel *const BatchEnd{DataIterator + batch};
+    while (DataIterator < BatchEnd)
+      WriteToBufferNear<Fast>(buffer, DataIterator, SeenPixels, DataEndIt, previous, Tolerance);
+    file.Advance(buffer);
+  }
+  return true;
+}
+
+// Writes the open run as RUN chunks of at most 62 pixels
+static inline bool writeOpenRun(Sink &file, RowState &State) {
+  while (State.run) {
+    const size_t length{std::min<size_t>(State.run, 62)};
+    const uint8_t runMarker{static_cast<uint8_t>((length - 1) | 0xC0)};
+    if (!file.Write(&runMarker, sizeof(runMarker))) return false;
+    State.run -= length;
+  }
+  return true;
+}
+
+// Encodes the next pixels of the image [DataIterator, DataEndIt), usually a row. Pixels of earlier pieces are never
+// read, only State
+static inline bool writeRow(Sink &file, RowState &State, const Pixel *DataIterator, const Pixel *const DataEndIt) {
+  // the open run continues as long as the row starts with the previous pixel
+  const size_t leading{simd::RunLength(DataIterator, DataEndIt, State.previous)};
+  State.run += leading;
+  DataIterator += leading;
+  if (DataIterator == DataEndIt) return true;
+  if (!writeOpenRun(file, State)) return false;
+
+  // the pixels equal to the last one at the end of the piece start a run that may go on in the next one, so everything
+  // after the first of them is left open. The first one differs from its predecessor and is encoded here
+  const Pixel *stop{DataEndIt - 1};
+  while (stop > DataIterator && stop[-1] == *stop) --stop;
+  ++stop;
+
+  // DataIterator differs from previous, so WriteToBuffer doesn't start a run that would read the previous row
+  if (!file.Reserve(MaxChunkSize)) return false;
+  std::byte *buffer{file.Pos()};
+  WriteToBuffer(buffer, DataIterator, State.index, stop, State.previous);
+  file.Advance(buffer);
+  if (!writeRange(file, DataIterator, stop, State.index, State.previous)) return false;
+  State.run = static_cast<size_t>(DataEndIt - stop);
+  return true;
+}
+
+// Index for a band that doesn't know what the decoder's index holds. A lookup only hits when the slot holds the
+// pixel itself, so zeroed slots can only produce false hits for (0, 0, 0, 0) in slot 0. Slot 0 therefore gets a
+// pixel hashing elsewhere, and no slot can hit before the band wrote it.
+static inline ColorIndex BandIndex() {
+  ColorIndex index{EmptyIndex()};
+  index[0] = Pixel{1, 0, 0, 0};
+  return index;
+}
+
+// Writes the first pixel of a band as OP_RGBA (OP_RGB is enough when the decoder's previous alpha is 255 anyway)
+template <bool Opaque> static inline void WriteBandStart(std::byte *&buffer, const Pixel first) {
+  if constexpr (Opaque) WriteRGB(buffer, first);
+  else WriteRGBA(buffer, first);
+}
+
+// Encodes [begin, end) independently from the pixels before it. The first pixel is written in full to resync the
+// previous pixel, so the bands can be encoded in any order and concatenated into a standard qoi stream.
+template <bool Opaque = false>
+static inline void writeBand(std::vector<std::byte> &buffer, const Pixel *begin, const Pixel *const end) {
+  buffer.resize(static_cast<size_t>(end - begin) * MaxChunkSize);
+  ColorIndex SeenPixels{BandIndex()};
+  Pixel previous{*begin};
+  SeenPixels[IndexPos(previous)] = previous;
+  std::byte *out{buffer.data()};
+  WriteBandStart<Opaque>(out, previous);
+
+  ++begin;
+  WritePixels<Opaque>(out, begin, end, end, SeenPixels, previous);
+  buffer.resize(static_cast<size_t>(out - buffer.data()));
+}
+
+// Restart points are stored after the end marker, so standard decoders never see them:
+//   per point: byte offset (8), pixel offset (8), previous pixel (4, R G B A)
+//   point count (4), "qoiR"
+// all integers are big endian like the header
+static inline constexpr size_t RestartEntrySize{20};
+static inline constexpr size_t RestartFooterSize{8};
+static inline constexpr std::array<char, 4> RestartMagic{'q', 'o', 'i', 'R'};
+
+static inline RestartPoint MakeRestartPoint(const Image &image, const size_t PixelOffset, const size_t ByteOffset) {
+  return {ByteOffset, PixelOffset, PixelOffset ? image.GetData()[PixelOffset - 1] : Pixel{0, 0, 0, 255}};
+}
+
+// Serial counterpart of writeDataParallel for files with restart points, each band starts like in writeBand but is
+// encoded straight into the sink
+template <bool Opaque = false>
+static inline bool writeDataBands(Sink &file, const Image &image, const size_t bandPixels,
+                                  std::vector<RestartPoint> &Restarts) {
+  const Pixel *const begin{image.GetData().data()};
+  const size_t ImageSize{image.GetData().size()};
+  for (size_t start{0}; start < ImageSize; start += bandPixels) {
+    Restarts.push_back(MakeRestartPoint(image, start, file.Written()));
+    if (!file.Reserve(MaxChunkSize)) return false;
+    ColorIndex SeenPixels{BandIndex()};
+    Pixel previous{begin[start]};
+    SeenPixels[IndexPos(previous)] = previous;
+    std::byte *buffer{file.Pos()};
+    WriteBandStart<Opaque>(buffer, previous);
+    file.Advance(buffer);
+    const Pixel *const bandEnd{begin + std::min(ImageSize, start + bandPixels)};
+    if (!writeRange<Opaque>(file, begin + start + 1, bandEnd, SeenPixels, previous)) return false;
+  }
+  return true;
+}
+
+// Splits the image into bands of rows which worker threads encode into their own buffers, then writes the buffers
+// in order. Every band start is added to Restarts if it isn't null. Bands holds the band buffers if it isn't null, so
+// they can be reused by the next call
+template <bool Opaque = false>
+static inline bool writeDataParallel(Sink &file, const Image &image, const EncodeOptions &Options,
+                                     std::vector<RestartPoint> *Restarts = nullptr,
+                                     std::vector<std::vector<std::byte>> *Bands = nullptr) {
+  const unsigned threads{Options.threads ? Options.threads : std::max(1u, std::thread::hardware_concurrency())};
+  // a few bands per thread so uneven bands still keep every thread busy
+  const size_t targetBands{size_t{threads} * 4};
+  const ui autoRows{static_cast<ui>(std::max<size_t>(16, (image.getHeight() + targetBands - 1) / targetBands))};
+  const ui bandRows{Options.restartRows ? Options.restartRows : Options.bandRows ? Options.bandRows : autoRows};
+  const size_t bandPixels{static_cast<size_t>(bandRows) * image.getWidth()};
+  const size_t ImageSize{image.GetData().size()};
+  if (ImageSize == 0) return true;
+  const size_t bandCount{(ImageSize + bandPixels - 1) / bandPixels};
+
+  std::vector<std::vector<std::byte>> ownBands;
+  std::vector<std::vector<std::byte>> &bands{Bands ? *Bands : ownBands};
+  if (bands.size() < bandCount) bands.resize(bandCount);
+  std::atomic<size_t> nextBand{0};
+  auto worker = [&]() {
+    for (size_t band{nextBand++}; band < bandCount; band = nextBand++) {
+      const Pixel *const begin{image.GetData().data()};
+      writeBand<Opaque>(bands[band], begin + band * bandPixels, begin + std::min(ImageSize, (band + 1) * bandPixels));
+    }
+  };
   {
-    constexpr size_t maxRunLength = 62;
-    size_t runCount = 1;
-    while (runCount < maxRunLength && (DataIterator + runCount) != DataEndIt &&
-           (DataIterator + runCount)->packed == DataIterator->packed) {
-      ++runCount;
+    std::vector<std::jthread> workers;
+    for (unsigned i{1}; i < std::min<size_t>(threads, bandCount); ++i) workers.emplace_back(worker);
+    worker();
+  }
+
+  for (size_t band{0}; band < bandCount; ++band) {
+    if (Restarts) Restarts->push_back(MakeRestartPoint(image, band * bandPixels, file.Written()));
+    if (!file.Write(bands[band].data(), bands[band].size())) return false;
+  }
+  return true;
+}
+
+static inline bool writeRestarts(Sink &file, const std::vector<RestartPoint> &Restarts) {
+  for (const RestartPoint &point : Restarts) {
+    std::array<uint8_t, RestartEntrySize> entry;
+    for (size_t i{0}; i < 8; ++i) {
+      entry[i] = static_cast<uint8_t>(point.byteOffset >> (56 - i * 8));
+      entry[8 + i] = static_cast<uint8_t>(point.pixelOffset >> (56 - i * 8));
+    }
+    entry[16] = point.previous.R();
+    entry[17] = point.previous.G();
+    entry[18] = point.previous.B();
+    entry[19] = point.previous.A();
+    if (!file.Write(entry.data(), entry.size())) return false;
+  }
+  const uint32_t count{static_cast<uint32_t>(Restarts.size())};
+  const std::array<uint8_t, 4> countBytes{static_cast<uint8_t>(count >> 24), static_cast<uint8_t>(count >> 16),
+                                          static_cast<uint8_t>(count >> 8), static_cast<uint8_t>(count)};
+  return file.Write(countBytes.data(), countBytes.size()) && file.Write(RestartMagic.data(), RestartMagic.size());
+}
+
+static inline constexpr size_t HeaderSize{14};
+static inline constexpr size_t TrailSize{8};
+
+static inline constexpr uint32_t readBE32(const uint8_t *bytes) {
+  return static_cast<uint32_t>(bytes[0]) << 24 | static_cast<uint32_t>(bytes[1]) << 16 |
+         static_cast<uint32_t>(bytes[2]) << 8 | static_cast<uint32_t>(bytes[3]);
+}
+
+// Decodes the chunk stream [in, end) into out. end points at the end marker (or at a later chunk), so reading up to 4
+// bytes past it (the payload of OP_RGB/OP_RGBA) is always inside the data. Returns false if the stream ends too early.
+// previous is the decoder state to start from, the index always starts out empty
+static inline bool readData(const uint8_t *in, const uint8_t *const end, Pixel *out, const size_t pixelCount,
+                            const Pixel previous = Pixel{0, 0, 0, 255}) {
+  ColorIndex index{EmptyIndex()};
+  uint8_t r{previous.R()}, g{previous.G()}, b{previous.B()}, a{previous.A()};
+  Pixel px{previous};
+  const Pixel *const outEnd{out + pixelCount};
+
+  while (out < outEnd) {
+    if (in >= end) return false;
+    const uint8_t op{*in++};
+    if (op < 0x40) { // INDEX
+      px = index[op];
+      r = px.R();
+      g = px.G();
+      b = px.B();
+      a = px.A();
+      *out++ = px;
+      continue;
+    }
+    if (op < 0x80) { // DIFF
+      r += ((op >> 4) & 0x03) - 2;
+      g += ((op >> 2) & 0x03) - 2;
+      b += (op & 0x03) - 2;
+    } else if (op < 0xC0) { // LUMA
+      const int dg{(op & 0x3F) - 32};
+      const uint8_t drdb{*in++};
+      r += dg - 8 + (drdb >> 4);
+      g += dg;
+      b += dg - 8 + (drdb & 0x0F);
+    } else if (op < 0xFE) { // RUN, the pixel is already in the index
+      const size_t run{std::min<size_t>((op & 0x3F) + 1, static_cast<size_t>(outEnd - out))};
+      out = std::fill_n(out, run, px);
+      continue;
+    } else if (op == 0xFE) { // RGB
+      r = in[0];
+      g = in[1];
+      b = in[2];
+      in += 3;
+    } else { // RGBA
+      r = in[0];
+      g = in[1];
+      b = in[2];
+      a = in[3];
+      in += 4;
+    }
+    px = Pixel{r, g, b, a};
+    index[IndexPos(px)] = px;
+    *out++ = px;
+  }
+  return true;
+}
+
+static inline constexpr uint64_t readBE64(const uint8_t *bytes) {
+  return static_cast<uint64_t>(readBE32(bytes)) << 32 | readBE32(bytes + 4);
+}
+
+// Reads the restart points at the end of data. Returns an empty vector if there are none or they don't describe a
+// usable split of the pixelCount pixels, the file then simply gets decoded serially
+static inline std::vector<RestartPoint> readRestarts(const std::span<const std::byte> data, const size_t pixelCount) {
+  const auto *bytes{reinterpret_cast<const uint8_t *>(data.data())};
+  if (data.size() < HeaderSize + TrailSize + RestartFooterSize) return {};
+  const uint8_t *const footer{bytes + data.size() - RestartFooterSize};
+  if (std::memcmp(footer + 4, RestartMagic.data(), RestartMagic.size()) != 0) return {};
+
+  const size_t count{readBE32(footer)};
+  if (count == 0 || count > (data.size() - HeaderSize - TrailSize - RestartFooterSize) / RestartEntrySize) return {};
+  const uint8_t *const entries{footer - count * RestartEntrySize};
+  // the chunk has to directly follow the end marker
+  static constexpr std::array<uint8_t, TrailSize> endMarker{0, 0, 0, 0, 0, 0, 0, 1};
+  if (std::memcmp(entries - TrailSize, endMarker.data(), TrailSize) != 0) return {};
+
+  std::vector<RestartPoint> restarts(count);
+  const uint64_t streamEnd{static_cast<uint64_t>(entries - TrailSize - bytes)};
+  for (size_t i{0}; i < count; ++i) {
+    const uint8_t *const entry{entries + i * RestartEntrySize};
+    restarts[i] = {readBE64(entry), readBE64(entry + 8), Pixel{entry[16], entry[17], entry[18], entry[19]}};
+    const bool first{i == 0};
+    if (restarts[i].byteOffset < HeaderSize || restarts[i].byteOffset >= streamEnd ||
+        restarts[i].pixelOffset >= pixelCount || (first && restarts[i].pixelOffset != 0) ||
+        (!first && (restarts[i].byteOffset <= restarts[i - 1].byteOffset ||
+                    restarts[i].pixelOffset <= restarts[i - 1].pixelOffset)))
+      return {};
+  }
+  return restarts;
+}
+
+// Decodes the pieces between restart points on up to Threads threads
+static inline bool readDataParallel(const uint8_t *bytes, const uint8_t *const end, Pixel *out,
+                                    const size_t pixelCount, const std::vector<RestartPoint> &Restarts,
+                                    const unsigned Threads) {
+  std::atomic<size_t> nextPiece{0};
+  std::atomic<bool> failed{false};
+  auto worker = [&]() {
+    for (size_t piece{nextPiece++}; piece < Restarts.size(); piece = nextPiece++) {
+      const RestartPoint &point{Restarts[piece]};
+      const bool last{piece + 1 == Restarts.size()};
+      const uint8_t *const pieceEnd{last ? end : bytes + Restarts[piece + 1].byteOffset};
+      const size_t pieceEndPixel{last ? pixelCount : Restarts[piece + 1].pixelOffset};
+      if (!readData(bytes + point.byteOffset, pieceEnd, out + point.pixelOffset, pieceEndPixel - point.pixelOffset,
+                    point.previous))
+        failed = true;
     }
-    uint8_t runMarker = static_cast<uint8_t>((runCount - 1) | 0xC0);
-    std::memcpy(buffer.data() + bufferIndex, &runMarker, sizeof(runMarker));
-    bufferIndex += 1;
-    DataIterator += runCount;
+  };
+  {
+    std::vector<std::jthread> workers;
+    for (unsigned i{1}; i < std::min<size_t>(Threads, Restarts.size()); ++i) workers.emplace_back(worker);
+    worker();
+  }
+  return !failed;
+}
+
+} // namespace
+
+// Reads and checks the header of a qoi file held in memory. Throws std::runtime_error like Decode
+inline Dimensions PeekSize(const std::span<const std::byte> data) {
+  if (data.size() < HeaderSize + TrailSize) throw std::runtime_error("QOI data is too small");
+  const auto *bytes{reinterpret_cast<const uint8_t *>(data.data())};
+  if (std::memcmp(bytes, "qoif", 4) != 0) throw std::runtime_error("QOI magic number missing");
+
+  const ui width{readBE32(bytes + 4)};
+  const ui height{readBE32(bytes + 8)};
+  const uint8_t channels{bytes[12]};
+  const uint8_t colorspace{bytes[13]};
+  if (width == 0 || height == 0 || channels < 3 || channels > 4 || colorspace > 1)
+    throw std::runtime_error("Invalid QOI header");
+
+  // a single byte encodes at most 62 pixels (RUN), anything above can't be valid
+  if (static_cast<size_t>(width) * height > (data.size() - HeaderSize - TrailSize) * 62)
+    throw std::runtime_error("QOI data is truncated");
+  return {width, height};
+}
+
+// Decodes a complete qoi file held in memory into image, which needs the size from PeekSize (std::invalid_argument
+// otherwise). With an Image::Wrap over a reused buffer no pixel memory gets allocated. Throws std::runtime_error on
+// malformed data, image may be partly overwritten then
+inline void DecodeInto(const std::span<const std::byte> data, Image &image, const DecodeOptions &Options = {}) {
+  const Dimensions size{PeekSize(data)};
+  if (image.getWidth() != size.width || image.getHeight() != size.height)
+    throw std::invalid_argument("Image size differs from the QOI header");
+  const auto *bytes{reinterpret_cast<const uint8_t *>(data.data())};
+  const size_t pixelCount{image.GetData().size()};
+  const unsigned threads{Options.threads ? Options.threads : std::max(1u, std::thread::hardware_concurrency())};
+  const std::vector<RestartPoint> restarts{threads > 1 ? readRestarts(data, pixelCount)
+                                                       : std::vector<RestartPoint>{}};
+  if (restarts.size() > 1) {
+    const uint8_t *const end{bytes + data.size() - RestartFooterSize - restarts.size() * RestartEntrySize - TrailSize};
+    if (!readDataParallel(bytes, end, image.GetData().data(), pixelCount, restarts, threads))
+      throw std::runtime_error("QOI data is truncated");
     return;
   }
+  if (!readData(bytes + HeaderSize, bytes + data.size() - TrailSize, image.GetData().data(), pixelCount))
+    throw std::runtime_error("QOI data is truncated");
+}
+
+// Decodes a complete qoi file held in memory. Throws std::runtime_error on malformed data. Files with restart points
+// (EncodeOptions::restartRows) are decoded on Options.threads threads
+inline Image Decode(const std::span<const std::byte> data, const DecodeOptions &Options = {}) {
+  const Dimensions size{PeekSize(data)};
+  Image image{size.width, size.height, Image::Uninitialized{}};
+  DecodeInto(data, image, Options);
+  return image;
+}
+
+// Decodes a qoi file from a stream (reads until end of stream)
+inline Image Decode(std::istream &stream, const DecodeOptions &Options = {}) {
+  const std::vector<char> data{std::istreambuf_iterator<char>{stream}, std::istreambuf_iterator<char>{}};
+  return Decode(std::as_bytes(std::span{data}), Options);
+}
+
+// Loads a qoi file. ".qoi" is appended if FilePath does not end with it (same as GenerateFile)
+inline Image LoadFile(const strv FilePath, const DecodeOptions &Options = {}) {
+  std::ifstream file{FilePath.ends_with(".qoi") ? std::string(FilePath) : std::string(FilePath) + ".qoi",
+                     std::ios::binary | std::ios::in};
+  if (!file) throw std::runtime_error("Could not open QOI file");
+  return Decode(file, Options);
+}
+
+// Pixel data of Encode, collects the restart points into Restarts if Options asks for them. Bands are the band buffers
+// of the parallel encoder, see writeDataParallel
+template <bool Opaque>
+static inline bool writeImageData(Sink &sink, const Image &image, const EncodeOptions &Options,
+                                  std::vector<RestartPoint> &Restarts,
+                                  std::vector<std::vector<std::byte>> *Bands = nullptr) {
+  if (Options.maxError)
+    return Options.nearFast ? writeDataNear<true>(sink, image, Options.maxError)
+                            : writeDataNear<false>(sink, image, Options.maxError);
+  if (!Options.restartRows)
+    return Options.threads == 1 ? writeData<Opaque>(sink, image)
+                                : writeDataParallel<Opaque>(sink, image, Options, nullptr, Bands);
+
+  const size_t bandPixels{static_cast<size_t>(Options.restartRows) * image.getWidth()};
+  return Options.threads == 1 ? writeDataBands<Opaque>(sink, image, bandPixels, Restarts)
+                              : writeDataParallel<Opaque>(sink, image, Options, &Restarts, Bands);
+}
+
+// Everything of Encode after the pixel data
+static inline bool writeImageEnd(Sink &sink, const EncodeOptions &Options, const std::vector<RestartPoint> &Restarts) {
+  return writeTrail(sink) && (!Options.restartRows || Options.maxError || writeRestarts(sink, Restarts)) &&
+         sink.Flush();
+}
+
+#if defined(QOID_ENCODER_STATS)
+// Buffer in front of the sink of an Encode with EncodeStats, counts the chunks of everything passing through before
+// handing it on. A chunk may be split over two drains, its remaining bytes are skipped at the start of the next one
+class StatsSink : public BufferedSink {
+public:
+  StatsSink(Sink &Target, EncodeStats &Stats) : m_target{Target}, m_stats{Stats}, m_pixels{Stats.pixels} {}
+
+  bool Flush() override { return BufferedSink::Flush() && m_target.Flush(); }
+
+protected:
+  // a full buffer only drains into the target, which is flushed once at the end (writeImageEnd). Flushing it on every
+  // drain would e.g. shrink a VectorSink each time, which then grows and zero fills again (quadratic)
+  bool Overflow(const size_t Size) override { return Size <= BufferSize ? BufferedSink::Flush() : Fail(ENOBUFS); }
+
+  bool Drain(const std::byte *Data, const size_t Size) override {
+    Count(reinterpret_cast<const uint8_t *>(Data), Size);
+    return m_target.Write(Data, Size);
+  }
 
-  const Pixel &current{*DataIterator};
-  const Pixel &previous{*(DataIterator - 1)};
-  if (DataIterator->A() == (DataIterator - 1)->A()) {
-    int diffG = static_cast<int>(current.G()) - static_cast<int>(previous.G());
-    int diffR = static_cast<int>(current.R()) - static_cast<int>(previous.R());
-    int diffB = static_cast<int>(current.B()) - static_cast<int>(previous.B());
-    if ((diffR >= -2 && diffR <= 1) && (diffG >= -2 && diffG <= 1) && (diffB >= -2 && diffB <= 1)) { // Diff
-      // Compute current minus previous.
-      uint8_t diffR = static_cast<uint8_t>(current.R() - previous.R() + 2);
-      uint8_t diffG = static_cast<uint8_t>(current.G() - previous.G() + 2);
-      uint8_t diffB = static_cast<uint8_t>(current.B() - previous.B() + 2);
-      const uint8_t comb{static_cast<uint8_t>(0x40 | (diffR << 4 | diffG << 2 | diffB))};
-      std::memcpy(buffer.data() + bufferIndex, &comb, sizeof(comb));
-      bufferIndex += 1;
-      updateIndex(SeenPixels, current, SwapNum);
-      ++DataIterator;
-      return;
+private:
+  inline void Count(const uint8_t *bytes, const size_t Size) {
+    size_t i{m_skip};
+    // the end marker and restart points follow the last pixel
+    while (i < Size && m_pixels) {
+      const uint8_t op{bytes[i]};
+      size_t chunk{1}, pixels{1};
+      if (op < 0x40) { // INDEX
+        ++m_stats.index;
+      } else if (op < 0x80) { // DIFF
+        ++m_stats.diff;
+      } else if (op < 0xC0) { // LUMA
+        ++m_stats.luma;
+        chunk = 2;
+      } else if (op < 0xFE) { // RUN
+        pixels = (op & 0x3F) + 1;
+        ++m_stats.run;
+        ++m_stats.runLengths[pixels - 1];
+      } else if (op == 0xFE) { // RGB
+        ++m_stats.rgb;
+        chunk = 4;
+      } else { // RGBA
+        ++m_stats.rgba;
+        chunk = 5;
+      }
+      m_pixels -= std::min(pixels, m_pixels);
+      i += chunk;
     }
-    diffR -= diffG;
-    diffB -= diffG;
-    if ((diffG >= -32 && diffG <= 31) && (diffR >= -8 && diffR <= 7) && (diffB >= -8 && diffB <= 7)) { // LUMA
-      int8_t dg = static_cast<int8_t>(current.G() - previous.G());
-      int8_t dr = static_cast<int8_t>(current.R() - previous.R()) - dg;
-      int8_t db = static_cast<int8_t>(current.B() - previous.B()) - dg;
-      uint8_t encodedDG = static_cast<uint8_t>(dg + 32); // Range: 0 to 63.
-      uint8_t encodedDR = static_cast<uint8_t>(dr + 8);  // Range: 0 to 15.
-      uint8_t encodedDB = static_cast<uint8_t>(db + 8);  // Range: 0 to 15.
-#if defined(BIG_ENDIAN)
-      const uint16_t comb{static_cast<uint16_t>(0x8000 | (encodedDG << 8) | (encodedDR << 4) | encodedDB)};
+    m_skip = i > Size ? i - Size : 0;
+  }
+
+  Sink &m_target;
+  EncodeStats &m_stats;
+  size_t m_skip{HeaderSize};
+  uint64_t m_pixels;
+};
+#endif
+
+// Encode with the scratch memory of the caller: Restarts (emptied first) and Bands, see writeImageData
+static inline bool encodeImage(const Image &image, Sink &sink, const EncodeOptions &Options,
+                               std::vector<RestartPoint> &Restarts,
+                               std::vector<std::vector<std::byte>> *Bands = nullptr) {
+  const bool opaque{simd::AllOpaque(image.GetData().data(), image.GetData().size())};
+  if (!writeHeader(sink, image.getWidth(), image.getHeight(), opaque ? 3 : 4)) return false;
+  Restarts.clear();
+  if (!(opaque ? writeImageData<true>(sink, image, Options, Restarts, Bands)
+               : writeImageData<false>(sink, image, Options, Restarts, Bands)))
+    return false;
+  return writeImageEnd(sink, Options, Restarts);
+}
+
+// Encodes image into sink (e.g. a StreamSink or FdSink) and flushes it. The serial encoder only ever holds the
+// sink's buffer, the parallel one additionally holds the encoded bands. Fully opaque images (one simd::AllOpaque scan)
+// get a 3 channel header and an encoder without alpha checks
+inline bool Encode(const Image &image, Sink &sink, const EncodeOptions &Options = {}) {
+  std::vector<RestartPoint> restarts;
+  return encodeImage(image, sink, Options, restarts);
+}
+
+// Encode that also fills Stats (see EncodeStats). With QOID_ENCODER_STATS the output takes a detour through one more
+// buffer where the chunks get counted, plain Encode calls are never affected
+inline bool Encode(const Image &image, Sink &sink, const EncodeOptions &Options, EncodeStats &Stats) {
+  using Clock = std::chrono::steady_clock;
+  Stats = {};
+  Stats.pixels = image.GetData().size();
+  const size_t start{sink.Written()};
+#if defined(QOID_ENCODER_STATS)
+  StatsSink counter{sink, Stats};
+  Sink &out{counter};
+  Stats.counted = true;
 #else
-      const uint16_t comb{
-          std::byteswap(static_cast<uint16_t>(0x8000 | (encodedDG << 8) | (encodedDR << 4) | encodedDB))};
+  Sink &out{sink};
 #endif
-      std::memcpy(buffer.data() + bufferIndex, &comb, sizeof(comb));
-      bufferIndex += 2;
-      updateIndex(SeenPixels, current, SwapNum);
-      ++DataIterator;
-      return;
+  Clock::time_point begin{Clock::now()};
+  const auto lap{[&begin](double &Seconds) {
+    const Clock::time_point now{Clock::now()};
+    Seconds = std::chrono::duration<double>(now - begin).count();
+    begin = now;
+  }};
+
+  const bool opaque{simd::AllOpaque(image.GetData().data(), image.GetData().size())};
+  if (!writeHeader(out, image.getWidth(), image.getHeight(), opaque ? 3 : 4)) return false;
+  lap(Stats.headerSeconds);
+  std::vector<RestartPoint> restarts;
+  if (!(opaque ? writeImageData<true>(out, image, Options, restarts)
+               : writeImageData<false>(out, image, Options, restarts)))
+    return false;
+  lap(Stats.encodeSeconds);
+  if (!writeImageEnd(out, Options, restarts)) return false;
+  lap(Stats.flushSeconds);
+  Stats.bytes = sink.Written() - start;
+  return true;
+}
+
+// Encodes an image that is handed over piece by piece while it is produced (e.g. scanlines of a renderer), so only the
+// sink's buffer and the current piece have to be in memory. Index, previous pixel and an open run are kept between
+// calls and the output is the same as Encode with one thread, given the channels Encode picks (3 if every pixel is
+// opaque, otherwise 4):
+//   StreamEncoder encoder{sink};
+//   encoder.BeginImage(w, h, channels);
+//   for (...) encoder.PushRows(row);
+//   encoder.Finish();
+// After a failed call (sink error or misuse) every following call fails until the next BeginImage
+class StreamEncoder {
+public:
+  // sink has to outlive the encoder
+  explicit StreamEncoder(Sink &sink) : m_sink{sink} {}
+
+  // Starts a width x height image and writes its header. The pixels aren't known yet, so the caller tells the channels
+  // of the header (see writeHeader, 3 only if every pixel will be opaque). An unfinished image is dropped
+  inline bool BeginImage(const ui width, const ui height, const uint8_t channels = 4) {
+    m_state = {};
+    m_remaining = static_cast<size_t>(width) * height;
+    m_open = writeHeader(m_sink, width, height, channels);
+    return m_open;
+  }
+
+  // Encodes the next pixels in row order. Any amount works (a row, several rows, part of a row), but pushing more
+  // than width * height pixels in total fails
+  inline bool PushRows(const std::span<const Pixel> Pixels) {
+    if (!m_open || Pixels.size() > m_remaining) return m_open = false;
+    m_remaining -= Pixels.size();
+    return m_open = writeRow(m_sink, m_state, Pixels.data(), Pixels.data() + Pixels.size());
+  }
+
+  // Writes the open run and the end marker and flushes the sink. Fails if pixels are missing
+  inline bool Finish() {
+    const bool done{m_open && m_remaining == 0 && writeOpenRun(m_sink, m_state) && writeTrail(m_sink) &&
+                    m_sink.Flush()};
+    m_open = false;
+    return done;
+  }
+
+  // Pixels still expected by the current image
+  inline size_t Remaining() const { return m_remaining; }
+
+private:
+  Sink &m_sink;
+  RowState m_state;
+  size_t m_remaining{0};
+  bool m_open{false};
+};
+
+// Encodes a width x height image row by row into sink and flushes it. Rows supplies one row at a time (see
+// RowProvider), so the image never has to be in memory as a whole. The output is the same as Encode with one thread
+// if channels is the one Encode writes (see StreamEncoder). Returns false if Rows aborts
+inline bool EncodeRows(const ui width, const ui height, const RowProvider &Rows, Sink &sink,
+                       const uint8_t channels = 4) {
+  StreamEncoder encoder{sink};
+  if (!encoder.BeginImage(width, height, channels)) return false;
+  for (ui y{0}; y < height; ++y) {
+    const std::span<const Pixel> row{Rows(y)};
+    if (row.size() != width || !encoder.PushRows(row)) return false;
+  }
+  return encoder.Finish();
+}
+
+// Encodes the pixels a coroutine co_yields (see RowGenerator) into sink and flushes it. The coroutine runs up to its
+// next co_yield whenever the encoder is done with the previous piece, so producing and encoding interleave. Fails if
+// it yields more or fewer than width * height pixels. channels like in the other EncodeRows
+inline bool EncodeRows(const ui width, const ui height, RowGenerator Rows, Sink &sink, const uint8_t channels = 4) {
+  StreamEncoder encoder{sink};
+  if (!encoder.BeginImage(width, height, channels)) return false;
+  for (const std::span<const Pixel> pixels : Rows)
+    if (!encoder.PushRows(pixels)) return false;
+  return encoder.Finish();
+}
+
+// Upper bound of the encoded size, a span of this size always fits the encoded image
+inline size_t MaxEncodedSize(const Image &image, const EncodeOptions &Options = {}) {
+  const size_t restarts{
+      Options.restartRows ? (size_t{image.getHeight()} + Options.restartRows - 1) / Options.restartRows : 0};
+  const size_t restartSize{restarts ? restarts * RestartEntrySize + RestartFooterSize : 0};
+  return HeaderSize + image.GetData().size() * MaxChunkSize + TrailSize + restartSize;
+}
+
+// Encodes image directly into Buffer. Returns the encoded size, or 0 if Buffer is too small (see MaxEncodedSize)
+inline size_t EncodeToBuffer(const Image &image, const std::span<std::byte> Buffer, const EncodeOptions &Options = {}) {
+  SpanSink sink{Buffer};
+  return Encode(image, sink, Options) ? sink.Written() : 0;
+}
+
+// Appends the encoded image to Buffer. Returns the amount of bytes appended
+inline size_t EncodeToBuffer(const Image &image, std::vector<std::byte> &Buffer, const EncodeOptions &Options = {}) {
+  VectorSink sink{Buffer, image.GetData().size()};
+  return Encode(image, sink, Options) ? sink.Written() : 0;
+}
+
+// Encodes Pixels independently of every pixel before them into Buffer (replacing its contents, the capacity is kept),
+// like the parallel encoder encodes its bands. A header (writeHeader), the bands of an image in order and the end
+// marker (writeTrail) make up a standard qoi file, so callers can spread one image over threads of their own
+inline void EncodeBand(const std::span<const Pixel> Pixels, std::vector<std::byte> &Buffer) {
+  if (Pixels.empty()) return Buffer.clear();
+  writeBand(Buffer, Pixels.data(), Pixels.data() + Pixels.size());
+}
+
+// Encodes an image that stays around and changes a little between encodes (a window, a canvas). The image is split
+// into bands of BandRows rows, encoded like the bands of the parallel encoder (writeBand: no state carried over from
+// the band before, so any band can be replaced on its own). The bytes of every band are kept and an encode only
+// re-encodes the bands with rows changed since its last encode (Image::ChangedSince) before writing header, bands and
+// end marker. Every encoder keeps its own view of the changes, any number of them can share an image:
+//   qoi::IncrementalEncoder encoder;
+//   for (...) { window.FillRect(...); encoder.Encode(window, sink); }
+// The output is a standard qoi file, slightly larger than from Encode because every band starts cold
+class IncrementalEncoder {
+public:
+  explicit IncrementalEncoder(const ui BandRows = 16) : m_bandRows{std::max<ui>(BandRows, 1)} {}
+
+  // Encodes image into sink and flushes it, the marks for Image::Dirty are left alone. The first encode, and encodes
+  // of an image with another TrackingId (another image, or one assigned to since), encode everything and start
+  // tracking if image doesn't track yet
+  inline bool Encode(Image &image, Sink &sink) {
+    const Image &pixels{image};
+    const ui width{image.getWidth()}, height{image.getHeight()};
+    const bool reset{!image.Tracking() || image.TrackingId() != m_trackingId};
+    if (reset) {
+      if (!image.Tracking()) image.TrackChanges();
+      m_trackingId = image.TrackingId();
+      m_bands.assign((size_t{height} + m_bandRows - 1) / m_bandRows, {});
     }
+
+    m_reencoded = 0;
+    const Pixel *const data{pixels.GetData().data()};
+    for (size_t band{0}; band < m_bands.size(); ++band) {
+      const ui y{static_cast<ui>(band * m_bandRows)};
+      if (!reset && !image.ChangedSince(m_generation, y, m_bandRows)) continue;
+      const size_t begin{size_t{y} * width};
+      const size_t end{std::min<size_t>(height, size_t{y} + m_bandRows) * width};
+      EncodeBand({data + begin, end - begin}, m_scratch);
+      m_bands[band].assign(m_scratch.begin(), m_scratch.end());
+      ++m_reencoded;
+    }
+    m_generation = image.Generation();
+
+    if (!writeHeader(sink, width, height)) return false;
+    for (const std::vector<std::byte> &band : m_bands)
+      if (!sink.Write(band.data(), band.size())) return false;
+    return writeTrail(sink) && sink.Flush();
   }
-  if (SeenPixels.count(DataIterator->packed)) { // index
-    const uint8_t comb{SeenPixels[DataIterator->packed]};
-    std::memcpy(buffer.data() + bufferIndex, &comb, sizeof(comb));
-    ++bufferIndex;
-    ++DataIterator;
-    return;
-  } else { // NEW
-    static constexpr uint8_t Uint8Tmp{0xFF};
-    std::memcpy(buffer.data() + bufferIndex, &Uint8Tmp, sizeof(Uint8Tmp));
-    std::memcpy(buffer.data() + bufferIndex + 1, &(*DataIterator), sizeof(Pixel));
-    updateIndex(SeenPixels, *DataIterator, SwapNum);
-    ++DataIterator;
-    bufferIndex += sizeof(Pixel) + sizeof(Uint8Tmp);
-    return;
+
+  // Bands the last Encode encoded, the others came from the cache
+  inline size_t Reencoded() const { return m_reencoded; }
+  inline size_t Bands() const { return m_bands.size(); }
+
+  // Encoded size of the last Encode
+  inline size_t Size() const {
+    size_t size{HeaderSize + TrailSize};
+    for (const std::vector<std::byte> &band : m_bands) size += band.size();
+    return size;
   }
+
+private:
+  ui m_bandRows;
+  uint64_t m_trackingId{0}; // Image::TrackingId the bands belong to
+  uint64_t m_generation{0}; // Image::Generation at the last encode
+  std::vector<std::vector<std::byte>> m_bands;
+  std::vector<std::byte> m_scratch; // writeBand needs room for the worst case, the bands only keep what they use
+  size_t m_reencoded{0};
+};
+
+// FilePath with ".qoi" appended if it does not end with it
+static inline std::string QoiPath(const strv FilePath) {
+  return FilePath.ends_with(".qoi") ? std::string(FilePath) : std::string(FilePath) + ".qoi";
 }
 
-static inline bool writeData(std::ostream &file, const Image &image) {
-  const size_t ImageSize{image.getHeight() * image.getWidth()};
-  const auto &RawDataVec{image.GetData()};
-  std::vector<std::byte> buffer(ImageSize * 5); // max possible size  this has to because of memcpy
-  std::unordered_map<p_color, uint8_t> SeenPixels;
-  auto DataIterator{RawDataVec.begin()};
-  size_t bufferIndex = 0;
-  unsigned int SwapNum{0};
-
-  // The first pixel is always new.
-  WriteFirstCol(buffer, DataIterator, SeenPixels, bufferIndex, SwapNum);
-  for (; DataIterator != image.GetData().end();) {
-    WriteToBuffer(buffer, DataIterator, SeenPixels, bufferIndex, RawDataVec.end(), SwapNum);
-  }
-
-  // Write out the buffer in chunks.
-  constexpr size_t chunkSize = 4096; // 4KB
-  size_t chunkCount = bufferIndex / chunkSize;
-  for (size_t pos = 0; pos < chunkCount; ++pos) {
-    file.write(reinterpret_cast<const char *>(buffer.data() + pos * chunkSize), chunkSize);
-  }
-  // Write the remaining bytes.
-  size_t remainder = bufferIndex % chunkSize;
-  if (remainder) file.write(reinterpret_cast<const char *>(buffer.data() + chunkCount * chunkSize), remainder);
-  return true;
+// Writes a qoi file (see WriteFile: written to a temporary file that replaces FilePath once complete). ".qoi" is
+// appended if FilePath does not end with it
+inline WriteResult GenerateFile(const Image &image, const strv FilePath, const EncodeOptions &Options = {}) {
+  return WriteFile(QoiPath(FilePath), Options.output, MaxEncodedSize(image, Options),
+                   [&](Sink &sink) { return Encode(image, sink, Options); });
 }
 
-} // namespace
+// GenerateFile that also fills Stats (see EncodeStats)
+inline WriteResult GenerateFile(const Image &image, const strv FilePath, const EncodeOptions &Options,
+                                EncodeStats &Stats) {
+  return WriteFile(QoiPath(FilePath), Options.output, MaxEncodedSize(image, Options),
+                   [&](Sink &sink) { return Encode(image, sink, Options, Stats); });
+}
 
-inline bool GenerateFile(const Image &image, const strv FilePath) {
-  std::ofstream file{FilePath.ends_with(".qoi") ? FilePath.data() : std::string(FilePath) + ".qoi",
-                     std::ios::binary | std::ios::out};
-  return writeHeader(file, image) && writeData(file, image) && writeTrail(file);
+// Writes a qoi file from rows supplied one at a time, see EncodeRows. ".qoi" is appended like in GenerateFile
+inline WriteResult GenerateFile(const ui width, const ui height, const RowProvider &Rows, const strv FilePath,
+                                const uint8_t channels = 4) {
+  return WriteFile(QoiPath(FilePath), OutputBackend::stream, 0,
+                   [&](Sink &sink) { return EncodeRows(width, height, Rows, sink, channels); });
 }
 
-static inline bool GenerateFileNonCompressed(const Image &image, const strv FilePath) {
-  std::ofstream file{FilePath.ends_with(".qoi") ? FilePath.data() : std::string(FilePath) + ".qoi",
-                     std::ios::binary | std::ios::out};
-  return writeHeader(file, image) && writeDataNonCompressedNonOptimized(file, image) && writeTrail(file);
+static inline WriteResult GenerateFileNonCompressed(const Image &image, const strv FilePath) {
+  return WriteFile(QoiPath(FilePath), OutputBackend::stream, 0, [&](Sink &sink) {
+    return writeHeader(sink, image) && writeDataNonCompressedNonOptimized(sink, image) && writeTrail(sink) &&
+           sink.Flush();
+  });
 }
 
+// Encoder context for many small encodes per second (icons, tiles, thumbnails). Keeps what the free Encode /
+// GenerateFile set up on every call: the output buffer, the restart points and band buffers of the band encoders and
+// the write buffer and path strings of the file writes. Once the buffers have grown to the largest image (and longest
+// path), Encode and GenerateFile make no heap allocations (threads other than 1 still start their threads on every
+// call). Not thread safe, one per thread:
+//   qoi::Encoder encoder;
+//   for (...) send(encoder.Encode(icon));
+class Encoder {
+public:
+  explicit Encoder(const EncodeOptions &Options = {}) : m_options{Options} {}
+
+  // Encodes image into the buffer of the encoder. The bytes stay valid until the next call, empty if the image was
+  // refused
+  inline std::span<const std::byte> Encode(const Image &image) {
+    // the buffer only ever grows, so the bytes are written into memory that is already there
+    const size_t maxSize{MaxEncodedSize(image, m_options)};
+    if (m_output.size() < maxSize) m_output.resize(maxSize);
+    SpanSink sink{m_output};
+    if (!Encode(image, sink)) return {};
+    return {m_output.data(), sink.Written()};
+  }
+
+  // Encodes image into sink and flushes it, like qoi::Encode
+  inline bool Encode(const Image &image, Sink &sink) {
+    return encodeImage(image, sink, m_options, m_restarts, &m_bands);
+  }
+
+  // Writes a qoi file like qoi::GenerateFile, buffered writes go through the buffer of the encoder and the paths
+  // (FilePath with ".qoi", the temporary file and its directory) are built in strings of the encoder
+  inline WriteResult GenerateFile(const Image &image, const strv FilePath) {
+    if (!m_fileBuffer) m_fileBuffer = std::make_unique_for_overwrite<std::byte[]>(BufferedSink::BufferSize);
+    m_qoiPath.assign(FilePath);
+    if (!FilePath.ends_with(".qoi")) m_qoiPath += ".qoi";
+    return WriteFile(
+        m_qoiPath, m_options.output, MaxEncodedSize(image, m_options), [&](Sink &sink) { return Encode(image, sink); },
+        std::span{m_fileBuffer.get(), BufferedSink::BufferSize}, &m_paths);
+  }
+
+  inline const EncodeOptions &Options() const { return m_options; }
+  inline void SetOptions(const EncodeOptions &Options) { m_options = Options; }
+
+private:
+  EncodeOptions m_options;
+  std::vector<std::byte> m_output;
+  std::vector<RestartPoint> m_restarts;
+  std::vector<std::vector<std::byte>> m_bands;
+  std::unique_ptr<std::byte[]> m_fileBuffer;
+  std::string m_qoiPath;
+  AtomicFilePaths m_paths;
+};
+
 } // namespace qoi
 
 } // namespace QOID
@@ -0,0 +1,398 @@
+#pragma once
+#include "../../QOID_General.hpp"
+#include "../pixel.hpp"
+#include "../simd.hpp"
+#include "../sink.hpp"
+#include "../../image.hpp"
+#include "qoi.hpp"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+// Sequence of equally sized frames (animation, screen recording) in one file. Frames are stored whole (keyframes) or
+// as the pixels that changed since the previous frame (delta frames). All numbers are big endian like in qoi:
+//   header    "qoiS", width (4), height (4)
+//   frame     type (1, 'K' or 'D'), payload size (8), payload
+//             K: a complete qoi file of the frame
+//             D: segment count, then per segment the unchanged pixels to skip and the changed pixels that follow (all
+//                LEB128 varints), then the qoi chunks of every changed pixel one after another (one index and previous
+//                pixel for the whole frame, no header) and the qoi end marker
+//   end       type 'E'
+//   index     per frame: offset of its type byte from the start of the header (8), type (1)
+//   footer    frame count (4), offset of the index (8), "qoiX"
+// Readers without seeking stop at 'E', the footer at the very end leads seeking readers to the index
+
+namespace QOID {
+namespace qoi {
+
+namespace {
+
+static inline constexpr size_t SequenceHeaderSize{12};
+static inline constexpr size_t RecordHeaderSize{9};
+static inline constexpr size_t IndexEntrySize{9};
+static inline constexpr size_t SequenceFooterSize{16};
+static inline constexpr uint8_t KeyFrame{'K'};
+static inline constexpr uint8_t DeltaFrame{'D'};
+static inline constexpr uint8_t SequenceEnd{'E'};
+
+// Writes the Size lowest bytes of Value big endian
+static inline void putBE(uint8_t *bytes, const uint64_t Value, const size_t Size) {
+  for (size_t i{0}; i < Size; ++i) bytes[i] = static_cast<uint8_t>(Value >> ((Size - 1 - i) * 8));
+}
+
+static inline uint64_t getBE(const uint8_t *bytes, const size_t Size) {
+  uint64_t value{0};
+  for (size_t i{0}; i < Size; ++i) value = value << 8 | bytes[i];
+  return value;
+}
+
+static inline bool writeVarint(Sink &file, uint64_t Value) {
+  if (!file.Reserve(10)) return false;
+  std::byte *buffer{file.Pos()};
+  for (; Value >= 0x80; Value >>= 7) *buffer++ = static_cast<std::byte>(Value | 0x80);
+  *buffer++ = static_cast<std::byte>(Value);
+  file.Advance(buffer);
+  return true;
+}
+
+// Throws std::runtime_error if the varint runs past end or doesn't fit 64 bits
+static inline uint64_t readVarint(const uint8_t *&in, const uint8_t *const end) {
+  uint64_t value{0};
+  for (unsigned shift{0}; shift < 64 && in < end; shift += 7) {
+    const uint8_t byte{*in++};
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) return value;
+  }
+  throw std::runtime_error("Invalid sequence delta frame");
+}
+
+} // namespace
+
+// Unchanged pixels to skip followed by changed pixels to store, see the format description above
+struct Segment {
+  uint64_t skip;
+  uint64_t copy;
+};
+
+// Writes frames into a sequence (format above). Every frame is compared with the previous one, pixels that stayed the
+// same turn into skips and only the changed ones go through the qoi encoder, so a screen recording where a cursor or
+// a line of text changes costs a few bytes per frame:
+//   SequenceWriter writer{sink, w, h};
+//   for (...) writer.AddFrame(frame);
+//   writer.Finish();
+// After a failed call every following call fails. Keeps a copy of the previous frame and reuses its buffers
+class SequenceWriter {
+public:
+  // sink has to outlive the writer. The header is written right away
+  SequenceWriter(Sink &sink, const ui width, const ui height, const SequenceOptions &Options = {}) :
+      m_sink{sink}, m_options{Options}, m_previous{width, height, Image::Uninitialized{}}, m_start{sink.Written()} {
+    std::array<uint8_t, SequenceHeaderSize> header;
+    std::memcpy(header.data(), "qoiS", 4);
+    putBE(header.data() + 4, width, 4);
+    putBE(header.data() + 8, height, 4);
+    m_ok = width && height && m_sink.Write(header.data(), header.size());
+  }
+
+  // Appends frame, which has to have the size given to the constructor
+  inline bool AddFrame(const Image &frame) {
+    if (!m_ok || frame.getWidth() != m_previous.getWidth() || frame.getHeight() != m_previous.getHeight())
+      return m_ok = false;
+    const size_t number{m_index.size()};
+    const size_t count{frame.GetData().size()};
+    bool key{number == 0 || (m_options.keyframeInterval && number % m_options.keyframeInterval == 0)};
+    if (!key) key = static_cast<double>(FindSegments(frame)) > m_options.maxChanged * static_cast<double>(count);
+
+    m_payload.clear();
+    VectorSink payload{m_payload};
+    m_ok = key ? Encode(frame, payload, m_options.keyframe) : writeDelta(payload, frame);
+    if (!m_ok) return false;
+
+    std::array<uint8_t, RecordHeaderSize> record;
+    record[0] = key ? KeyFrame : DeltaFrame;
+    putBE(record.data() + 1, m_payload.size(), 8);
+    m_index.push_back({m_sink.Written() - m_start, record[0]});
+    m_ok = m_sink.Write(record.data(), record.size()) && m_sink.Write(m_payload.data(), m_payload.size());
+
+    // only the stored pixels differ from the previous frame (short unchanged gaps are stored too, copying is harmless)
+    Pixel *const previous{m_previous.GetData().data()};
+    if (key) std::ranges::copy(frame.GetData(), previous);
+    else {
+      uint64_t pos{0};
+      for (const Segment &segment : m_segments) {
+        pos += segment.skip;
+        std::copy_n(frame.GetData().data() + pos, segment.copy, previous + pos);
+        pos += segment.copy;
+      }
+    }
+    return m_ok;
+  }
+
+  // Writes the end record, the index and the footer and flushes the sink
+  inline bool Finish() {
+    if (!m_ok) return false;
+    const uint64_t indexOffset{m_sink.Written() - m_start + 1};
+    m_ok = m_sink.Write(&SequenceEnd, 1);
+    for (const IndexEntry &entry : m_index) {
+      std::array<uint8_t, IndexEntrySize> bytes;
+      putBE(bytes.data(), entry.offset, 8);
+      bytes[8] = entry.type;
+      m_ok = m_ok && m_sink.Write(bytes.data(), bytes.size());
+    }
+    std::array<uint8_t, SequenceFooterSize> footer;
+    putBE(footer.data(), m_index.size(), 4);
+    putBE(footer.data() + 4, indexOffset, 8);
+    std::memcpy(footer.data() + 12, "qoiX", 4);
+    const bool done{m_ok && m_sink.Write(footer.data(), footer.size()) && m_sink.Flush()};
+    m_ok = false;
+    return done;
+  }
+
+  // Frames written so far
+  inline size_t Frames() const { return m_index.size(); }
+
+private:
+  struct IndexEntry {
+    uint64_t offset;
+    uint8_t type;
+  };
+
+  // Splits frame into segments against the previous frame, returns the amount of changed (stored) pixels
+  inline uint64_t FindSegments(const Image &frame) {
+    m_segments.clear();
+    const Pixel *const current{frame.GetData().data()};
+    const Pixel *const previous{m_previous.GetData().data()};
+    const size_t count{frame.GetData().size()};
+    size_t pos{simd::EqualLength(current, previous, count)};
+    uint64_t skip{pos}, stored{0};
+    while (pos < count) {
+      const size_t start{pos};
+      size_t equal{0};
+      // unchanged gaps shorter than minSkip stay part of the segment
+      while (pos < count) {
+        pos += simd::DifferentLength(current + pos, previous + pos, count - pos);
+        equal = simd::EqualLength(current + pos, previous + pos, count - pos);
+        if (equal >= m_options.minSkip || pos + equal == count) break;
+        pos += equal;
+      }
+      m_segments.push_back({skip, pos - start});
+      stored += pos - start;
+      skip = equal;
+      pos += equal;
+    }
+    return stored;
+  }
+
+  // Delta payload of frame from the segments FindSegments found
+  inline bool writeDelta(Sink &payload, const Image &frame) {
+    if (!writeVarint(payload, m_segments.size())) return false;
+    for (const Segment &segment : m_segments)
+      if (!writeVarint(payload, segment.skip) || !writeVarint(payload, segment.copy)) return false;
+    RowState state;
+    const Pixel *pixels{frame.GetData().data()};
+    for (const Segment &segment : m_segments) {
+      pixels += segment.skip;
+      if (!writeRow(payload, state, pixels, pixels + segment.copy)) return false;
+      pixels += segment.copy;
+    }
+    return writeOpenRun(payload, state) && writeTrail(payload) && payload.Flush();
+  }
+
+  Sink &m_sink;
+  SequenceOptions m_options;
+  Image m_previous;
+  size_t m_start;
+  std::vector<IndexEntry> m_index;
+  std::vector<Segment> m_segments;
+  std::vector<std::byte> m_payload;
+  bool m_ok{false};
+};
+
+// Reads a sequence frame by frame (Next), from any stream. On a seekable stream (e.g. std::ifstream) Seek jumps to a
+// frame through the index, decoding from the closest keyframe before it. Corrupt data throws std::runtime_error
+class SequenceReader {
+public:
+  // Reads the header. Stream has to outlive the reader and may hold other data before the sequence, but not after it.
+  // The frame is only allocated with the first keyframe, once its payload shows the size is real
+  explicit SequenceReader(std::istream &Stream) : m_stream{Stream}, m_start{Stream.tellg()} {
+    std::array<uint8_t, SequenceHeaderSize> header;
+    if (!m_stream.read(reinterpret_cast<char *>(header.data()), header.size()))
+      throw std::runtime_error("Sequence data is truncated");
+    if (std::memcmp(header.data(), "qoiS", 4) != 0) throw std::runtime_error("Sequence magic number missing");
+    m_width = static_cast<ui>(getBE(header.data() + 4, 4));
+    m_height = static_cast<ui>(getBE(header.data() + 8, 4));
+    if (m_width == 0 || m_height == 0) throw std::runtime_error("Invalid sequence header");
+    if (m_start >= 0) {
+      const std::streampos frames{m_stream.tellg()};
+      m_stream.seekg(0, std::ios::end);
+      m_end = m_stream.tellg();
+      m_stream.clear();
+      m_stream.seekg(frames);
+    }
+  }
+
+  constexpr ui getWidth() const { return m_width; }
+  constexpr ui getHeight() const { return m_height; }
+
+  // Decodes the next frame, nullptr after the last one. The image is reused by the following calls
+  inline const Image *Next() {
+    if (m_ended) return nullptr;
+    std::array<uint8_t, RecordHeaderSize> record;
+    if (!m_stream.read(reinterpret_cast<char *>(record.data()), 1)) throw std::runtime_error("Sequence is truncated");
+    if (record[0] == SequenceEnd) {
+      m_ended = true;
+      return nullptr;
+    }
+    if (!m_stream.read(reinterpret_cast<char *>(record.data() + 1), 8))
+      throw std::runtime_error("Sequence is truncated");
+    // no valid frame comes close to 16 bytes per pixel, so corrupt sizes don't end up as huge allocations
+    const uint64_t size{getBE(record.data() + 1, 8)};
+    if (size > static_cast<uint64_t>(m_width) * m_height * 16 + 64)
+      throw std::runtime_error("Invalid sequence frame size");
+    readPayload(size);
+
+    if (record[0] == KeyFrame) {
+      // PeekSize bounds the pixels by the payload that was actually read (at most 62 per byte)
+      const Dimensions frameSize{PeekSize(m_payload)};
+      if (frameSize.width != m_width || frameSize.height != m_height)
+        throw std::runtime_error("Sequence frame size differs from the header");
+      if (m_frame.getWidth() != m_width || m_frame.getHeight() != m_height)
+        m_frame = Image{m_width, m_height, Image::Uninitialized{}};
+      DecodeInto(m_payload, m_frame);
+    }
+    else if (record[0] == DeltaFrame && m_valid) applyDelta();
+    else throw std::runtime_error(record[0] == DeltaFrame ? "Delta frame without keyframe" : "Invalid sequence frame");
+    m_valid = true;
+    ++m_next;
+    return &m_frame;
+  }
+
+  // Number of the frame the next call of Next decodes
+  inline size_t Position() const { return m_next; }
+
+  // Frames in the sequence, 0 if the stream can't seek (see LoadIndex)
+  inline size_t FrameCount() { return LoadIndex() ? m_index.size() : 0; }
+
+  // Makes Next return frame Frame. Decodes forward from the closest keyframe, or from the current frame if that is
+  // closer. Returns false if Frame is out of range or the index can't be read
+  inline bool Seek(const size_t Frame) {
+    if (!LoadIndex() || Frame >= m_index.size()) return false;
+    size_t key{Frame};
+    while (key > 0 && m_index[key].type != KeyFrame) --key;
+    if (!(m_valid && !m_ended && m_next > key && m_next <= Frame)) {
+      m_stream.clear();
+      m_stream.seekg(m_start + static_cast<std::streamoff>(m_index[key].offset));
+      m_next = key;
+      m_valid = false;
+      m_ended = false;
+    }
+    while (m_next < Frame) Next();
+    return true;
+  }
+
+  // Reads the index through the footer at the end of the stream, once. Returns false if the stream can't seek
+  inline bool LoadIndex() {
+    if (m_indexLoaded) return true;
+    if (m_start < 0) return false;
+    m_stream.clear();
+    const std::streampos resume{m_stream.tellg()};
+    std::array<uint8_t, SequenceFooterSize> footer;
+    if (!m_stream.seekg(-static_cast<std::streamoff>(SequenceFooterSize), std::ios::end)) return false;
+    const std::streampos footerPos{m_stream.tellg()};
+    if (footerPos < m_start || !m_stream.read(reinterpret_cast<char *>(footer.data()), footer.size())) return false;
+    if (std::memcmp(footer.data() + 12, "qoiX", 4) != 0) throw std::runtime_error("Sequence index missing");
+    // the footer is untrusted: the index has to fit between its offset and the footer before anything is allocated
+    const uint64_t count{getBE(footer.data(), 4)}, offset{getBE(footer.data() + 4, 8)};
+    const auto indexEnd{static_cast<uint64_t>(footerPos - m_start)};
+    if (offset > indexEnd || count > (indexEnd - offset) / IndexEntrySize)
+      throw std::runtime_error("Invalid sequence index");
+    std::vector<uint8_t> entries(count * IndexEntrySize);
+    m_stream.seekg(m_start + static_cast<std::streamoff>(offset));
+    if (!m_stream.read(reinterpret_cast<char *>(entries.data()), static_cast<std::streamsize>(entries.size())))
+      throw std::runtime_error("Sequence index is truncated");
+    m_index.resize(count);
+    for (size_t i{0}; i < count; ++i)
+      m_index[i] = {getBE(entries.data() + i * IndexEntrySize, 8), entries[i * IndexEntrySize + 8]};
+    if (count && m_index[0].type != KeyFrame) throw std::runtime_error("Sequence starts without keyframe");
+    m_stream.clear();
+    m_stream.seekg(resume);
+    m_indexLoaded = true;
+    return true;
+  }
+
+private:
+  struct IndexEntry {
+    uint64_t offset;
+    uint8_t type;
+  };
+
+  // Reads Size payload bytes into m_payload. The buffer grows with the data that actually arrives (and the size is
+  // checked against the end of a seekable stream first), so a corrupt size fails as truncated instead of allocating
+  inline void readPayload(const uint64_t Size) {
+    if (m_end >= 0 && Size > static_cast<uint64_t>(m_end - m_stream.tellg()))
+      throw std::runtime_error("Sequence is truncated");
+    m_payload.clear();
+    for (size_t read{0}; read < Size;) {
+      const size_t chunk{static_cast<size_t>(std::min<uint64_t>(Size - read, std::max<size_t>(read, 1 << 20)))};
+      m_payload.resize(read + chunk);
+      if (!m_stream.read(reinterpret_cast<char *>(m_payload.data() + read), static_cast<std::streamsize>(chunk)))
+        throw std::runtime_error("Sequence is truncated");
+      read += chunk;
+    }
+  }
+
+  // Decodes the changed pixels of a delta payload and puts them over the previous frame
+  inline void applyDelta() {
+    const auto *in{reinterpret_cast<const uint8_t *>(m_payload.data())};
+    if (m_payload.size() < TrailSize) throw std::runtime_error("Invalid sequence delta frame");
+    const uint8_t *const end{in + m_payload.size() - TrailSize};
+    const size_t count{m_frame.GetData().size()};
+    const uint64_t segments{readVarint(in, end)};
+    if (segments > count) throw std::runtime_error("Invalid sequence delta frame");
+    m_segments.resize(segments);
+    uint64_t covered{0}, stored{0};
+    for (Segment &segment : m_segments) {
+      segment.skip = readVarint(in, end);
+      segment.copy = readVarint(in, end);
+      if (segment.skip > count - covered || segment.copy > count - covered - segment.skip)
+        throw std::runtime_error("Invalid sequence delta frame");
+      covered += segment.skip + segment.copy;
+      stored += segment.copy;
+    }
+    m_changed.resize(stored);
+    if (!readData(in, end, m_changed.data(), stored)) throw std::runtime_error("Sequence delta frame is truncated");
+
+    Pixel *const frame{m_frame.GetData().data()};
+    uint64_t pos{0};
+    const Pixel *changed{m_changed.data()};
+    for (const Segment &segment : m_segments) {
+      pos += segment.skip;
+      std::copy_n(changed, segment.copy, frame + pos);
+      changed += segment.copy;
+      pos += segment.copy;
+    }
+  }
+
+  std::istream &m_stream;
+  std::streampos m_start;
+  std::streampos m_end{-1};
+  ui m_width{0};
+  ui m_height{0};
+  Image m_frame{1, 1, Image::Uninitialized{}}; // placeholder until the first keyframe
+  std::vector<std::byte> m_payload;
+  std::vector<Segment> m_segments;
+  std::vector<Pixel> m_changed;
+  std::vector<IndexEntry> m_index;
+  size_t m_next{0};
+  bool m_valid{false};
+  bool m_ended{false};
+  bool m_indexLoaded{false};
+};
+
+} // namespace qoi
+} // namespace QOID
@@ -0,0 +1,90 @@
+#pragma once
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+namespace QOID {
+
+// Minimal synchronous generator (std::generator is C++23 and missing from older standard libraries). The coroutine
+// runs until its next co_yield whenever the consumer advances, so producing and consuming interleave:
+//   Generator<int> Count() { for (int i{0};; ++i) co_yield i; }
+// A yielded value stays valid until the consumer advances again. Exceptions thrown by the coroutine come out of
+// begin() / operator++
+template <typename T> class Generator {
+public:
+  struct promise_type {
+    const T *current{nullptr};
+    std::exception_ptr exception;
+
+    Generator get_return_object() { return Generator{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    // temporaries of the co_yield expression live until the coroutine resumes, so pointing at them is fine
+    std::suspend_always yield_value(const T &Value) noexcept {
+      current = std::addressof(Value);
+      return {};
+    }
+    void return_void() noexcept {}
+    void unhandled_exception() { exception = std::current_exception(); }
+    // only co_yield makes sense in a generator
+    template <typename U> std::suspend_never await_transform(U &&) = delete;
+  };
+
+  class Iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+
+    Iterator() = default;
+    explicit Iterator(const std::coroutine_handle<promise_type> Handle) : m_handle{Handle} {}
+
+    inline const T &operator*() const { return *m_handle.promise().current; }
+    inline Iterator &operator++() {
+      Resume(m_handle);
+      return *this;
+    }
+    inline void operator++(int) { ++*this; }
+    inline bool operator==(std::default_sentinel_t) const { return !m_handle || m_handle.done(); }
+
+  private:
+    std::coroutine_handle<promise_type> m_handle{};
+  };
+
+  Generator(Generator &&Other) noexcept : m_handle{std::exchange(Other.m_handle, {})} {}
+  Generator &operator=(Generator &&Other) noexcept {
+    if (this != &Other) {
+      if (m_handle) m_handle.destroy();
+      m_handle = std::exchange(Other.m_handle, {});
+    }
+    return *this;
+  }
+  Generator(const Generator &) = delete;
+  Generator &operator=(const Generator &) = delete;
+  ~Generator() {
+    if (m_handle) m_handle.destroy();
+  }
+
+  // Runs the coroutine up to its first co_yield, call once
+  inline Iterator begin() {
+    Resume(m_handle);
+    return Iterator{m_handle};
+  }
+  inline std::default_sentinel_t end() const { return {}; }
+
+private:
+  explicit Generator(const std::coroutine_handle<promise_type> Handle) : m_handle{Handle} {}
+
+  static inline void Resume(const std::coroutine_handle<promise_type> Handle) {
+    if (!Handle || Handle.done()) return;
+    Handle.resume();
+    if (Handle.promise().exception) std::rethrow_exception(std::exchange(Handle.promise().exception, nullptr));
+  }
+
+  std::coroutine_handle<promise_type> m_handle;
+};
+
+} // namespace QOID
@@ -7,7 +7,7 @@ struct Pixel {
 
   constexpr Pixel(p_color p) : packed(p) {}
 
-#if defined(BIG_ENDIAN)
+#if defined(QOID_BIG_ENDIAN)
   constexpr Pixel(const color r = 0, const color g = 0, const color b = 0, const color a = 255) :
       packed((r << 24) | (g << 16) | (b << 8) | a) {}
 
@@ -0,0 +1,792 @@
+#pragma once
+#include "../QOID_General.hpp"
+#include "pixel.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+// x86 kernels are compiled with target attributes and picked at runtime, so no -mavx2 is needed
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define QOID_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace QOID {
+namespace simd {
+
+enum class Level {
+  scalar = 0,
+  sse41,
+  avx2,
+};
+
+// Best level the cpu supports
+inline Level Detect() {
+#if defined(QOID_SIMD_X86)
+  static const Level level{__builtin_cpu_supports("avx2")     ? Level::avx2
+                           : __builtin_cpu_supports("sse4.1") ? Level::sse41
+                                                              : Level::scalar};
+  return level;
+#else
+  return Level::scalar;
+#endif
+}
+
+namespace detail {
+inline Level &ActiveLevel() {
+  static Level level{Detect()};
+  return level;
+}
+} // namespace detail
+
+// Level the kernels currently use
+inline Level Active() { return detail::ActiveLevel(); }
+
+// Restricts the kernels to at most Max (e.g. to benchmark against the scalar code). Never goes above Detect()
+inline void Limit(const Level Max) { detail::ActiveLevel() = std::min(Max, Detect()); }
+
+// Classification of 8 consecutive pixels against their predecessors, bit i belongs to p[i] and p[i - 1]
+struct BlockMasks {
+  // p[i] == p[i - 1]
+  uint32_t run;
+  // alpha unchanged and every channel difference in [-2, 1] (QOI_OP_DIFF)
+  uint32_t diff;
+  // alpha unchanged, green difference in [-32, 31], red and blue minus green difference in [-8, 7] (QOI_OP_LUMA)
+  uint32_t luma;
+};
+
+namespace detail {
+
+inline BlockMasks Classify8Scalar(const Pixel *p) {
+  BlockMasks masks{0, 0, 0};
+  for (unsigned i{0}; i < 8; ++i) {
+    const Pixel current{p[i]}, previous{p[static_cast<std::ptrdiff_t>(i) - 1]};
+    masks.run |= static_cast<uint32_t>(current == previous) << i;
+    if (current.A() != previous.A()) continue;
+    const int8_t dr{static_cast<int8_t>(current.R() - previous.R())};
+    const int8_t dg{static_cast<int8_t>(current.G() - previous.G())};
+    const int8_t db{static_cast<int8_t>(current.B() - previous.B())};
+    const int8_t dgr{static_cast<int8_t>(dr - dg)}, dgb{static_cast<int8_t>(db - dg)};
+    masks.diff |= static_cast<uint32_t>(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) << i;
+    masks.luma |= static_cast<uint32_t>(dg >= -32 && dg <= 31 && dgr >= -8 && dgr <= 7 && dgb >= -8 && dgb <= 7) << i;
+  }
+  return masks;
+}
+
+inline void SwapRedBlueScalar(const std::byte *in, std::byte *out, const size_t count) {
+  for (size_t i{0}; i < count; ++i, in += 4, out += 4) {
+    const std::byte r{in[0]}, b{in[2]};
+    out[0] = b;
+    out[1] = in[1];
+    out[2] = r;
+    out[3] = in[3];
+  }
+}
+
+inline size_t RunLengthScalar(const Pixel *p, const Pixel *const end, const Pixel value) {
+  const Pixel *const begin{p};
+  while (p < end && *p == value) ++p;
+  return static_cast<size_t>(p - begin);
+}
+
+inline size_t LiteralLengthScalar(const Pixel *p, const Pixel *const end) {
+  const Pixel *const begin{p};
+  while (end - p >= 2 && p[0] != p[1]) ++p;
+  return static_cast<size_t>(p - begin) + (end - p == 1);
+}
+
+inline size_t EqualLengthScalar(const Pixel *a, const Pixel *b, const size_t count) {
+  size_t i{0};
+  while (i < count && a[i] == b[i]) ++i;
+  return i;
+}
+
+inline size_t DifferentLengthScalar(const Pixel *a, const Pixel *b, const size_t count) {
+  size_t i{0};
+  while (i < count && a[i] != b[i]) ++i;
+  return i;
+}
+
+inline size_t FindWithinScalar(const Pixel *p, const size_t count, const Pixel value, const uint8_t tolerance) {
+  for (size_t i{0}; i < count; ++i) {
+    const Pixel x{p[i]};
+    if (std::abs(x.R() - value.R()) <= tolerance && std::abs(x.G() - value.G()) <= tolerance &&
+        std::abs(x.B() - value.B()) <= tolerance && std::abs(x.A() - value.A()) <= tolerance)
+      return i;
+  }
+  return count;
+}
+
+inline bool AllOpaqueScalar(const Pixel *p, const size_t count) {
+  for (size_t i{0}; i < count; ++i)
+    if (p[i].A() != 255) return false;
+  return true;
+}
+
+// the vector kernels AND pixels together and only check the alpha bytes once per chunk, so a translucent image stops
+// the scan early without a compare per load
+inline constexpr size_t OpaqueChunk{256};
+
+// Straight (not premultiplied) alpha source-over of one pixel. Opaque destinations (the common case when drawing onto
+// a frame) only need a weighted average, which is what the vector kernels compute
+inline Pixel BlendPixel(const Pixel src, const Pixel dst) {
+  const unsigned sa{src.A()}, da{dst.A()};
+  if (sa == 255) return src;
+  if (sa == 0) return dst;
+  if (da == 255) {
+    // rounded x / 255, exact for x <= 255 * 255
+    const auto channel{[&](const unsigned s, const unsigned d) {
+      const unsigned x{s * sa + d * (255 - sa) + 128};
+      return static_cast<color>((x + (x >> 8)) >> 8);
+    }};
+    return Pixel{channel(src.R(), dst.R()), channel(src.G(), dst.G()), channel(src.B(), dst.B()), 255};
+  }
+  // both weights scaled by 255: source sa * 255, destination da * (255 - sa)
+  const unsigned dw{da * (255 - sa)}, total{sa * 255 + dw};
+  const auto channel{[&](const unsigned s, const unsigned d) {
+    return static_cast<color>((s * sa * 255 + d * dw + total / 2) / total);
+  }};
+  return Pixel{channel(src.R(), dst.R()), channel(src.G(), dst.G()), channel(src.B(), dst.B()),
+               static_cast<color>((total + 127) / 255)};
+}
+
+inline void BlendOverScalar(const Pixel *src, Pixel *dst, const size_t count) {
+  for (size_t i{0}; i < count; ++i) dst[i] = BlendPixel(src[i], dst[i]);
+}
+
+// rounded a * b / 255, exact for a, b <= 255. The vector kernels compute the same with pmulhuw: (x * 257) >> 16
+inline constexpr unsigned MulDiv255(const unsigned a, const unsigned b) {
+  const unsigned x{a * b + 128};
+  return (x + (x >> 8)) >> 8;
+}
+
+// Channel wise product, alpha included (multiply blend / modulation)
+inline constexpr Pixel MultiplyPixel(const Pixel a, const Pixel b) {
+  return Pixel{static_cast<color>(MulDiv255(a.R(), b.R())), static_cast<color>(MulDiv255(a.G(), b.G())),
+               static_cast<color>(MulDiv255(a.B(), b.B())), static_cast<color>(MulDiv255(a.A(), b.A()))};
+}
+
+// Source-over of premultiplied pixels: src + dst * (255 - src alpha) / 255 per channel, saturated for inputs that
+// aren't actually premultiplied (a channel above alpha)
+inline constexpr Pixel PremultipliedOverPixel(const Pixel src, const Pixel dst) {
+  const unsigned inverse{255u - src.A()};
+  const auto channel{[inverse](const unsigned s, const unsigned d) {
+    return static_cast<color>(std::min(255u, s + MulDiv255(d, inverse)));
+  }};
+  return Pixel{channel(src.R(), dst.R()), channel(src.G(), dst.G()), channel(src.B(), dst.B()),
+               channel(src.A(), dst.A())};
+}
+
+inline void AddScalar(const Pixel *src, Pixel *dst, const size_t count) {
+  for (size_t i{0}; i < count; ++i) dst[i] += src[i];
+}
+
+inline void SubtractScalar(const Pixel *src, Pixel *dst, const size_t count) {
+  for (size_t i{0}; i < count; ++i) dst[i] -= src[i];
+}
+
+inline void MultiplyScalar(const Pixel *src, Pixel *dst, const size_t count) {
+  for (size_t i{0}; i < count; ++i) dst[i] = MultiplyPixel(dst[i], src[i]);
+}
+
+inline void PremultipliedOverScalar(const Pixel *src, Pixel *dst, const size_t count) {
+  for (size_t i{0}; i < count; ++i) dst[i] = PremultipliedOverPixel(src[i], dst[i]);
+}
+
+inline void ScaleScalar(Pixel *dst, const size_t count, const float scale) {
+  for (size_t i{0}; i < count; ++i) dst[i] *= scale;
+}
+
+#if defined(QOID_SIMD_X86)
+// Both kernels work on the little endian byte layout of Pixel (R, G, B, A). Channel differences are byte wise
+// subtractions, which wrap exactly like the int8_t casts of the scalar encoder. A range check [lo, hi] becomes
+// "(d - lo) has no bits above hi - lo" after adding -lo.
+
+// returns a 4 bit mask (bit per pixel) for each class
+__attribute__((target("sse4.1"))) inline void Classify4SSE41(const Pixel *p, uint32_t &run, uint32_t &diff,
+                                                              uint32_t &luma) {
+  const __m128i current{_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))};
+  const __m128i previous{_mm_loadu_si128(reinterpret_cast<const __m128i *>(p - 1))};
+  const __m128i zero{_mm_setzero_si128()};
+  const __m128i d{_mm_sub_epi8(current, previous)};
+
+  run = static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(current, previous))));
+
+  // DIFF: (d + 2) & 0xFC must be zero for R, G, B and the alpha difference must be zero
+  const __m128i diffBits{
+      _mm_and_si128(_mm_add_epi8(d, _mm_set1_epi32(0x00020202)), _mm_set1_epi32(-0x01000000 | 0xFCFCFC))};
+  diff = static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(diffBits, zero))));
+
+  // LUMA: subtract dg from dr and db (bytes 0 and 2), keep dg in byte 1, then range check all three
+  const __m128i dgSpread{_mm_shuffle_epi8(d, _mm_setr_epi8(1, -1, 1, -1, 5, -1, 5, -1, 9, -1, 9, -1, 13, -1, 13, -1))};
+  const __m128i lumaBits{_mm_and_si128(_mm_add_epi8(_mm_sub_epi8(d, dgSpread), _mm_set1_epi32(0x00082008)),
+                                       _mm_set1_epi32(-0x01000000 | 0xF0C0F0))};
+  luma = static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(lumaBits, zero))));
+}
+
+__attribute__((target("sse4.1"))) inline BlockMasks Classify8SSE41(const Pixel *p) {
+  BlockMasks low, high;
+  Classify4SSE41(p, low.run, low.diff, low.luma);
+  Classify4SSE41(p + 4, high.run, high.diff, high.luma);
+  return {low.run | high.run << 4, low.diff | high.diff << 4, low.luma | high.luma << 4};
+}
+
+__attribute__((target("avx2"))) inline BlockMasks Classify8AVX2(const Pixel *p) {
+  const __m256i current{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p))};
+  const __m256i previous{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p - 1))};
+  const __m256i zero{_mm256_setzero_si256()};
+  const __m256i d{_mm256_sub_epi8(current, previous)};
+
+  const __m256i diffBits{_mm256_and_si256(_mm256_add_epi8(d, _mm256_set1_epi32(0x00020202)),
+                                          _mm256_set1_epi32(-0x01000000 | 0xFCFCFC))};
+  const __m256i dgSpread{_mm256_shuffle_epi8(d, _mm256_setr_epi8(1, -1, 1, -1, 5, -1, 5, -1, 9, -1, 9, -1, 13, -1,
+                                                                  13, -1, 1, -1, 1, -1, 5, -1, 5, -1, 9, -1, 9, -1,
+                                                                  13, -1, 13, -1))};
+  const __m256i lumaBits{
+      _mm256_and_si256(_mm256_add_epi8(_mm256_sub_epi8(d, dgSpread), _mm256_set1_epi32(0x00082008)),
+                       _mm256_set1_epi32(-0x01000000 | 0xF0C0F0))};
+  return {static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(current, previous)))),
+          static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(diffBits, zero)))),
+          static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(lumaBits, zero))))};
+}
+
+__attribute__((target("sse4.1"))) inline size_t RunLengthSSE41(const Pixel *p, const Pixel *const end,
+                                                                const Pixel value) {
+  const Pixel *const begin{p};
+  const __m128i broadcast{_mm_set1_epi32(static_cast<int>(value.packed))};
+  for (; end - p >= 4; p += 4) {
+    const __m128i block{_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))};
+    const unsigned equal{
+        static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(block, broadcast))))};
+    if (equal != 0xF) return static_cast<size_t>(p - begin) + std::countr_one(equal);
+  }
+  return static_cast<size_t>(p - begin) + RunLengthScalar(p, end, value);
+}
+
+__attribute__((target("avx2"))) inline size_t RunLengthAVX2(const Pixel *p, const Pixel *const end,
+                                                              const Pixel value) {
+  const Pixel *const begin{p};
+  const __m256i broadcast{_mm256_set1_epi32(static_cast<int>(value.packed))};
+  for (; end - p >= 8; p += 8) {
+    const __m256i block{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p))};
+    const unsigned equal{
+        static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(block, broadcast))))};
+    if (equal != 0xFF) return static_cast<size_t>(p - begin) + std::countr_one(equal);
+  }
+  return static_cast<size_t>(p - begin) + RunLengthScalar(p, end, value);
+}
+
+// Equal = true counts leading pixels with a[i] == b[i], false leading pixels with a[i] != b[i]
+template <bool Equal>
+__attribute__((target("sse4.1"))) inline size_t CompareLengthSSE41(const Pixel *a, const Pixel *b, const size_t count) {
+  size_t i{0};
+  for (; count - i >= 4; i += 4) {
+    const __m128i x{_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i))};
+    const __m128i y{_mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i))};
+    unsigned same{static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(x, y))))};
+    if (!Equal) same ^= 0xF;
+    if (same != 0xF) return i + std::countr_one(same);
+  }
+  return i + (Equal ? EqualLengthScalar(a + i, b + i, count - i) : DifferentLengthScalar(a + i, b + i, count - i));
+}
+
+template <bool Equal>
+__attribute__((target("avx2"))) inline size_t CompareLengthAVX2(const Pixel *a, const Pixel *b, const size_t count) {
+  size_t i{0};
+  for (; count - i >= 8; i += 8) {
+    const __m256i x{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i))};
+    const __m256i y{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i))};
+    unsigned same{static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(x, y))))};
+    if (!Equal) same ^= 0xFF;
+    if (same != 0xFF) return i + std::countr_one(same);
+  }
+  return i + CompareLengthSSE41<Equal>(a + i, b + i, count - i);
+}
+
+// every pixel is compared with its successor, so a block of n pixels needs n + 1 left
+__attribute__((target("sse4.1"))) inline size_t LiteralLengthSSE41(const Pixel *p, const Pixel *const end) {
+  const Pixel *const begin{p};
+  for (; end - p > 4; p += 4) {
+    const __m128i current{_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))};
+    const __m128i next{_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 1))};
+    const unsigned equal{static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(current, next))))};
+    if (equal) return static_cast<size_t>(p - begin) + std::countr_zero(equal);
+  }
+  return static_cast<size_t>(p - begin) + LiteralLengthScalar(p, end);
+}
+
+__attribute__((target("avx2"))) inline size_t LiteralLengthAVX2(const Pixel *p, const Pixel *const end) {
+  const Pixel *const begin{p};
+  for (; end - p > 8; p += 8) {
+    const __m256i current{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p))};
+    const __m256i next{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 1))};
+    const unsigned equal{
+        static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(current, next))))};
+    if (equal) return static_cast<size_t>(p - begin) + std::countr_zero(equal);
+  }
+  return static_cast<size_t>(p - begin) + LiteralLengthSSE41(p, end);
+}
+
+// byte 0 <-> byte 2 of every 4 byte pixel, RGBA <-> BGRA
+__attribute__((target("sse4.1"))) inline void SwapRedBlueSSE41(const std::byte *in, std::byte *out, size_t count) {
+  const __m128i shuffle{_mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15)};
+  for (; count >= 4; count -= 4, in += 16, out += 16) {
+    const __m128i block{_mm_loadu_si128(reinterpret_cast<const __m128i *>(in))};
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_shuffle_epi8(block, shuffle));
+  }
+  SwapRedBlueScalar(in, out, count);
+}
+
+__attribute__((target("avx2"))) inline void SwapRedBlueAVX2(const std::byte *in, std::byte *out, size_t count) {
+  const __m256i shuffle{_mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15, 2, 1, 0, 3, 6, 5, 4, 7,
+                                         10, 9, 8, 11, 14, 13, 12, 15)};
+  // unrolled twice, 16 pixels per iteration
+  for (; count >= 16; count -= 16, in += 64, out += 64) {
+    const __m256i low{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(in))};
+    const __m256i high{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + 32))};
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), _mm256_shuffle_epi8(low, shuffle));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 32), _mm256_shuffle_epi8(high, shuffle));
+  }
+  SwapRedBlueSSE41(in, out, count);
+}
+
+// |x - value| per byte is the saturated difference in one direction or the other, a pixel is within when no byte of it
+// is still above 0 after subtracting tolerance
+__attribute__((target("sse4.1"))) inline size_t FindWithinSSE41(const Pixel *p, const size_t count, const Pixel value,
+                                                                const uint8_t tolerance) {
+  const __m128i v{_mm_set1_epi32(static_cast<int>(value.packed))};
+  const __m128i t{_mm_set1_epi8(static_cast<char>(tolerance))};
+  size_t i{0};
+  for (; count - i >= 4; i += 4) {
+    const __m128i x{_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i))};
+    const __m128i over{_mm_subs_epu8(_mm_or_si128(_mm_subs_epu8(x, v), _mm_subs_epu8(v, x)), t)};
+    const int within{_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(over, _mm_setzero_si128())))};
+    if (within) return i + std::countr_zero(static_cast<unsigned>(within));
+  }
+  return i + FindWithinScalar(p + i, count - i, value, tolerance);
+}
+
+__attribute__((target("avx2"))) inline size_t FindWithinAVX2(const Pixel *p, const size_t count, const Pixel value,
+                                                             const uint8_t tolerance) {
+  const __m256i v{_mm256_set1_epi32(static_cast<int>(value.packed))};
+  const __m256i t{_mm256_set1_epi8(static_cast<char>(tolerance))};
+  size_t i{0};
+  for (; count - i >= 8; i += 8) {
+    const __m256i x{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i))};
+    const __m256i over{_mm256_subs_epu8(_mm256_or_si256(_mm256_subs_epu8(x, v), _mm256_subs_epu8(v, x)), t)};
+    const int within{_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(over, _mm256_setzero_si256())))};
+    if (within) return i + std::countr_zero(static_cast<unsigned>(within));
+  }
+  return i + FindWithinSSE41(p + i, count - i, value, tolerance);
+}
+
+__attribute__((target("sse4.1"))) inline bool AllOpaqueSSE41(const Pixel *p, size_t count) {
+  const __m128i alphaMask{_mm_set1_epi32(static_cast<int>(0xFF000000u))};
+  while (count >= 4) {
+    const size_t chunk{std::min(count, OpaqueChunk) & ~size_t{3}};
+    __m128i all{_mm_set1_epi32(-1)};
+    for (size_t i{0}; i < chunk; i += 4)
+      all = _mm_and_si128(all, _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i)));
+    if (!_mm_testc_si128(all, alphaMask)) return false;
+    p += chunk;
+    count -= chunk;
+  }
+  return AllOpaqueScalar(p, count);
+}
+
+__attribute__((target("avx2"))) inline bool AllOpaqueAVX2(const Pixel *p, size_t count) {
+  const __m256i alphaMask{_mm256_set1_epi32(static_cast<int>(0xFF000000u))};
+  while (count >= 8) {
+    const size_t chunk{std::min(count, OpaqueChunk) & ~size_t{7}};
+    __m256i all{_mm256_set1_epi32(-1)};
+    for (size_t i{0}; i < chunk; i += 8)
+      all = _mm256_and_si256(all, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i)));
+    if (!_mm256_testc_si256(all, alphaMask)) return false;
+    p += chunk;
+    count -= chunk;
+  }
+  return AllOpaqueSSE41(p, count);
+}
+
+// BlendPixel for opaque destinations on 16 bit lanes (2 pixels per 128 bit lane), the alpha word of each pixel is
+// broadcast to its 4 words. The alpha channel itself comes out as garbage and is set to 255 afterwards
+__attribute__((target("sse4.1"))) inline __m128i BlendOpaque2SSE41(const __m128i src, const __m128i dst) {
+  const __m128i alpha{_mm_shufflehi_epi16(_mm_shufflelo_epi16(src, 0xFF), 0xFF)};
+  const __m128i inverse{_mm_sub_epi16(_mm_set1_epi16(255), alpha)};
+  __m128i x{_mm_add_epi16(_mm_mullo_epi16(src, alpha), _mm_mullo_epi16(dst, inverse))};
+  x = _mm_add_epi16(x, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// blocks with a translucent destination pixel go through BlendPixel
+__attribute__((target("sse4.1"))) inline void BlendOverSSE41(const Pixel *src, Pixel *dst, size_t count) {
+  const __m128i alphaMask{_mm_set1_epi32(static_cast<int>(0xFF000000u))};
+  const __m128i zero{_mm_setzero_si128()};
+  for (; count >= 4; count -= 4, src += 4, dst += 4) {
+    const __m128i s{_mm_loadu_si128(reinterpret_cast<const __m128i *>(src))};
+    const __m128i d{_mm_loadu_si128(reinterpret_cast<const __m128i *>(dst))};
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(d, alphaMask), alphaMask)) != 0xFFFF) {
+      BlendOverScalar(src, dst, 4);
+      continue;
+    }
+    const __m128i low{BlendOpaque2SSE41(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero))};
+    const __m128i high{BlendOpaque2SSE41(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero))};
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_or_si128(_mm_packus_epi16(low, high), alphaMask));
+  }
+  BlendOverScalar(src, dst, count);
+}
+
+__attribute__((target("avx2"))) inline __m256i BlendOpaque4AVX2(const __m256i src, const __m256i dst) {
+  const __m256i alpha{_mm256_shufflehi_epi16(_mm256_shufflelo_epi16(src, 0xFF), 0xFF)};
+  const __m256i inverse{_mm256_sub_epi16(_mm256_set1_epi16(255), alpha)};
+  __m256i x{_mm256_add_epi16(_mm256_mullo_epi16(src, alpha), _mm256_mullo_epi16(dst, inverse))};
+  x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+// unpack and pack both work within 128 bit lanes, so the pixel order survives the round trip
+__attribute__((target("avx2"))) inline void BlendOverAVX2(const Pixel *src, Pixel *dst, size_t count) {
+  const __m256i alphaMask{_mm256_set1_epi32(static_cast<int>(0xFF000000u))};
+  const __m256i zero{_mm256_setzero_si256()};
+  for (; count >= 8; count -= 8, src += 8, dst += 8) {
+    const __m256i s{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src))};
+    const __m256i d{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst))};
+    if (static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_cmpeq_epi32(_mm256_and_si256(d, alphaMask), alphaMask))) != 0xFFFFFFFFu) {
+      BlendOverScalar(src, dst, 8);
+      continue;
+    }
+    const __m256i low{BlendOpaque4AVX2(_mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi8(d, zero))};
+    const __m256i high{BlendOpaque4AVX2(_mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi8(d, zero))};
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_or_si256(_mm256_packus_epi16(low, high), alphaMask));
+  }
+  BlendOverSSE41(src, dst, count);
+}
+
+// Pixel::operator+ and operator- saturate every byte, which is exactly paddusb / psubusb
+__attribute__((target("sse4.1"))) inline void AddSSE41(const Pixel *src, Pixel *dst, size_t count) {
+  for (; count >= 4; count -= 4, src += 4, dst += 4) {
+    const __m128i s{_mm_loadu_si128(reinterpret_cast<const __m128i *>(src))};
+    const __m128i d{_mm_loadu_si128(reinterpret_cast<const __m128i *>(dst))};
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_adds_epu8(d, s));
+  }
+  AddScalar(src, dst, count);
+}
+
+__attribute__((target("avx2"))) inline void AddAVX2(const Pixel *src, Pixel *dst, size_t count) {
+  for (; count >= 8; count -= 8, src += 8, dst += 8) {
+    const __m256i s{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src))};
+    const __m256i d{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst))};
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_adds_epu8(d, s));
+  }
+  AddSSE41(src, dst, count);
+}
+
+__attribute__((target("sse4.1"))) inline void SubtractSSE41(const Pixel *src, Pixel *dst, size_t count) {
+  for (; count >= 4; count -= 4, src += 4, dst += 4) {
+    const __m128i s{_mm_loadu_si128(reinterpret_cast<const __m128i *>(src))};
+    const __m128i d{_mm_loadu_si128(reinterpret_cast<const __m128i *>(dst))};
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_subs_epu8(d, s));
+  }
+  SubtractScalar(src, dst, count);
+}
+
+__attribute__((target("avx2"))) inline void SubtractAVX2(const Pixel *src, Pixel *dst, size_t count) {
+  for (; count >= 8; count -= 8, src += 8, dst += 8) {
+    const __m256i s{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src))};
+    const __m256i d{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst))};
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_subs_epu8(d, s));
+  }
+  SubtractSSE41(src, dst, count);
+}
+
+// MulDiv255 on 16 bit lanes: x = a * b + 128 fits 16 bits, (x + (x >> 8)) >> 8 == (x * 257) >> 16
+__attribute__((target("sse4.1"))) inline __m128i MulDiv255SSE41(const __m128i a, const __m128i b) {
+  return _mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128)), _mm_set1_epi16(257));
+}
+
+__attribute__((target("avx2"))) inline __m256i MulDiv255AVX2(const __m256i a, const __m256i b) {
+  return _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(a, b), _mm256_set1_epi16(128)),
+                            _mm256_set1_epi16(257));
+}
+
+__attribute__((target("sse4.1"))) inline void MultiplySSE41(const Pixel *src, Pixel *dst, size_t count) {
+  const __m128i zero{_mm_setzero_si128()};
+  for (; count >= 4; count -= 4, src += 4, dst += 4) {
+    const __m128i s{_mm_loadu_si128(reinterpret_cast<const __m128i *>(src))};
+    const __m128i d{_mm_loadu_si128(reinterpret_cast<const __m128i *>(dst))};
+    const __m128i low{MulDiv255SSE41(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero))};
+    const __m128i high{MulDiv255SSE41(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero))};
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_packus_epi16(low, high));
+  }
+  MultiplyScalar(src, dst, count);
+}
+
+__attribute__((target("avx2"))) inline void MultiplyAVX2(const Pixel *src, Pixel *dst, size_t count) {
+  const __m256i zero{_mm256_setzero_si256()};
+  for (; count >= 8; count -= 8, src += 8, dst += 8) {
+    const __m256i s{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src))};
+    const __m256i d{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst))};
+    const __m256i low{MulDiv255AVX2(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(s, zero))};
+    const __m256i high{MulDiv255AVX2(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(s, zero))};
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_packus_epi16(low, high));
+  }
+  MultiplySSE41(src, dst, count);
+}
+
+// dst * (255 - src alpha) on 16 bit lanes, the inverse alpha word of each pixel is broadcast to its 4 words like in
+// BlendOpaque2SSE41, then src is added with saturation
+__attribute__((target("sse4.1"))) inline void PremultipliedOverSSE41(const Pixel *src, Pixel *dst, size_t count) {
+  const __m128i zero{_mm_setzero_si128()};
+  const __m128i ones{_mm_set1_epi16(255)};
+  for (; count >= 4; count -= 4, src += 4, dst += 4) {
+    const __m128i s{_mm_loadu_si128(reinterpret_cast<const __m128i *>(src))};
+    const __m128i d{_mm_loadu_si128(reinterpret_cast<const __m128i *>(dst))};
+    const __m128i sLow{_mm_unpacklo_epi8(s, zero)}, sHigh{_mm_unpackhi_epi8(s, zero)};
+    const __m128i inverseLow{_mm_sub_epi16(ones, _mm_shufflehi_epi16(_mm_shufflelo_epi16(sLow, 0xFF), 0xFF))};
+    const __m128i inverseHigh{_mm_sub_epi16(ones, _mm_shufflehi_epi16(_mm_shufflelo_epi16(sHigh, 0xFF), 0xFF))};
+    const __m128i low{MulDiv255SSE41(_mm_unpacklo_epi8(d, zero), inverseLow)};
+    const __m128i high{MulDiv255SSE41(_mm_unpackhi_epi8(d, zero), inverseHigh)};
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_adds_epu8(s, _mm_packus_epi16(low, high)));
+  }
+  PremultipliedOverScalar(src, dst, count);
+}
+
+__attribute__((target("avx2"))) inline void PremultipliedOverAVX2(const Pixel *src, Pixel *dst, size_t count) {
+  const __m256i zero{_mm256_setzero_si256()};
+  const __m256i ones{_mm256_set1_epi16(255)};
+  for (; count >= 8; count -= 8, src += 8, dst += 8) {
+    const __m256i s{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src))};
+    const __m256i d{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst))};
+    const __m256i sLow{_mm256_unpacklo_epi8(s, zero)}, sHigh{_mm256_unpackhi_epi8(s, zero)};
+    const __m256i inverseLow{
+        _mm256_sub_epi16(ones, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(sLow, 0xFF), 0xFF))};
+    const __m256i inverseHigh{
+        _mm256_sub_epi16(ones, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(sHigh, 0xFF), 0xFF))};
+    const __m256i low{MulDiv255AVX2(_mm256_unpacklo_epi8(d, zero), inverseLow)};
+    const __m256i high{MulDiv255AVX2(_mm256_unpackhi_epi8(d, zero), inverseHigh)};
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_adds_epu8(s, _mm256_packus_epi16(low, high)));
+  }
+  PremultipliedOverSSE41(src, dst, count);
+}
+
+// Pixel::operator*(float) multiplies int channels by a float and truncates, so the kernels do the same in single
+// precision: every product and the truncation match bit for bit. A 16 bit fixed point multiply (pmulhuw) would round
+// differently for most scales. Results below 0 keep their low byte like the color conversion of the operator
+__attribute__((target("sse4.1"))) inline __m128i Scale4SSE41(const __m128i channels, const __m128 scale) {
+  const __m128i scaled{_mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(channels), scale))};
+  return _mm_and_si128(_mm_min_epi32(scaled, _mm_set1_epi32(255)), _mm_set1_epi32(0xFF));
+}
+
+__attribute__((target("sse4.1"))) inline void ScaleSSE41(Pixel *dst, size_t count, const float scale) {
+  const __m128 factor{_mm_set1_ps(scale)};
+  for (; count >= 4; count -= 4, dst += 4) {
+    const __m128i d{_mm_loadu_si128(reinterpret_cast<const __m128i *>(dst))};
+    const __m128i p0{Scale4SSE41(_mm_cvtepu8_epi32(d), factor)};
+    const __m128i p1{Scale4SSE41(_mm_cvtepu8_epi32(_mm_srli_si128(d, 4)), factor)};
+    const __m128i p2{Scale4SSE41(_mm_cvtepu8_epi32(_mm_srli_si128(d, 8)), factor)};
+    const __m128i p3{Scale4SSE41(_mm_cvtepu8_epi32(_mm_srli_si128(d, 12)), factor)};
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+                     _mm_packus_epi16(_mm_packus_epi32(p0, p1), _mm_packus_epi32(p2, p3)));
+  }
+  ScaleScalar(dst, count, scale);
+}
+
+__attribute__((target("avx2"))) inline __m256i Scale8AVX2(const __m128i channels, const __m256 scale) {
+  const __m256i scaled{_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(channels)), scale))};
+  return _mm256_and_si256(_mm256_min_epi32(scaled, _mm256_set1_epi32(255)), _mm256_set1_epi32(0xFF));
+}
+
+// the 128 bit lane wise packs leave the pixels in the order 0 2 4 6 1 3 5 7, one dword permute restores it
+__attribute__((target("avx2"))) inline void ScaleAVX2(Pixel *dst, size_t count, const float scale) {
+  const __m256 factor{_mm256_set1_ps(scale)};
+  const __m256i order{_mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)};
+  for (; count >= 8; count -= 8, dst += 8) {
+    const __m128i low{_mm_loadu_si128(reinterpret_cast<const __m128i *>(dst))};
+    const __m128i high{_mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + 4))};
+    const __m256i p0{Scale8AVX2(low, factor)}, p1{Scale8AVX2(_mm_srli_si128(low, 8), factor)};
+    const __m256i p2{Scale8AVX2(high, factor)}, p3{Scale8AVX2(_mm_srli_si128(high, 8), factor)};
+    const __m256i packed{_mm256_packus_epi16(_mm256_packus_epi32(p0, p1), _mm256_packus_epi32(p2, p3))};
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_permutevar8x32_epi32(packed, order));
+  }
+  ScaleSSE41(dst, count, scale);
+}
+#endif
+
+} // namespace detail
+
+// Classifies p[0..7] against p[-1..6]. p[-1] and p[7] have to be readable
+inline BlockMasks Classify8(const Pixel *p) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::Classify8AVX2(p);
+  case Level::sse41: return detail::Classify8SSE41(p);
+  default: break;
+  }
+#endif
+  return detail::Classify8Scalar(p);
+}
+
+// Number of pixels equal to value at the start of [p, end)
+inline size_t RunLength(const Pixel *p, const Pixel *const end, const Pixel value) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::RunLengthAVX2(p, end, value);
+  case Level::sse41: return detail::RunLengthSSE41(p, end, value);
+  default: break;
+  }
+#endif
+  return detail::RunLengthScalar(p, end, value);
+}
+
+// Amount of pixels from p on until the first one that equals its successor (where a run starts), end - p if there
+// is none
+inline size_t LiteralLength(const Pixel *p, const Pixel *const end) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::LiteralLengthAVX2(p, end);
+  case Level::sse41: return detail::LiteralLengthSSE41(p, end);
+  default: break;
+  }
+#endif
+  return detail::LiteralLengthScalar(p, end);
+}
+
+// Amount of pixels from the start on that are the same in a and b, at most count
+inline size_t EqualLength(const Pixel *a, const Pixel *b, const size_t count) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::CompareLengthAVX2<true>(a, b, count);
+  case Level::sse41: return detail::CompareLengthSSE41<true>(a, b, count);
+  default: break;
+  }
+#endif
+  return detail::EqualLengthScalar(a, b, count);
+}
+
+// Amount of pixels from the start on that differ between a and b, at most count
+inline size_t DifferentLength(const Pixel *a, const Pixel *b, const size_t count) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::CompareLengthAVX2<false>(a, b, count);
+  case Level::sse41: return detail::CompareLengthSSE41<false>(a, b, count);
+  default: break;
+  }
+#endif
+  return detail::DifferentLengthScalar(a, b, count);
+}
+
+// Position of the first of the count pixels at p where no channel differs from value by more than tolerance, count if
+// there is none
+inline size_t FindWithin(const Pixel *p, const size_t count, const Pixel value, const uint8_t tolerance) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::FindWithinAVX2(p, count, value, tolerance);
+  case Level::sse41: return detail::FindWithinSSE41(p, count, value, tolerance);
+  default: break;
+  }
+#endif
+  return detail::FindWithinScalar(p, count, value, tolerance);
+}
+
+// true if every one of the count pixels at p has alpha 255
+inline bool AllOpaque(const Pixel *p, const size_t count) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::AllOpaqueAVX2(p, count);
+  case Level::sse41: return detail::AllOpaqueSSE41(p, count);
+  default: break;
+  }
+#endif
+  return detail::AllOpaqueScalar(p, count);
+}
+
+// Copies count 4 byte pixels from in to out, swapping the first and third byte (RGBA <-> BGRA). in and out may be
+// the same buffer
+inline void SwapRedBlue(const std::byte *in, std::byte *out, const size_t count) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::SwapRedBlueAVX2(in, out, count);
+  case Level::sse41: return detail::SwapRedBlueSSE41(in, out, count);
+  default: break;
+  }
+#endif
+  detail::SwapRedBlueScalar(in, out, count);
+}
+
+// Blends count src pixels over dst (straight alpha source-over, see detail::BlendPixel)
+inline void BlendOver(const Pixel *src, Pixel *dst, const size_t count) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::BlendOverAVX2(src, dst, count);
+  case Level::sse41: return detail::BlendOverSSE41(src, dst, count);
+  default: break;
+  }
+#endif
+  detail::BlendOverScalar(src, dst, count);
+}
+
+// dst[i] = dst[i] + src[i] (Pixel::operator+, saturating). src may be dst
+inline void Add(const Pixel *src, Pixel *dst, const size_t count) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::AddAVX2(src, dst, count);
+  case Level::sse41: return detail::AddSSE41(src, dst, count);
+  default: break;
+  }
+#endif
+  detail::AddScalar(src, dst, count);
+}
+
+// dst[i] = dst[i] - src[i] (Pixel::operator-, saturating). src may be dst
+inline void Subtract(const Pixel *src, Pixel *dst, const size_t count) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::SubtractAVX2(src, dst, count);
+  case Level::sse41: return detail::SubtractSSE41(src, dst, count);
+  default: break;
+  }
+#endif
+  detail::SubtractScalar(src, dst, count);
+}
+
+// dst[i] = dst[i] * src[i] / 255 per channel, rounded (see detail::MultiplyPixel). src may be dst
+inline void Multiply(const Pixel *src, Pixel *dst, const size_t count) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::MultiplyAVX2(src, dst, count);
+  case Level::sse41: return detail::MultiplySSE41(src, dst, count);
+  default: break;
+  }
+#endif
+  detail::MultiplyScalar(src, dst, count);
+}
+
+// Blends count premultiplied src pixels over dst (see detail::PremultipliedOverPixel)
+inline void BlendOverPremultiplied(const Pixel *src, Pixel *dst, const size_t count) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::PremultipliedOverAVX2(src, dst, count);
+  case Level::sse41: return detail::PremultipliedOverSSE41(src, dst, count);
+  default: break;
+  }
+#endif
+  detail::PremultipliedOverScalar(src, dst, count);
+}
+
+// dst[i] = dst[i] * scale (Pixel::operator*(float))
+inline void Scale(Pixel *dst, const size_t count, const float scale) {
+#if defined(QOID_SIMD_X86)
+  switch (Active()) {
+  case Level::avx2: return detail::ScaleAVX2(dst, count, scale);
+  case Level::sse41: return detail::ScaleSSE41(dst, count, scale);
+  default: break;
+  }
+#endif
+  detail::ScaleScalar(dst, count, scale);
+}
+
+} // namespace simd
+} // namespace QOID
@@ -0,0 +1,421 @@
+#pragma once
+#include "../QOID_General.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <span>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <filesystem>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace QOID {
+
+// Output target of the encoders. Encoders write straight into [Pos(), Pos() + Available()) and hand the new
+// position back with Advance. What happens once the space runs out is up to the derived sink (flush, grow or fail).
+class Sink {
+public:
+  virtual ~Sink() = default;
+
+  // Makes sure at least Size bytes can be written at Pos(). Returns false if the sink can't take them
+  inline bool Reserve(const size_t Size) { return Available() >= Size || Overflow(Size); }
+
+  inline std::byte *Pos() const { return m_pos; }
+  inline size_t Available() const { return static_cast<size_t>(m_end - m_pos); }
+
+  // Marks everything up to Pos as written
+  inline void Advance(std::byte *const Pos) { m_pos = Pos; }
+
+  // Copies Size bytes into the sink
+  inline bool Write(const void *Data, size_t Size) {
+    const auto *bytes{static_cast<const std::byte *>(Data)};
+    while (Size) {
+      if (!Reserve(1)) return false;
+      const size_t chunk{std::min(Size, Available())};
+      std::memcpy(m_pos, bytes, chunk);
+      m_pos += chunk;
+      bytes += chunk;
+      Size -= chunk;
+    }
+    return true;
+  }
+
+  // Pushes out everything that is still buffered
+  virtual bool Flush() { return true; }
+
+  // Bytes written to the sink so far
+  inline size_t Written() const { return m_flushed + static_cast<size_t>(m_pos - m_begin); }
+
+  // errno value of the failure that made the sink return false (e.g. ENOSPC), 0 if it didn't fail
+  inline int Error() const { return m_error; }
+
+protected:
+  // Called when fewer than Size bytes are available
+  virtual bool Overflow(const size_t Size) = 0;
+
+  inline bool Fail(const int Error) {
+    m_error = Error;
+    return false;
+  }
+
+  std::byte *m_begin{nullptr};
+  std::byte *m_pos{nullptr};
+  std::byte *m_end{nullptr};
+  size_t m_flushed{0}; // bytes that already left [m_begin, m_pos)
+  int m_error{0};
+};
+
+// Fixed size buffer that is handed to Drain whenever it fills up, so memory use doesn't depend on the image size
+class BufferedSink : public Sink {
+public:
+  static constexpr size_t BufferSize{64 * 1024};
+
+  BufferedSink() : BufferedSink{std::span<std::byte>{}} {}
+  // Buffers in caller owned memory (at least MaxChunkSize of the encoders, usually BufferSize) that has to outlive the
+  // sink, which saves the allocation when sinks are created over and over (see qoi::Encoder). An empty Buffer
+  // allocates BufferSize bytes like the default constructor, not value initialized since every byte gets written
+  // before it is read
+  explicit BufferedSink(const std::span<std::byte> Buffer) :
+      m_buffer{Buffer.empty() ? std::make_unique_for_overwrite<std::byte[]>(BufferSize) : nullptr} {
+    m_begin = m_pos = m_buffer ? m_buffer.get() : Buffer.data();
+    m_end = m_begin + (m_buffer ? BufferSize : Buffer.size());
+  }
+
+  bool Flush() override {
+    const size_t size{static_cast<size_t>(m_pos - m_begin)};
+    if (size && !Drain(m_begin, size)) return false;
+    m_flushed += size;
+    m_pos = m_begin;
+    return true;
+  }
+
+protected:
+  virtual bool Drain(const std::byte *Data, const size_t Size) = 0;
+
+  bool Overflow(const size_t Size) override {
+    return Size <= static_cast<size_t>(m_end - m_begin) ? Flush() : Fail(ENOBUFS);
+  }
+
+private:
+  std::unique_ptr<std::byte[]> m_buffer; // null for caller owned buffers
+};
+
+// Buffers output for a std::ostream
+class StreamSink : public BufferedSink {
+public:
+  explicit StreamSink(std::ostream &Stream) : m_stream{Stream} {}
+
+  bool Flush() override {
+    if (!BufferedSink::Flush()) return false;
+    errno = 0;
+    return m_stream.flush() ? true : Fail(errno ? errno : EIO);
+  }
+
+protected:
+  // streams don't report why they failed, errno is the best guess (the file buffers set it)
+  bool Drain(const std::byte *Data, const size_t Size) override {
+    errno = 0;
+    if (m_stream.write(reinterpret_cast<const char *>(Data), static_cast<std::streamsize>(Size))) return true;
+    return Fail(errno ? errno : EIO);
+  }
+
+private:
+  std::ostream &m_stream;
+};
+
+// Buffers output for a file descriptor (which stays owned by the caller)
+class FdSink : public BufferedSink {
+public:
+  explicit FdSink(const int Fd) : m_fd{Fd} {}
+  // Buffers in Buffer instead of an own allocation, see BufferedSink. An empty Buffer allocates like FdSink(Fd)
+  FdSink(const int Fd, const std::span<std::byte> Buffer) : BufferedSink{Buffer}, m_fd{Fd} {}
+
+protected:
+  bool Drain(const std::byte *Data, size_t Size) override {
+    while (Size) {
+#if defined(_WIN32)
+      const auto written{::_write(m_fd, Data, static_cast<unsigned>(std::min<size_t>(Size, 1u << 30)))};
+#else
+      const auto written{::write(m_fd, Data, Size)};
+#endif
+      if (written < 0 && errno == EINTR) continue;
+      if (written <= 0) return Fail(written < 0 ? errno : ENOSPC);
+      Data += written;
+      Size -= static_cast<size_t>(written);
+    }
+    return true;
+  }
+
+private:
+  int m_fd;
+};
+
+// Writes into caller owned memory, fails once it is full
+class SpanSink : public Sink {
+public:
+  explicit SpanSink(const std::span<std::byte> Buffer) {
+    m_begin = m_pos = Buffer.data();
+    m_end = m_begin + Buffer.size();
+  }
+
+protected:
+  bool Overflow(const size_t) override { return Fail(ENOBUFS); }
+};
+
+// Appends to a vector, growing it as needed. The vector has its final size after Flush
+class VectorSink : public Sink {
+public:
+  explicit VectorSink(std::vector<std::byte> &Buffer, const size_t SizeHint = 0) :
+      m_buffer{Buffer}, m_start{Buffer.size()} {
+    m_buffer.resize(m_start + std::max<size_t>(SizeHint, 256));
+    m_begin = m_buffer.data() + m_start;
+    m_pos = m_begin;
+    m_end = m_buffer.data() + m_buffer.size();
+  }
+
+  bool Flush() override {
+    m_buffer.resize(m_start + Written());
+    m_begin = m_buffer.data() + m_start;
+    m_pos = m_end = m_buffer.data() + m_buffer.size();
+    return true;
+  }
+
+protected:
+  bool Overflow(const size_t Size) override {
+    const size_t written{Written()};
+    m_buffer.resize(m_start + written + std::max(Size, written));
+    m_begin = m_buffer.data() + m_start;
+    m_pos = m_begin + written;
+    m_end = m_buffer.data() + m_buffer.size();
+    return true;
+  }
+
+private:
+  std::vector<std::byte> &m_buffer;
+  size_t m_start; // size of the vector before anything was written
+};
+
+// Grows the empty file behind Fd (opened read / write, stays owned by the caller) to Capacity bytes and writes into a
+// shared mapping of it, so encoded bytes never go through a stream buffer. Flush truncates the file to the bytes
+// actually written. On Linux the blocks are allocated up front, so a full disk fails here instead of raising SIGBUS on
+// a write into the mapping. File systems that can't allocate blocks natively (EOPNOTSUPP) fail too rather than having
+// every block written, WriteFile uses the buffered backend then. If mapping fails the file is empty again. Only
+// available on POSIX systems, check IsOpen before use
+class MappedSink : public Sink {
+public:
+  MappedSink(const int Fd, const size_t Capacity) : m_fd{Fd} {
+#if !defined(_WIN32)
+    if (Capacity == 0) return;
+#if defined(__linux__)
+    // not posix_fallocate: glibc emulates that by writing every block where the file system has no fallocate
+    int grown;
+    do grown = ::fallocate(m_fd, 0, 0, static_cast<off_t>(Capacity)) == 0 ? 0 : errno;
+    while (grown == EINTR);
+#else
+    const int grown{::ftruncate(m_fd, static_cast<off_t>(Capacity)) == 0 ? 0 : errno};
+#endif
+    void *mapping{grown == 0 ? ::mmap(nullptr, Capacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0) : MAP_FAILED};
+    if (mapping == MAP_FAILED) {
+      Fail(grown ? grown : errno);
+      static_cast<void>(::ftruncate(m_fd, 0));
+      return;
+    }
+    m_begin = m_pos = static_cast<std::byte *>(mapping);
+    m_end = m_begin + Capacity;
+#else
+    (void)Capacity;
+#endif
+  }
+  MappedSink(const MappedSink &) = delete;
+  MappedSink &operator=(const MappedSink &) = delete;
+
+  ~MappedSink() override {
+#if !defined(_WIN32)
+    if (m_begin) ::munmap(m_begin, static_cast<size_t>(m_end - m_begin));
+#endif
+  }
+
+  inline bool IsOpen() const { return m_begin != nullptr; }
+
+  bool Flush() override {
+#if !defined(_WIN32)
+    if (!IsOpen()) return false;
+    return ::ftruncate(m_fd, static_cast<off_t>(Written())) == 0 ? true : Fail(errno);
+#else
+    return false;
+#endif
+  }
+
+protected:
+  bool Overflow(const size_t) override { return Fail(ENOSPC); }
+
+private:
+  int m_fd;
+};
+
+// Path strings of an AtomicFile. Handing the same one to every AtomicFile (e.g. through WriteFile) reuses their memory,
+// so writing a file makes no heap allocations once the strings have grown to the longest path
+struct AtomicFilePaths {
+  std::string path;
+  std::string tempPath;
+  std::string directory;
+};
+
+// Temporary file next to FilePath that replaces FilePath on Commit, so readers only ever see the old file or the
+// complete new one. Without Commit the temporary file is removed again. Error holds the errno value of a failure.
+// Paths (if given) has to outlive the file and must not be shared with another open AtomicFile
+class AtomicFile {
+public:
+  explicit AtomicFile(const strv FilePath, AtomicFilePaths *Paths = nullptr)
+      : m_paths{Paths ? *Paths : m_ownPaths}, m_path{m_paths.path}, m_tempPath{m_paths.tempPath} {
+    static std::atomic<unsigned> counter{0};
+    m_path.assign(FilePath);
+    // O_EXCL makes the name unique, a clash with another writer just takes the next one
+    for (int attempt{0}; attempt < 16 && m_fd < 0; ++attempt) {
+      m_tempPath.assign(m_path).append(".tmp");
+      appendNumber(m_tempPath, static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()));
+      m_tempPath += '-';
+      appendNumber(m_tempPath, counter++);
+#if defined(_WIN32)
+      m_fd = ::_open(m_tempPath.c_str(), _O_RDWR | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+      m_fd = ::open(m_tempPath.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+#endif
+      m_error = m_fd < 0 ? errno : 0;
+      if (m_error != EEXIST) break;
+    }
+#if !defined(_WIN32)
+    // a replaced file keeps its permissions, only new files get 0644 (less the umask)
+    struct stat existing;
+    if (m_fd >= 0 && ::stat(m_path.c_str(), &existing) == 0 && ::fchmod(m_fd, existing.st_mode & 07777) != 0) {
+      const int error{errno};
+      Close();
+      std::remove(m_tempPath.c_str());
+      m_created = false;
+      m_error = error;
+    }
+#endif
+  }
+  AtomicFile(const AtomicFile &) = delete;
+  AtomicFile &operator=(const AtomicFile &) = delete;
+
+  ~AtomicFile() {
+    if (m_committed) return;
+    Close();
+    if (m_created) std::remove(m_tempPath.c_str());
+  }
+
+  inline bool IsOpen() const { return m_fd >= 0; }
+  inline int Fd() const { return m_fd; }
+  inline int Error() const { return m_error; }
+
+  // Syncs the temporary file to disk, closes it and renames it to FilePath (the directory is synced as well on POSIX
+  // systems, where possible). Returns false if any of that fails, FilePath is untouched then
+  inline bool Commit() {
+    if (m_fd < 0) return false;
+#if defined(_WIN32)
+    if (::_commit(m_fd) != 0) return Failed(errno);
+    if (!Close()) return false;
+    std::error_code error;
+    std::filesystem::rename(m_tempPath, m_path, error);
+    if (error) return Failed(error.value());
+#else
+    if (::fsync(m_fd) != 0) return Failed(errno);
+    if (!Close()) return false;
+    if (::rename(m_tempPath.c_str(), m_path.c_str()) != 0) return Failed(errno);
+    SyncDirectory();
+#endif
+    m_committed = true;
+    return true;
+  }
+
+private:
+  inline bool Failed(const int Error) {
+    m_error = Error;
+    return false;
+  }
+
+  // appends Value in decimal, without the temporary string of std::to_string
+  static inline void appendNumber(std::string &Text, const uint64_t Value) {
+    std::array<char, 20> digits;
+    const auto [end, error]{std::to_chars(digits.data(), digits.data() + digits.size(), Value)};
+    Text.append(digits.data(), end);
+  }
+
+  inline bool Close() {
+    if (m_fd < 0) return true;
+    m_created = true;
+#if defined(_WIN32)
+    const bool closed{::_close(m_fd) == 0};
+#else
+    const bool closed{::close(m_fd) == 0};
+#endif
+    m_fd = -1;
+    return closed ? true : Failed(errno);
+  }
+
+#if !defined(_WIN32)
+  // makes the rename itself durable. Best effort, not every file system can sync a directory
+  inline void SyncDirectory() {
+    const size_t slash{m_path.find_last_of('/')};
+    std::string &directory{m_paths.directory};
+    if (slash == std::string::npos) directory.assign(".");
+    else directory.assign(m_path, 0, slash == 0 ? 1 : slash);
+    const int fd{::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+    if (fd < 0) return;
+    static_cast<void>(::fsync(fd));
+    ::close(fd);
+  }
+#endif
+
+  AtomicFilePaths m_ownPaths;
+  AtomicFilePaths &m_paths;
+  std::string &m_path;
+  std::string &m_tempPath;
+  int m_fd{-1};
+  int m_error{0};
+  bool m_created{false};
+  bool m_committed{false};
+};
+
+// Writes FilePath through an AtomicFile: EncodeTo(Sink &) writes everything (and flushes), then the file is committed.
+// OutputBackend::mmap maps MaxSize bytes (an upper bound of the output) and falls back to buffered writes if that
+// fails. Buffered writes go through Buffer if it isn't empty (see FdSink), the path strings go into Paths if given
+template <typename Function>
+inline WriteResult WriteFile(const strv FilePath, const OutputBackend Output, const size_t MaxSize,
+                             const Function &EncodeTo, const std::span<std::byte> Buffer = {},
+                             AtomicFilePaths *Paths = nullptr) {
+  AtomicFile file{FilePath, Paths};
+  if (!file.IsOpen()) return {false, 0, file.Error()};
+  const auto finish{[&file](const Sink &sink, const bool Encoded) -> WriteResult {
+    // a failure without an error of the sink means the encoder refused the input
+    if (!Encoded) return {false, sink.Written(), sink.Error() ? sink.Error() : EINVAL};
+    if (!file.Commit()) return {false, sink.Written(), file.Error()};
+    return {true, sink.Written(), 0};
+  }};
+  if (Output == OutputBackend::mmap) {
+    MappedSink sink{file.Fd(), MaxSize};
+    if (sink.IsOpen()) return finish(sink, EncodeTo(sink));
+  }
+  FdSink sink{file.Fd(), Buffer};
+  return finish(sink, EncodeTo(sink));
+}
+
+} // namespace QOID
@@ -0,0 +1,78 @@
+#pragma once
+#include "../QOID_General.hpp"
+#include "generator.hpp"
+#include "pixel.hpp"
+#include <cstddef>
+#include <functional>
+#include <span>
+#include <string>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace QOID {
+
+// Input of the row streaming encoders (qoi::EncodeRows), for images that don't fit into memory as a whole. Called once
+// per row from top to bottom, returns row y (width pixels) which has to stay valid until the next call. An empty span
+// aborts the encode
+using RowProvider = std::function<std::span<const Pixel>(ui y)>;
+
+// Coroutine producing the pixels for the streaming encoders (qoi::EncodeRows, qoi::StreamEncoder) in row order, e.g. a
+// renderer that co_yields every scanline as soon as it is done. A yielded span may hold any amount of pixels
+using RowGenerator = Generator<std::span<const Pixel>>;
+
+// Read only mapping of a raw RGBA file (width * height pixels, row by row, no header), so the encoders can walk an
+// image larger than RAM and the kernel pages it in and out. Passed as a RowProvider with std::ref. Only available on
+// POSIX systems, check IsOpen before use
+class MappedRaw {
+public:
+  MappedRaw(const std::string &FilePath, const ui width, const ui height) : m_width{width}, m_height{height} {
+#if !defined(_WIN32)
+    const size_t size{static_cast<size_t>(width) * height * sizeof(Pixel)};
+    const int fd{::open(FilePath.c_str(), O_RDONLY)};
+    if (fd < 0) return;
+    struct stat info{};
+    if (size != 0 && ::fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= size) {
+      void *mapping{::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)};
+      if (mapping != MAP_FAILED) {
+        // rows are read once from top to bottom
+        ::madvise(mapping, size, MADV_SEQUENTIAL);
+        m_data = static_cast<const Pixel *>(mapping);
+      }
+    }
+    ::close(fd); // the mapping keeps the file referenced
+#else
+    (void)FilePath;
+#endif
+  }
+  MappedRaw(const MappedRaw &) = delete;
+  MappedRaw &operator=(const MappedRaw &) = delete;
+
+  ~MappedRaw() {
+#if !defined(_WIN32)
+    if (m_data) ::munmap(const_cast<Pixel *>(m_data), static_cast<size_t>(m_width) * m_height * sizeof(Pixel));
+#endif
+  }
+
+  inline bool IsOpen() const { return m_data != nullptr; }
+
+  constexpr ui getWidth() const { return m_width; }
+  constexpr ui getHeight() const { return m_height; }
+
+  // Row y, empty if the file isn't mapped or y is out of bounds
+  inline std::span<const Pixel> operator()(const ui y) const {
+    if (!m_data || y >= m_height) return {};
+    return {m_data + static_cast<size_t>(y) * m_width, m_width};
+  }
+
+private:
+  ui m_width;
+  ui m_height;
+  const Pixel *m_data{nullptr};
+};
+
+} // namespace QOID
@@ -0,0 +1,140 @@
+#pragma once
+#include "../QOID_General.hpp"
+#include "pixel.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+
+namespace QOID {
+
+// Non owning view of a rectangle of pixels, rows are Stride pixels apart. Views of an Image come from Image::SubRect
+// and stay valid as long as the image isn't resized or destroyed
+template <typename PixelType> class BasicView {
+public:
+  BasicView(PixelType *Data, const ui Width, const ui Height, const size_t Stride) :
+      m_data{Data}, m_width{Width}, m_height{Height}, m_stride{Stride} {}
+
+  // View -> ConstView
+  template <typename Other>
+    requires std::is_convertible_v<Other *, PixelType *>
+  BasicView(const BasicView<Other> &view) :
+      m_data{view.Data()}, m_width{view.getWidth()}, m_height{view.getHeight()}, m_stride{view.getStride()} {}
+
+  constexpr ui getWidth() const { return m_width; }
+  constexpr ui getHeight() const { return m_height; }
+  constexpr size_t getStride() const { return m_stride; }
+  constexpr PixelType *Data() const { return m_data; }
+
+  // Row y of the view. Throws std::out_of_range
+  inline std::span<PixelType> Row(const ui y) const {
+    if (y >= m_height) throw std::out_of_range("Row out of bounds");
+    return fRow(y);
+  }
+
+  // Row y of the view (no bounds checking)
+  inline std::span<PixelType> fRow(const ui y) const { return {m_data + y * m_stride, m_width}; }
+
+  // View of the Width x Height rectangle at (x, y), relative to this view. Throws std::out_of_range if it doesn't fit
+  inline BasicView SubRect(const ui x, const ui y, const ui Width, const ui Height) const {
+    if (x > m_width || y > m_height || Width > m_width - x || Height > m_height - y)
+      throw std::out_of_range("Rectangle out of bounds");
+    return {m_data + y * m_stride + x, Width, Height, m_stride};
+  }
+
+private:
+  PixelType *m_data;
+  ui m_width;
+  ui m_height;
+  size_t m_stride;
+};
+
+using View = BasicView<Pixel>;
+using ConstView = BasicView<const Pixel>;
+
+// Bulk operations, sizes are checked once per call and the rows are handled by std::fill / memmove / the simd kernels
+
+// Sets every pixel of Target to P
+inline void Fill(const View Target, const Pixel P) {
+  for (ui y{0}; y < Target.getHeight(); ++y) std::ranges::fill(Target.fRow(y), P);
+}
+
+// Copies Source into Target, which must have the same size (throws std::invalid_argument otherwise). Both may overlap
+// (e.g. two rectangles of the same image)
+inline void Copy(const ConstView Source, const View Target) {
+  if (Source.getWidth() != Target.getWidth() || Source.getHeight() != Target.getHeight())
+    throw std::invalid_argument("Source and target sizes differ");
+  const size_t rowBytes{Source.getWidth() * sizeof(Pixel)};
+  // copying a rectangle down over itself has to start at the bottom
+  if (std::greater<const Pixel *>{}(Target.Data(), Source.Data())) {
+    for (ui y{Source.getHeight()}; y-- > 0;) std::memmove(Target.fRow(y).data(), Source.fRow(y).data(), rowBytes);
+  } else {
+    for (ui y{0}; y < Source.getHeight(); ++y) std::memmove(Target.fRow(y).data(), Source.fRow(y).data(), rowBytes);
+  }
+}
+
+namespace detail {
+// Runs Kernel(source row, target row, width) over every row, sizes must match (throws std::invalid_argument otherwise)
+template <typename Kernel> inline void ForEachRow(const ConstView Source, const View Target, const Kernel &kernel) {
+  if (Source.getWidth() != Target.getWidth() || Source.getHeight() != Target.getHeight())
+    throw std::invalid_argument("Source and target sizes differ");
+  for (ui y{0}; y < Source.getHeight(); ++y) kernel(Source.fRow(y).data(), Target.fRow(y).data(), Source.getWidth());
+}
+
+// Span version of ForEachRow, the whole span is one row
+template <typename Kernel>
+inline void ForEachRow(const std::span<const Pixel> Source, const std::span<Pixel> Target, const Kernel &kernel) {
+  if (Source.size() != Target.size()) throw std::invalid_argument("Source and target sizes differ");
+  kernel(Source.data(), Target.data(), Source.size());
+}
+} // namespace detail
+
+// Blends Source over Target (straight alpha source-over), sizes must match (throws std::invalid_argument otherwise).
+// Source and Target must not overlap
+inline void BlendOver(const ConstView Source, const View Target) {
+  detail::ForEachRow(Source, Target, simd::BlendOver);
+}
+
+// Per pixel arithmetic on the simd kernels, every pixel comes out exactly like the scalar Pixel operator (or
+// simd::detail function) named. Views or spans (e.g. Image::GetData() for whole images), sizes must match (throws
+// std::invalid_argument otherwise). Source may be Target itself but must not overlap it otherwise
+
+// Target = Target + Source (Pixel::operator+, saturating)
+inline void Add(const ConstView Source, const View Target) { detail::ForEachRow(Source, Target, simd::Add); }
+inline void Add(const std::span<const Pixel> Source, const std::span<Pixel> Target) {
+  detail::ForEachRow(Source, Target, simd::Add);
+}
+
+// Target = Target - Source (Pixel::operator-, saturating)
+inline void Subtract(const ConstView Source, const View Target) { detail::ForEachRow(Source, Target, simd::Subtract); }
+inline void Subtract(const std::span<const Pixel> Source, const std::span<Pixel> Target) {
+  detail::ForEachRow(Source, Target, simd::Subtract);
+}
+
+// Target = Target * Source / 255 per channel, alpha included (multiply blend, simd::detail::MultiplyPixel)
+inline void Multiply(const ConstView Source, const View Target) { detail::ForEachRow(Source, Target, simd::Multiply); }
+inline void Multiply(const std::span<const Pixel> Source, const std::span<Pixel> Target) {
+  detail::ForEachRow(Source, Target, simd::Multiply);
+}
+
+// Blends premultiplied Source over premultiplied Target (simd::detail::PremultipliedOverPixel)
+inline void BlendOverPremultiplied(const ConstView Source, const View Target) {
+  detail::ForEachRow(Source, Target, simd::BlendOverPremultiplied);
+}
+inline void BlendOverPremultiplied(const std::span<const Pixel> Source, const std::span<Pixel> Target) {
+  detail::ForEachRow(Source, Target, simd::BlendOverPremultiplied);
+}
+
+// Target = Target * Factor (Pixel::operator*(float)), e.g. to brighten or darken a frame
+inline void Scale(const View Target, const float Factor) {
+  for (ui y{0}; y < Target.getHeight(); ++y) simd::Scale(Target.fRow(y).data(), Target.getWidth(), Factor);
+}
+inline void Scale(const std::span<Pixel> Target, const float Factor) {
+  simd::Scale(Target.data(), Target.size(), Factor);
+}
+
+} // namespace QOID
@@ -1,12 +1,13 @@
 #pragma once
 // based on https://qoiformat.org/qoi-specification.pdf  | accessed on 2026.02.2025
+#include <array>
 #include <cstdint>
 #include <string>
 #include <string_view>
 
 // assumes little endian if not big endian
 #if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-#define BIG_ENDIAN
+#define QOID_BIG_ENDIAN
 #endif
 
 namespace QOID {
@@ -27,7 +28,121 @@ inline color max{255};
 enum class ImageType {
   // Will be saved according to QOI specification - 26.02.2025
   qoi = 0,
-  // TGA is a lot faster, but its raw data, so a lot more space taken up in storage
+  // TGA is a lot faster, but its raw data, so a lot more space taken up in storage (EncodeOptions::rle helps for
+  // flat images)
   tga,
 };
+
+// how GenerateFile gets the encoded bytes into the file
+enum class OutputBackend {
+  // buffered writes through a file descriptor
+  stream = 0,
+  // file is sized once, encoded straight into a memory mapping and truncated to the final size. Falls back to
+  // stream where mapping isn't available
+  mmap,
+};
+
+// Width and height of an image, e.g. read from a file header before decoding
+struct Dimensions {
+  ui width;
+  ui height;
+};
+
+// width x height pixels at (x, y), empty if either is 0
+struct Rect {
+  ui x;
+  ui y;
+  ui width;
+  ui height;
+
+  constexpr bool empty() const { return width == 0 || height == 0; }
+};
+
+// options for Image::GenerateFile, formats ignore the ones that don't apply to them
+struct EncodeOptions {
+  // qoi: number of threads encoding row bands in parallel. 1 encodes serially, 0 uses all hardware threads
+  unsigned threads{1};
+  // qoi: rows per band in parallel mode, 0 picks a size from the image height and thread count
+  ui bandRows{0};
+  // qoi, tga: output path used by GenerateFile
+  OutputBackend output{OutputBackend::stream};
+  // tga: run-length encode the pixels (image type 10). A lot smaller for flat images, slower to write than raw
+  bool rle{false};
+  // qoi: record a restart point every restartRows rows in a chunk after the end marker, 0 writes none. Decoders that
+  // know the chunk can split the work between threads, others ignore it. Overrides bandRows
+  ui restartRows{0};
+  // qoi: near-lossless when above 0, every channel of every pixel may come out up to maxError off. The output is a
+  // standard qoi file, smaller for noisy images (longer runs, DIFF / LUMA instead of RGB). Always encodes serially,
+  // without restart points. Small bounds on noisy images cost encode time: every pixel's chunk depends on the decoded
+  // value of the one before, and pixels DIFF can't reach are looked up in all 64 index slots. On camera-like noise
+  // maxError 1 and 2 take about 3-4x the lossless time, large bounds are faster than lossless (long runs)
+  uint8_t maxError{0};
+  // qoi, near-lossless only: trades size for speed. The index is only searched for pixels that neither DIFF nor LUMA
+  // reach (they would need RGB / RGBA otherwise) instead of for every pixel DIFF misses. On camera-like noise at
+  // maxError 1 about a quarter faster, at 2 barely, and about 30% larger at both
+  bool nearFast{false};
+};
+
+// options for qoi::SequenceWriter
+struct SequenceOptions {
+  // every keyframeInterval-th frame is stored whole, so seeking decodes at most that many frames. 0 only makes the
+  // first frame and frames that changed too much (maxChanged) keyframes
+  ui keyframeInterval{60};
+  // unchanged stretches shorter than this many pixels are stored with the changed pixels around them, every skip
+  // costs a few bytes and interrupts the qoi runs
+  ui minSkip{16};
+  // a frame where more than this share of the pixels changed is stored as a keyframe, a delta would only be larger
+  float maxChanged{0.75f};
+  // used for the keyframes
+  EncodeOptions keyframe{};
+};
+
+// Statistics of one qoi encode, filled by the qoi Encode / GenerateFile overloads taking it. Sizes and timings are
+// always filled. The chunk counts need QOID_ENCODER_STATS to be defined, otherwise counted stays false and they stay 0.
+// Encodes without an EncodeStats never pay for any of it
+struct EncodeStats {
+  bool counted{false};
+  // chunks per opcode
+  uint64_t run{0};
+  uint64_t diff{0};
+  uint64_t luma{0};
+  uint64_t index{0};
+  uint64_t rgb{0};
+  uint64_t rgba{0};
+  // runLengths[n - 1] is the amount of RUN chunks covering n pixels
+  std::array<uint64_t, 62> runLengths{};
+  uint64_t pixels{0};
+  // bytes written, header and end marker included
+  uint64_t bytes{0};
+  // wall time per phase: opaque scan + header, pixel data, end marker + restart points + flush
+  double headerSeconds{0};
+  double encodeSeconds{0};
+  double flushSeconds{0};
+
+  // Share of the pixels outside of runs that were found in the index
+  inline double IndexHitRate() const {
+    const uint64_t lookups{index + diff + luma + rgb + rgba};
+    return lookups ? static_cast<double>(index) / static_cast<double>(lookups) : 0.0;
+  }
+};
+
+// Result of writing an image file (GenerateFile), true on success. Files are written to a temporary file first, which
+// only replaces the target once it is complete and synced, so a failed write never leaves a truncated image behind
+struct WriteResult {
+  bool ok{false};
+  // size of the file, on failure the bytes encoded up to it
+  uint64_t bytes{0};
+  // errno value of the failure (e.g. ENOSPC, EACCES), EINVAL if the encoder refused the image (e.g. too large for tga)
+  // or a row source aborted
+  int error{0};
+
+  explicit operator bool() const { return ok; }
+};
+
+// options for Image::LoadFile
+struct DecodeOptions {
+  // qoi: threads decoding in parallel if the file has restart points (see EncodeOptions::restartRows). 0 uses all
+  // hardware threads
+  unsigned threads{1};
+};
 } // namespace QOID
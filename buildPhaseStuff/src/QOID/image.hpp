@@ -1,17 +1,80 @@
 #pragma once
 #include "QOID_General.hpp"
 #include "DataTypes/pixel.hpp"
+#include "DataTypes/view.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
 #include <cstring>
-#include <vector>
+#include <limits>
+#include <memory>
+#include <new>
+#include <span>
 #include <stdexcept>
+#include <utility>
+#include <vector>
 
 namespace QOID {
 
 class Image {
 public:
+  // Tag for the constructor that leaves the pixels uninitialized
+  struct Uninitialized {};
+
   Image() = delete;
-  Image(const ui width, const ui height) : m_width{width}, m_height{height}, m_pixel_data(width * height) {}
-  Image(Image &I) : m_width{I.m_width}, m_height{I.m_height}, m_pixel_data{I.m_pixel_data} {}
+  // Every pixel starts out as (0, 0, 0, 255)
+  Image(const ui width, const ui height) : Image{width, height, Uninitialized{}} { Fill(Pixel{}); }
+  // Pixels hold whatever the allocator returned, for images that get overwritten completely anyway (decoders, frames)
+  Image(const ui width, const ui height, Uninitialized) :
+      m_width{width}, m_height{height}, m_owned{Allocate(static_cast<size_t>(width) * height)},
+      m_pixel_data{m_owned.get()} {}
+  // Deep copy, the copy always owns its pixels
+  Image(const Image &I) : Image{I.m_width, I.m_height, Uninitialized{}} {
+    std::copy_n(I.m_pixel_data, I.PixelCount(), m_pixel_data);
+  }
+  Image(Image &&I) noexcept :
+      m_width{std::exchange(I.m_width, 0)}, m_height{std::exchange(I.m_height, 0)}, m_owned{std::move(I.m_owned)},
+      m_pixel_data{std::exchange(I.m_pixel_data, nullptr)}, m_dirty{std::move(I.m_dirty)},
+      m_trackingId{std::exchange(I.m_trackingId, 0)}, m_generation{std::exchange(I.m_generation, 0)} {
+    I.m_dirty.clear();
+  }
+
+  // A tracking image keeps tracking with every pixel marked
+  Image &operator=(const Image &I) {
+    if (this == &I) return *this;
+    const bool tracking{Tracking()};
+    *this = Image{I};
+    if (tracking) TrackChanges();
+    return *this;
+  }
+  Image &operator=(Image &&I) noexcept {
+    m_width = std::exchange(I.m_width, 0);
+    m_height = std::exchange(I.m_height, 0);
+    m_owned = std::move(I.m_owned);
+    m_pixel_data = std::exchange(I.m_pixel_data, nullptr);
+    m_dirty = std::move(I.m_dirty);
+    I.m_dirty.clear();
+    m_trackingId = std::exchange(I.m_trackingId, 0);
+    m_generation = std::exchange(I.m_generation, 0);
+    return *this;
+  }
+
+  // Uses width * height pixels at Data (e.g. a camera or decoder buffer) without copying. The memory stays owned by
+  // the caller and has to outlive the image and every move of it
+  static Image Wrap(Pixel *const Data, const ui width, const ui height) { return Image{Data, width, height}; }
+
+  // false for images made with Wrap
+  inline bool OwnsData() const { return m_owned != nullptr; }
+
+  // Same size and pixels
+  inline bool operator==(const Image &I) const {
+    return m_width == I.m_width && m_height == I.m_height && std::ranges::equal(GetData(), I.GetData());
+  }
+
+  // Loads an image from disk. Throws std::runtime_error if the file can't be read or is malformed
+  static Image LoadFile(const strv FilePath, const ImageType Type = QOID::ImageType::qoi,
+                        const DecodeOptions &Options = {});
 
   // Set pixel at position
   inline void SetPixel(const Pixel P, const ui width, const ui height);
@@ -26,24 +89,188 @@ public:
   inline Pixel &fGetPixel(const ui width, const ui height);
 
   // Fill Image with given Pixel
-  inline void Fill(const Pixel Pixel) { std::fill(m_pixel_data.begin(), m_pixel_data.end(), Pixel); }
+  inline void Fill(const Pixel Pixel) {
+    MarkAllDirty();
+    std::fill_n(m_pixel_data, PixelCount(), Pixel);
+  }
+
+  // Row y. Throws std::out_of_range
+  inline std::span<Pixel> Row(const ui y) {
+    const std::span<Pixel> row{View{m_pixel_data, m_width, m_height, m_width}.Row(y)};
+    MarkDirty(0, y, m_width, 1);
+    return row;
+  }
+  inline std::span<const Pixel> Row(const ui y) const { return GetView().Row(y); }
 
-  // Get reference to pixel data (mutable)
-  inline std::vector<Pixel> &GetData() { return m_pixel_data; }
+  // Whole image as a view
+  inline View GetView() {
+    MarkAllDirty();
+    return {m_pixel_data, m_width, m_height, m_width};
+  }
+  inline ConstView GetView() const { return {m_pixel_data, m_width, m_height, m_width}; }
+
+  // View of the width x height rectangle at (x, y). Throws std::out_of_range if it doesn't fit
+  inline View SubRect(const ui x, const ui y, const ui width, const ui height) {
+    const View view{View{m_pixel_data, m_width, m_height, m_width}.SubRect(x, y, width, height)};
+    MarkDirty(x, y, width, height);
+    return view;
+  }
+  inline ConstView SubRect(const ui x, const ui y, const ui width, const ui height) const {
+    return GetView().SubRect(x, y, width, height);
+  }
+
+  // Bulk writes, bounds are checked once per call (std::out_of_range)
+
+  // Fills the width x height rectangle at (x, y) with P
+  inline void FillRect(const ui x, const ui y, const ui width, const ui height, const Pixel P) {
+    QOID::Fill(SubRect(x, y, width, height), P);
+  }
+
+  // Copies Source (e.g. other.SubRect(...), may be part of this image) to (x, y)
+  inline void CopyRect(const ConstView Source, const ui x, const ui y) {
+    Copy(Source, SubRect(x, y, Source.getWidth(), Source.getHeight()));
+  }
+
+  // Blends Source over the pixels at (x, y), straight alpha source-over. Source must not overlap the target rectangle
+  inline void Blit(const ConstView Source, const ui x, const ui y) {
+    BlendOver(Source, SubRect(x, y, Source.getWidth(), Source.getHeight()));
+  }
+
+  // Get pixel data, row by row (mutable)
+  inline std::span<Pixel> GetData() {
+    MarkAllDirty();
+    return {m_pixel_data, PixelCount()};
+  }
 
-  // Get reference to pixel data (read-only)
-  inline const std::vector<Pixel> &GetData() const { return m_pixel_data; }
+  // Get pixel data, row by row (read-only)
+  inline std::span<const Pixel> GetData() const { return {m_pixel_data, PixelCount()}; }
 
   constexpr ui getWidth() const { return m_width; }
   constexpr ui getHeight() const { return m_height; }
 
-  // Filepath can be realtive to cwd or absolute
-  bool GenerateFile(const strv FilePath, const ImageType Type = QOID::ImageType::qoi);
+  // Change tracking, for consumers that only want to look at what changed (e.g. qoi::IncrementalEncoder). Once
+  // started, every mutable access marks the pixels it can reach: SetPixel and GetPixel one pixel, Row, SubRect and the
+  // rectangle functions their rectangle, Fill, GetView and GetData the whole image. Writes the image can't see (through
+  // pointers kept from earlier calls or through memory passed to Wrap) have to be marked with MarkDirty. Copies of an
+  // image don't track.
+  // There are two ways to read the marks. Dirty / DirtyBounds see everything marked since the last ClearDirty, for a
+  // single owner of the image. Consumers that share an image keep the Generation of their last look instead and ask
+  // ChangedSince, nobody has to clear anything then
+
+  // Starts tracking with the whole image marked. Costs 16 bytes per row. Every start gets a new TrackingId
+  inline void TrackChanges() {
+    static std::atomic<uint64_t> nextId{1};
+    m_trackingId = nextId++;
+    m_dirty.assign(m_height, DirtySpan{0, m_width, ++m_generation});
+  }
+
+  inline bool Tracking() const { return !m_dirty.empty(); }
+
+  // Identifies the tracked pixels for consumers that keep state about them: unique in the process for every
+  // TrackChanges, moves take it along. 0 without tracking
+  inline uint64_t TrackingId() const { return m_trackingId; }
+
+  // Counts the marks, a consumer keeps the value of its last look for ChangedSince
+  inline uint64_t Generation() const { return m_generation; }
+
+  // true if one of the Count rows from y on was marked after Generation returned Since. Always true without tracking
+  inline bool ChangedSince(const uint64_t Since, const ui y, const ui Count = 1) const {
+    if (m_dirty.empty()) return true;
+    for (ui row{y}; row < m_height && row - y < Count; ++row)
+      if (m_dirty[row].generation > Since) return true;
+    return false;
+  }
+
+  // Marks the width x height rectangle at (x, y), clipped to the image
+  inline void MarkDirty(const ui x, const ui y, const ui width, const ui height) {
+    if (m_dirty.empty() || x >= m_width || y >= m_height) return;
+    const ui end{x + std::min(width, m_width - x)};
+    ++m_generation;
+    for (ui row{y}; row < y + std::min(height, m_height - y); ++row) {
+      m_dirty[row].begin = std::min(m_dirty[row].begin, x);
+      m_dirty[row].end = std::max(m_dirty[row].end, end);
+      m_dirty[row].generation = m_generation;
+    }
+  }
+
+  inline void MarkAllDirty() { MarkDirty(0, 0, m_width, m_height); }
+
+  // Forgets what has been marked for Dirty / DirtyBounds, the current pixels become the state later changes are
+  // relative to. ChangedSince isn't affected
+  inline void ClearDirty() {
+    for (DirtySpan &row : m_dirty) {
+      row.begin = DirtySpan{}.begin;
+      row.end = 0;
+    }
+  }
+
+  // true if one of the Count rows from y on has marked pixels. Always true without tracking
+  inline bool Dirty(const ui y, const ui Count = 1) const {
+    if (m_dirty.empty()) return true;
+    for (ui row{y}; row < m_height && row - y < Count; ++row)
+      if (m_dirty[row].begin < m_dirty[row].end) return true;
+    return false;
+  }
+
+  // Smallest rectangle holding every marked pixel. The whole image without tracking
+  inline Rect DirtyBounds() const {
+    if (m_dirty.empty()) return {0, 0, m_width, m_height};
+    ui left{m_width}, right{0}, top{m_height}, bottom{0};
+    for (ui row{0}; row < m_height; ++row) {
+      if (m_dirty[row].begin >= m_dirty[row].end) continue;
+      left = std::min(left, m_dirty[row].begin);
+      right = std::max(right, m_dirty[row].end);
+      top = std::min(top, row);
+      bottom = row + 1;
+    }
+    return top < bottom ? Rect{left, top, right - left, bottom - top} : Rect{};
+  }
+
+  // Filepath can be realtive to cwd or absolute. The file is replaced only once it is written completely (see
+  // WriteResult)
+  WriteResult GenerateFile(const strv FilePath, const ImageType Type = QOID::ImageType::qoi,
+                           const EncodeOptions &Options = {});
+
+  // Writes a qoi file and fills Stats (see EncodeStats)
+  WriteResult GenerateFile(const strv FilePath, EncodeStats &Stats, const EncodeOptions &Options = {});
 
 private:
+  // raw storage: operator new creates the (implicit lifetime) pixels without running a constructor
+  struct FreePixels {
+    void operator()(Pixel *const Data) const { ::operator delete(Data); }
+  };
+  static std::unique_ptr<Pixel, FreePixels> Allocate(const size_t Count) {
+    if (Count > std::numeric_limits<size_t>::max() / sizeof(Pixel)) throw std::length_error("Image is too large");
+    void *const memory{::operator new(std::max<size_t>(Count, 1) * sizeof(Pixel))};
+    return std::unique_ptr<Pixel, FreePixels>{static_cast<Pixel *>(memory)};
+  }
+
+  Image(Pixel *const Data, const ui width, const ui height) : m_width{width}, m_height{height}, m_pixel_data{Data} {}
+
+  inline size_t PixelCount() const { return static_cast<size_t>(m_width) * m_height; }
+
+  inline void MarkPixel(const ui x, const ui y) {
+    if (m_dirty.empty()) return;
+    m_dirty[y].begin = std::min(m_dirty[y].begin, x);
+    m_dirty[y].end = std::max(m_dirty[y].end, x + 1);
+    m_dirty[y].generation = ++m_generation;
+  }
+
+  // Marked columns [begin, end) of a row since ClearDirty, begin >= end if the row is clean. generation is the value
+  // of m_generation at the row's last mark
+  struct DirtySpan {
+    ui begin{std::numeric_limits<ui>::max()};
+    ui end{0};
+    uint64_t generation{0};
+  };
+
   ui m_width{};
   ui m_height{};
-  std::vector<Pixel> m_pixel_data;
+  std::unique_ptr<Pixel, FreePixels> m_owned; // null for wrapped memory
+  Pixel *m_pixel_data{nullptr};
+  std::vector<DirtySpan> m_dirty; // one per row while tracking, empty otherwise
+  uint64_t m_trackingId{0};
+  uint64_t m_generation{0};
 };
 
 inline void Image::SetPixel(const Pixel P, const ui width, const ui height) {
@@ -52,16 +279,20 @@ inline void Image::SetPixel(const Pixel P, const ui width, const ui height) {
 }
 
 inline void Image::fSetPixel(const Pixel P, const ui width, const ui height) {
-  std::memcpy(&m_pixel_data[width + height * m_width], &P, sizeof(P));
+  MarkPixel(width, height);
+  std::memcpy(&m_pixel_data[width + static_cast<size_t>(height) * m_width], &P, sizeof(P));
 }
 
 inline Pixel &Image::GetPixel(const ui width, const ui height) {
-  if (m_pixel_data.empty()) throw std::runtime_error("Image has no pixel data.");
+  if (!m_pixel_data) throw std::runtime_error("Image has no pixel data.");
   if (width >= m_width || height >= m_height) throw std::out_of_range("Pixel coordinates out of bounds");
   return fGetPixel(width, height);
 }
 
-inline Pixel &Image::fGetPixel(const ui width, const ui height) { return m_pixel_data[width + height * m_width]; }
+inline Pixel &Image::fGetPixel(const ui width, const ui height) {
+  MarkPixel(width, height);
+  return m_pixel_data[width + static_cast<size_t>(height) * m_width];
+}
 // } // namespace QOID
 
 // #include "DataTypes/ImageFunctions/qoi.hpp"
@@ -74,22 +305,42 @@ inline Pixel &Image::fGetPixel(const ui width, const ui height) { return m_pixel
 
 // namespace QOID {
 
-namespace qoi { // forward declare the function
-bool GenerateFile(const Image &image, const strv FilePath);
+namespace qoi { // forward declare the functions
+WriteResult GenerateFile(const Image &image, const strv FilePath, const EncodeOptions &Options);
+WriteResult GenerateFile(const Image &image, const strv FilePath, const EncodeOptions &Options, EncodeStats &Stats);
+Image LoadFile(const strv FilePath, const DecodeOptions &Options);
+}
+namespace tga { // forward declare the functions
+WriteResult GenerateFile(const Image &image, const strv FilePath, const EncodeOptions &Options);
+Image LoadFile(const strv FilePath);
+}
+
+inline WriteResult Image::GenerateFile(const strv FilePath, const ImageType Type, const EncodeOptions &Options) {
+  if (FilePath.empty()) throw std::invalid_argument("Filename is empty");
+
+  switch (Type) {
+  case ImageType::qoi: return qoi::GenerateFile(*this, FilePath, Options);
+  case ImageType::tga: return tga::GenerateFile(*this, FilePath, Options);
+  default: return {false, 0, EINVAL};
+  }
 }
-namespace tga { // forward declare the function
-bool GenerateFile(const Image &image, const strv FilePath);
+
+inline WriteResult Image::GenerateFile(const strv FilePath, EncodeStats &Stats, const EncodeOptions &Options) {
+  if (FilePath.empty()) throw std::invalid_argument("Filename is empty");
+  return qoi::GenerateFile(*this, FilePath, Options, Stats);
 }
 
-inline bool Image::GenerateFile(const strv FilePath, const ImageType Type) {
+inline Image Image::LoadFile(const strv FilePath, const ImageType Type, const DecodeOptions &Options) {
   if (FilePath.empty()) throw std::invalid_argument("Filename is empty");
 
   switch (Type) {
-  case ImageType::qoi: return qoi::GenerateFile(*this, FilePath);
-  case ImageType::tga: return tga::GenerateFile(*this, FilePath);
-  default: return false;
+  case ImageType::qoi: return qoi::LoadFile(FilePath, Options);
+  case ImageType::tga: return tga::LoadFile(FilePath);
+  default: throw std::invalid_argument("Loading is not supported for this image type");
   }
 }
 } // namespace QOID
 #include "DataTypes/ImageFunctions/qoi.hpp"
-#include "DataTypes/ImageFunctions/TGA.hpp"
\ No newline at end of file
+#include "DataTypes/ImageFunctions/qoi_sequence.hpp"
+#include "DataTypes/ImageFunctions/TGA.hpp"
+#include "tiled_image.hpp"
\ No newline at end of file
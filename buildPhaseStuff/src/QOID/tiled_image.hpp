@@ -0,0 +1,150 @@
+#pragma once
+#include "QOID_General.hpp"
+#include "DataTypes/pixel.hpp"
+#include "image.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+namespace QOID {
+
+// Image stored as 64x64 pixel tiles (each one contiguous, tiles in row-major order), so vertical and block shaped
+// access stays inside a few KB of memory instead of touching a new row for every pixel. Edge tiles are padded to the
+// full tile size. Encoding goes through ToImage, which converts back to the linear layout
+class TiledImage {
+public:
+  static constexpr ui TileShift{6};
+  static constexpr ui TileSize{1u << TileShift};
+  static constexpr ui TileMask{TileSize - 1};
+  static constexpr size_t TilePixels{static_cast<size_t>(TileSize) * TileSize};
+
+  // One tile, rows are TileSize pixels apart. width and height are smaller than TileSize at the right and bottom edge
+  struct Tile {
+    ui x;      // position of the top left pixel in the image
+    ui y;
+    ui width;  // valid pixels
+    ui height;
+    Pixel *data;
+
+    // valid pixels of row Row (relative to the tile)
+    inline std::span<Pixel> Row(const ui Row) const { return {data + static_cast<size_t>(Row) * TileSize, width}; }
+  };
+
+  class TileIterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Tile;
+    using difference_type = std::ptrdiff_t;
+
+    TileIterator(TiledImage *Image, const size_t Index) : m_image{Image}, m_index{Index} {}
+
+    inline Tile operator*() const { return m_image->GetTile(m_index); }
+    inline TileIterator &operator++() {
+      ++m_index;
+      return *this;
+    }
+    inline TileIterator operator++(int) { return {m_image, m_index++}; }
+    inline bool operator==(const TileIterator &Other) const { return m_index == Other.m_index; }
+
+  private:
+    TiledImage *m_image;
+    size_t m_index;
+  };
+
+  TiledImage() = delete;
+  TiledImage(const ui width, const ui height) :
+      m_width{width}, m_height{height}, m_tilesX{TilesFor(width)}, m_tilesY{TilesFor(height)},
+      m_pixel_data(static_cast<size_t>(m_tilesX) * m_tilesY * TilePixels) {}
+
+  // Converts a linear image
+  explicit TiledImage(const Image &image) : TiledImage{image.getWidth(), image.getHeight()} {
+    for (size_t i{0}; i < TileCount(); ++i) {
+      const Tile tile{GetTile(i)};
+      for (ui row{0}; row < tile.height; ++row)
+        std::memcpy(tile.Row(row).data(), &image.GetData()[tile.x + static_cast<size_t>(tile.y + row) * m_width],
+                    tile.width * sizeof(Pixel));
+    }
+  }
+
+  // Set pixel at position
+  inline void SetPixel(const Pixel P, const ui width, const ui height) {
+    if (width >= m_width || height >= m_height) throw std::out_of_range("Pixel coordinates out of bounds");
+    fSetPixel(P, width, height);
+  }
+
+  // Set pixel at position (no bounds checking)
+  inline void fSetPixel(const Pixel P, const ui width, const ui height) { m_pixel_data[Offset(width, height)] = P; }
+
+  // Returns reference to pixel at position
+  inline Pixel &GetPixel(const ui width, const ui height) {
+    if (width >= m_width || height >= m_height) throw std::out_of_range("Pixel coordinates out of bounds");
+    return fGetPixel(width, height);
+  }
+
+  // Returns reference to pixel at position (no bounds checking)
+  inline Pixel &fGetPixel(const ui width, const ui height) { return m_pixel_data[Offset(width, height)]; }
+
+  // Fill Image with given Pixel (padding included, it is never read)
+  inline void Fill(const Pixel Pixel) { std::fill(m_pixel_data.begin(), m_pixel_data.end(), Pixel); }
+
+  constexpr ui getWidth() const { return m_width; }
+  constexpr ui getHeight() const { return m_height; }
+
+  inline size_t TileCount() const { return static_cast<size_t>(m_tilesX) * m_tilesY; }
+
+  // Tile Index, counted row by row
+  inline Tile GetTile(const size_t Index) { return MakeTile(Index, m_pixel_data.data()); }
+
+  // Tiles in memory order: for (const TiledImage::Tile tile : image) ...
+  inline TileIterator begin() { return {this, 0}; }
+  inline TileIterator end() { return {this, TileCount()}; }
+
+  // Converts to the linear layout the encoders work on
+  inline Image ToImage() const {
+    Image image{m_width, m_height, Image::Uninitialized{}};
+    for (size_t i{0}; i < TileCount(); ++i) {
+      const Tile tile{MakeTile(i, nullptr)};
+      const Pixel *in{m_pixel_data.data() + i * TilePixels};
+      for (ui row{0}; row < tile.height; ++row, in += TileSize)
+        std::memcpy(&image.GetData()[tile.x + static_cast<size_t>(tile.y + row) * m_width], in,
+                    tile.width * sizeof(Pixel));
+    }
+    return image;
+  }
+
+  // Converts to the linear layout and writes the file, see Image::GenerateFile
+  inline WriteResult GenerateFile(const strv FilePath, const ImageType Type = QOID::ImageType::qoi,
+                                  const EncodeOptions &Options = {}) const {
+    return ToImage().GenerateFile(FilePath, Type, Options);
+  }
+
+private:
+  // computed in 64 bit, Size + TileMask can overflow ui
+  static constexpr ui TilesFor(const ui Size) {
+    return static_cast<ui>((static_cast<size_t>(Size) + TileMask) >> TileShift);
+  }
+
+  inline Tile MakeTile(const size_t Index, Pixel *const Data) const {
+    const ui x{static_cast<ui>(Index % m_tilesX) << TileShift}, y{static_cast<ui>(Index / m_tilesX) << TileShift};
+    return {x, y, std::min(TileSize, m_width - x), std::min(TileSize, m_height - y),
+            Data ? Data + Index * TilePixels : nullptr};
+  }
+
+  // tile base + position inside the tile, only shifts and masks
+  inline size_t Offset(const ui x, const ui y) const {
+    const size_t tile{static_cast<size_t>(y >> TileShift) * m_tilesX + (x >> TileShift)};
+    return tile * TilePixels + ((y & TileMask) << TileShift) + (x & TileMask);
+  }
+
+  ui m_width{};
+  ui m_height{};
+  ui m_tilesX{};
+  ui m_tilesY{};
+  std::vector<Pixel> m_pixel_data;
+};
+
+} // namespace QOID
@@ -0,0 +1,515 @@
+// Encoder / decoder benchmark. Built as its own optimized target (see meson.build), main.cpp stays the debug playground
+//
+// usage: bench [--reps N] [--warmup N] [--size WxH] [--json FILE] [--stats] [--small N] [DIR or FILE.qoi ...]
+// Directories are searched for .qoi files (e.g. the qoi test images from qoiformat.org), "qoi_test_images" is used
+// when it exists and nothing else is given. --json - writes the json report to stdout instead of the table. --stats
+// adds the qoi chunk statistics of every image (QOID::EncodeStats, the target defines QOID_ENCODER_STATS). --small N
+// runs N encodes of 64x64 icons instead (a tenth of that as files), free functions against a reused qoi::Encoder
+
+#include "QOID/image.hpp"
+
+#include "Timer.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// heap allocations so far, --small reports them per encode. Not inlined, so the compiler doesn't pair the malloc and
+// free inside with the operator new and delete calls of the library code
+static std::atomic<size_t> Allocations{0};
+
+__attribute__((noinline)) void *operator new(const std::size_t Size) {
+  ++Allocations;
+  if (void *const memory{std::malloc(Size ? Size : 1)}) return memory;
+  throw std::bad_alloc{};
+}
+__attribute__((noinline)) void operator delete(void *const Memory) noexcept { std::free(Memory); }
+__attribute__((noinline)) void operator delete(void *const Memory, std::size_t) noexcept { std::free(Memory); }
+
+namespace {
+
+struct Settings {
+  unsigned reps{10};
+  unsigned warmup{2};
+  QOID::ui width{1920};
+  QOID::ui height{1080};
+  std::string json;
+  bool stats{false};
+  unsigned small{0};
+  std::vector<std::string> paths;
+};
+
+struct CorpusImage {
+  std::string name;
+  QOID::Image image;
+};
+
+struct Timing {
+  double median{0};
+  double best{0};
+};
+
+struct Result {
+  std::string image;
+  std::string codec;
+  QOID::ui width{0};
+  QOID::ui height{0};
+  size_t encodedSize{0};
+  bool roundTrip{false};
+  Timing encode;
+  Timing decode;
+};
+
+struct ImageStats {
+  std::string image;
+  QOID::EncodeStats stats;
+  double plainSeconds{0}; // plain Encode into the same kind of sink, the counting encode has to stay close to it
+};
+
+struct Codec {
+  const char *name;
+  std::function<size_t(const QOID::Image &, std::vector<std::byte> &)> encode;
+  std::function<QOID::Image(const std::vector<std::byte> &)> decode;
+};
+
+// synthetic corpus, every generator is deterministic so runs stay comparable
+
+QOID::Image Gradient(const QOID::ui w, const QOID::ui h) {
+  QOID::Image I{w, h};
+  const QOID::ui right{std::max(w - 1, 1u)}, bottom{std::max(h - 1, 1u)};
+  for (QOID::ui y{0}; y < h; ++y)
+    for (QOID::ui x{0}; x < w; ++x)
+      I.SetPixel({static_cast<uint8_t>(x * 255 / right), static_cast<uint8_t>(y * 255 / bottom), 128, 255}, x, y);
+  return I;
+}
+
+QOID::Image Noise(const QOID::ui w, const QOID::ui h) {
+  QOID::Image I{w, h};
+  std::mt19937 rng{1};
+  for (auto &p : I.GetData()) p = QOID::Pixel{static_cast<QOID::p_color>(rng() | 0xFF000000u)};
+  return I;
+}
+
+// UI like flat colored blocks
+QOID::Image Flat(const QOID::ui w, const QOID::ui h) {
+  QOID::Image I{w, h};
+  I.Fill({240, 240, 240, 255});
+  for (QOID::ui y{0}; y < h; ++y)
+    for (QOID::ui x{0}; x < w; ++x)
+      if ((x / 300 + y / 200) % 3 == 0) I.SetPixel({30, 60, static_cast<uint8_t>(90 + (x / 300) % 2), 255}, x, y);
+  return I;
+}
+
+// soft edged sprites on a transparent background, alpha changes all the time along the edges
+QOID::Image Alpha(const QOID::ui w, const QOID::ui h) {
+  QOID::Image I{w, h};
+  I.Fill({0, 0, 0, 0});
+  for (QOID::ui y{0}; y < h; ++y)
+    for (QOID::ui x{0}; x < w; ++x) {
+      const double dx{static_cast<double>(x % 128) - 64}, dy{static_cast<double>(y % 128) - 64};
+      const double d{std::sqrt(dx * dx + dy * dy)};
+      if (d < 60)
+        I.SetPixel({static_cast<uint8_t>(x / 16), static_cast<uint8_t>(y / 16), 200,
+                    static_cast<uint8_t>(std::clamp((60 - d) * 16, 0.0, 255.0))},
+                   x, y);
+    }
+  return I;
+}
+
+// smooth color fields plus sensor like noise
+QOID::Image Photo(const QOID::ui w, const QOID::ui h) {
+  QOID::Image I{w, h};
+  std::mt19937 rng{2};
+  std::uniform_int_distribution<int> grain{-3, 3};
+  for (QOID::ui y{0}; y < h; ++y)
+    for (QOID::ui x{0}; x < w; ++x) {
+      const double base{128 + 60 * std::sin(x * 0.011) * std::cos(y * 0.007) + 40 * std::sin((x + y) * 0.003)};
+      const auto channel{[&](const double offset) {
+        return static_cast<uint8_t>(std::clamp(base + offset + grain(rng), 0.0, 255.0));
+      }};
+      I.SetPixel({channel(20), channel(0), channel(-25), 255}, x, y);
+    }
+  return I;
+}
+
+void AddFile(std::vector<CorpusImage> &corpus, const std::filesystem::path &path) {
+  try {
+    corpus.push_back({path.filename().string(), QOID::Image::LoadFile(path.string())});
+  } catch (const std::exception &e) { std::cerr << "skipping " << path.string() << ": " << e.what() << '\n'; }
+}
+
+std::vector<CorpusImage> BuildCorpus(const Settings &settings) {
+  std::vector<CorpusImage> corpus;
+  const QOID::ui w{settings.width}, h{settings.height};
+  corpus.push_back({"gradient", Gradient(w, h)});
+  corpus.push_back({"noise", Noise(w, h)});
+  corpus.push_back({"flat", Flat(w, h)});
+  corpus.push_back({"alpha", Alpha(w, h)});
+  corpus.push_back({"photo", Photo(w, h)});
+
+  std::vector<std::string> paths{settings.paths};
+  if (paths.empty() && std::filesystem::is_directory("qoi_test_images")) paths.push_back("qoi_test_images");
+  for (const auto &path : paths) {
+    if (!std::filesystem::is_directory(path)) {
+      AddFile(corpus, path);
+      continue;
+    }
+    std::vector<std::filesystem::path> files;
+    for (const auto &entry : std::filesystem::directory_iterator{path})
+      if (entry.is_regular_file() && entry.path().extension() == ".qoi") files.push_back(entry.path());
+    std::sort(files.begin(), files.end());
+    for (const auto &file : files) AddFile(corpus, file);
+  }
+  return corpus;
+}
+
+// runs Function warmup + reps times and returns the median and best of the timed runs
+Timing Measure(const Settings &settings, const std::function<void()> &Function) {
+  for (unsigned i{0}; i < settings.warmup; ++i) Function();
+  std::vector<double> times;
+  times.reserve(settings.reps);
+  for (unsigned i{0}; i < settings.reps; ++i) {
+    Timer T{};
+    Function();
+    times.push_back(T.delapsed());
+  }
+  std::sort(times.begin(), times.end());
+  return {times[times.size() / 2], times.front()};
+}
+
+Result Run(const Settings &settings, const CorpusImage &input, const Codec &codec) {
+  Result result;
+  result.image = input.name;
+  result.codec = codec.name;
+  result.width = input.image.getWidth();
+  result.height = input.image.getHeight();
+  std::vector<std::byte> encoded;
+  result.encodedSize = codec.encode(input.image, encoded);
+  result.roundTrip = codec.decode(encoded) == input.image;
+
+  // the buffer keeps its capacity, so only the encoder is timed and not the allocation
+  result.encode = Measure(settings, [&] {
+    encoded.clear();
+    if (codec.encode(input.image, encoded) != result.encodedSize) result.roundTrip = false;
+  });
+  result.decode = Measure(settings, [&] {
+    if (codec.decode(encoded).getWidth() != result.width) result.roundTrip = false;
+  });
+  return result;
+}
+
+double RawBytes(const Result &result) {
+  return static_cast<double>(result.width) * result.height * sizeof(QOID::Pixel);
+}
+
+// MB/s of raw (uncompressed RGBA) image data
+double MegaBytesPerSecond(const Result &result, const double Seconds) { return RawBytes(result) / Seconds / 1e6; }
+
+double MegaPixelsPerSecond(const Result &result, const double Seconds) {
+  return static_cast<double>(result.width) * result.height / Seconds / 1e6;
+}
+
+const char *LevelName(const QOID::simd::Level level) {
+  switch (level) {
+  case QOID::simd::Level::avx2: return "avx2";
+  case QOID::simd::Level::sse41: return "sse4.1";
+  default: return "scalar";
+  }
+}
+
+std::string JsonEscape(const std::string &text) {
+  std::string out;
+  for (const char c : text) {
+    if (c == '"' || c == '\\') out += '\\';
+    if (static_cast<unsigned char>(c) < 0x20) continue;
+    out += c;
+  }
+  return out;
+}
+
+void WriteTiming(std::ostream &out, const char *Name, const Result &result, const Timing &timing) {
+  out << "      \"" << Name << "\": {\"median_s\": " << timing.median << ", \"best_s\": " << timing.best
+      << ", \"mb_per_s\": " << MegaBytesPerSecond(result, timing.median)
+      << ", \"mpixel_per_s\": " << MegaPixelsPerSecond(result, timing.median) << "}";
+}
+
+// Share of the encoded pixels covered by each chunk type, runs count every pixel they cover
+double PixelShare(const QOID::EncodeStats &stats, const uint64_t Pixels) {
+  return stats.pixels ? 100.0 * static_cast<double>(Pixels) / static_cast<double>(stats.pixels) : 0.0;
+}
+
+uint64_t RunPixels(const QOID::EncodeStats &stats) {
+  uint64_t pixels{0};
+  for (size_t i{0}; i < stats.runLengths.size(); ++i) pixels += (i + 1) * stats.runLengths[i];
+  return pixels;
+}
+
+void WriteStatsJson(std::ostream &out, const std::vector<ImageStats> &stats) {
+  out << ",\n  \"qoi_stats\": [\n";
+  for (size_t i{0}; i < stats.size(); ++i) {
+    const QOID::EncodeStats &s{stats[i].stats};
+    out << "    {\"image\": \"" << JsonEscape(stats[i].image) << "\", \"counted\": " << (s.counted ? "true" : "false")
+        << ", \"pixels\": " << s.pixels << ", \"bytes\": " << s.bytes << ", \"run\": " << s.run
+        << ", \"diff\": " << s.diff << ", \"luma\": " << s.luma << ", \"index\": " << s.index
+        << ", \"rgb\": " << s.rgb << ", \"rgba\": " << s.rgba << ", \"index_hit_rate\": " << s.IndexHitRate()
+        << ", \"header_s\": " << s.headerSeconds << ", \"encode_s\": " << s.encodeSeconds
+        << ", \"flush_s\": " << s.flushSeconds << ", \"plain_s\": " << stats[i].plainSeconds
+        << ", \"run_lengths\": [";
+    for (size_t n{0}; n < s.runLengths.size(); ++n) out << (n ? ", " : "") << s.runLengths[n];
+    out << "]}" << (i + 1 < stats.size() ? "," : "") << '\n';
+  }
+  out << "  ]";
+}
+
+void WriteJson(std::ostream &out, const Settings &settings, const std::vector<Result> &results,
+               const std::vector<ImageStats> &stats) {
+  out << std::setprecision(6) << "{\n  \"simd\": \"" << LevelName(QOID::simd::Active()) << "\",\n  \"repetitions\": "
+      << settings.reps << ",\n  \"warmup\": " << settings.warmup << ",\n  \"results\": [\n";
+  for (size_t i{0}; i < results.size(); ++i) {
+    const Result &r{results[i]};
+    out << "    {\n      \"image\": \"" << JsonEscape(r.image) << "\",\n      \"codec\": \"" << r.codec
+        << "\",\n      \"width\": " << r.width << ",\n      \"height\": " << r.height
+        << ",\n      \"encoded_bytes\": " << r.encodedSize << ",\n      \"ratio\": " << RawBytes(r) / r.encodedSize
+        << ",\n      \"round_trip\": " << (r.roundTrip ? "true" : "false") << ",\n";
+    WriteTiming(out, "encode", r, r.encode);
+    out << ",\n";
+    WriteTiming(out, "decode", r, r.decode);
+    out << "\n    }" << (i + 1 < results.size() ? "," : "") << '\n';
+  }
+  out << "  ]";
+  if (settings.stats) WriteStatsJson(out, stats);
+  out << "\n}\n";
+}
+
+void WriteTable(std::ostream &out, const std::vector<Result> &results) {
+  out << std::left << std::setw(24) << "image" << std::setw(10) << "codec" << std::right << std::setw(9) << "ratio"
+      << std::setw(12) << "enc MB/s" << std::setw(12) << "enc MP/s" << std::setw(12) << "dec MB/s" << std::setw(12)
+      << "dec MP/s" << '\n';
+  out << std::fixed << std::setprecision(1);
+  for (const Result &r : results) {
+    out << std::left << std::setw(24) << r.image.substr(0, 23) << std::setw(10) << r.codec << std::right
+        << std::setw(9) << RawBytes(r) / r.encodedSize << std::setw(12) << MegaBytesPerSecond(r, r.encode.median)
+        << std::setw(12) << MegaPixelsPerSecond(r, r.encode.median) << std::setw(12)
+        << MegaBytesPerSecond(r, r.decode.median) << std::setw(12) << MegaPixelsPerSecond(r, r.decode.median)
+        << (r.roundTrip ? "" : "  ROUND TRIP FAILED") << '\n';
+  }
+  out << std::defaultfloat;
+}
+
+// Pixel shares per chunk type, index hit rate and phase timings of one qoi encode per image
+void WriteStatsTable(std::ostream &out, const std::vector<ImageStats> &stats) {
+  out << '\n' << std::left << std::setw(24) << "qoi chunks (% pixels)" << std::right << std::setw(7) << "run"
+      << std::setw(7) << "diff" << std::setw(7) << "luma" << std::setw(7) << "index" << std::setw(7) << "rgb"
+      << std::setw(7) << "rgba" << std::setw(8) << "hit %" << std::setw(9) << "avg run" << std::setw(11) << "enc ms"
+      << std::setw(10) << "flush ms" << std::setw(10) << "plain ms" << '\n';
+  out << std::fixed << std::setprecision(1);
+  for (const ImageStats &entry : stats) {
+    const QOID::EncodeStats &s{entry.stats};
+    out << std::left << std::setw(24) << entry.image.substr(0, 23) << std::right;
+    if (!s.counted) {
+      out << "  not counted, build with QOID_ENCODER_STATS\n";
+      continue;
+    }
+    const uint64_t runPixels{RunPixels(s)};
+    out << std::setw(7) << PixelShare(s, runPixels) << std::setw(7) << PixelShare(s, s.diff) << std::setw(7)
+        << PixelShare(s, s.luma) << std::setw(7) << PixelShare(s, s.index) << std::setw(7) << PixelShare(s, s.rgb)
+        << std::setw(7) << PixelShare(s, s.rgba) << std::setw(8) << 100.0 * s.IndexHitRate() << std::setw(9)
+        << (s.run ? static_cast<double>(runPixels) / static_cast<double>(s.run) : 0.0) << std::setw(11)
+        << 1e3 * (s.headerSeconds + s.encodeSeconds) << std::setw(10) << 1e3 * s.flushSeconds << std::setw(10)
+        << 1e3 * entry.plainSeconds << '\n';
+  }
+  out << std::defaultfloat;
+}
+
+// Rate and heap allocations per encode of Count encodes (Files of them writing files), cycling through Icons
+template <typename Function>
+void TimeSmall(const char *Name, const std::vector<QOID::Image> &Icons, const unsigned Count, const Function &Encode) {
+  Encode(Icons[0], 0); // warm-up, the encoder buffers grow here
+  const size_t allocations{Allocations};
+  Timer T{};
+  for (unsigned i{0}; i < Count; ++i) Encode(Icons[i % Icons.size()], i);
+  const double seconds{T.delapsed()};
+  std::cout << std::left << std::setw(26) << Name << std::right << std::setw(12) << std::fixed << std::setprecision(0)
+            << Count / seconds << std::setw(14) << std::setprecision(2)
+            << static_cast<double>(Allocations - allocations) / Count << '\n'
+            << std::defaultfloat;
+}
+
+// Many 64x64 encodes like an icon or tile server: free functions, which set everything up per call, against a reused
+// qoi::Encoder. The encoded bytes have to be the same
+bool RunSmall(const unsigned Count) {
+  const std::vector<QOID::Image> icons{Gradient(64, 64), Flat(64, 64), Alpha(64, 64), Photo(64, 64)};
+  const std::filesystem::path directory{std::filesystem::temp_directory_path() / "qoid_bench_small"};
+  std::filesystem::create_directories(directory);
+  // built up front, so the allocation counts are those of the writers
+  std::vector<std::string> paths;
+  for (unsigned i{0}; i < 64; ++i) paths.push_back((directory / ("icon" + std::to_string(i))).string());
+  const auto path{[&](const unsigned i) -> const std::string & { return paths[i % 64]; }};
+
+  QOID::qoi::Encoder encoder;
+  bool identical{true};
+  for (const QOID::Image &icon : icons) {
+    std::vector<std::byte> free;
+    QOID::qoi::EncodeToBuffer(icon, free);
+    const std::span<const std::byte> pooled{encoder.Encode(icon)};
+    identical &= std::ranges::equal(free, pooled);
+  }
+
+  std::cout << "simd level: " << LevelName(QOID::simd::Active()) << ", 64x64 icons\n"
+            << std::left << std::setw(26) << "path" << std::right << std::setw(12) << "encodes/s" << std::setw(14)
+            << "allocs/enc" << '\n';
+  size_t bytes{0};
+  TimeSmall("qoi::EncodeToBuffer", icons, Count, [&](const QOID::Image &I, unsigned) {
+    std::vector<std::byte> out;
+    bytes += QOID::qoi::EncodeToBuffer(I, out);
+  });
+  TimeSmall("qoi::Encoder::Encode", icons, Count,
+            [&](const QOID::Image &I, unsigned) { bytes += encoder.Encode(I).size(); });
+  bool written{true};
+  TimeSmall("qoi::GenerateFile", icons, std::max(Count / 10, 1u), [&](const QOID::Image &I, const unsigned i) {
+    written &= static_cast<bool>(QOID::qoi::GenerateFile(I, path(i)));
+  });
+  TimeSmall("qoi::Encoder::GenerateFile", icons, std::max(Count / 10, 1u), [&](const QOID::Image &I, const unsigned i) {
+    written &= static_cast<bool>(encoder.GenerateFile(I, path(i)));
+  });
+  std::filesystem::remove_all(directory);
+  if (!identical) std::cout << "ENCODER OUTPUT DIFFERS\n";
+  if (!written) std::cout << "FILE WRITE FAILED\n";
+  return identical && written && bytes;
+}
+
+// Parses all of Text into Value, false on anything else (std::stoi throws and accepts trailing text)
+template <typename T> bool ParseNumber(const char *Text, T &Value) {
+  const char *const end{Text + std::strlen(Text)};
+  const auto [parsed, error]{std::from_chars(Text, end, Value)};
+  return error == std::errc{} && parsed == end;
+}
+
+bool ParseArgs(const int argc, char **argv, Settings &settings) {
+  for (int i{1}; i < argc; ++i) {
+    const std::string arg{argv[i]};
+    const bool hasValue{i + 1 < argc};
+    if (arg == "--reps" && hasValue) {
+      if (!ParseNumber(argv[++i], settings.reps) || settings.reps < 1) return false;
+    } else if (arg == "--warmup" && hasValue) {
+      if (!ParseNumber(argv[++i], settings.warmup)) return false;
+    } else if (arg == "--json" && hasValue) settings.json = argv[++i];
+    else if (arg == "--stats") settings.stats = true;
+    else if (arg == "--small" && hasValue) {
+      if (!ParseNumber(argv[++i], settings.small) || !settings.small) return false;
+    } else if (arg == "--size" && hasValue) {
+      std::istringstream size{argv[++i]};
+      char x{};
+      if (!(size >> settings.width >> x >> settings.height) || x != 'x' || !settings.width || !settings.height)
+        return false;
+    } else if (arg.starts_with("--")) return false;
+    else settings.paths.push_back(arg);
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Settings settings;
+  if (!ParseArgs(argc, argv, settings)) {
+    std::cerr << "usage: " << argv[0]
+              << " [--reps N] [--warmup N] [--size WxH] [--json FILE] [--stats] [--small N] [DIR or FILE.qoi ...]\n";
+    return 1;
+  }
+  if (settings.small) return RunSmall(settings.small) ? 0 : 2;
+
+  const std::vector<Codec> codecs{
+      {"qoi", [](const QOID::Image &I, std::vector<std::byte> &out) { return QOID::qoi::EncodeToBuffer(I, out); },
+       [](const std::vector<std::byte> &in) { return QOID::qoi::Decode(in); }},
+      {"qoi-mt",
+       [](const QOID::Image &I, std::vector<std::byte> &out) {
+         return QOID::qoi::EncodeToBuffer(I, out, {.threads = 0});
+       },
+       [](const std::vector<std::byte> &in) { return QOID::qoi::Decode(in); }},
+      // restart points every 64 rows, decoded on all threads
+      {"qoi-rst",
+       [](const QOID::Image &I, std::vector<std::byte> &out) {
+         return QOID::qoi::EncodeToBuffer(I, out, {.threads = 0, .restartRows = 64});
+       },
+       [](const std::vector<std::byte> &in) { return QOID::qoi::Decode(in, {.threads = 0}); }},
+      {"tga", [](const QOID::Image &I, std::vector<std::byte> &out) { return QOID::tga::EncodeToBuffer(I, out); },
+       [](const std::vector<std::byte> &in) { return QOID::tga::Decode(in); }},
+      {"tga-rle",
+       [](const QOID::Image &I, std::vector<std::byte> &out) {
+         return QOID::tga::EncodeToBuffer(I, out, {.rle = true});
+       },
+       [](const std::vector<std::byte> &in) { return QOID::tga::Decode(in); }},
+  };
+
+  const std::vector<CorpusImage> corpus{BuildCorpus(settings)};
+  std::vector<Result> results;
+  bool ok{true};
+  for (const auto &input : corpus)
+    for (const auto &codec : codecs) {
+      results.push_back(Run(settings, input, codec));
+      ok &= results.back().roundTrip;
+    }
+
+  // extra encodes per image, the timed ones above don't pay for the counting. Best of 3 with and without counting, the
+  // counting encode taking much longer than the plain one means the stats path measures itself
+  std::vector<ImageStats> stats;
+  if (settings.stats)
+    for (const auto &input : corpus) {
+      stats.push_back({input.name, {}});
+      ImageStats &entry{stats.back()};
+      double statsSeconds{0};
+      for (int rep{0}; rep < 3; ++rep) {
+        std::vector<std::byte> plain, counted;
+        QOID::VectorSink plainSink{plain, input.image.GetData().size()};
+        Timer T{};
+        ok &= QOID::qoi::Encode(input.image, plainSink);
+        const double plainSeconds{T.delapsed()};
+        QOID::VectorSink countedSink{counted, input.image.GetData().size()};
+        QOID::EncodeStats current;
+        T.reset();
+        ok &= QOID::qoi::Encode(input.image, countedSink, {}, current) && counted == plain;
+        const double countedSeconds{T.delapsed()};
+        if (rep == 0 || countedSeconds < statsSeconds) {
+          statsSeconds = countedSeconds;
+          entry.stats = current;
+        }
+        entry.plainSeconds = rep == 0 ? plainSeconds : std::min(entry.plainSeconds, plainSeconds);
+      }
+      if (statsSeconds > 3 * entry.plainSeconds + 1e-3) {
+        std::cerr << input.name << ": counting encode " << statsSeconds << "s, plain " << entry.plainSeconds << "s\n";
+        ok = false;
+      }
+    }
+
+  if (settings.json == "-") {
+    WriteJson(std::cout, settings, results, stats);
+  } else {
+    std::cout << "simd level: " << LevelName(QOID::simd::Active()) << ", " << settings.reps << " repetitions after "
+              << settings.warmup << " warm-up runs, medians\n";
+    WriteTable(std::cout, results);
+    if (settings.stats) WriteStatsTable(std::cout, stats);
+    if (!settings.json.empty()) {
+      std::ofstream file{settings.json};
+      WriteJson(file, settings, results, stats);
+      if (!file) {
+        std::cerr << "could not write " << settings.json << '\n';
+        return 1;
+      }
+    }
+  }
+  return ok ? 0 : 2;
+}
@@ -0,0 +1,464 @@
+// Batch converter between raw RGBA, TGA and QOI. Built as its own optimized target (see meson.build)
+//
+// usage: convert [--to qoi|tga|raw] [--threads N] [--size WxH] [--rle] [--split MPIXEL] INPUT_DIR OUTPUT_DIR
+// Every .qoi, .tga and .raw file below INPUT_DIR is written to the same relative path below OUTPUT_DIR in the --to
+// format (qoi by default). Raw files are width * height RGBA pixels without a header, --size gives their dimensions.
+// Files are spread over a work stealing pool of --threads threads (0, the default, uses all hardware threads). qoi
+// encodes of images above --split megapixels (default 4) are cut into row bands which idle threads steal. Every thread
+// reuses its buffers, so once they have grown to the largest image no more pixel or byte buffers are allocated
+
+#include "QOID/image.hpp"
+
+#include "Timer.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+enum class Format { qoi, tga, raw };
+
+struct Settings {
+  Format to{Format::qoi};
+  unsigned threads{0};
+  QOID::ui rawWidth{0};
+  QOID::ui rawHeight{0};
+  bool rle{false};
+  size_t splitPixels{4'000'000};
+  std::filesystem::path input;
+  std::filesystem::path output;
+};
+
+// One file to convert
+struct Job {
+  std::filesystem::path from;
+  std::filesystem::path to;
+  Format format;
+  uintmax_t size;
+};
+
+// A qoi encode cut into bands. Any worker may encode a band, the one that owns the file waits for all of them and
+// writes them out in order
+struct SplitEncode {
+  const QOID::Image *image;
+  size_t bandPixels;
+  std::vector<std::vector<std::byte>> *bands;
+  std::atomic<size_t> left;
+};
+
+// Work item of the pool, a whole file or one band of a split encode
+struct Task {
+  size_t job{0};
+  SplitEncode *split{nullptr};
+  size_t band{0};
+};
+
+// Every worker owns a queue and takes its newest task, workers without work steal the oldest task of another queue.
+// Bands are queued apart from files and always taken first, so a split image finishes before new files are started
+class WorkStealingPool {
+public:
+  explicit WorkStealingPool(const unsigned Workers) : m_queues(Workers) {}
+
+  inline unsigned Workers() const { return static_cast<unsigned>(m_queues.size()); }
+
+  // Queues T on Worker's queue
+  inline void Push(const unsigned Worker, const Task T) {
+    ++m_pending;
+    {
+      Queue &queue{m_queues[Worker]};
+      const std::lock_guard lock{queue.mutex};
+      (T.split ? queue.bands : queue.files).push_back(T);
+      ++(T.split ? m_queuedBands : m_queuedFiles);
+    }
+    Wake();
+  }
+
+  // Next task for Worker, its own queue first. BandsOnly skips whole files (used while waiting for a split encode)
+  inline std::optional<Task> Take(const unsigned Worker, const bool BandsOnly) {
+    if (auto task{TakeFrom(Worker, true, true)}) return task;
+    for (unsigned i{1}; i < Workers(); ++i)
+      if (auto task{TakeFrom((Worker + i) % Workers(), false, true)}) return task;
+    if (BandsOnly) return std::nullopt;
+    if (auto task{TakeFrom(Worker, true, false)}) return task;
+    for (unsigned i{1}; i < Workers(); ++i)
+      if (auto task{TakeFrom((Worker + i) % Workers(), false, false)}) return task;
+    return std::nullopt;
+  }
+
+  // Marks a task taken with Take as finished
+  inline void Done() {
+    --m_pending;
+    Wake();
+  }
+
+  // Tasks queued or running
+  inline size_t Pending() const { return m_pending; }
+
+  // Blocks until a task Take can return is queued, no task is pending any more or Ready() holds. Ready is checked
+  // whenever a task is queued or done, so it has to become true through one of them
+  template <typename Predicate> inline void Wait(const bool BandsOnly, const Predicate &Ready) {
+    std::unique_lock lock{m_wakeMutex};
+    m_wake.wait(lock, [&] { return m_queuedBands || (!BandsOnly && m_queuedFiles) || !m_pending || Ready(); });
+  }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> files;
+    std::deque<Task> bands;
+  };
+
+  inline std::optional<Task> TakeFrom(const unsigned Worker, const bool Own, const bool Bands) {
+    Queue &queue{m_queues[Worker]};
+    const std::lock_guard lock{queue.mutex};
+    std::deque<Task> &tasks{Bands ? queue.bands : queue.files};
+    if (tasks.empty()) return std::nullopt;
+    const Task task{Own ? tasks.back() : tasks.front()};
+    if (Own) tasks.pop_back();
+    else tasks.pop_front();
+    --(Bands ? m_queuedBands : m_queuedFiles);
+    return task;
+  }
+
+  // The counters change before the mutex is taken, so a waiter either sees the change or is already waiting
+  inline void Wake() {
+    { const std::lock_guard lock{m_wakeMutex}; }
+    m_wake.notify_all();
+  }
+
+  std::vector<Queue> m_queues;
+  std::atomic<size_t> m_pending{0};
+  std::atomic<size_t> m_queuedFiles{0};
+  std::atomic<size_t> m_queuedBands{0};
+  std::mutex m_wakeMutex;
+  std::condition_variable m_wake;
+};
+
+// Buffers a worker keeps from file to file, they only ever grow
+struct Scratch {
+  std::vector<std::byte> input;
+  std::optional<QOID::Image> pixels; // storage only, images are Image::Wrap views of it
+  std::vector<std::byte> output;
+  std::vector<std::vector<std::byte>> bands;
+
+  // Image of the given size on top of the reused pixel storage
+  QOID::Image Wrap(const QOID::Dimensions Size) {
+    const size_t count{static_cast<size_t>(Size.width) * Size.height};
+    if (!pixels || pixels->GetData().size() < count) {
+      pixels.reset(); // frees the old storage before allocating the larger one
+      pixels.emplace(Size.width, Size.height, QOID::Image::Uninitialized{});
+    }
+    return QOID::Image::Wrap(pixels->GetData().data(), Size.width, Size.height);
+  }
+};
+
+struct Totals {
+  std::atomic<size_t> files{0};
+  std::atomic<size_t> failed{0};
+  std::atomic<uint64_t> pixels{0};
+  std::atomic<uint64_t> bytesIn{0};
+  std::atomic<uint64_t> bytesOut{0};
+};
+
+// Files are read and written with plain file descriptors and the worker's buffers, streams would allocate their own
+// buffer for every file
+
+int OpenFile(const std::filesystem::path &Path) {
+#if defined(_WIN32)
+  return ::_wopen(Path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+  return ::open(Path.c_str(), O_RDONLY);
+#endif
+}
+
+bool CloseFile(const int Fd) {
+#if defined(_WIN32)
+  return ::_close(Fd) == 0;
+#else
+  return ::close(Fd) == 0;
+#endif
+}
+
+// Reads or writes Size bytes at Data, returns false if the file ends early or on errors
+bool Transfer(const int Fd, std::byte *Data, size_t Size, const bool Write) {
+  while (Size) {
+    const size_t chunk{std::min<size_t>(Size, 1u << 30)};
+#if defined(_WIN32)
+    const auto count{Write ? ::_write(Fd, Data, static_cast<unsigned>(chunk))
+                           : ::_read(Fd, Data, static_cast<unsigned>(chunk))};
+#else
+    const auto count{Write ? ::write(Fd, Data, chunk) : ::read(Fd, Data, chunk)};
+#endif
+    if (count < 0 && errno == EINTR) continue;
+    if (count <= 0) return false;
+    Data += count;
+    Size -= static_cast<size_t>(count);
+  }
+  return true;
+}
+
+// Reads the whole file into Buffer, which is resized to Size
+bool ReadWhole(const std::filesystem::path &Path, const uintmax_t Size, std::vector<std::byte> &Buffer) {
+  const int fd{OpenFile(Path)};
+  if (fd < 0) return false;
+  Buffer.resize(Size);
+  const bool read{Transfer(fd, Buffer.data(), Buffer.size(), false)};
+  return CloseFile(fd) && read;
+}
+
+// Writes through a temporary file that replaces Path once complete (see QOID::AtomicFile), so a full disk or a killed
+// run never leaves truncated images behind
+QOID::WriteResult WriteWhole(const std::filesystem::path &Path, const std::span<const std::byte> Data) {
+  QOID::AtomicFile file{Path.string()};
+  if (!file.IsOpen()) return {false, 0, file.Error()};
+  errno = 0;
+  if (!Transfer(file.Fd(), const_cast<std::byte *>(Data.data()), Data.size(), true))
+    return {false, 0, errno ? errno : ENOSPC};
+  if (!file.Commit()) return {false, Data.size(), file.Error()};
+  return {true, Data.size(), 0};
+}
+
+class Converter {
+public:
+  Converter(const Settings &settings, std::vector<Job> Jobs) :
+      m_settings{settings}, m_jobs{std::move(Jobs)}, m_pool{std::max(1u, settings.threads)},
+      m_scratch(m_pool.Workers()) {}
+
+  // Converts every job and blocks until all are done
+  void Run() {
+    // biggest files first, dealt out round robin, so the long ones don't end up last on a single thread
+    for (size_t i{0}; i < m_jobs.size(); ++i) m_pool.Push(static_cast<unsigned>(i % m_pool.Workers()), {i});
+    std::vector<std::jthread> workers;
+    for (unsigned i{1}; i < m_pool.Workers(); ++i) workers.emplace_back([this, i] { Work(i); });
+    Work(0);
+  }
+
+  const Totals &GetTotals() const { return m_totals; }
+
+private:
+  void Work(const unsigned Worker) {
+    while (m_pool.Pending()) {
+      if (const auto task{m_pool.Take(Worker, false)}) {
+        Execute(Worker, *task);
+        m_pool.Done();
+      } else m_pool.Wait(false, [] { return false; });
+    }
+  }
+
+  void Execute(const unsigned Worker, const Task &T) {
+    if (T.split) {
+      SplitEncode &split{*T.split};
+      const auto pixels{split.image->GetData()};
+      const size_t first{T.band * split.bandPixels};
+      QOID::qoi::EncodeBand(pixels.subspan(first, std::min(split.bandPixels, pixels.size() - first)),
+                            (*split.bands)[T.band]);
+      --split.left;
+      return;
+    }
+    const Job &job{m_jobs[T.job]};
+    try {
+      Convert(Worker, job);
+      ++m_totals.files;
+    } catch (const std::exception &e) {
+      ++m_totals.failed;
+      const std::lock_guard lock{m_errorMutex};
+      std::cerr << job.from.string() << ": " << e.what() << '\n';
+    }
+  }
+
+  void Convert(const unsigned Worker, const Job &job) {
+    Scratch &scratch{m_scratch[Worker]};
+    if (!ReadWhole(job.from, job.size, scratch.input)) throw std::runtime_error("could not read the file");
+
+    QOID::Dimensions size{m_settings.rawWidth, m_settings.rawHeight};
+    if (job.format == Format::qoi) size = QOID::qoi::PeekSize(scratch.input);
+    else if (job.format == Format::tga) size = QOID::tga::PeekSize(scratch.input);
+    else if (!size.width || static_cast<size_t>(size.width) * size.height * sizeof(QOID::Pixel) != job.size)
+      throw std::runtime_error("raw file doesn't match --size");
+
+    QOID::Image image{scratch.Wrap(size)};
+    if (job.format == Format::qoi) QOID::qoi::DecodeInto(scratch.input, image);
+    else if (job.format == Format::tga) QOID::tga::DecodeInto(scratch.input, image);
+    else std::memcpy(image.GetData().data(), scratch.input.data(), scratch.input.size());
+
+    std::span<const std::byte> encoded;
+    scratch.output.clear();
+    if (m_settings.to == Format::qoi) {
+      if (image.GetData().size() >= m_settings.splitPixels && m_pool.Workers() > 1) EncodeSplit(Worker, image);
+      else QOID::qoi::EncodeToBuffer(image, scratch.output);
+      encoded = scratch.output;
+    } else if (m_settings.to == Format::tga) {
+      if (!QOID::tga::EncodeToBuffer(image, scratch.output, {.rle = m_settings.rle}))
+        throw std::runtime_error("image is too large for TGA");
+      encoded = scratch.output;
+    } else {
+      encoded = std::as_bytes(image.GetData());
+    }
+    if (const QOID::WriteResult written{WriteWhole(job.to, encoded)}; !written)
+      throw std::runtime_error("could not write " + job.to.string() + ": " + std::strerror(written.error));
+
+    m_totals.pixels += image.GetData().size();
+    m_totals.bytesIn += job.size;
+    m_totals.bytesOut += encoded.size();
+  }
+
+  // Queues the bands of image on this worker's queue (where idle workers steal them), helps encoding bands until all
+  // are done and joins them into a standard qoi file in scratch.output
+  void EncodeSplit(const unsigned Worker, const QOID::Image &image) {
+    Scratch &scratch{m_scratch[Worker]};
+    // bands of at least 16 rows and 256K pixels, so queueing costs nothing next to encoding
+    const size_t bandRows{std::max<size_t>(16, ((size_t{1} << 18) + image.getWidth() - 1) / image.getWidth())};
+    const size_t bandPixels{bandRows * image.getWidth()};
+    const size_t bandCount{(image.GetData().size() + bandPixels - 1) / bandPixels};
+    if (scratch.bands.size() < bandCount) scratch.bands.resize(bandCount);
+
+    SplitEncode split{&image, bandPixels, &scratch.bands, bandCount};
+    for (size_t band{0}; band < bandCount; ++band) m_pool.Push(Worker, {0, &split, band});
+    while (split.left) {
+      if (const auto task{m_pool.Take(Worker, true)}) {
+        Execute(Worker, *task);
+        m_pool.Done();
+      } else m_pool.Wait(true, [&split] { return split.left == 0; });
+    }
+
+    QOID::VectorSink sink{scratch.output};
+    bool written{QOID::qoi::writeHeader(sink, image)};
+    for (size_t band{0}; band < bandCount; ++band)
+      written = written && sink.Write(scratch.bands[band].data(), scratch.bands[band].size());
+    if (!(written && QOID::qoi::writeTrail(sink) && sink.Flush())) throw std::runtime_error("could not encode");
+  }
+
+  const Settings &m_settings;
+  std::vector<Job> m_jobs;
+  WorkStealingPool m_pool;
+  std::vector<Scratch> m_scratch;
+  Totals m_totals;
+  std::mutex m_errorMutex;
+};
+
+std::optional<Format> FormatOf(const std::string &Name) {
+  if (Name == "qoi") return Format::qoi;
+  if (Name == "tga") return Format::tga;
+  if (Name == "raw") return Format::raw;
+  return std::nullopt;
+}
+
+const char *Extension(const Format format) {
+  switch (format) {
+  case Format::qoi: return ".qoi";
+  case Format::tga: return ".tga";
+  default: return ".raw";
+  }
+}
+
+std::vector<Job> CollectJobs(const Settings &settings) {
+  std::vector<Job> jobs;
+  for (const auto &entry : std::filesystem::recursive_directory_iterator{settings.input}) {
+    if (!entry.is_regular_file()) continue;
+    std::string extension{entry.path().extension().string()};
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](const char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+    const std::optional<Format> format{extension.size() > 1 ? FormatOf(extension.substr(1)) : std::nullopt};
+    if (!format) continue;
+    std::filesystem::path to{settings.output / std::filesystem::relative(entry.path(), settings.input)};
+    to.replace_extension(Extension(settings.to));
+    jobs.push_back({entry.path(), std::move(to), *format, entry.file_size()});
+  }
+  std::sort(jobs.begin(), jobs.end(), [](const Job &a, const Job &b) { return a.size > b.size; });
+  return jobs;
+}
+
+// Parses all of Text into Value, false on anything else (std::stoi throws and accepts trailing text)
+template <typename T> bool ParseNumber(const char *Text, T &Value) {
+  const char *const end{Text + std::strlen(Text)};
+  const auto [parsed, error]{std::from_chars(Text, end, Value)};
+  return error == std::errc{} && parsed == end;
+}
+
+bool ParseArgs(const int argc, char **argv, Settings &settings) {
+  std::vector<std::string> paths;
+  for (int i{1}; i < argc; ++i) {
+    const std::string arg{argv[i]};
+    const bool hasValue{i + 1 < argc};
+    if (arg == "--to" && hasValue) {
+      const std::optional<Format> format{FormatOf(argv[++i])};
+      if (!format) return false;
+      settings.to = *format;
+    } else if (arg == "--threads" && hasValue) {
+      if (!ParseNumber(argv[++i], settings.threads)) return false;
+    } else if (arg == "--split" && hasValue) {
+      double megapixels{};
+      if (!ParseNumber(argv[++i], megapixels) || !(megapixels >= 0 && megapixels < 1e12)) return false;
+      settings.splitPixels = static_cast<size_t>(megapixels * 1e6);
+    } else if (arg == "--rle") {
+      settings.rle = true;
+    } else if (arg == "--size" && hasValue) {
+      std::istringstream size{argv[++i]};
+      char x{};
+      if (!(size >> settings.rawWidth >> x >> settings.rawHeight) || x != 'x' || !settings.rawWidth ||
+          !settings.rawHeight)
+        return false;
+    } else if (arg.starts_with("--")) return false;
+    else paths.push_back(arg);
+  }
+  if (paths.size() != 2) return false;
+  settings.input = paths[0];
+  settings.output = paths[1];
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Settings settings;
+  if (!ParseArgs(argc, argv, settings) || !std::filesystem::is_directory(settings.input)) {
+    std::cerr << "usage: " << argv[0]
+              << " [--to qoi|tga|raw] [--threads N] [--size WxH] [--rle] [--split MPIXEL] INPUT_DIR OUTPUT_DIR\n";
+    return 1;
+  }
+  if (!settings.threads) settings.threads = std::max(1u, std::thread::hardware_concurrency());
+
+  std::vector<Job> jobs{CollectJobs(settings)};
+  // directories up front, the workers only write files
+  for (const Job &job : jobs) std::filesystem::create_directories(job.to.parent_path());
+
+  Timer T{};
+  Converter converter{settings, std::move(jobs)};
+  converter.Run();
+  const double seconds{T.delapsed()};
+
+  const Totals &totals{converter.GetTotals()};
+  const double mpixels{static_cast<double>(totals.pixels) / 1e6};
+  std::cout << "converted " << totals.files << " files (" << totals.failed << " failed) on " << settings.threads
+            << " threads in " << seconds << "s\n"
+            << "  " << totals.files / seconds << " files/s, " << mpixels / seconds << " MPixel/s, "
+            << static_cast<double>(totals.pixels) * sizeof(QOID::Pixel) / seconds / 1e6 << " MB/s of RGBA\n"
+            << "  in " << static_cast<double>(totals.bytesIn) / 1e6 << " MB, out "
+            << static_cast<double>(totals.bytesOut) / 1e6 << " MB\n";
+  return totals.failed ? 2 : 0;
+}
@@ -1,9 +1,87 @@
 #include "QOID/image.hpp"
 
 #include "Timer.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
 #include <iostream>
+#include <iterator>
+#include <sstream>
+#include <vector>
 
-int main() {
+static std::vector<char> ReadFile(const std::string &FilePath) {
+  std::ifstream file{FilePath, std::ios::binary};
+  return {std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+}
+
+// Near-lossless encodes at a few error bounds, the decoded pixels may not be off by more than the bound
+static void CompareNearLossless(const QOID::Image &I, const char *Name, const bool Fast = false) {
+  std::cout << Name << (Fast ? " near-lossless fast:" : " near-lossless:");
+  for (const uint8_t maxError : {0, 1, 2, 4, 8}) {
+    std::vector<std::byte> out;
+    Timer T{};
+    QOID::qoi::EncodeToBuffer(I, out, {.maxError = maxError, .nearFast = Fast});
+    const double encodeTime{T.delapsed()};
+    const QOID::Image decoded{QOID::qoi::Decode(out)};
+    int error{0};
+    for (size_t i{0}; i < decoded.GetData().size(); ++i) {
+      const QOID::Pixel a{I.GetData()[i]}, b{decoded.GetData()[i]};
+      error = std::max({error, std::abs(a.R() - b.R()), std::abs(a.G() - b.G()), std::abs(a.B() - b.B()),
+                        std::abs(a.A() - b.A())});
+    }
+    std::cout << " [" << int{maxError} << "] " << out.size() << " bytes " << encodeTime << "s"
+              << (error > maxError ? " ERROR BOUND EXCEEDED" : "");
+  }
+  std::cout << '\n';
+}
+
+// Re-encodes qoi files (e.g. the photographs of the qoi test suite) and checks the output is identical to the input,
+// which holds for files written by the reference encoder
+static void BenchmarkFile(const std::string &FilePath) {
+  QOID::Image I{QOID::Image::LoadFile(FilePath)};
+  Timer T{};
+  I.GenerateFile("Reencoded");
+  const double encodeTime{T.delapsed()};
+  std::vector<char> original{ReadFile(FilePath)}, reencoded{ReadFile("Reencoded.qoi")};
+  // colorspace byte is not part of the pixel data, the reference encoder keeps whatever the caller passes
+  if (original.size() > 13 && reencoded.size() > 13) original[13] = reencoded[13];
+  // channels byte too, the reference encoder writes what the caller passes (3 for the test photos)
+  if (original.size() > 12 && reencoded.size() > 12) original[12] = reencoded[12];
+  std::cout << FilePath << ": " << encodeTime << "s ("
+            << static_cast<double>(I.getWidth()) * I.getHeight() / encodeTime / 1e6 << " MPixel/s), "
+            << (original == reencoded ? "bit-exact" : "differs from input") << '\n';
+  CompareNearLossless(I, FilePath.c_str());
+}
+
+// Encodes with the SIMD kernels and with the scalar code, the output has to be identical
+static void CompareSimd(const QOID::Image &I, const char *Name) {
+  std::vector<std::byte> simdOut, scalarOut;
+  Timer T{};
+  QOID::qoi::EncodeToBuffer(I, simdOut);
+  const double simdTime{T.delapsed()};
+  QOID::simd::Limit(QOID::simd::Level::scalar);
+  T.reset();
+  QOID::qoi::EncodeToBuffer(I, scalarOut);
+  const double scalarTime{T.delapsed()};
+  QOID::simd::Limit(QOID::simd::Level::avx2);
+  std::cout << Name << ": simd " << simdTime << "s, scalar " << scalarTime << "s, "
+            << (simdOut == scalarOut ? "identical" : "OUTPUT DIFFERS") << '\n';
+}
+
+// Renders the gradient of main into a single row buffer and yields every finished row, as a scanline renderer would
+static QOID::RowGenerator RenderGradient(const QOID::ui Width, const QOID::ui Height) {
+  std::vector<QOID::Pixel> row(Width);
+  for (QOID::ui j = 0; j < Height; ++j) {
+    for (QOID::ui i = 0; i < Width; ++i)
+      row[i] = {static_cast<uint8_t>((i * 255) / (Width - 1)), static_cast<uint8_t>((j * 255) / (Height - 1)), 128,
+                255};
+    co_yield std::span<const QOID::Pixel>{row};
+  }
+}
+
+int main(int argc, char **argv) {
   // QOID::Image I{2048, 4024};
   QOID::Image I{4024, 2048};
 
@@ -30,8 +108,241 @@ int main() {
 
   // I.GenerateFile(QOID::ImageType::qoi, "Test");
   Timer T{};
-  I.GenerateFile("Compressed");
-  std::cout << "Compressed elapsed: " << T.delapsed() << '\n';
+  const QOID::WriteResult written{I.GenerateFile("Compressed")};
+  std::cout << "Compressed elapsed: " << T.delapsed() << ", " << written.bytes << " bytes\n";
+
+  // failed writes say why and leave no partial file behind
+  if (const QOID::WriteResult failed{I.GenerateFile("missing/directory/Compressed")}; !failed)
+    std::cout << "write into a missing directory: " << std::strerror(failed.error) << '\n';
+
+  T.reset();
+  QOID::Image D{QOID::Image::LoadFile("Compressed")};
+  const double decodeTime{T.delapsed()};
+  std::cout << "Decompressed elapsed: " << decodeTime << " ("
+            << static_cast<double>(D.getWidth()) * D.getHeight() / decodeTime / 1e6 << " MPixel/s)\n";
+  if (D != I) std::cout << "Decompressed image does not match the original\n";
+
+  // column by column like the loop above, linear vs tiled storage
+  {
+    QOID::TiledImage Tiled{I.getWidth(), I.getHeight()};
+    QOID::Image Linear{I.getWidth(), I.getHeight()};
+    T.reset();
+    for (QOID::ui i = 0; i < Tiled.getWidth(); ++i)
+      for (QOID::ui j = 0; j < Tiled.getHeight(); ++j) Tiled.fSetPixel(I.fGetPixel(i, j), i, j);
+    const double tiledTime{T.delapsed()};
+    T.reset();
+    for (QOID::ui i = 0; i < Linear.getWidth(); ++i)
+      for (QOID::ui j = 0; j < Linear.getHeight(); ++j) Linear.fSetPixel(I.fGetPixel(i, j), i, j);
+    const double linearTime{T.delapsed()};
+    std::cout << "column major copy: linear " << linearTime << "s, tiled " << tiledTime << "s, "
+              << (Tiled.ToImage() == I ? "identical" : "OUTPUT DIFFERS") << '\n';
+  }
+
+  // 4K frame drawn per pixel vs with the bulk writes
+  {
+    T.reset();
+    QOID::Image Frame{3840, 2160, QOID::Image::Uninitialized{}};
+    const double allocTime{T.delapsed()};
+    T.reset();
+    QOID::Image Initialized{3840, 2160};
+    std::cout << "4k allocation: uninitialized " << allocTime << "s, initialized " << T.delapsed() << "s\n";
+    T.reset();
+    for (QOID::ui j = 0; j < Frame.getHeight(); ++j)
+      for (QOID::ui i = 0; i < Frame.getWidth(); ++i) Frame.SetPixel({20, 20, 30, 255}, i, j);
+    const double perPixelTime{T.delapsed()};
+    T.reset();
+    Frame.FillRect(0, 0, Frame.getWidth(), Frame.getHeight(), {20, 20, 30, 255});
+    const double fillTime{T.delapsed()};
+    QOID::Image Overlay{1920, 1080};
+    Overlay.Fill({200, 180, 40, 128});
+    T.reset();
+    Frame.Blit(Overlay.GetView(), 960, 540);
+    std::cout << "4k fill: SetPixel " << perPixelTime << "s, FillRect " << fillTime << "s, 1080p blit " << T.delapsed()
+              << "s\n";
+  }
+
+  // 4K brighten and composite, Pixel operators per pixel vs the simd image operations
+  {
+    QOID::Image Frame{3840, 2160, QOID::Image::Uninitialized{}};
+    QOID::Image Scaled{Frame.getWidth(), Frame.getHeight(), QOID::Image::Uninitialized{}};
+    for (QOID::ui j = 0; j < Frame.getHeight(); ++j)
+      for (QOID::ui i = 0; i < Frame.getWidth(); ++i)
+        Frame.fSetPixel({static_cast<QOID::color>(i), static_cast<QOID::color>(j), static_cast<QOID::color>(i ^ j),
+                         static_cast<QOID::color>(i + j)},
+                        i, j);
+    std::ranges::copy(Frame.GetData(), Scaled.GetData().begin());
+    T.reset();
+    for (QOID::Pixel &P : Frame.GetData()) P *= 1.2f;
+    const double perPixelTime{T.delapsed()};
+    T.reset();
+    QOID::Scale(Scaled.GetData(), 1.2f);
+    const double scaleTime{T.delapsed()};
+    const bool same{Frame == Scaled};
+    T.reset();
+    QOID::Add(Scaled.GetData(), Frame.GetData());
+    const double addTime{T.delapsed()};
+    T.reset();
+    QOID::BlendOverPremultiplied(Scaled.GetData(), Frame.GetData());
+    std::cout << "4k brighten: operator* " << perPixelTime << "s, Scale " << scaleTime << "s ("
+              << (same ? "identical" : "OUTPUT DIFFERS") << "), Add " << addTime << "s, premultiplied over "
+              << T.delapsed() << "s\n";
+  }
+
+  // parallel encoder scaling curve, 0 threads = all hardware threads
+  for (const unsigned threads : {1u, 2u, 4u, 8u, 16u, 0u}) {
+    T.reset();
+    I.GenerateFile("CompressedParallel", QOID::ImageType::qoi, {.threads = threads});
+    std::cout << "Compressed with " << threads << " threads elapsed: " << T.delapsed() << '\n';
+  }
+
+  // buffered writes vs memory mapped output
+  for (const auto type : {QOID::ImageType::qoi, QOID::ImageType::tga}) {
+    const char *name{type == QOID::ImageType::qoi ? "qoi" : "tga"};
+    T.reset();
+    I.GenerateFile("Stream", type, {.output = QOID::OutputBackend::stream});
+    const double streamTime{T.delapsed()};
+    T.reset();
+    I.GenerateFile("Mapped", type, {.output = QOID::OutputBackend::mmap});
+    std::cout << name << " buffered " << streamTime << "s, mmap " << T.delapsed() << "s\n";
+  }
+
+  // bulk swizzle vs per pixel tga writer
+  T.reset();
+  QOID::tga::GenerateFileNonOptimized(I, "PerPixel");
+  const double perPixelTime{T.delapsed()};
+  T.reset();
+  I.GenerateFile("Swizzled", QOID::ImageType::tga);
+  const double swizzleTime{T.delapsed()};
+  std::cout << "tga per pixel " << perPixelTime << "s, swizzled " << swizzleTime << "s ("
+            << static_cast<double>(I.getWidth()) * I.getHeight() * 4 / swizzleTime / 1e6 << " MB/s), "
+            << (ReadFile("PerPixel.tga") == ReadFile("Swizzled.tga") ? "identical" : "OUTPUT DIFFERS") << '\n';
+
+  CompareSimd(I, "gradient");
+  // flat colored blocks, like UI screenshots
+  QOID::Image UI{4024, 2048};
+  UI.Fill({240, 240, 240, 255});
+  for (QOID::ui j = 0; j < UI.getHeight(); ++j)
+    for (QOID::ui i = 0; i < UI.getWidth(); ++i)
+      if ((i / 300 + j / 200) % 3 == 0) UI.SetPixel({30, 60, static_cast<uint8_t>(90 + (i / 300) % 2), 255}, i, j);
+  CompareSimd(UI, "ui");
+
+  // raw vs run-length encoded tga, the size difference is largest for flat images like this one
+  for (const bool rle : {false, true}) {
+    std::vector<std::byte> tgaOut;
+    T.reset();
+    QOID::tga::EncodeToBuffer(UI, tgaOut, {.rle = rle});
+    const double encodeTime{T.delapsed()};
+    T.reset();
+    const bool identical{QOID::tga::Decode(tgaOut) == UI};
+    std::cout << "ui tga " << (rle ? "rle" : "raw") << ": " << tgaOut.size() << " bytes, encode " << encodeTime
+              << "s, decode " << T.delapsed() << "s" << (identical ? "" : ", DECODED IMAGE DIFFERS") << '\n';
+  }
+
+  // row streamed encode, one row in memory at a time. Has to match the whole image encoder
+  for (const QOID::Image *Source : {&I, &UI}) {
+    std::vector<std::byte> whole, rows;
+    QOID::qoi::EncodeToBuffer(*Source, whole);
+    QOID::VectorSink sink{rows};
+    T.reset();
+    // the row encoder can't see the whole image, the caller knows whether it is opaque
+    const uint8_t channels = QOID::simd::AllOpaque(Source->GetData().data(), Source->GetData().size()) ? 3 : 4;
+    QOID::qoi::EncodeRows(Source->getWidth(), Source->getHeight(), [&](const QOID::ui y) { return Source->Row(y); },
+                          sink, channels);
+    std::cout << "row streamed encode " << T.delapsed() << "s, " << (whole == rows ? "identical" : "OUTPUT DIFFERS")
+              << '\n';
+  }
+
+  // rendering and encoding interleaved through a coroutine, only one row exists at a time
+  {
+    std::vector<std::byte> whole, rendered;
+    QOID::qoi::EncodeToBuffer(I, whole);
+    QOID::VectorSink sink{rendered};
+    T.reset();
+    // the gradient is opaque
+    QOID::qoi::EncodeRows(I.getWidth(), I.getHeight(), RenderGradient(I.getWidth(), I.getHeight()), sink, 3);
+    std::cout << "render + encode coroutine " << T.delapsed() << "s, "
+              << (whole == rendered ? "identical" : "OUTPUT DIFFERS") << '\n';
+  }
+
+  // camera-like noise over the gradient, where lossless qoi falls back to RGB chunks
+  {
+    QOID::Image Noisy{I};
+    uint32_t seed{12345};
+    for (QOID::Pixel &P : Noisy.GetData()) {
+      seed = seed * 1664525 + 1013904223;
+      const auto noise = [&](const uint8_t c, const int shift) {
+        return static_cast<uint8_t>(std::clamp(c + static_cast<int>((seed >> shift) & 7) - 3, 0, 255));
+      };
+      P = QOID::Pixel{noise(P.R(), 8), noise(P.G(), 14), noise(P.B(), 20), 255};
+    }
+    CompareNearLossless(Noisy, "noisy gradient");
+    CompareNearLossless(Noisy, "noisy gradient", true);
+  }
+
+  // long-lived window where a few small rectangles change per frame: the incremental encoder only re-encodes the row
+  // bands they touch
+  {
+    QOID::Image Window{UI};
+    QOID::qoi::IncrementalEncoder incremental;
+    std::vector<std::byte> full, cached;
+    double fullTime{0}, incrementalTime{0};
+    bool identical{true};
+    for (QOID::ui n{0}; n < 60; ++n) {
+      Window.FillRect(40 + n * 20, 300, 16, 16, {200, static_cast<uint8_t>(n * 4), 40, 255});
+      Window.FillRect(3000, 1500 + n * 8, 64, 8, {static_cast<uint8_t>(n), 90, 160, 255});
+      full.clear();
+      T.reset();
+      QOID::qoi::EncodeToBuffer(Window, full);
+      fullTime += T.delapsed();
+      cached.clear();
+      QOID::VectorSink sink{cached};
+      T.reset();
+      incremental.Encode(Window, sink);
+      incrementalTime += T.delapsed();
+      identical = identical && QOID::qoi::Decode(cached) == Window;
+    }
+    std::cout << "incremental encode: full " << fullTime << "s (" << full.size() << " bytes), incremental "
+              << incrementalTime << "s (" << cached.size() << " bytes, " << incremental.Reencoded() << " of "
+              << incremental.Bands() << " bands re-encoded), " << (identical ? "identical" : "OUTPUT DIFFERS") << '\n';
+  }
+
+  // screen recording: a desktop where only a blinking cursor and a line of text change. A sequence stores the changed
+  // pixels of each frame, against one qoi file per frame
+  {
+    QOID::Image Screen{1920, 1080};
+    Screen.Fill({240, 240, 240, 255});
+    Screen.FillRect(0, 0, 1920, 40, {30, 60, 90, 255});
+    std::vector<std::byte> sequence, single;
+    QOID::VectorSink sink{sequence};
+    QOID::qoi::SequenceWriter writer{sink, Screen.getWidth(), Screen.getHeight()};
+    std::vector<QOID::Image> frames;
+    double sequenceTime{0}, singleTime{0};
+    for (QOID::ui n{0}; n < 120; ++n) {
+      const QOID::Pixel cursor{n % 30 < 15 ? QOID::Pixel{0, 0, 0, 255} : QOID::Pixel{240, 240, 240, 255}};
+      Screen.FillRect(100 + n * 8, 200, 6, 12, {20, 20, 20, 255}); // typed character
+      Screen.FillRect(108 + n * 8, 198, 2, 16, cursor);
+      T.reset();
+      writer.AddFrame(Screen);
+      sequenceTime += T.delapsed();
+      single.clear();
+      T.reset();
+      QOID::qoi::EncodeToBuffer(Screen, single);
+      singleTime += T.delapsed();
+      frames.push_back(Screen);
+    }
+    writer.Finish();
+    std::istringstream stream{std::string{reinterpret_cast<const char *>(sequence.data()), sequence.size()}};
+    QOID::qoi::SequenceReader reader{stream};
+    bool identical{true};
+    for (const QOID::Image &Frame : frames) identical = identical && *reader.Next() == Frame;
+    identical = identical && reader.Seek(77) && *reader.Next() == frames[77];
+    std::cout << "sequence of " << frames.size() << " frames: " << sequence.size() << " bytes, encode " << sequenceTime
+              << "s, one qoi per frame ~" << single.size() * frames.size() << " bytes, encode " << singleTime << "s, "
+              << (identical ? "identical" : "OUTPUT DIFFERS") << '\n';
+  }
+
+  // optional photographic inputs: ./a image1.qoi image2.qoi ...
+  for (int i{1}; i < argc; ++i) BenchmarkFile(argv[i]);
   // I.GenerateFile("tgaTest", QOID::ImageType::tga);
   // T.reset();
   // std::cout << "tga elapsed: " << T.delapsed() << '\n';